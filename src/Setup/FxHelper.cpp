@@ -1,6 +1,9 @@
 #include "stdafx.h"
 #include "FxHelper.h"
+#include "UpdateRunner.h"
 #include "resource.h"
+#include "trace.h"
+#include "download.h"
 
 // http://msdn.microsoft.com/en-us/library/hh925568(v=vs.110).aspx#net_b
 static const wchar_t* ndpPath = L"SOFTWARE\\Microsoft\\NET Framework Setup\\NDP\\v4\\Full";
@@ -85,62 +88,43 @@ UINT CFxHelper::GetDotNetVersionReleaseNumber(NetVersion version)
 	}
 }
 
-class ATL_NO_VTABLE CDownloadProgressCallback :
-	public CComObjectRoot,
-	public IBindStatusCallback
+// DownloadFile runs on a thread of its own, so that this one can keep the
+// progress dialog (which belongs to it) up to date and pass on a cancel
+typedef struct
 {
-public:
-	CDownloadProgressCallback()
-	{
-	}
-
-	DECLARE_NOT_AGGREGATABLE(CDownloadProgressCallback)
-
-	BEGIN_COM_MAP(CDownloadProgressCallback)
-		COM_INTERFACE_ENTRY(IBindStatusCallback)
-	END_COM_MAP()
-
-	DECLARE_PROTECT_FINAL_CONSTRUCT()
-
-	HRESULT FinalConstruct() { return S_OK; }
-
-	void FinalRelease()
-	{
-	}
-
-	void SetProgressDialog(IProgressDialog* pd)
-	{
-		m_spProgressDialog = pd;
-	}
-
-	STDMETHOD(OnProgress)(ULONG ulProgress, ULONG ulProgressMax, ULONG /*ulStatusCode*/, LPCWSTR /*szStatusText*/)
-	{
-		if (m_spProgressDialog != nullptr) {
-			if (m_spProgressDialog->HasUserCancelled()) {
-				return E_ABORT;
-			}
+	const wchar_t* url;
+	const wchar_t* file;
+	DOWNLOADOPTIONS opts;
+	volatile __int64 done, size;	// only ever shown, so a torn read doesn't matter
+	volatile LONG cancelled;
+	int result;
+} FxDownload;
+
+static bool FxDownloadProgress(void* param, __int64 done, __int64 size)
+{
+	FxDownload* dl = (FxDownload*)param;
+	dl->done = done;
+	dl->size = size;
+	return dl->cancelled == 0;
+}
 
-			m_spProgressDialog->SetProgress(ulProgress, ulProgressMax);
-		}
+static DWORD WINAPI FxDownloadThread(LPVOID param)
+{
+	FxDownload* dl = (FxDownload*)param;
+	dl->result = DownloadFile(dl->url, dl->file, &dl->opts, NULL);
+	return 0;
+}
 
-		return S_OK;
+HRESULT CFxHelper::InstallDotNetFramework(NetVersion version, bool isQuiet, CBackgroundExtraction* extraction)
+{
+	// Nothing happens while the prompt's up, so start unpacking the payload
+	// meanwhile, quietly; if the user says no it's thrown away
+	if (extraction != NULL && !isQuiet) {
+		extraction->Start(true);
 	}
 
-	STDMETHOD(OnStartBinding)(DWORD /*dwReserved*/, IBinding *pBinding) { return E_NOTIMPL; }
-	STDMETHOD(GetPriority)(LONG *pnPriority) { return E_NOTIMPL; }
-	STDMETHOD(OnLowResource)(DWORD /*reserved*/) { return E_NOTIMPL; }
-	STDMETHOD(OnStopBinding)(HRESULT /*hresult*/, LPCWSTR /*szError*/) { return E_NOTIMPL; }
-	STDMETHOD(GetBindInfo)(DWORD *pgrfBINDF, BINDINFO *pbindInfo) { return E_NOTIMPL; }
-	STDMETHOD(OnDataAvailable)(DWORD grfBSCF, DWORD dwSize, FORMATETC * /*pformatetc*/, STGMEDIUM *pstgmed) { return E_NOTIMPL; }
-	STDMETHOD(OnObjectAvailable)(REFIID /*riid*/, IUnknown * /*punk*/) { return E_NOTIMPL; }
-
-private:
-	CComPtr<IProgressDialog> m_spProgressDialog;
-};
-
-HRESULT CFxHelper::InstallDotNetFramework(NetVersion version, bool isQuiet)
-{
 	if (!isQuiet) {
+		TraceSpan span("consent dialog");
 		CTaskDialog dlg;
 		TASKDIALOG_BUTTON buttons[] = {
 			{ 1, L"Install", },
@@ -157,13 +141,24 @@ HRESULT CFxHelper::InstallDotNetFramework(NetVersion version, bool isQuiet)
 
 		int nButton;
 		if (FAILED(dlg.DoModal(::GetActiveWindow(), &nButton)) || nButton != 1) {
+			if (extraction != NULL) {
+				extraction->Cancel();
+			}
 			return S_FALSE;
 		}
 	}
 
+	// Starts it, or has the speculative one go flat out now it's wanted
+	if (extraction != NULL) {
+		extraction->Start();
+	}
+
 	HRESULT hr = E_FAIL;
+	__int64 phase;
 	WCHAR szFinalTempFileName[_MAX_PATH] = L"";
-	CComPtr<IBindStatusCallback> bscb;
+	WCHAR szCacheDir[_MAX_PATH] = L"";
+	FxDownload dl;
+	HANDLE hDownload;
 	CComPtr<IProgressDialog> pd;
 	SHELLEXECUTEINFO execInfo = { sizeof(execInfo), };
 
@@ -218,16 +213,41 @@ HRESULT CFxHelper::InstallDotNetFramework(NetVersion version, bool isQuiet)
 			pd->SetTitle(L"Downloading");
 			pd->SetLine(1, L"Downloading the .NET Framework installer", FALSE, nullptr);
 			pd->StartProgressDialog(nullptr, nullptr, 0, nullptr);
+		}
+	}
 
-			CComObject<CDownloadProgressCallback>* bscbObj = nullptr;
-			if (SUCCEEDED(CComObject<CDownloadProgressCallback>::CreateInstance(&bscbObj))) {
-				bscbObj->SetProgressDialog(pd);
-				bscb = bscbObj;
+	// In ranges over several connections, kept in %LOCALAPPDATA%\SquirrelTemp\Downloads
+	// so that a download that's cancelled or fails carries on from where it got
+	// to the next time, and the installer isn't fetched again if it fails
+	ZeroMemory(&dl, sizeof(dl));
+	dl.url = url;
+	dl.file = szFinalTempFileName;
+	dl.opts.progress = FxDownloadProgress;
+	dl.opts.param = &dl;
+	if (SUCCEEDED(SHGetFolderPath(NULL, CSIDL_LOCAL_APPDATA, NULL, SHGFP_TYPE_CURRENT, szCacheDir))) {
+		wcscat_s(szCacheDir, _countof(szCacheDir), L"\\SquirrelTemp");
+		CreateDirectory(szCacheDir, NULL);
+		wcscat_s(szCacheDir, _countof(szCacheDir), L"\\Downloads");
+		dl.opts.cachedir = szCacheDir;
+	}
+
+	phase = TraceNow();
+	hDownload = CreateThread(NULL, 0, FxDownloadThread, &dl, 0, NULL);
+	if (hDownload == NULL) {
+		hr = AtlHresultFromLastError();
+	} else {
+		while (WaitForSingleObject(hDownload, 100) == WAIT_TIMEOUT) {
+			if (pd != nullptr) {
+				if (pd->HasUserCancelled()) {
+					dl.cancelled = 1;
+				}
+				pd->SetProgress64(dl.done, dl.size);
 			}
 		}
+		CloseHandle(hDownload);
+		hr = dl.result == DL_OK ? S_OK : dl.result == DL_CANCELLED ? E_ABORT : E_FAIL;
 	}
-
-	hr = URLDownloadToFile(nullptr, url, szFinalTempFileName, 0, bscb);
+	TraceSpanEnd("download .NET", phase);
 	if (pd != nullptr) {
 		pd->StopProgressDialog();
 	}
@@ -252,7 +272,9 @@ HRESULT CFxHelper::InstallDotNetFramework(NetVersion version, bool isQuiet)
 		goto out;
 	}
 
+	phase = TraceNow();
 	WaitForSingleObject(execInfo.hProcess, INFINITE);
+	TraceSpanEnd("install .NET", phase);
 
 	DWORD exitCode;
 	if (!GetExitCodeProcess(execInfo.hProcess, &exitCode)) {
@@ -260,6 +282,11 @@ HRESULT CFxHelper::InstallDotNetFramework(NetVersion version, bool isQuiet)
 		goto out;
 	}
 
+	if (exitCode == 0 || exitCode == 1641 || exitCode == 3010) {
+		// It's installed, so the installer won't be wanted again
+		DownloadEvict(dl.url, dl.file, &dl.opts);
+	}
+
 	if (exitCode == 1641 || exitCode == 3010) {
 		// The framework installer wants a reboot before we can continue
 		// See https://msdn.microsoft.com/en-us/library/ee942965%28v=vs.110%29.aspx
@@ -1,5 +1,7 @@
 #pragma once
 
+class CBackgroundExtraction;
+
 enum class NetVersion {net45=0, net451=1, net452=2, net46=3, net461=4, net462=5, net47=6, net471=7, net472=8, net48=9};
 
 class CFxHelper
@@ -8,7 +10,9 @@ public:
 	static NetVersion GetRequiredDotNetVersion();
 	static bool CanInstallDotNet4_5();
 	static bool IsDotNetInstalled(NetVersion requiredVersion);
-	static HRESULT InstallDotNetFramework(NetVersion version, bool isQuiet);
+	// If extraction isn't NULL, it's started as soon as the user agrees to the
+	// install, so the payload unpacks while the framework downloads
+	static HRESULT InstallDotNetFramework(NetVersion version, bool isQuiet, CBackgroundExtraction* extraction = NULL);
 private:
 	static HRESULT HandleRebootRequirement(bool isQuiet);
 	static bool WriteRunOnceEntry();
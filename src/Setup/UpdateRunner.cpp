@@ -1,5 +1,6 @@
 #include "stdafx.h"
 #include "unzip.h"
+#include "trace.h"
 #include "Resource.h"
 #include "UpdateRunner.h"
 #include <vector>
@@ -160,22 +161,86 @@ bool CUpdateRunner::DirectoryIsWritable(wchar_t * szPath)
 		return true;
 }
 
-int CUpdateRunner::ExtractUpdaterAndRun(wchar_t* lpCommandLine, bool useFallbackDir)
+// Appends a line per extracted file to the setup log, so a slow or failed
+// extraction can be told apart from a slow or failed install. It's also
+// where a background extraction notices it's been cancelled. It's called
+// under UnzipAll's progress lock, so the log's opened once, by ExtractUpdater.
+static bool LogUnzipProgress(void* param, const ZIPPROGRESS* zp)
+{
+	ExtractedUpdater* extracted = (ExtractedUpdater*)param;
+	if (extracted->cancel != NULL && *extracted->cancel) {
+		return false;
+	}
+
+	if (zp->event != ZIPPROGRESS_END) {
+		return true;
+	}
+
+	if (extracted->hLog == INVALID_HANDLE_VALUE) {
+		return true;
+	}
+
+	char line[1024];
+	int len = sprintf_s(line, "Setup: Extracted %S (%I64d bytes, %.1f MB/s, result 0x%08x)\r\n",
+		zp->name, zp->unc_done, zp->mbps, zp->result);
+
+	DWORD written;
+	if (len > 0) {
+		WriteFile(extracted->hLog, line, len, &written, NULL);
+	}
+
+	return true;
+}
+
+// What ForegroundIsBusy last saw of the machine's CPU time
+struct ForegroundProbe
+{
+	ULONGLONG idle, total;
+};
+
+// A throttled extraction waits while the user's typing or moving the mouse,
+// or while the CPUs are mostly busy (with their login apps starting, say)
+static bool ForegroundIsBusy(void* param)
+{
+	ForegroundProbe* probe = (ForegroundProbe*)param;
+	LASTINPUTINFO lii = { sizeof(lii), };
+	if (GetLastInputInfo(&lii) && GetTickCount() - lii.dwTime < 1000) {
+		return true;
+	}
+
+	FILETIME idleTime, kernelTime, userTime;
+	if (!GetSystemTimes(&idleTime, &kernelTime, &userTime)) {
+		return false;
+	}
+
+	// kernel time includes idle time
+	ULONGLONG idle = ((ULONGLONG)idleTime.dwHighDateTime << 32) | idleTime.dwLowDateTime;
+	ULONGLONG total = (((ULONGLONG)kernelTime.dwHighDateTime << 32) | kernelTime.dwLowDateTime) +
+		(((ULONGLONG)userTime.dwHighDateTime << 32) | userTime.dwLowDateTime);
+	bool busy = probe->total != 0 && total > probe->total &&
+		(idle - probe->idle) * 5 < (total - probe->total);
+	probe->idle = idle;
+	probe->total = total;
+	return busy;
+}
+
+HRESULT CUpdateRunner::ExtractUpdater(ExtractedUpdater& extracted, bool useFallbackDir)
 {
-	PROCESS_INFORMATION pi = { 0 };
-	STARTUPINFO si = { 0 };
 	CResource zipResource;
-	wchar_t targetDir[MAX_PATH] = { 0 };
-	wchar_t logFile[MAX_PATH];
+	CResource manifestResource;
+	ZRESULT unzipped;
+	__int64 phase;
+	wchar_t* targetDir = extracted.targetDir;
 
-	std::vector<CString> to_delete;
+	*targetDir = L'\0';
+	extracted.to_delete.clear();
 
 	wchar_t* envSquirrelTemp = _wgetenv(L"SQUIRREL_TEMP");
 	if (envSquirrelTemp &&
 		DirectoryExists(envSquirrelTemp) &&
 		DirectoryIsWritable(envSquirrelTemp) &&
 		!PathIsUNCW(envSquirrelTemp)) {
-		_swprintf_c(targetDir, _countof(targetDir), L"%s", envSquirrelTemp);
+		_swprintf_c(targetDir, MAX_PATH, L"%s", envSquirrelTemp);
 		goto gotADir;
 	}
 
@@ -191,19 +256,19 @@ int CUpdateRunner::ExtractUpdaterAndRun(wchar_t* lpCommandLine, bool useFallback
 	SHGetFolderPath(NULL, CSIDL_COMMON_APPDATA, NULL, SHGFP_TYPE_CURRENT, appDataDir);
 	GetUserName(username, &unameSize);
 
-	_swprintf_c(targetDir, _countof(targetDir), L"%s\\%s", appDataDir, username);
+	_swprintf_c(targetDir, MAX_PATH, L"%s\\%s", appDataDir, username);
 
 	if (!CreateDirectory(targetDir, NULL) && GetLastError() != ERROR_ALREADY_EXISTS) {
 		wchar_t err[4096];
 		_swprintf_c(err, _countof(err), L"Unable to write to %s - IT policies may be restricting access to this folder", targetDir);
 		DisplayErrorMessage(CString(err), NULL);
 
-		return -1;
+		return E_ABORT;
 	}
 
 gotADir:
 
-	wcscat_s(targetDir, _countof(targetDir), L"\\SquirrelTemp");
+	wcscat_s(targetDir, MAX_PATH, L"\\SquirrelTemp");
 
 	if (!CreateDirectory(targetDir, NULL) && GetLastError() != ERROR_ALREADY_EXISTS) {
 		wchar_t err[4096];
@@ -213,56 +278,161 @@ gotADir:
 			DisplayErrorMessage(CString(err), NULL);
 		}
 
-		goto failedExtract;
+		return E_FAIL;
 	}
 
-	swprintf_s(logFile, L"%s\\SquirrelSetup.log", targetDir);
+	swprintf_s(extracted.logFile, L"%s\\SquirrelSetup.log", targetDir);
 
-	if (!zipResource.Load(L"DATA", IDR_UPDATE_ZIP)) {
-		goto failedExtract;
+	if (Tracing()) {
+		wchar_t traceFile[MAX_PATH];
+		swprintf_s(traceFile, L"%s\\SquirrelSetup.trace.json", targetDir);
+		TraceFile(traceFile);
 	}
 
-	DWORD dwSize = zipResource.GetSize();
-	if (dwSize < 0x100) {
-		goto failedExtract;
+	phase = TraceNow();
+
+	// The payload's either appended to Setup.exe (WriteZipToSetup --overlay),
+	// which is read in place as it's unzipped, or in the DATA resource
+	wchar_t setupExe[MAX_PATH];
+	HZIP zipFile = NULL;
+	if (GetModuleFileName(NULL, setupExe, _countof(setupExe)) != 0) {
+		zipFile = OpenZipOverlay(setupExe, NULL);
+	}
+
+	if (!zipFile) {
+		if (!zipResource.Load(L"DATA", IDR_UPDATE_ZIP)) {
+			return E_FAIL;
+		}
+
+		DWORD dwSize = zipResource.GetSize();
+		if (dwSize < 0x100) {
+			return E_FAIL;
+		}
+
+		BYTE* pData = (BYTE*)zipResource.Lock();
+		zipFile = OpenZip(pData, dwSize, NULL);
 	}
 
-	BYTE* pData = (BYTE*)zipResource.Lock();
-	HZIP zipFile = OpenZip(pData, dwSize, NULL);
 	SetUnzipBaseDir(zipFile, targetDir);
+	SetUnzipProgress(zipFile, LogUnzipProgress, &extracted);
+
+	// WriteZipToSetup hashes every item into DATA/133; each one's checked as
+	// it's unzipped, and one that doesn't match fails the install
+	if (manifestResource.Load(L"DATA", IDR_MANIFEST)) {
+		if (SetUnzipManifest(zipFile, manifestResource.Lock(), manifestResource.GetSize()) != ZR_OK) {
+			CloseZip(zipFile);
+			return E_FAIL;
+		}
+	}
+
+	// Opt-in: share unpacked files with every other Squirrel setup on the
+	// machine through a content-addressed cache, so that they're only
+	// inflated once. The value is the cache's size limit in MB.
+	if (_wgetenv(L"SQUIRREL_EXTRACT_CACHE") != NULL) {
+		wchar_t cacheDir[MAX_PATH];
+		swprintf_s(cacheDir, L"%s\\ExtractCache", targetDir);
+
+		__int64 maxMB = _wtoi64(_wgetenv(L"SQUIRREL_EXTRACT_CACHE"));
+		if (maxMB <= 0) maxMB = 512;
 
-	// NB: This library is kind of a disaster
-	ZRESULT zr;
-	int index = 0;
-	do {
+		DWORD cacheFlags = _wgetenv(L"SQUIRREL_EXTRACT_CACHE_VERIFY") != NULL ? ZIPCACHE_STRONG : 0;
+		if (_wgetenv(L"SQUIRREL_EXTRACT_CACHE_LINK") != NULL) cacheFlags |= ZIPCACHE_LINK;
+		SetUnzipCache(zipFile, cacheDir, maxMB * 1024 * 1024, cacheFlags);
+	}
+
+	// Machine-wide installs run with --checkInstall at every logon, where
+	// unpacking flat out would hold up the user's own apps, so there it's
+	// throttled, as it is whenever SQUIRREL_EXTRACT_THROTTLE is set to
+	// "MB/s[,workers]" (or not, if it's "off"). A speculative extraction
+	// just keeps to one worker in the background, until it's promoted.
+	ForegroundProbe probe = { 0, 0 };
+	ZIPTHROTTLE throttle;
+	ZeroMemory(&throttle, sizeof(throttle));
+	wchar_t* envThrottle = _wgetenv(L"SQUIRREL_EXTRACT_THROTTLE");
+	bool throttled = envThrottle != NULL ?
+		_wcsicmp(envThrottle, L"off") != 0 :
+		wcsstr(GetCommandLine(), L"--checkInstall") != NULL;
+
+	if (throttled) {
+		throttle.mbps = 20;
+		throttle.threads = 1;
+		if (envThrottle != NULL) {
+			swscanf_s(envThrottle, L"%u,%u", &throttle.mbps, &throttle.threads);
+		}
+		throttle.background = true;
+		throttle.busy = ForegroundIsBusy;
+		throttle.param = &probe;
+		throttle.patience = 60000;
+		SetUnzipThrottle(zipFile, &throttle);
+	} else if (extracted.speculative) {
+		throttle.threads = 1;
+		throttle.background = true;
+		throttle.lift = extracted.promote;
+		SetUnzipThrottle(zipFile, &throttle);
+	}
+
+	// NB: UnzipItem won't overwrite data, we need to do it ourselves
+	ZIPENTRY zinfo;
+	if (GetZipItem(zipFile, -1, &zinfo) != ZR_OK) zinfo.index = 0;
+	for (int index = 0; index < zinfo.index; index++) {
 		ZIPENTRY zentry;
 		wchar_t targetFile[MAX_PATH];
 
-		zr = GetZipItem(zipFile, index, &zentry);
-		if (zr != ZR_OK && zr != ZR_MORE) {
-			break;
-		}
+		if (GetZipItem(zipFile, index, &zentry) != ZR_OK) break;
 
-		// NB: UnzipItem won't overwrite data, we need to do it ourselves
 		swprintf_s(targetFile, L"%s\\%s", targetDir, zentry.name);
 		DeleteFile(targetFile);
+		extracted.to_delete.push_back(CString(targetFile));
+	}
 
-		if (UnzipItem(zipFile, index, zentry.name) != ZR_OK) break;
-		to_delete.push_back(CString(targetFile));
-		index++;
-	} while (zr == ZR_MORE || zr == ZR_OK);
+	// Biggest items first, on every core unless it's throttled
+	extracted.hLog = CreateFile(extracted.logFile, FILE_APPEND_DATA, FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	unzipped = UnzipAll(zipFile, 0);
+
+	if (extracted.hLog != INVALID_HANDLE_VALUE) {
+		CloseHandle(extracted.hLog);
+		extracted.hLog = INVALID_HANDLE_VALUE;
+	}
+
+	// A speculative extraction's thread went into the background itself, and
+	// only it can come back out
+	if (extracted.speculative && extracted.promote != NULL && *extracted.promote) {
+		SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_END);
+	}
 
 	CloseZip(zipFile);
 	zipResource.Release();
+	manifestResource.Release();
+	TraceSpanEnd("extract", phase);
+
+	if (unzipped == ZR_CANCELLED) {
+		return E_ABORT;
+	}
+
+	if (unzipped == ZR_CORRUPT) {
+		return E_FAIL;
+	}
 
 	// nfi if the zip extract actually worked, check for Update.exe
 	wchar_t updateExePath[MAX_PATH];
 	swprintf_s(updateExePath, L"%s\\%s", targetDir, L"Update.exe");
 
 	if (GetFileAttributes(updateExePath) == INVALID_FILE_ATTRIBUTES) {
-		goto failedExtract;
+		return E_FAIL;
 	}
 
+	return S_OK;
+}
+
+bool CUpdateRunner::RunUpdater(ExtractedUpdater& extracted, wchar_t* lpCommandLine, int* exitCode)
+{
+	PROCESS_INFORMATION pi = { 0 };
+	STARTUPINFO si = { 0 };
+	__int64 phase;
+
+	wchar_t updateExePath[MAX_PATH];
+	swprintf_s(updateExePath, L"%s\\%s", extracted.targetDir, L"Update.exe");
+
 	// Run Update.exe
 	si.cb = sizeof(STARTUPINFO);
 	si.wShowWindow = SW_SHOW;
@@ -275,11 +445,13 @@ gotADir:
 	wchar_t cmd[MAX_PATH];
 	swprintf_s(cmd, L"\"%s\" --install . %s", updateExePath, lpCommandLine);
 
-	if (!CreateProcess(NULL, cmd, NULL, NULL, false, 0, NULL, targetDir, &si, &pi)) {
-		goto failedExtract;
+	if (!CreateProcess(NULL, cmd, NULL, NULL, false, 0, NULL, extracted.targetDir, &si, &pi)) {
+		return false;
 	}
 
+	phase = TraceNow();
 	WaitForSingleObject(pi.hProcess, INFINITE);
+	TraceSpanEnd("wait for Update.exe", phase);
 
 	DWORD dwExitCode;
 	if (!GetExitCodeProcess(pi.hProcess, &dwExitCode)) {
@@ -289,23 +461,126 @@ gotADir:
 	if (dwExitCode != 0) {
 		DisplayErrorMessage(CString(
 			L"There was an error while installing the application. "
-			L"Check the setup log for more information and contact the author."), logFile);
+			L"Check the setup log for more information and contact the author."), extracted.logFile);
 	}
 
-	for (unsigned int i = 0; i < to_delete.size(); i++) {
-		DeleteFile(to_delete[i]);
+	for (unsigned int i = 0; i < extracted.to_delete.size(); i++) {
+		DeleteFile(extracted.to_delete[i]);
 	}
 
 	CloseHandle(pi.hProcess);
 	CloseHandle(pi.hThread);
-	return (int) dwExitCode;
+	*exitCode = (int) dwExitCode;
+	return true;
+}
+
+int CUpdateRunner::ExtractUpdaterAndRun(wchar_t* lpCommandLine, bool useFallbackDir, CBackgroundExtraction* extraction)
+{
+	ExtractedUpdater extracted;
+	ExtractedUpdater* ready = &extracted;
+	HRESULT hr;
+	int exitCode;
+
+	// If the payload's been unpacking while the .NET Framework installed,
+	// pick up where that got to; it only ever tries SquirrelTemp, so a
+	// failure takes the same second pass as our own would
+	if (extraction != NULL && extraction->Started()) {
+		__int64 phase = TraceNow();
+		hr = extraction->Join();
+		TraceSpanEnd("join extraction", phase);
+		ready = &extraction->extracted;
+	} else {
+		hr = ExtractUpdater(extracted, useFallbackDir);
+	}
+
+	if (hr == E_ABORT) {
+		return -1;
+	}
+
+	if (SUCCEEDED(hr) && RunUpdater(*ready, lpCommandLine, &exitCode)) {
+		return exitCode;
+	}
 
-failedExtract:
 	if (!useFallbackDir) {
 		// Take another pass at it, using C:\ProgramData instead
-		return ExtractUpdaterAndRun(lpCommandLine, true);
+		TraceCount("retries", 1);
+		return ExtractUpdaterAndRun(lpCommandLine, true, NULL);
 	}
 
 	DisplayErrorMessage(CString(L"Failed to extract installer"), NULL);
-	return (int) dwExitCode;
+	return -1;
+}
+
+CBackgroundExtraction::CBackgroundExtraction() : hThread(NULL), started(false), hr(E_PENDING), cancelled(0), promoted(0)
+{
+	extracted.cancel = &cancelled;
+	extracted.promote = &promoted;
+}
+
+CBackgroundExtraction::~CBackgroundExtraction()
+{
+	Cancel();
+}
+
+bool CBackgroundExtraction::Start(bool speculative)
+{
+	// Already running: if it was speculative and now it's wanted, lift its
+	// throttle, which UnzipAll notices within 100ms
+	if (hThread != NULL) {
+		if (!speculative) {
+			InterlockedExchange(&promoted, 1);
+		}
+		return true;
+	}
+
+	cancelled = 0;
+	promoted = 0;
+	extracted.cancel = &cancelled;
+	extracted.promote = &promoted;
+	extracted.speculative = speculative;
+	hr = E_PENDING;
+	hThread = CreateThread(NULL, 0, ThreadProc, this, 0, NULL);
+	started = hThread != NULL;
+	return started;
+}
+
+HRESULT CBackgroundExtraction::Join()
+{
+	if (hThread != NULL) {
+		WaitForSingleObject(hThread, INFINITE);
+		CloseHandle(hThread);
+		hThread = NULL;
+	}
+
+	extracted.cancel = NULL;
+	return hr;
+}
+
+void CBackgroundExtraction::Cancel()
+{
+	if (hThread == NULL) {
+		return;
+	}
+
+	InterlockedExchange(&cancelled, 1);
+	Join();
+
+	for (unsigned int i = 0; i < extracted.to_delete.size(); i++) {
+		DeleteFile(extracted.to_delete[i]);
+	}
+	extracted.to_delete.clear();
+}
+
+DWORD WINAPI CBackgroundExtraction::ThreadProc(LPVOID param)
+{
+	CBackgroundExtraction* self = (CBackgroundExtraction*)param;
+	TraceThreadName("background extraction");
+
+	// Out of the way of the prompt, and of whatever else the user's doing
+	if (self->extracted.speculative) {
+		SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+	}
+
+	self->hr = CUpdateRunner::ExtractUpdater(self->extracted, false);
+	return 0;
 }
@@ -1,4 +1,22 @@
 #pragma once
+#include <vector>
+
+class CBackgroundExtraction;
+
+// Where ExtractUpdater unpacked the payload, for RunUpdater
+struct ExtractedUpdater
+{
+	wchar_t targetDir[MAX_PATH];
+	wchar_t logFile[MAX_PATH];
+	HANDLE hLog;						// logFile, open to append to while UnzipAll runs
+	std::vector<CString> to_delete;		// every file in the payload, which RunUpdater deletes afterwards
+	volatile LONG* cancel;				// stops the extraction when it's set, if it isn't NULL
+	bool speculative;					// unzip on one worker in the background, as it may not be wanted
+	volatile LONG* promote;				// once it's set, a speculative extraction's wanted after all and goes flat out
+
+	ExtractedUpdater() : hLog(INVALID_HANDLE_VALUE), cancel(NULL), speculative(false), promote(NULL) { *targetDir = L'\0'; *logFile = L'\0'; }
+};
+
 class CUpdateRunner
 {
 
@@ -9,5 +27,39 @@ public:
 	static HRESULT ShellExecuteFromExplorer(LPWSTR pszFile, LPWSTR pszParameters);
 	static bool DirectoryExists(wchar_t* szPath);
 	static bool DirectoryIsWritable(wchar_t* szPath);
-	static int ExtractUpdaterAndRun(wchar_t* lpCommandLine, bool useFallbackDir);
+	static HRESULT ExtractUpdater(ExtractedUpdater& extracted, bool useFallbackDir);
+	static bool RunUpdater(ExtractedUpdater& extracted, wchar_t* lpCommandLine, int* exitCode);
+	static int ExtractUpdaterAndRun(wchar_t* lpCommandLine, bool useFallbackDir, CBackgroundExtraction* extraction = NULL);
+};
+
+// Runs ExtractUpdater into SquirrelTemp on a thread of its own, so that the
+// payload unpacks while the .NET Framework downloads and installs rather than
+// afterwards. ExtractUpdaterAndRun joins it before it starts Update.exe, and
+// falls back to extracting again itself if it failed. If Setup gives up
+// instead, Cancel (or the destructor) stops it and deletes what it unpacked.
+// Start(true) starts it speculatively, at background CPU and I/O priority on
+// a single worker, for while a prompt is up that may yet decline the install.
+// Start() once it's agreed to promotes a speculative one as it runs: the rest
+// of the payload unpacks at normal priority on every core.
+class CBackgroundExtraction
+{
+public:
+	CBackgroundExtraction();
+	~CBackgroundExtraction();
+
+	bool Start(bool speculative = false);
+	bool Started() const { return started; }
+	HRESULT Join();
+	void Cancel();
+
+	ExtractedUpdater extracted;
+
+private:
+	static DWORD WINAPI ThreadProc(LPVOID param);
+
+	HANDLE hThread;
+	bool started;
+	HRESULT hr;
+	volatile LONG cancelled;
+	volatile LONG promoted;
 };
@@ -0,0 +1,1394 @@
+// unzbench - micro-benchmarks for the unzip engine in ../unzip.cpp, and the
+// zip writer in ../zip.cpp
+//
+// Generates a synthetic corpus of zips (many small files, a few huge ones,
+// stored and deflated, text and binary), then times the engine at opening the
+// central directory, finding items, inflating (in the zip, and as zlib streams
+// through UnzipStream), CRC and extracting to a tmpfs directory (from the zip,
+// and from the zip appended to an executable), at hashing the items into a
+// manifest and extracting with every item checked against it, at extracting
+// throttled (capped, and yielding to a busy machine), at reading through the http
+// source (../unzipurl.cpp) from a loopback server, at downloading the zip from
+// it (../download.cpp), with and without dropped connections, and at zipping the corpus
+// up again. Separately, it times Setup --checkInstall's decision (../checkinstall.cpp). Where it makes sense the same work is also
+// timed with the system zlib, so that numbers from different machines can be compared.
+// Results go to stdout (or --json) as JSON; a readable summary goes to stderr,
+// and --trace writes the engine's spans (../trace.h) for a timeline.
+//
+// See README.md for how to build and run it.
+
+#include "../unzip.h"
+#include "../unzipurl.h"
+#include "../download.h"
+#include "../checkinstall.h"
+#include "../zip.h"
+#include "../trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include "../../../vendor/zstd/lib/zstd.h"
+#include <ftw.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+
+// not in unzip.h, but it's what the engine checks every byte it writes with
+unsigned long ucrc32(unsigned long crc, const unsigned char *buf, unsigned int len);
+
+static const char *usage =
+	"usage: unzbench [options]\n"
+	"  --corpus DIR     where to write the generated zips (default: unzbench-corpus)\n"
+	"  --tmpdir DIR     where to extract to (default: /dev/shm)\n"
+	"  --scale N        multiply the corpus sizes by N (default: 1)\n"
+	"  --min-time S     keep repeating each measurement for S seconds (default: 1)\n"
+	"  --only NAME      only run corpora whose name contains NAME\n"
+	"  --json FILE      write the results to FILE rather than stdout\n"
+	"  --no-zlib        skip the system zlib baselines\n"
+	"  --threads N      workers for the unzip-all extract and the zip (default: 0, one per core)\n"
+	"  --level N        deflate level for the zip op (default: 6)\n"
+	"  --plan           print UnzipAll's plan for each corpus to stderr\n"
+	"  --trace FILE     write a Chrome trace of the engine's spans and counters to FILE\n"
+	"  --gen-only       generate the corpus and stop\n";
+
+struct Options
+{
+	std::string corpusDir = "unzbench-corpus";
+	std::string tmpDir = "/dev/shm";
+	double scale = 1;
+	double minTime = 1;
+	std::string only;
+	std::string jsonFile;
+	bool zlib = true;
+	unsigned int threads = 0;
+	int level = 6;
+	bool plan = false;
+	std::string traceFile;
+	bool genOnly = false;
+};
+
+enum Content { Text, Binary };
+
+struct CorpusSpec
+{
+	const char* name;
+	int files;
+	size_t fileSize;
+	Content content;
+	bool deflate;
+};
+
+// fileSize and files are multiplied by --scale, the huge ones in size and the small ones in number
+static const CorpusSpec corpusSpecs[] = {
+	{ "small-text-deflate", 4000, 4096, Text, true },
+	{ "small-bin-deflate", 4000, 4096, Binary, true },
+	{ "small-bin-stored", 4000, 4096, Binary, false },
+	{ "huge-text-deflate", 2, 32 << 20, Text, true },
+	{ "huge-bin-deflate", 2, 32 << 20, Binary, true },
+	{ "huge-text-stored", 2, 32 << 20, Text, false },
+};
+
+// What we learn about each entry from the central directory; the zlib
+// baselines need it because they read the compressed bytes directly
+struct Entry
+{
+	std::string name;
+	int method;
+	unsigned long crc;
+	size_t compSize, uncSize;
+	size_t dataOffset;
+};
+
+struct Corpus
+{
+	const CorpusSpec* spec;
+	std::string path;
+	std::vector<unsigned char> zip;
+	std::vector<Entry> entries;
+	size_t uncBytes, compBytes, cdBytes;
+};
+
+struct Result
+{
+	std::string corpus, op, impl, unit;
+	double rate, best, seconds;
+	long long bytes;
+	int iterations;
+};
+
+static double Now()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// xorshift64*, so the corpus is the same on every machine and every run
+static unsigned long long rngState = 0x9E3779B97F4A7C15ULL;
+static unsigned long long Rand()
+{
+	rngState ^= rngState >> 12; rngState ^= rngState << 25; rngState ^= rngState >> 27;
+	return rngState * 2685821657736338717ULL;
+}
+
+static void FillText(std::vector<unsigned char>& buf)
+{
+	static const char* words[] = {
+		"the", "of", "and", "to", "in", "is", "that", "for", "it", "as", "was", "with", "be", "by",
+		"on", "not", "he", "this", "are", "or", "his", "from", "at", "which", "but", "have", "an",
+		"Squirrel", "update", "release", "package", "install", "version", "delta", "nupkg", "Setup",
+		"<dependency", "id=", "/>", "{", "}", "return", "null;", "if", "(", ")", "0x", "1.0.0",
+	};
+	size_t i = 0, col = 0;
+	while (i < buf.size()) {
+		const char* w = words[Rand() % (sizeof(words) / sizeof(words[0]))];
+		while (*w && i < buf.size()) { buf[i++] = *w++; col++; }
+		if (i < buf.size()) { buf[i++] = col > 72 ? '\n' : ' '; if (col > 72) col = 0; else col++; }
+	}
+}
+
+// Roughly the mix found in an exe or dll: runs of noise, runs of zeros and
+// repeats of earlier bytes, so that deflate gets it down to about half
+static void FillBinary(std::vector<unsigned char>& buf)
+{
+	size_t i = 0;
+	while (i < buf.size()) {
+		size_t run = 16 + Rand() % 240;
+		if (run > buf.size() - i) run = buf.size() - i;
+		unsigned long long kind = Rand() % 8;
+		if (kind < 3 || i < 256) {
+			for (size_t j = 0; j < run; j++) buf[i + j] = (unsigned char)Rand();
+		} else if (kind < 5) {
+			memset(&buf[i], 0, run);
+		} else {
+			size_t from = i - 1 - Rand() % (i < 32768 ? i : 32768);
+			for (size_t j = 0; j < run; j++) buf[i + j] = buf[from + j];
+		}
+		i += run;
+	}
+}
+
+static void Put16(std::vector<unsigned char>& v, unsigned int x) { v.push_back(x & 0xFF); v.push_back((x >> 8) & 0xFF); }
+static void Put32(std::vector<unsigned char>& v, unsigned long x) { Put16(v, x & 0xFFFF); Put16(v, (x >> 16) & 0xFFFF); }
+
+static unsigned int Get16(const unsigned char* p) { return p[0] | (p[1] << 8); }
+static unsigned long Get32(const unsigned char* p) { return Get16(p) | ((unsigned long)Get16(p + 2) << 16); }
+
+static bool Deflate(const std::vector<unsigned char>& in, std::vector<unsigned char>& out)
+{
+	z_stream zs; memset(&zs, 0, sizeof(zs));
+	if (deflateInit2(&zs, 6, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) return false;
+
+	out.resize(deflateBound(&zs, in.size()));
+	zs.next_in = (Bytef*)in.data(); zs.avail_in = (uInt)in.size();
+	zs.next_out = out.data(); zs.avail_out = (uInt)out.size();
+	int err = deflate(&zs, Z_FINISH);
+	out.resize(zs.total_out);
+	deflateEnd(&zs);
+	return err == Z_STREAM_END;
+}
+
+// Writes a plain zip (no zip64, no extra fields), the way SetupZipBuilder
+// would without a chunk index
+static bool WriteCorpus(const CorpusSpec& spec, int files, size_t fileSize, const std::string& path)
+{
+	FILE* f = fopen(path.c_str(), "wb");
+	if (!f) return false;
+
+	std::vector<unsigned char> central, header, data(fileSize), comp;
+	unsigned long offset = 0;
+	for (int i = 0; i < files; i++) {
+		char name[64];
+		snprintf(name, sizeof(name), "dir%02d/%s-%05d.%s", i % 16, spec.name, i, spec.content == Text ? "txt" : "bin");
+		if (spec.content == Text) FillText(data); else FillBinary(data);
+
+		unsigned long crc = crc32(0, data.data(), (uInt)data.size());
+		const std::vector<unsigned char>* body = &data;
+		if (spec.deflate) {
+			if (!Deflate(data, comp)) { fclose(f); return false; }
+			body = &comp;
+		}
+
+		size_t nameLen = strlen(name);
+		header.clear();
+		Put32(header, 0x04034b50); Put16(header, 20); Put16(header, 0);
+		Put16(header, spec.deflate ? 8 : 0); Put16(header, 0); Put16(header, 0x21);
+		Put32(header, crc); Put32(header, (unsigned long)body->size()); Put32(header, (unsigned long)data.size());
+		Put16(header, (unsigned int)nameLen); Put16(header, 0);
+		header.insert(header.end(), name, name + nameLen);
+
+		Put32(central, 0x02014b50); Put16(central, 20); Put16(central, 20); Put16(central, 0);
+		Put16(central, spec.deflate ? 8 : 0); Put16(central, 0); Put16(central, 0x21);
+		Put32(central, crc); Put32(central, (unsigned long)body->size()); Put32(central, (unsigned long)data.size());
+		Put16(central, (unsigned int)nameLen); Put16(central, 0); Put16(central, 0);
+		Put16(central, 0); Put16(central, 0); Put32(central, 0x20); Put32(central, offset);
+		central.insert(central.end(), name, name + nameLen);
+
+		fwrite(header.data(), 1, header.size(), f);
+		fwrite(body->data(), 1, body->size(), f);
+		offset += (unsigned long)(header.size() + body->size());
+	}
+
+	std::vector<unsigned char> end;
+	Put32(end, 0x06054b50); Put16(end, 0); Put16(end, 0);
+	Put16(end, files); Put16(end, files);
+	Put32(end, (unsigned long)central.size()); Put32(end, offset); Put16(end, 0);
+	fwrite(central.data(), 1, central.size(), f);
+	fwrite(end.data(), 1, end.size(), f);
+	return fclose(f) == 0;
+}
+
+// A 64KB stub that starts like an executable, then zip, zeros to end on 8
+// bytes, and the trailer that OpenZipOverlay looks for
+static bool WriteOverlayExe(const char* path, const std::vector<unsigned char>& zip)
+{
+	std::vector<unsigned char> exe(65536, 0);
+	exe[0] = 'M'; exe[1] = 'Z';
+	exe.insert(exe.end(), zip.begin(), zip.end());
+	exe.resize(exe.size() + (8 - (zip.size() + ZIPOVERLAY_SIZE) % 8) % 8, 0);
+
+	unsigned char trailer[ZIPOVERLAY_SIZE] = { 0 };
+	for (int i = 0; i < 8; i++) trailer[i] = (unsigned char)((unsigned long long)zip.size() >> (8 * i));
+	trailer[8] = 1;
+	unsigned long crc = ucrc32(0, trailer, 12);
+	for (int i = 0; i < 4; i++) trailer[12 + i] = (unsigned char)(crc >> (8 * i));
+	memcpy(trailer + 16, "Squirrel payload", 16);
+	exe.insert(exe.end(), trailer, trailer + ZIPOVERLAY_SIZE);
+
+	FILE* f = fopen(path, "wb");
+	if (!f) return false;
+	bool ok = fwrite(exe.data(), 1, exe.size(), f) == exe.size();
+	return fclose(f) == 0 && ok;
+}
+
+static bool ReadWholeFile(const std::string& path, std::vector<unsigned char>& buf)
+{
+	FILE* f = fopen(path.c_str(), "rb");
+	if (!f) return false;
+	fseek(f, 0, SEEK_END); long len = ftell(f); fseek(f, 0, SEEK_SET);
+	buf.resize(len);
+	bool ok = fread(buf.data(), 1, len, f) == (size_t)len;
+	fclose(f);
+	return ok;
+}
+
+// Just enough of a central directory reader for the corpora we wrote ourselves
+static bool IndexCorpus(Corpus& c)
+{
+	const std::vector<unsigned char>& z = c.zip;
+	if (z.size() < 22 || Get32(&z[z.size() - 22]) != 0x06054b50) return false;
+
+	const unsigned char* eocd = &z[z.size() - 22];
+	unsigned int count = Get16(eocd + 10);
+	c.cdBytes = Get32(eocd + 12);
+	size_t pos = Get32(eocd + 16);
+	c.uncBytes = c.compBytes = 0;
+
+	for (unsigned int i = 0; i < count; i++) {
+		const unsigned char* p = &z[pos];
+		if (Get32(p) != 0x02014b50) return false;
+
+		Entry e;
+		e.method = Get16(p + 10);
+		e.crc = Get32(p + 16);
+		e.compSize = Get32(p + 20);
+		e.uncSize = Get32(p + 24);
+		unsigned int nameLen = Get16(p + 28), extraLen = Get16(p + 30), commentLen = Get16(p + 32);
+		e.name.assign((const char*)p + 46, nameLen);
+
+		size_t local = Get32(p + 42);
+		e.dataOffset = local + 30 + Get16(&z[local + 26]) + Get16(&z[local + 28]);
+		c.entries.push_back(e);
+		c.uncBytes += e.uncSize; c.compBytes += e.compSize;
+
+		pos += 46 + nameLen + extraLen + commentLen;
+	}
+
+	return true;
+}
+
+static int RemoveEntry(const char* path, const struct stat*, int, struct FTW*) { return remove(path); }
+
+static void RemoveTree(const std::string& dir)
+{
+	nftw(dir.c_str(), RemoveEntry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+static bool MakeDirs(const std::string& path)
+{
+	for (size_t i = 1; i <= path.size(); i++) {
+		if (i == path.size() || path[i] == '/') {
+			std::string sub = path.substr(0, i);
+			if (mkdir(sub.c_str(), 0755) != 0 && errno != EEXIST) return false;
+		}
+	}
+	return true;
+}
+
+// Repeats fn until minTime has passed (at least twice, so the first,
+// cold run isn't the only one), and reports the best and the mean rate.
+// fn returns how many units it got through, or -1 if it failed; prep runs
+// before each call to fn and isn't timed.
+
+// A stand-in for a web server that serves one zip, with Range and If-Range, on
+// 127.0.0.1. With cutEvery set, every cutEvery'th response stops halfway
+// through its body, as a flaky connection would. Bumping version changes the
+// ETag, as a new file on the server would. With ranges cleared it ignores
+// Range, and answers every request with the whole zip.
+class LoopbackServer
+{
+public:
+	LoopbackServer(const std::vector<unsigned char>& data) : requests(0), cutEvery(0), version(0), ranges(true), data(data)
+	{
+		listener = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		struct sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		socklen_t len = sizeof(addr);
+		if (listener == -1 || bind(listener, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+			listen(listener, 16) != 0 || getsockname(listener, (struct sockaddr*)&addr, &len) != 0) {
+			port = 0;
+			return;
+		}
+		port = ntohs(addr.sin_port);
+		thread = std::thread([this] { Serve(); });
+	}
+
+	~LoopbackServer()
+	{
+		if (listener != -1) shutdown(listener, SHUT_RDWR);
+		if (thread.joinable()) thread.join();
+		if (listener != -1) close(listener);
+	}
+
+	std::string Url() const { return "http://127.0.0.1:" + std::to_string(port) + "/corpus.zip"; }
+
+	int port;
+	std::atomic<int> requests;
+	std::atomic<int> cutEvery;
+	std::atomic<int> version;
+	std::atomic<bool> ranges;
+
+private:
+	void Serve()
+	{
+		int fd;
+		while ((fd = accept(listener, NULL, NULL)) != -1) {
+			std::string req;
+			char buf[4096];
+			ssize_t n;
+			while (req.find("\r\n\r\n") == std::string::npos && (n = recv(fd, buf, sizeof(buf), 0)) > 0) req.append(buf, n);
+
+			// bytes=a-b, or bytes=-n for the last n
+			long long size = (long long)data.size(), first = 0, last = size - 1;
+			std::string etag = "\"unzbench-" + std::to_string(size) + "-" + std::to_string(version) + "\"";
+			size_t range = req.find("\r\nRange: bytes="), ifRange = req.find("\r\nIf-Range: ");
+			bool partial = ranges && range != std::string::npos &&
+				(ifRange == std::string::npos || req.compare(ifRange + 12, etag.size() + 2, etag + "\r\n") == 0);
+			if (partial) {
+				const char* r = req.c_str() + range + 15;
+				if (*r == '-') first = std::max(0LL, size - atoll(r + 1));
+				else {
+					first = atoll(r);
+					const char* dash = strchr(r, '-');
+					if (dash && dash[1] >= '0' && dash[1] <= '9') last = std::min(last, atoll(dash + 1));
+				}
+			}
+			char head[256];
+			int len = partial
+				? snprintf(head, sizeof(head), "HTTP/1.1 206 Partial Content\r\nContent-Length: %lld\r\nContent-Range: bytes %lld-%lld/%lld\r\nETag: %s\r\nConnection: close\r\n\r\n", last - first + 1, first, last, size, etag.c_str())
+				: snprintf(head, sizeof(head), "HTTP/1.1 200 OK\r\nContent-Length: %lld\r\nETag: %s\r\nConnection: close\r\n\r\n", size, etag.c_str());
+			long long body = last - first + 1;
+			int nth = ++requests;
+			if (cutEvery > 0 && nth % cutEvery == 0) body /= 2;
+			if (send(fd, head, len, MSG_NOSIGNAL) == len && body > 0) send(fd, &data[first], body, MSG_NOSIGNAL);
+			close(fd);
+		}
+	}
+
+	const std::vector<unsigned char>& data;
+	int listener;
+	std::thread thread;
+};
+
+template <typename P, typename F>
+static bool MeasureWith(std::vector<Result>& results, const Options& opts, const Corpus& c,
+	const char* op, const char* impl, const char* unit, double scale, P prep, F fn)
+{
+	Result r = { c.spec->name, op, impl, unit, 0, 0, 0, 0, 0 };
+	TraceSpan span(op, impl);
+	double start = Now();
+	do {
+		prep();
+		double t0 = Now();
+		long long units = fn();
+		double t = Now() - t0;
+		if (units < 0) {
+			fprintf(stderr, "%-20s %-8s %-9s FAILED\n", c.spec->name, op, impl);
+			return false;
+		}
+
+		r.bytes += units; r.seconds += t; r.iterations++;
+		if (t > 0) r.best = std::max(r.best, units / t / scale);
+	} while (r.iterations < 2 || Now() - start < opts.minTime);
+
+	r.rate = r.bytes / r.seconds / scale;
+	fprintf(stderr, "%-20s %-8s %-9s %10.1f %s (best %.1f, %d runs)\n",
+		c.spec->name, op, impl, r.rate, unit, r.best, r.iterations);
+	results.push_back(r);
+	return true;
+}
+
+template <typename F>
+static bool Measure(std::vector<Result>& results, const Options& opts, const Corpus& c,
+	const char* op, const char* impl, const char* unit, double scale, F fn)
+{
+	return MeasureWith(results, opts, c, op, impl, unit, scale, [] {}, fn);
+}
+
+static bool RunCorpus(std::vector<Result>& results, const Options& opts, const Corpus& c)
+{
+	size_t largest = 0;
+	for (const Entry& e : c.entries) largest = std::max(largest, e.uncSize);
+	std::vector<unsigned char> out(largest ? largest : 1);
+	bool ok = true;
+
+	// The central directory: OpenZip only finds it, so walk every item as Setup does
+	ok &= Measure(results, opts, c, "open", "unzip", "MB/s", 1e6, [&]() -> long long {
+		HZIP hz = OpenZip((void*)c.zip.data(), (unsigned int)c.zip.size(), 0);
+		if (!hz) return -1;
+		ZIPENTRY ze;
+		for (size_t i = 0; i < c.entries.size(); i++) {
+			if (GetZipItem(hz, (int)i, &ze) != ZR_OK) {
+				CloseZip(hz);
+				return -1;
+			}
+		}
+		CloseZip(hz);
+		return (long long)c.cdBytes;
+	});
+
+	HZIP hz = OpenZip((void*)c.zip.data(), (unsigned int)c.zip.size(), 0);
+	if (!hz) {
+		fprintf(stderr, "%s: OpenZip failed\n", c.spec->name);
+		return false;
+	}
+
+	// Every name, in a shuffled order so that each one starts from somewhere else
+	std::vector<size_t> order(c.entries.size());
+	for (size_t i = 0; i < order.size(); i++) order[i] = i;
+	for (size_t i = order.size(); i > 1; i--) std::swap(order[i - 1], order[Rand() % i]);
+
+	ok &= Measure(results, opts, c, "find", "unzip", "finds/s", 1, [&]() -> long long {
+		for (size_t i : order) {
+			int index; ZIPENTRY ze;
+			if (FindZipItem(hz, c.entries[i].name.c_str(), false, &index, &ze) != ZR_OK || index != (int)i) return -1;
+		}
+		return (long long)order.size();
+	});
+
+	bool anyDeflated = false, anyStored = false;
+	for (const Entry& e : c.entries) if (e.method == 8) anyDeflated = true; else anyStored = true;
+
+	// Unzipping to memory, so this is the decoder and its CRC with no file system in the way
+	if (anyDeflated) {
+		ok &= Measure(results, opts, c, "inflate", "unzip", "MB/s", 1e6, [&]() -> long long {
+			long long done = 0;
+			for (size_t i = 0; i < c.entries.size(); i++) {
+				if (c.entries[i].method != 8) continue;
+				if (UnzipItem(hz, (int)i, out.data(), (unsigned int)out.size()) != ZR_OK) return -1;
+				done += c.entries[i].uncSize;
+			}
+			return done;
+		});
+
+		if (opts.zlib) ok &= Measure(results, opts, c, "inflate", "zlib", "MB/s", 1e6, [&]() -> long long {
+			long long done = 0;
+			for (const Entry& e : c.entries) {
+				if (e.method != 8) continue;
+				z_stream zs; memset(&zs, 0, sizeof(zs));
+				if (inflateInit2(&zs, -15) != Z_OK) return -1;
+				zs.next_in = (Bytef*)&c.zip[e.dataOffset]; zs.avail_in = (uInt)e.compSize;
+				zs.next_out = out.data(); zs.avail_out = (uInt)out.size();
+				int err = inflate(&zs, Z_FINISH);
+				inflateEnd(&zs);
+				if (err != Z_STREAM_END || crc32(0, out.data(), (uInt)e.uncSize) != e.crc) return -1;
+				done += e.uncSize;
+			}
+			return done;
+		});
+
+		// The same items with a zlib header and Adler-32 check, through UnzipStream
+		std::vector<std::vector<unsigned char>> framed;
+		for (size_t i = 0; i < c.entries.size(); i++) {
+			const Entry& e = c.entries[i];
+			if (e.method != 8) continue;
+			if (UnzipItem(hz, (int)i, out.data(), (unsigned int)out.size()) != ZR_OK) {
+				CloseZip(hz);
+				return false;
+			}
+			uLong adler = adler32(1, out.data(), (uInt)e.uncSize);
+			std::vector<unsigned char> f = { 0x78, 0x9c };
+			f.insert(f.end(), &c.zip[e.dataOffset], &c.zip[e.dataOffset] + e.compSize);
+			for (int b = 24; b >= 0; b -= 8) f.push_back((unsigned char)(adler >> b));
+			framed.push_back(f);
+		}
+
+		ok &= Measure(results, opts, c, "stream", "unzip", "MB/s", 1e6, [&]() -> long long {
+			long long done = 0;
+			for (const std::vector<unsigned char>& f : framed) {
+				HUNZSTREAM hs = OpenUnzipStream(ZSTREAM_ZLIB);
+				unsigned int used, made;
+				ZRESULT zr = UnzipStream(hs, f.data(), (unsigned int)f.size(), &used, out.data(), (unsigned int)out.size(), &made);
+				CloseUnzipStream(hs);
+				if (zr != ZR_OK) return -1;
+				done += made;
+			}
+			return done;
+		});
+
+		if (opts.zlib) ok &= Measure(results, opts, c, "stream", "zlib", "MB/s", 1e6, [&]() -> long long {
+			long long done = 0;
+			for (const std::vector<unsigned char>& f : framed) {
+				z_stream zs; memset(&zs, 0, sizeof(zs));
+				if (inflateInit(&zs) != Z_OK) return -1;
+				zs.next_in = (Bytef*)f.data(); zs.avail_in = (uInt)f.size();
+				zs.next_out = out.data(); zs.avail_out = (uInt)out.size();
+				int err = inflate(&zs, Z_FINISH);
+				inflateEnd(&zs);
+				if (err != Z_STREAM_END) return -1;
+				done += zs.total_out;
+			}
+			return done;
+		});
+	}
+
+	// Straight over the uncompressed bytes, so it doesn't matter how they were stored
+	if (anyStored) {
+		ok &= Measure(results, opts, c, "crc", "unzip", "MB/s", 1e6, [&]() -> long long {
+			long long done = 0;
+			for (const Entry& e : c.entries) {
+				if (e.method != 0) continue;
+				if (ucrc32(0, &c.zip[e.dataOffset], (unsigned int)e.uncSize) != e.crc) return -1;
+				done += e.uncSize;
+			}
+			return done;
+		});
+
+		if (opts.zlib) ok &= Measure(results, opts, c, "crc", "zlib", "MB/s", 1e6, [&]() -> long long {
+			long long done = 0;
+			for (const Entry& e : c.entries) {
+				if (e.method != 0) continue;
+				if (crc32(0, &c.zip[e.dataOffset], (uInt)e.uncSize) != e.crc) return -1;
+				done += e.uncSize;
+			}
+			return done;
+		});
+	}
+
+	// Zipping every item up again from memory, to a file in tmpdir; zlib
+	// deflates the same items at the same level, on one thread, to memory
+	std::vector<std::vector<unsigned char>> items(c.entries.size());
+	for (size_t i = 0; i < c.entries.size(); i++) {
+		items[i].resize(c.entries[i].uncSize);
+		if (UnzipItem(hz, (int)i, items[i].data(), (unsigned int)items[i].size()) != ZR_OK) {
+			CloseZip(hz);
+			return false;
+		}
+	}
+	CloseZip(hz);
+
+	char zipPath[MAX_PATH];
+	snprintf(zipPath, sizeof(zipPath), "%s/unzbench-%d.zip", opts.tmpDir.c_str(), (int)getpid());
+	ok &= Measure(results, opts, c, "zip", "zip", "MB/s", 1e6, [&]() -> long long {
+		HZIP hz = CreateZip(zipPath);
+		if (!hz || SetZipOptions(hz, opts.level, opts.threads, ZIPOPT_DETERMINISTIC) != ZR_OK) return -1;
+		for (size_t i = 0; i < c.entries.size(); i++) {
+			if (ZipAdd(hz, c.entries[i].name.c_str(), items[i].data(), (unsigned int)items[i].size()) != ZR_OK) {
+				CloseZip(hz);
+				return -1;
+			}
+		}
+		return CloseZip(hz) == ZR_OK ? (long long)c.uncBytes : -1;
+	});
+	struct stat st;
+	if (stat(zipPath, &st) == 0) fprintf(stderr, "%-20s zip      made %lld bytes from %zu at level %d\n",
+		c.spec->name, (long long)st.st_size, c.uncBytes, opts.level);
+	remove(zipPath);
+
+	if (opts.zlib) ok &= Measure(results, opts, c, "zip", "zlib", "MB/s", 1e6, [&]() -> long long {
+		std::vector<unsigned char> comp;
+		for (const std::vector<unsigned char>& item : items) {
+			z_stream zs; memset(&zs, 0, sizeof(zs));
+			if (deflateInit2(&zs, opts.level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) return -1;
+			comp.resize(deflateBound(&zs, (uLong)item.size()));
+			zs.next_in = (Bytef*)item.data(); zs.avail_in = (uInt)item.size();
+			zs.next_out = comp.data(); zs.avail_out = (uInt)comp.size();
+			int err = deflate(&zs, Z_FINISH);
+			deflateEnd(&zs);
+			if (err != Z_STREAM_END) return -1;
+		}
+		return (long long)c.uncBytes;
+	});
+
+	// The whole thing, from the zip file on disk to files in tmpdir, as Setup does it
+	char dir[MAX_PATH];
+	snprintf(dir, sizeof(dir), "%s/unzbench-%d/", opts.tmpDir.c_str(), (int)getpid());
+	auto clean = [&] { RemoveTree(dir); };
+	ok &= MeasureWith(results, opts, c, "extract", "unzip", "MB/s", 1e6, clean, [&]() -> long long {
+		HZIP hz = OpenZip(c.path.c_str(), 0);
+		if (!hz) return -1;
+		SetUnzipBaseDir(hz, dir);
+		for (size_t i = 0; i < c.entries.size(); i++) {
+			ZIPENTRY ze;
+			if (GetZipItem(hz, (int)i, &ze) != ZR_OK || UnzipItem(hz, (int)i, ze.name) != ZR_OK) {
+				CloseZip(hz);
+				return -1;
+			}
+		}
+		CloseZip(hz);
+		return (long long)c.uncBytes;
+	});
+
+	// The same through the scheduler
+	ok &= MeasureWith(results, opts, c, "extract", "unzip-all", "MB/s", 1e6, clean, [&]() -> long long {
+		HZIP hz = OpenZip(c.path.c_str(), 0);
+		if (!hz) return -1;
+		SetUnzipBaseDir(hz, dir);
+		ZRESULT zr = UnzipAll(hz, opts.threads);
+		CloseZip(hz);
+		return zr == ZR_OK ? (long long)c.uncBytes : -1;
+	});
+
+	// Hashing every item into the manifest WriteZipToSetup stamps in, and then
+	// the same unzip-all again with each item checked against it
+	std::vector<unsigned char> manifest;
+	ok &= Measure(results, opts, c, "manifest", "make", "MB/s", 1e6, [&]() -> long long {
+		HZIP hz = OpenZip(c.path.c_str(), 0);
+		if (!hz) return -1;
+		manifest.resize(ZIPMANIFEST_SIZE(c.entries.size()));
+		unsigned int len = (unsigned int)manifest.size();
+		ZRESULT zr = MakeZipManifest(hz, opts.threads, manifest.data(), &len);
+		CloseZip(hz);
+		return zr == ZR_OK ? (long long)c.uncBytes : -1;
+	});
+	ok &= MeasureWith(results, opts, c, "manifest", "unzip-all", "MB/s", 1e6, clean, [&]() -> long long {
+		HZIP hz = OpenZip(c.path.c_str(), 0);
+		if (!hz) return -1;
+		SetUnzipBaseDir(hz, dir);
+		ZRESULT zr = SetUnzipManifest(hz, manifest.data(), (unsigned int)manifest.size());
+		if (zr == ZR_OK) zr = UnzipAll(hz, opts.threads);
+		CloseZip(hz);
+		return zr == ZR_OK ? (long long)c.uncBytes : -1;
+	});
+
+	// Throttled as for a logon install: capped at 40 MB/s on one background
+	// worker, where even the fastest run must come in under the cap; and
+	// waiting while busy says the machine's wanted, for the first 300ms of each run
+	ZIPTHROTTLE throttle = {};
+	throttle.threads = 1;
+	throttle.mbps = 40;
+	throttle.background = true;
+	ok &= MeasureWith(results, opts, c, "throttle", "cap", "MB/s", 1e6, clean, [&]() -> long long {
+		HZIP hz = OpenZip(c.path.c_str(), 0);
+		if (!hz) return -1;
+		SetUnzipBaseDir(hz, dir);
+		ZRESULT zr = SetUnzipThrottle(hz, &throttle);
+		if (zr == ZR_OK) zr = UnzipAll(hz, opts.threads);
+		CloseZip(hz);
+		return zr == ZR_OK ? (long long)c.uncBytes : -1;
+	});
+	if (results.back().best > throttle.mbps * 1.1) {
+		fprintf(stderr, "%-20s throttle cap FAILED: %.1f MB/s over a cap of %u\n", c.spec->name, results.back().best, throttle.mbps);
+		ok = false;
+	}
+	double busyUntil = 0, took = 0;
+	throttle.mbps = 0;
+	throttle.busy = [](void* param) { return Now() < *(double*)param; };
+	throttle.param = &busyUntil;
+	ok &= MeasureWith(results, opts, c, "throttle", "yield", "MB/s", 1e6, clean, [&]() -> long long {
+		double t0 = Now();
+		busyUntil = t0 + 0.3;
+		HZIP hz = OpenZip(c.path.c_str(), 0);
+		if (!hz) return -1;
+		SetUnzipBaseDir(hz, dir);
+		ZRESULT zr = SetUnzipThrottle(hz, &throttle);
+		if (zr == ZR_OK) zr = UnzipAll(hz, opts.threads);
+		CloseZip(hz);
+		took = Now() - t0;
+		return zr == ZR_OK && took >= 0.3 ? (long long)c.uncBytes : -1;
+	});
+	// And lifted 20ms in, as Setup does when the user says yes to a prompt that
+	// a speculative extraction was running behind: every item must still match
+	// the manifest, and once the cap would have taken a while, it must beat it
+	ZIPTHROTTLE lifted = {};
+	volatile long lift = 0;
+	lifted.threads = 1;
+	lifted.mbps = 40;
+	lifted.background = true;
+	lifted.lift = &lift;
+	ok &= MeasureWith(results, opts, c, "throttle", "lift", "MB/s", 1e6, clean, [&]() -> long long {
+		lift = 0;
+		HZIP hz = OpenZip(c.path.c_str(), 0);
+		if (!hz) return -1;
+		SetUnzipBaseDir(hz, dir);
+		std::mutex m;
+		std::condition_variable cv;
+		bool done = false;
+		std::thread lifter([&] {
+			std::unique_lock<std::mutex> lock(m);
+			if (!cv.wait_for(lock, std::chrono::milliseconds(20), [&] { return done; })) lift = 1;
+		});
+		ZRESULT zr = SetUnzipManifest(hz, manifest.data(), (unsigned int)manifest.size());
+		if (zr == ZR_OK) zr = SetUnzipThrottle(hz, &lifted);
+		if (zr == ZR_OK) zr = UnzipAll(hz, opts.threads);
+		{
+			std::lock_guard<std::mutex> lock(m);
+			done = true;
+		}
+		cv.notify_all();
+		lifter.join();
+		CloseZip(hz);
+		return zr == ZR_OK ? (long long)c.uncBytes : -1;
+	});
+	if (c.uncBytes > lifted.mbps * 1e6 * 0.2 && results.back().rate <= lifted.mbps) {
+		fprintf(stderr, "%-20s throttle lift FAILED: %.1f MB/s, still under the cap of %u\n", c.spec->name, results.back().rate, lifted.mbps);
+		ok = false;
+	}
+
+	// The same again with the zip appended to a stand-in for Setup.exe, as
+	// WriteZipToSetup --overlay lays it out, so read through a mapped view
+	char exePath[MAX_PATH];
+	snprintf(exePath, sizeof(exePath), "%s/unzbench-%d.exe", opts.tmpDir.c_str(), (int)getpid());
+	if (!WriteOverlayExe(exePath, c.zip)) {
+		fprintf(stderr, "%-20s couldn't write %s\n", c.spec->name, exePath);
+		ok = false;
+	} else {
+		ok &= MeasureWith(results, opts, c, "overlay", "unzip-all", "MB/s", 1e6, clean, [&]() -> long long {
+			HZIP hz = OpenZipOverlay(exePath, 0);
+			if (!hz) return -1;
+			SetUnzipBaseDir(hz, dir);
+			ZRESULT zr = UnzipAll(hz, opts.threads);
+			CloseZip(hz);
+			return zr == ZR_OK ? (long long)c.uncBytes : -1;
+		});
+	}
+	remove(exePath);
+
+	if (opts.zlib) ok &= MeasureWith(results, opts, c, "extract", "zlib", "MB/s", 1e6, clean, [&]() -> long long {
+		std::vector<unsigned char> zip;
+		if (!ReadWholeFile(c.path, zip)) return -1;
+		for (const Entry& e : c.entries) {
+			const unsigned char* data = &zip[e.dataOffset];
+			if (e.method == 8) {
+				z_stream zs; memset(&zs, 0, sizeof(zs));
+				if (inflateInit2(&zs, -15) != Z_OK) return -1;
+				zs.next_in = (Bytef*)data; zs.avail_in = (uInt)e.compSize;
+				zs.next_out = out.data(); zs.avail_out = (uInt)out.size();
+				int err = inflate(&zs, Z_FINISH);
+				inflateEnd(&zs);
+				if (err != Z_STREAM_END) return -1;
+				data = out.data();
+			}
+			if (crc32(0, data, (uInt)e.uncSize) != e.crc) return -1;
+
+			std::string path = dir + e.name;
+			if (!MakeDirs(path.substr(0, path.rfind('/')))) return -1;
+			FILE* f = fopen(path.c_str(), "wb");
+			if (!f) return -1;
+			bool ok = fwrite(data, 1, e.uncSize, f) == e.uncSize;
+			if (fclose(f) != 0 || !ok) return -1;
+		}
+		return (long long)c.uncBytes;
+	});
+
+	// Over http from the loopback server: everything, and then just the last item
+	LoopbackServer server(c.zip);
+	if (server.port == 0) {
+		fprintf(stderr, "%-20s couldn't start the loopback server\n", c.spec->name);
+		RemoveTree(dir);
+		return false;
+	}
+	ok &= MeasureWith(results, opts, c, "http", "unzip-all", "MB/s", 1e6, clean, [&]() -> long long {
+		ZIPSOURCE src;
+		if (!OpenUrlSource(server.Url().c_str(), &src)) return -1;
+		HZIP hz = OpenZipSource(&src, 0);
+		if (!hz) return -1;
+		SetUnzipBaseDir(hz, dir);
+		ZRESULT zr = UnzipAll(hz, opts.threads);
+		CloseZip(hz);
+		return zr == ZR_OK ? (long long)c.uncBytes : -1;
+	});
+
+	URLSOURCESTATS stats = {};
+	ok &= Measure(results, opts, c, "http-one", "unzip", "items/s", 1, [&]() -> long long {
+		ZIPSOURCE src;
+		if (!OpenUrlSource(server.Url().c_str(), &src)) return -1;
+		HZIP hz = OpenZipSource(&src, 0);
+		int index;
+		ZIPENTRY ze;
+		bool ok = hz && FindZipItem(hz, c.entries.back().name.c_str(), false, &index, &ze) == ZR_OK &&
+			UnzipItem(hz, index, out.data(), (unsigned int)out.size()) == ZR_OK;
+		if (hz) GetUrlSourceStats(&src, &stats);
+		if (hz) CloseZip(hz);
+		return ok ? 1 : -1;
+	});
+	fprintf(stderr, "%-20s http-one fetched %lld of %lld bytes in %u requests\n",
+		c.spec->name, stats.fetched, stats.size, stats.requests);
+
+	// From a server that ignores Range, every miss would fetch the whole zip
+	// again, so opening it should fail on the first reply
+	server.ranges = false;
+	int before = server.requests;
+	ZIPSOURCE whole;
+	if (OpenUrlSource(server.Url().c_str(), &whole)) {
+		CloseZip(OpenZipSource(&whole, 0));
+		fprintf(stderr, "%-20s http without ranges opened FAILED\n", c.spec->name);
+		ok = false;
+	}
+	else if (server.requests != before + 1) {
+		fprintf(stderr, "%-20s http without ranges made %d requests FAILED\n", c.spec->name, server.requests - before);
+		ok = false;
+	}
+	server.ranges = true;
+
+	// Downloading the zip whole, in ranges over four connections: cleanly, with
+	// every third response cut off halfway, and carrying on from a download
+	// that was cancelled halfway (which prep does, untimed)
+	std::string dlPath = opts.tmpDir + "/unzbench-" + std::to_string(getpid()) + ".dl";
+	std::vector<unsigned char> got;
+	DOWNLOADSTATS dstats = {};
+	auto download = [&](const DOWNLOADOPTIONS* dopts) -> long long {
+		int r = DownloadFile(server.Url().c_str(), dlPath.c_str(), dopts, &dstats);
+		if (r != DL_OK || !ReadWholeFile(dlPath, got) || got != c.zip) return -1;
+		remove(dlPath.c_str());
+		return dstats.fetched;
+	};
+	DOWNLOADOPTIONS dopts = {};
+	ok &= Measure(results, opts, c, "download", "clean", "MB/s", 1e6, [&] { return download(&dopts); });
+	server.cutEvery = 3;
+	ok &= Measure(results, opts, c, "download", "faults", "MB/s", 1e6, [&] { return download(&dopts); });
+	fprintf(stderr, "%-20s download faults took %u requests, %u retries\n", c.spec->name, dstats.requests, dstats.retries);
+	server.cutEvery = 0;
+	DOWNLOADOPTIONS halfway = {};
+	halfway.progress = [](void*, __int64 done, __int64 size) { return done < size / 2; };
+	ok &= MeasureWith(results, opts, c, "download", "resume", "MB/s", 1e6, [&] {
+		DownloadFile(server.Url().c_str(), dlPath.c_str(), &halfway, NULL);
+	}, [&]() -> long long {
+		long long fetched = download(&dopts);
+		return fetched >= 0 && dstats.resumed > 0 && dstats.resumed + fetched == (long long)c.zip.size() ? fetched : -1;
+	});
+
+	// The checks: a wrong hash is refused, a download that's in the cache isn't
+	// fetched again while the server says it's the same, and is once it doesn't
+	char cacheDir[MAX_PATH];
+	snprintf(cacheDir, sizeof(cacheDir), "%s/unzbench-%d.cache", opts.tmpDir.c_str(), (int)getpid());
+	unsigned char wrong[32] = {};
+	DOWNLOADOPTIONS checked = {};
+	checked.sha256 = wrong;
+	checked.cachedir = cacheDir;
+	int hashed = DownloadFile(server.Url().c_str(), dlPath.c_str(), &checked, &dstats);
+	checked.sha256 = NULL;
+	int first = DownloadFile(server.Url().c_str(), dlPath.c_str(), &checked, &dstats);
+	int again = DownloadFile(server.Url().c_str(), dlPath.c_str(), &checked, &dstats);
+	bool cached = dstats.cached && dstats.fetched == 0;
+	server.version++;
+	int changed = DownloadFile(server.Url().c_str(), dlPath.c_str(), &checked, &dstats);
+	bool refetched = !dstats.cached && dstats.fetched == (long long)c.zip.size();
+	if (hashed != DL_HASH || first != DL_OK || again != DL_OK || !cached || changed != DL_OK || !refetched ||
+		!ReadWholeFile(dlPath, got) || got != c.zip) {
+		fprintf(stderr, "%-20s download checks FAILED (wrong hash %d, first %d, again %d, cached %d, changed %d, refetched %d)\n",
+			c.spec->name, hashed, first, again, (int)cached, changed, (int)refetched);
+		ok = false;
+	}
+	DownloadEvict(server.Url().c_str(), dlPath.c_str(), &checked);
+	remove(dlPath.c_str());
+	RemoveTree(cacheDir);
+
+	RemoveTree(dir);
+	return ok;
+}
+
+// Small zips built an item at a time, for the cases the generated corpora
+// don't have. A check that fails says which, and fails the run.
+struct FixtureItem
+{
+	std::string name;
+	std::vector<unsigned char> data;  // what it unzips to
+	std::vector<unsigned char> body;  // what's in the zip
+	int method;
+	unsigned long crc;
+	unsigned int flags = 0;           // bit 0 if it's encrypted
+	std::vector<unsigned char> extra; // the same in the local and central headers
+};
+
+static FixtureItem Fixture(const char* name, const std::vector<unsigned char>& data, bool deflate)
+{
+	FixtureItem it;
+	it.name = name;
+	it.data = data;
+	it.method = deflate ? 8 : 0;
+	it.crc = crc32(0, data.data(), (uInt)data.size());
+	if (!deflate || !Deflate(data, it.body)) it.body = data;
+	return it;
+}
+
+// zstd (method 93): a single frame, with zstd's own checksum as 7-Zip's plugin writes it
+static FixtureItem ZstdFixture(const char* name, const std::vector<unsigned char>& data)
+{
+	FixtureItem it;
+	it.name = name;
+	it.data = data;
+	it.method = 93;
+	it.crc = crc32(0, data.data(), (uInt)data.size());
+	it.body.resize(ZSTD_compressBound(data.size()));
+	ZSTD_CCtx* cctx = ZSTD_createCCtx();
+	ZSTD_CCtx_setParameter(cctx, ZSTD_c_checksumFlag, 1);
+	size_t n = ZSTD_compress2(cctx, it.body.data(), it.body.size(), data.data(), data.size());
+	ZSTD_freeCCtx(cctx);
+	it.body.resize(ZSTD_isError(n) ? 0 : n);
+	return it;
+}
+
+// WinZip AES (method 99): body is the salt, password verifier, encrypted data
+// and authentication code, made elsewhere; AE-1 keeps the crc and AE-2 drops it
+static FixtureItem AesFixture(const char* name, const std::vector<unsigned char>& data, int vendor, int strength,
+	int method, const unsigned char* body, size_t len)
+{
+	FixtureItem it;
+	it.name = name;
+	it.data = data;
+	it.method = 99;
+	it.crc = vendor == 1 ? crc32(0, data.data(), (uInt)data.size()) : 0;
+	it.flags = 1;
+	it.body.assign(body, body + len);
+	Put16(it.extra, 0x9901); Put16(it.extra, 7); Put16(it.extra, vendor);
+	it.extra.push_back('A'); it.extra.push_back('E'); it.extra.push_back((unsigned char)strength); Put16(it.extra, method);
+	return it;
+}
+
+static std::vector<unsigned char> BuildZip(const std::vector<FixtureItem>& items)
+{
+	std::vector<unsigned char> zip, central;
+	for (const FixtureItem& it : items) {
+		unsigned long offset = (unsigned long)zip.size();
+		unsigned int version = it.method == 93 ? 63 : 20;
+		Put32(zip, 0x04034b50); Put16(zip, version); Put16(zip, it.flags); Put16(zip, it.method); Put16(zip, 0); Put16(zip, 0x21);
+		Put32(zip, it.crc); Put32(zip, (unsigned long)it.body.size()); Put32(zip, (unsigned long)it.data.size());
+		Put16(zip, (unsigned int)it.name.size()); Put16(zip, (unsigned int)it.extra.size());
+		zip.insert(zip.end(), it.name.begin(), it.name.end());
+		zip.insert(zip.end(), it.extra.begin(), it.extra.end());
+		zip.insert(zip.end(), it.body.begin(), it.body.end());
+
+		Put32(central, 0x02014b50); Put16(central, version); Put16(central, version); Put16(central, it.flags);
+		Put16(central, it.method); Put16(central, 0); Put16(central, 0x21);
+		Put32(central, it.crc); Put32(central, (unsigned long)it.body.size()); Put32(central, (unsigned long)it.data.size());
+		Put16(central, (unsigned int)it.name.size()); Put16(central, (unsigned int)it.extra.size()); Put16(central, 0);
+		Put16(central, 0); Put16(central, 0); Put32(central, 0x20); Put32(central, offset);
+		central.insert(central.end(), it.name.begin(), it.name.end());
+		central.insert(central.end(), it.extra.begin(), it.extra.end());
+	}
+	unsigned long cdOffset = (unsigned long)zip.size();
+	zip.insert(zip.end(), central.begin(), central.end());
+	Put32(zip, 0x06054b50); Put16(zip, 0); Put16(zip, 0);
+	Put16(zip, (unsigned int)items.size()); Put16(zip, (unsigned int)items.size());
+	Put32(zip, (unsigned long)central.size()); Put32(zip, cdOffset); Put16(zip, 0);
+	return zip;
+}
+
+// Unzips every item of zip to memory, and checks each comes out as it went in
+static bool UnzipsTo(std::vector<unsigned char>& zip, const std::vector<FixtureItem>& items, const char* password = 0)
+{
+	HZIP hz = OpenZip(zip.data(), (unsigned int)zip.size(), password);
+	if (!hz) return false;
+	bool ok = true;
+	for (size_t i = 0; i < items.size() && ok; i++) {
+		std::vector<unsigned char> got(items[i].data.size() + 16);
+		ok = UnzipItem(hz, (int)i, got.data(), (unsigned int)got.size()) == ZR_OK &&
+			std::equal(items[i].data.begin(), items[i].data.end(), got.begin());
+	}
+	CloseZip(hz);
+	return ok;
+}
+
+// Unzips the one item in zip to memory: what UnzipItem says, and what it wrote
+static ZRESULT UnzipOnly(std::vector<unsigned char>& zip, std::vector<unsigned char>& got, const char* password = 0)
+{
+	HZIP hz = OpenZip(zip.data(), (unsigned int)zip.size(), password);
+	if (!hz) return ZR_CORRUPT;
+	ZIPENTRY ze;
+	ZRESULT zr = GetZipItem(hz, 0, &ze);
+	got.assign(zr == ZR_OK ? (size_t)ze.unc_size : 0, 0);
+	if (zr == ZR_OK) zr = UnzipItem(hz, 0, got.data(), (unsigned int)got.size());
+	CloseZip(hz);
+	return zr;
+}
+
+static bool RunFixtures(const Options& opts)
+{
+	bool ok = true;
+	auto check = [&](bool passed, const char* what) {
+		if (!passed) fprintf(stderr, "fixtures %s FAILED\n", what);
+		ok &= passed;
+	};
+	std::vector<unsigned char> text(5000);
+	FillText(text);
+
+	// Empty items, stored and deflated, as a .gitkeep or an empty config file
+	// would be, beside one that isn't: each unzips, and they hash into a manifest
+	std::vector<FixtureItem> empties = {
+		Fixture("empty.txt", std::vector<unsigned char>(), false),
+		Fixture("lib/empty.dll.config", std::vector<unsigned char>(), true),
+		Fixture("lib/readme.txt", text, true),
+	};
+	std::vector<unsigned char> emptyZip = BuildZip(empties), manifest;
+	check(UnzipsTo(emptyZip, empties), "empty items unzip");
+	HZIP hz = OpenZip(emptyZip.data(), (unsigned int)emptyZip.size(), 0);
+	unsigned int len = ZIPMANIFEST_SIZE(empties.size());
+	manifest.resize(len);
+	check(hz && MakeZipManifest(hz, 0, manifest.data(), &len) == ZR_OK, "empty items hash into a manifest");
+	if (hz) CloseZip(hz);
+
+	// and UnzipAll writes them out, checked against that manifest
+	std::string dir = opts.tmpDir + "/unzbench-" + std::to_string(getpid()) + ".fixtures/";
+	auto unzipsAll = [&](std::vector<unsigned char>& zip, const std::vector<FixtureItem>& items) {
+		RemoveTree(dir);
+		HZIP hz = OpenZip(zip.data(), (unsigned int)zip.size(), 0);
+		if (!hz) return false;
+		SetUnzipBaseDir(hz, dir.c_str());
+		ZRESULT zr = SetUnzipManifest(hz, manifest.data(), (unsigned int)manifest.size());
+		if (zr == ZR_OK) zr = UnzipAll(hz, 0);
+		CloseZip(hz);
+		bool ok = zr == ZR_OK;
+		std::vector<unsigned char> got;
+		for (size_t i = 0; i < items.size() && ok; i++) ok = ReadWholeFile(dir + items[i].name, got) && got == items[i].data;
+		return ok;
+	};
+	check(unzipsAll(emptyZip, empties), "empty items unzip-all");
+
+	// and the same as Setup's ExtractUpdater does it: appended to Setup.exe,
+	// speculatively on a background worker that's promoted part way, with
+	// a progress callback logging each item's end
+	std::string exe = opts.tmpDir + "/unzbench-" + std::to_string(getpid()) + ".fixture.exe";
+	volatile long promote = 0;
+	struct Ends { int count, failed; volatile long* promote; } ends = { 0, 0, &promote };
+	bool extracted = false;
+	if (WriteOverlayExe(exe.c_str(), emptyZip)) {
+		RemoveTree(dir);
+		HZIP hz = OpenZipOverlay(exe.c_str(), 0);
+		ZIPTHROTTLE throttle = {};
+		throttle.threads = 1;
+		throttle.background = true;
+		throttle.lift = &promote;
+		ZRESULT zr = hz ? SetUnzipBaseDir(hz, dir.c_str()) : ZR_NOFILE;
+		if (zr == ZR_OK) zr = SetUnzipProgress(hz, [](void* param, const ZIPPROGRESS* zp) {
+			Ends* e = (Ends*)param;
+			if (zp->event == ZIPPROGRESS_END) { e->count++; if (zp->result != ZR_OK) e->failed++; *e->promote = 1; }
+			return true;
+		}, &ends);
+		if (zr == ZR_OK) zr = SetUnzipManifest(hz, manifest.data(), (unsigned int)manifest.size());
+		if (zr == ZR_OK) zr = SetUnzipThrottle(hz, &throttle);
+		if (zr == ZR_OK) zr = UnzipAll(hz, 0);
+		if (hz) CloseZip(hz);
+		extracted = zr == ZR_OK && ends.count == (int)empties.size() && ends.failed == 0;
+		std::vector<unsigned char> got;
+		for (size_t i = 0; i < empties.size() && extracted; i++) extracted = ReadWholeFile(dir + empties[i].name, got) && got == empties[i].data;
+	}
+	remove(exe.c_str());
+	check(extracted, "empty items extract as Setup does");
+
+	// zstd items, one small and one that spans many reads, decode through
+	// method 93; a frame that's damaged, or doesn't match the header's size,
+	// fails with the error that says which
+	std::vector<unsigned char> big(300000);
+	FillText(big);
+	std::vector<FixtureItem> zstds = {
+		ZstdFixture("lib/readme.txt", text),
+		ZstdFixture("lib/big.txt", big),
+	};
+	std::vector<unsigned char> zstdZip = BuildZip(zstds), got;
+	check(!zstds[0].body.empty() && !zstds[1].body.empty() && UnzipsTo(zstdZip, zstds), "zstd items unzip");
+	hz = OpenZip(zstdZip.data(), (unsigned int)zstdZip.size(), 0);
+	len = ZIPMANIFEST_SIZE(zstds.size());
+	manifest.resize(len);
+	check(hz && MakeZipManifest(hz, 0, manifest.data(), &len) == ZR_OK && unzipsAll(zstdZip, zstds), "zstd items unzip-all");
+	if (hz) CloseZip(hz);
+	auto spoilt = [&](void (*spoil)(FixtureItem&)) {
+		FixtureItem it = ZstdFixture("lib/big.txt", big);
+		spoil(it);
+		std::vector<unsigned char> zip = BuildZip(std::vector<FixtureItem>(1, it));
+		return UnzipOnly(zip, got);
+	};
+	check(spoilt([](FixtureItem& it) { it.body[0] ^= 0xff; }) == ZR_FLATE, "zstd frame with a bad magic number");
+	check(spoilt([](FixtureItem& it) { it.body[it.body.size() / 2] ^= 0x55; }) == ZR_FLATE, "zstd frame damaged in a block");
+	check(spoilt([](FixtureItem& it) { it.body[it.body.size() - 1] ^= 0x01; }) == ZR_FLATE, "zstd frame with a bad checksum");
+	check(spoilt([](FixtureItem& it) { it.body.resize(it.body.size() - 100); }) == ZR_FLATE, "zstd frame cut short");
+	check(spoilt([](FixtureItem& it) { it.data.push_back('!'); }) == ZR_CORRUPT, "zstd frame shorter than the header says");
+	check(spoilt([](FixtureItem& it) { it.data.pop_back(); }) == ZR_CORRUPT, "zstd frame longer than the header says");
+
+	// WinZip AES items: AE-1 and AE-2, at 128 bits stored and 256 bits
+	// deflated, with the password "squirrel". They were encrypted outside the
+	// engine (keys from Python's hashlib.pbkdf2_hmac, the CTR keystream from
+	// OpenSSL's AES, the code from its hmac) so they don't share its mistakes.
+	// Each decrypts; a wrong password is ZR_PASSWORD, and a tampered
+	// authentication code, or data that AE-2 has no crc to catch, is ZR_CORRUPT.
+	static const unsigned char ae1_128[] = {
+		0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0xea, 0xde, 0x12, 0xb6, 0xeb, 0xd6, 0x07, 0x49,
+		0x7e, 0xed, 0x60, 0xdb, 0x77, 0x74, 0x69, 0xd9, 0xcd, 0x68, 0x60, 0xf0, 0x3a, 0x0a, 0xdb, 0xc7,
+		0xa3, 0x32, 0x85, 0xaf, 0x60, 0x81, 0x56, 0x6a, 0x78, 0x25, 0xf5, 0x24, 0x9a, 0x28, 0xe5, 0x91,
+		0x42, 0xce, 0x0c, 0x76, 0x1e, 0x71, 0x62, 0xcb, 0xc4, 0x6c, 0x9c, 0x85, 0xd3, 0xe7, 0xfc, 0x3c,
+		0x7f, 0x16, 0x8b, 0x93, 0xf9, 0xc3, 0x45, 0x6b, 0xa4, 0xeb, 0xbc, 0x28, 0x23, 0x87, 0xd7, 0x50,
+		0x51, 0x95, 0x9d, 0xea, 0xea, 0x38, 0x93,
+	};
+	static const unsigned char ae2_128[] = {
+		0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10, 0x11, 0x12, 0x7d, 0x7d, 0xc6, 0xe0, 0x47, 0xb8, 0x47, 0x6a,
+		0x3c, 0x09, 0x6a, 0xec, 0x96, 0x10, 0xb4, 0xd0, 0xbd, 0x32, 0x47, 0x38, 0xd7, 0x98, 0x71, 0x3b,
+		0x20, 0x47, 0x02, 0x35, 0xf4, 0x3a, 0x5f, 0x20, 0x35, 0x5d, 0x5f, 0xcb, 0xa2, 0xc1, 0x8a, 0xb5,
+		0x64, 0xaf, 0x9c, 0xcd, 0x3c, 0x8a, 0x38, 0x39, 0xba, 0x3c, 0x96, 0xef, 0x7b, 0xdf, 0xc2, 0x3a,
+		0xd5, 0x01, 0x41, 0xe0, 0x6c, 0xc8, 0x5a, 0x64, 0x37, 0x95, 0xea, 0x6a, 0xf0, 0xc1, 0xbe, 0xd5,
+		0x93, 0x93, 0x99, 0x14, 0x33, 0xb7, 0x3b,
+	};
+	static const unsigned char ae1_256[] = {
+		0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20, 0x21, 0x22, 0x23, 0x24,
+		0xa7, 0x56, 0x6b, 0xb1, 0xfa, 0x48, 0xc9, 0x7b, 0x85, 0xa3, 0x91, 0xed, 0x62, 0x1c, 0xa0, 0xcc,
+		0x11, 0x70, 0xd6, 0x4d, 0xae, 0x40, 0x0e, 0x47, 0xb2, 0x83, 0x91, 0x6d, 0xba, 0xe9, 0x1c, 0x0e,
+		0x42, 0x7a, 0x2c, 0xe5, 0x31, 0x27, 0xc2, 0x9b, 0xc3, 0x4b, 0x7f, 0x98, 0x30, 0x7d, 0xee, 0x9a,
+		0xa4, 0x64, 0xac, 0x2d, 0x0c, 0xe5, 0x4b, 0x5f, 0xc0, 0x67, 0x2e, 0x1c, 0xcf, 0xe5, 0xd5, 0xd5,
+		0x91, 0xdf, 0x72, 0x45, 0xe0, 0x96, 0xbd, 0x50, 0x54, 0xbc, 0x04, 0x80, 0xa3,
+	};
+	static const unsigned char ae2_256[] = {
+		0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38,
+		0xf9, 0xef, 0x3a, 0x73, 0xce, 0xe2, 0x45, 0xd4, 0x68, 0x0d, 0x75, 0xd2, 0x87, 0x27, 0xb1, 0xce,
+		0x59, 0xf2, 0x85, 0x1b, 0xb3, 0x5e, 0x05, 0xec, 0x2f, 0xbd, 0x1b, 0x81, 0x99, 0x31, 0x03, 0xe1,
+		0x51, 0x7e, 0x7f, 0xef, 0xe2, 0xbc, 0x04, 0xac, 0x0e, 0x3b, 0x36, 0xcc, 0x8f, 0xf6, 0x16, 0x36,
+		0x1a, 0x63, 0x1b, 0xfa, 0x80, 0xe9, 0xaf, 0x38, 0x32, 0xf3, 0x6a, 0xbb, 0xb3, 0xc7, 0x7f, 0xb4,
+		0x81, 0x90, 0xfa, 0x04, 0x17, 0xdf, 0xee, 0x1e, 0x6c, 0x7d, 0xde, 0xba, 0xf1,
+	};
+	const char* plain = "Squirrel's WinZip AES fixture: keys from PBKDF2, CTR from OpenSSL.\n";
+	std::vector<unsigned char> aesText(plain, plain + strlen(plain));
+	std::vector<FixtureItem> aes = {
+		AesFixture("ae1-128.txt", aesText, 1, 1, 0, ae1_128, sizeof(ae1_128)),
+		AesFixture("ae2-128.txt", aesText, 2, 1, 0, ae2_128, sizeof(ae2_128)),
+		AesFixture("ae1-256.txt", aesText, 1, 3, 8, ae1_256, sizeof(ae1_256)),
+		AesFixture("ae2-256.txt", aesText, 2, 3, 8, ae2_256, sizeof(ae2_256)),
+	};
+	std::vector<unsigned char> aesZip = BuildZip(aes);
+	check(UnzipsTo(aesZip, aes, "squirrel"), "AES items decrypt");
+	for (const FixtureItem& it : aes) {
+		std::vector<unsigned char> zip = BuildZip(std::vector<FixtureItem>(1, it));
+		std::string what = "AES item " + it.name;
+		check(UnzipOnly(zip, got, "squirrel") == ZR_OK && got == it.data, (what + " decrypts alone").c_str());
+		check(UnzipOnly(zip, got, "squirrels") == ZR_PASSWORD, (what + " with the wrong password").c_str());
+		check(UnzipOnly(zip, got, 0) == ZR_PASSWORD, (what + " with no password").c_str());
+		FixtureItem spoilt = it;
+		spoilt.body.back() ^= 0x01;
+		zip = BuildZip(std::vector<FixtureItem>(1, spoilt));
+		check(UnzipOnly(zip, got, "squirrel") == ZR_CORRUPT, (what + " with a tampered code").c_str());
+		HZIP hz = OpenZip(zip.data(), (unsigned int)zip.size(), "squirrel");
+		check(hz && UnzipItem(hz, 0, (dir + it.name).c_str()) == ZR_CORRUPT, (what + " with a tampered code, to a file").c_str());
+		if (hz) CloseZip(hz);
+		spoilt = it;
+		spoilt.body[spoilt.body.size() - 11] ^= 0x01;
+		zip = BuildZip(std::vector<FixtureItem>(1, spoilt));
+		check(UnzipOnly(zip, got, "squirrel") == ZR_CORRUPT, (what + " with tampered data").c_str());
+	}
+
+	RemoveTree(dir);
+	if (ok) fprintf(stderr, "fixtures             all passed\n");
+	return ok;
+}
+
+// Setup --checkInstall's decision, against a stand-in for a user's folders:
+// installed by Update.exe (one stat), installed by the MSI (two), and not
+// installed (two, and then Setup asks ShouldSilentInstall)
+static const CorpusSpec checkInstallSpec = { "checkinstall", 0, 0, Binary, false };
+
+static bool RunCheckInstall(std::vector<Result>& results, const Options& opts)
+{
+	Corpus c;
+	c.spec = &checkInstallSpec;
+	std::string root = opts.tmpDir + "/unzbench-" + std::to_string(getpid()) + ".users";
+	std::string local = root + "/Local", programData = root + "/ProgramData";
+	std::string exe = root + "/Downloads/MyAppDeploymentTool.exe";
+	if (!MakeDirs(local + "/MyApp") || !MakeDirs(programData + "/OtherApp/alice")) {
+		fprintf(stderr, "couldn't make %s\n", root.c_str());
+		return false;
+	}
+
+	const int checks = 10000;
+	bool ok = true;
+	struct Case { const char* impl; const char* exe; const char* user; int want; };
+	std::string otherExe = root + "/OtherAppDeploymentTool.exe", missingExe = root + "/NewAppDeploymentTool.exe";
+	Case cases[] = {
+		{ "installed", exe.c_str(), "alice", CHECKINSTALL_SKIP },
+		{ "machine", otherExe.c_str(), "alice", CHECKINSTALL_SKIP },
+		{ "missing", missingExe.c_str(), "alice", CHECKINSTALL_UNKNOWN },
+	};
+	for (const Case& k : cases) {
+		ok &= Measure(results, opts, c, "checkinstall", k.impl, "checks/s", 1, [&]() -> long long {
+			for (int i = 0; i < checks; i++) {
+				if (CheckInstall(k.exe, local.c_str(), programData.c_str(), k.user) != k.want) return -1;
+			}
+			return checks;
+		});
+	}
+	// without all of the environment it can still find an install
+	if (CheckInstall(exe.c_str(), local.c_str(), NULL, NULL) != CHECKINSTALL_SKIP ||
+		CheckInstall(otherExe.c_str(), NULL, programData.c_str(), "alice") != CHECKINSTALL_SKIP) {
+		fprintf(stderr, "checkinstall FAILED to find an install with only some of the environment\n");
+		ok = false;
+	}
+	// nor does it matter how the download cased the name
+	std::string lowerExe = root + "/Downloads/MyAppdeploymenttool.EXE";
+	if (CheckInstall(lowerExe.c_str(), local.c_str(), programData.c_str(), "alice") != CHECKINSTALL_SKIP) {
+		fprintf(stderr, "checkinstall FAILED to find an install from %s\n", lowerExe.c_str());
+		ok = false;
+	}
+	RemoveTree(root);
+	return ok;
+}
+
+// One line per task: how many items, how many bytes, and where it starts in the zip
+static void PrintPlan(const Options& opts, const Corpus& c)
+{
+	HZIP hz = OpenZip(c.path.c_str(), 0);
+	if (!hz) return;
+	int count = 0;
+	GetUnzipPlan(hz, opts.threads, NULL, &count);
+	std::vector<ZIPPLANITEM> plan(count);
+	if (count > 0) GetUnzipPlan(hz, opts.threads, plan.data(), &count);
+	CloseZip(hz);
+
+	fprintf(stderr, "%s: %d items\n", c.spec->name, count);
+	for (size_t i = 0; i < plan.size();) {
+		size_t j = i;
+		long long bytes = 0;
+		for (; j < plan.size() && plan[j].task == plan[i].task; j++) bytes += plan[j].unc_size;
+		fprintf(stderr, "  task %-5d %5zu items %12lld bytes  offset %ld\n", plan[i].task, j - i, bytes, plan[i].offset);
+		i = j;
+	}
+}
+
+static void WriteJson(FILE* f, const Options& opts, const std::vector<Corpus>& corpora, const std::vector<Result>& results)
+{
+	fprintf(f, "{\n  \"bench\": \"unzbench\",\n  \"scale\": %g,\n  \"min_time\": %g,\n", opts.scale, opts.minTime);
+	fprintf(f, "  \"tmpdir\": \"%s\",\n  \"zlib_version\": \"%s\",\n", opts.tmpDir.c_str(), zlibVersion());
+
+	fprintf(f, "  \"corpora\": [\n");
+	for (size_t i = 0; i < corpora.size(); i++) {
+		const Corpus& c = corpora[i];
+		fprintf(f, "    {\"name\": \"%s\", \"entries\": %zu, \"unc_bytes\": %zu, \"comp_bytes\": %zu, \"cd_bytes\": %zu}%s\n",
+			c.spec->name, c.entries.size(), c.uncBytes, c.compBytes, c.cdBytes, i + 1 < corpora.size() ? "," : "");
+	}
+
+	fprintf(f, "  ],\n  \"results\": [\n");
+	for (size_t i = 0; i < results.size(); i++) {
+		const Result& r = results[i];
+		fprintf(f, "    {\"corpus\": \"%s\", \"op\": \"%s\", \"impl\": \"%s\", \"unit\": \"%s\", \"rate\": %.3f, \"best\": %.3f, "
+			"\"units\": %lld, \"seconds\": %.6f, \"iterations\": %d}%s\n",
+			r.corpus.c_str(), r.op.c_str(), r.impl.c_str(), r.unit.c_str(), r.rate, r.best,
+			r.bytes, r.seconds, r.iterations, i + 1 < results.size() ? "," : "");
+	}
+	fprintf(f, "  ]\n}\n");
+}
+
+int main(int argc, char** argv)
+{
+	Options opts;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (arg == "--corpus" && hasValue) opts.corpusDir = argv[++i];
+		else if (arg == "--tmpdir" && hasValue) opts.tmpDir = argv[++i];
+		else if (arg == "--scale" && hasValue) opts.scale = atof(argv[++i]);
+		else if (arg == "--min-time" && hasValue) opts.minTime = atof(argv[++i]);
+		else if (arg == "--only" && hasValue) opts.only = argv[++i];
+		else if (arg == "--json" && hasValue) opts.jsonFile = argv[++i];
+		else if (arg == "--no-zlib") opts.zlib = false;
+		else if (arg == "--threads" && hasValue) opts.threads = (unsigned int)atoi(argv[++i]);
+		else if (arg == "--level" && hasValue) opts.level = atoi(argv[++i]);
+		else if (arg == "--plan") opts.plan = true;
+		else if (arg == "--trace" && hasValue) opts.traceFile = argv[++i];
+		else if (arg == "--gen-only") opts.genOnly = true;
+		else {
+			fputs(usage, stderr);
+			return arg == "--help" ? 0 : 1;
+		}
+	}
+
+	if (opts.scale <= 0 || !MakeDirs(opts.corpusDir)) {
+		fputs(usage, stderr);
+		return 1;
+	}
+
+	std::vector<Corpus> corpora;
+	for (const CorpusSpec& spec : corpusSpecs) {
+		if (!opts.only.empty() && strstr(spec.name, opts.only.c_str()) == NULL) continue;
+
+		bool huge = spec.files < 16;
+		int files = huge ? spec.files : std::max(1, (int)(spec.files * opts.scale));
+		size_t fileSize = huge ? std::max((size_t)1, (size_t)(spec.fileSize * opts.scale)) : spec.fileSize;
+
+		char path[MAX_PATH];
+		snprintf(path, sizeof(path), "%s/%s-x%g.zip", opts.corpusDir.c_str(), spec.name, opts.scale);
+
+		Corpus c;
+		c.spec = &spec;
+		c.path = path;
+		if (!ReadWholeFile(c.path, c.zip) || !IndexCorpus(c)) {
+			fprintf(stderr, "generating %s\n", path);
+			c.entries.clear();
+			if (!WriteCorpus(spec, files, fileSize, c.path) || !ReadWholeFile(c.path, c.zip) || !IndexCorpus(c)) {
+				fprintf(stderr, "%s: couldn't generate the corpus\n", path);
+				return 1;
+			}
+		}
+		corpora.push_back(c);
+	}
+
+	if (opts.genOnly) return 0;
+
+	if (opts.plan) {
+		for (const Corpus& c : corpora) PrintPlan(opts, c);
+	}
+
+	if (!opts.traceFile.empty() && (!TraceStart("unzbench") || !TraceFile(opts.traceFile.c_str()))) {
+		fprintf(stderr, "%s: %s\n", opts.traceFile.c_str(), strerror(errno));
+		return 1;
+	}
+
+	std::vector<Result> results;
+	bool ok = true;
+	for (const Corpus& c : corpora) {
+		TraceSpan span(c.spec->name);
+		ok &= RunCorpus(results, opts, c);
+	}
+	if (opts.only.empty() || strstr("fixtures", opts.only.c_str()) != NULL) {
+		TraceSpan span("fixtures");
+		ok &= RunFixtures(opts);
+	}
+	if (opts.only.empty() || strstr(checkInstallSpec.name, opts.only.c_str()) != NULL) {
+		TraceSpan span(checkInstallSpec.name);
+		ok &= RunCheckInstall(results, opts);
+	}
+	TraceStop();
+
+	FILE* f = opts.jsonFile.empty() ? stdout : fopen(opts.jsonFile.c_str(), "w");
+	if (!f) {
+		fprintf(stderr, "%s: %s\n", opts.jsonFile.c_str(), strerror(errno));
+		return 1;
+	}
+	WriteJson(f, opts, corpora, results);
+	if (f != stdout) fclose(f);
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,76 @@
+#ifdef _WIN32
+#include "stdafx.h"
+#else
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <sys/stat.h>
+#endif
+#include "unzip.h"
+#include "checkinstall.h"
+#include <string>
+
+
+#ifdef _WIN32
+#define CI_T(s) L##s
+#define CI_SLASH L"\\"
+#define CI_ICMP _wcsicmp
+
+// Something that's there but we can't look at counts as there
+bool ci_exists(const TCHAR *path)
+{ if (GetFileAttributes(path)!=INVALID_FILE_ATTRIBUTES) return true;
+  DWORD err=GetLastError();
+  return err!=ERROR_FILE_NOT_FOUND && err!=ERROR_PATH_NOT_FOUND;
+}
+
+// Straight from the process's environment block, which loads nothing
+const TCHAR *ci_getenv(const TCHAR *name, TCHAR *buf, DWORD len)
+{ DWORD n=GetEnvironmentVariable(name,buf,len);
+  return n>0 && n<len ? buf : 0;
+}
+#else
+#define CI_T(s) s
+#define CI_SLASH "/"
+#define CI_ICMP strcasecmp
+
+bool ci_exists(const TCHAR *path)
+{ struct stat st; if (stat(path,&st)==0) return true;
+  return errno!=ENOENT && errno!=ENOTDIR;
+}
+
+const TCHAR *ci_getenv(const TCHAR *name, TCHAR *, unsigned int) {return getenv(name);}
+#endif
+
+typedef std::basic_string<TCHAR> ci_path;
+
+bool ci_known(const TCHAR *s) {return s!=0 && *s!=0;}
+
+// $pkgName, from $pkgNameDeploymentTool.exe, however a download or a rename cased it
+ci_path ci_pkgname(const TCHAR *exe)
+{ const TCHAR *name=exe;
+  for (const TCHAR *c=exe; *c!=0; c++) if (*c=='\\' || *c=='/') name=c+1;
+  ci_path pkg(name), suffix(CI_T("DeploymentTool.exe"));
+  if (pkg.size()>=suffix.size() && CI_ICMP(pkg.c_str()+pkg.size()-suffix.size(),suffix.c_str())==0) pkg.resize(pkg.size()-suffix.size());
+  return pkg;
+}
+
+
+int CheckInstall(const TCHAR *exe, const TCHAR *localappdata, const TCHAR *programdata, const TCHAR *username)
+{ if (!ci_known(exe)) return CHECKINSTALL_UNKNOWN;
+  ci_path pkg=ci_pkgname(exe);
+  // the usual answer, so it's asked first
+  if (ci_known(localappdata) && ci_exists((ci_path(localappdata)+CI_SLASH+pkg).c_str())) return CHECKINSTALL_SKIP;
+  if (ci_known(programdata) && ci_known(username) && ci_exists((ci_path(programdata)+CI_SLASH+pkg+CI_SLASH+username).c_str())) return CHECKINSTALL_SKIP;
+  // not finding it is no reason to install: ShouldSilentInstall has the last word
+  return CHECKINSTALL_UNKNOWN;
+}
+
+int CheckInstallFromEnvironment(const TCHAR *exe)
+{ TCHAR local[MAX_PATH], programdata[MAX_PATH], username[256];
+  return CheckInstall(exe,
+    ci_getenv(CI_T("LOCALAPPDATA"),local,MAX_PATH),
+    ci_getenv(CI_T("ProgramData"),programdata,MAX_PATH),
+    ci_getenv(CI_T("USERNAME"),username,256));
+}
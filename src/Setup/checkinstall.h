@@ -0,0 +1,32 @@
+#ifndef _checkinstall_H
+#define _checkinstall_H
+
+// The decision Setup.exe --checkInstall makes at every logon on a machine
+// that has the app deployed machine-wide: is it already installed for this
+// user? MachineInstaller::ShouldSilentInstall says so if either of
+//   %LOCALAPPDATA%\$pkgName                 (Update.exe's install)
+//   %ProgramData%\$pkgName\%USERNAME%       (the MSI's)
+// exists at all, where Setup's own name is $pkgNameDeploymentTool.exe. It
+// needs shell32 and advapi32 for those, and runs after the system DLLs are
+// preloaded; this gets the usual answer (the app's there) from the
+// environment, before any of that, with one GetFileAttributes, or two for the
+// MSI's. The environment's only trusted to say skip: anything else is left to
+// ShouldSilentInstall, as the variables can be stale or redirected. e.g.
+//   if (CheckInstallFromEnvironment(ourFile)==CHECKINSTALL_SKIP) return 0;
+// Like the unzip engine it builds on Windows and elsewhere, for the bench.
+
+#include "unzip.h"
+
+#define CHECKINSTALL_SKIP    1   // it's installed for this user, one way or the other
+#define CHECKINSTALL_UNKNOWN 2   // it wasn't found where the environment says; ask ShouldSilentInstall
+
+int CheckInstall(const TCHAR *exe, const TCHAR *localappdata, const TCHAR *programdata, const TCHAR *username);
+// CheckInstall - the decision for the Setup at exe (a full path), given those
+// folders and the user's name, any of which may be 0 or empty if they aren't
+// known. Returns CHECKINSTALL_SKIP if it's found, and else CHECKINSTALL_UNKNOWN.
+
+int CheckInstallFromEnvironment(const TCHAR *exe);
+// CheckInstallFromEnvironment - CheckInstall with LOCALAPPDATA, ProgramData
+// and USERNAME from the environment.
+
+#endif // _checkinstall_H
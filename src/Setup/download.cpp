@@ -0,0 +1,666 @@
+#ifdef _WIN32
+#include "stdafx.h"
+#include "httpsession.h"
+#else
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#endif
+#include "unzip.h"
+#include "download.h"
+#include "trace.h"
+#include <vector>
+#include <string>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+
+
+#define DL_BLOCK      (64*1024)        // what's read from the server and written at a time
+#define DL_MINSEG     (1024*1024)      // segments are at least this big,
+#define DL_SEGS       4                // and otherwise there are this many for each connection
+#define DL_SAVE       (2*1024*1024)    // the state's saved each time this much more has come
+#define DL_BACKOFF    100              // ms before the first retry, doubling each time up to
+#define DL_MAXBACKOFF 3000
+#define DL_RESTART    100              // (not returned) the file on the server isn't the one the state's for
+
+#ifdef _WIN32
+#define DL_T(s) L##s
+#define DL_SLASH L"\\"
+#else
+#define DL_T(s) s
+#define DL_SLASH "/"
+#endif
+
+typedef std::basic_string<TCHAR> dl_path;
+
+
+// SHA-256, which is what the hash of a download is usually published as
+
+typedef struct {unsigned int h[8]; unsigned char buf[64]; unsigned __int64 len;} dl_sha256;
+
+static const unsigned int dl_sha256_k[64] =
+{ 0x428a2f98,0x71374491,0xb5c0fbcf,0xe9b5dba5,0x3956c25b,0x59f111f1,0x923f82a4,0xab1c5ed5,
+  0xd807aa98,0x12835b01,0x243185be,0x550c7dc3,0x72be5d74,0x80deb1fe,0x9bdc06a7,0xc19bf174,
+  0xe49b69c1,0xefbe4786,0x0fc19dc6,0x240ca1cc,0x2de92c6f,0x4a7484aa,0x5cb0a9dc,0x76f988da,
+  0x983e5152,0xa831c66d,0xb00327c8,0xbf597fc7,0xc6e00bf3,0xd5a79147,0x06ca6351,0x14292967,
+  0x27b70a85,0x2e1b2138,0x4d2c6dfc,0x53380d13,0x650a7354,0x766a0abb,0x81c2c92e,0x92722c85,
+  0xa2bfe8a1,0xa81a664b,0xc24b8b70,0xc76c51a3,0xd192e819,0xd6990624,0xf40e3585,0x106aa070,
+  0x19a4c116,0x1e376c08,0x2748774c,0x34b0bcb5,0x391c0cb3,0x4ed8aa4a,0x5b9cca4f,0x682e6ff3,
+  0x748f82ee,0x78a5636f,0x84c87814,0x8cc70208,0x90befffa,0xa4506ceb,0xbef9a3f7,0xc67178f2
+};
+
+#define DL_ROR(x,n) (((x)>>(n))|((x)<<(32-(n))))
+static void dl_sha256_block(unsigned int *h, const unsigned char *p)
+{ unsigned int w[64];
+  for (int i=0; i<16; i++) w[i]=((unsigned int)p[4*i]<<24)|((unsigned int)p[4*i+1]<<16)|((unsigned int)p[4*i+2]<<8)|p[4*i+3];
+  for (int i=16; i<64; i++)
+  { unsigned int s0=DL_ROR(w[i-15],7)^DL_ROR(w[i-15],18)^(w[i-15]>>3), s1=DL_ROR(w[i-2],17)^DL_ROR(w[i-2],19)^(w[i-2]>>10);
+    w[i]=w[i-16]+s0+w[i-7]+s1;
+  }
+  unsigned int a=h[0],b=h[1],c=h[2],d=h[3],e=h[4],f=h[5],g=h[6],k=h[7];
+  for (int i=0; i<64; i++)
+  { unsigned int t1=k+(DL_ROR(e,6)^DL_ROR(e,11)^DL_ROR(e,25))+((e&f)^(~e&g))+dl_sha256_k[i]+w[i];
+    unsigned int t2=(DL_ROR(a,2)^DL_ROR(a,13)^DL_ROR(a,22))+((a&b)^(a&c)^(b&c));
+    k=g; g=f; f=e; e=d+t1; d=c; c=b; b=a; a=t1+t2;
+  }
+  h[0]+=a; h[1]+=b; h[2]+=c; h[3]+=d; h[4]+=e; h[5]+=f; h[6]+=g; h[7]+=k;
+}
+
+static void dl_sha256_init(dl_sha256 *c)
+{ static const unsigned int iv[8]={0x6a09e667,0xbb67ae85,0x3c6ef372,0xa54ff53a,0x510e527f,0x9b05688c,0x1f83d9ab,0x5be0cd19};
+  memcpy(c->h,iv,sizeof(iv)); c->len=0;
+}
+
+static void dl_sha256_update(dl_sha256 *c, const unsigned char *p, size_t n)
+{ unsigned int used=(unsigned int)(c->len&63); c->len+=n;
+  if (used>0)
+  { unsigned int take=64-used; if (take>n) take=(unsigned int)n;
+    memcpy(c->buf+used,p,take); p+=take; n-=take;
+    if (used+take<64) return;
+    dl_sha256_block(c->h,c->buf);
+  }
+  for (; n>=64; p+=64, n-=64) dl_sha256_block(c->h,p);
+  memcpy(c->buf,p,n);
+}
+
+static void dl_sha256_final(dl_sha256 *c, unsigned char *out)
+{ unsigned __int64 bits=c->len*8; unsigned char pad=0x80, zero=0, lenbuf[8];
+  dl_sha256_update(c,&pad,1);
+  while ((c->len&63)!=56) dl_sha256_update(c,&zero,1);
+  for (int i=0; i<8; i++) lenbuf[i]=(unsigned char)(bits>>(56-8*i));
+  dl_sha256_update(c,lenbuf,8);
+  for (int i=0; i<8; i++) {out[4*i]=(unsigned char)(c->h[i]>>24); out[4*i+1]=(unsigned char)(c->h[i]>>16); out[4*i+2]=(unsigned char)(c->h[i]>>8); out[4*i+3]=(unsigned char)c->h[i];}
+}
+
+static std::string dl_hex(const unsigned char *p, unsigned int n)
+{ static const char digits[]="0123456789abcdef";
+  std::string s;
+  for (unsigned int i=0; i<n; i++) {s+=digits[p[i]>>4]; s+=digits[p[i]&15];}
+  return s;
+}
+
+static dl_path dl_widen(const std::string &s) {return dl_path(s.begin(),s.end());} // it's only ever hex
+
+
+// Files. The temp file is written at many places at once, so through
+// positional writes on one handle.
+
+#ifdef _WIN32
+typedef HANDLE dl_file;
+#define DL_NOFILE INVALID_HANDLE_VALUE
+
+static dl_file dl_open(const TCHAR *fn, bool write, bool create)
+{ return CreateFile(fn,write?GENERIC_READ|GENERIC_WRITE:GENERIC_READ,FILE_SHARE_READ,NULL,create?CREATE_ALWAYS:OPEN_EXISTING,FILE_ATTRIBUTE_NORMAL,NULL);
+}
+static void dl_close(dl_file f) {CloseHandle(f);}
+static bool dl_size(dl_file f, __int64 *size) {LARGE_INTEGER li; if (!GetFileSizeEx(f,&li)) return false; *size=li.QuadPart; return true;}
+static bool dl_setsize(dl_file f, __int64 size) {LARGE_INTEGER li; li.QuadPart=size; return SetFilePointerEx(f,li,NULL,FILE_BEGIN) && SetEndOfFile(f);}
+static bool dl_read(dl_file f, void *buf, unsigned int len, unsigned int *red) {DWORD r=0; BOOL ok=ReadFile(f,buf,len,&r,NULL); *red=r; return ok!=FALSE;}
+static bool dl_pwrite(dl_file f, const void *buf, unsigned int len, __int64 off)
+{ OVERLAPPED ov; ZeroMemory(&ov,sizeof(ov));
+  ov.Offset=(DWORD)off; ov.OffsetHigh=(DWORD)(off>>32);
+  DWORD writ; return WriteFile(f,buf,len,&writ,&ov)!=FALSE && writ==len;
+}
+static bool dl_delete(const TCHAR *fn) {return DeleteFile(fn)!=FALSE;}
+static bool dl_rename(const TCHAR *from, const TCHAR *to) {return MoveFileEx(from,to,MOVEFILE_REPLACE_EXISTING)!=FALSE;}
+static bool dl_copy(const TCHAR *from, const TCHAR *to) {return CopyFile(from,to,FALSE)!=FALSE;}
+static void dl_mkdir(const TCHAR *dir) {CreateDirectory(dir,NULL);}
+#else
+typedef int dl_file;
+#define DL_NOFILE -1
+
+static dl_file dl_open(const TCHAR *fn, bool write, bool create)
+{ return open(fn,(write?O_RDWR:O_RDONLY)|(create?O_CREAT|O_TRUNC:0)|O_CLOEXEC,0666);
+}
+static void dl_close(dl_file f) {close(f);}
+static bool dl_size(dl_file f, __int64 *size) {struct stat st; if (fstat(f,&st)!=0) return false; *size=(__int64)st.st_size; return true;}
+static bool dl_setsize(dl_file f, __int64 size) {return ftruncate(f,(off_t)size)==0;}
+static bool dl_read(dl_file f, void *buf, unsigned int len, unsigned int *red)
+{ ssize_t r; do r=read(f,buf,len); while (r<0 && errno==EINTR);
+  *red = r<0 ? 0 : (unsigned int)r; return r>=0;
+}
+static bool dl_pwrite(dl_file f, const void *buf, unsigned int len, __int64 off)
+{ const char *p=(const char*)buf;
+  while (len>0)
+  { ssize_t r=pwrite(f,p,len,(off_t)off);
+    if (r<0 && errno==EINTR) continue;
+    if (r<=0) return false;
+    p+=r; len-=(unsigned int)r; off+=r;
+  }
+  return true;
+}
+static bool dl_delete(const TCHAR *fn) {return unlink(fn)==0;}
+static bool dl_rename(const TCHAR *from, const TCHAR *to) {return rename(from,to)==0;}
+static bool dl_copy(const TCHAR *from, const TCHAR *to)
+{ dl_file in=dl_open(from,false,false); if (in==DL_NOFILE) return false;
+  dl_file out=dl_open(to,true,true); if (out==DL_NOFILE) {dl_close(in); return false;}
+  std::vector<char> buf(1024*1024); unsigned int red; __int64 off=0; bool ok=true;
+  while (ok && (ok=dl_read(in,&buf[0],(unsigned int)buf.size(),&red)) && red>0) {ok=dl_pwrite(out,&buf[0],red,off); off+=red;}
+  dl_close(in); dl_close(out);
+  if (!ok) dl_delete(to);
+  return ok;
+}
+static void dl_mkdir(const TCHAR *dir) {mkdir(dir,0777);}
+#endif
+
+static bool dl_readall(const TCHAR *fn, std::string &s)
+{ dl_file f=dl_open(fn,false,false); if (f==DL_NOFILE) return false;
+  s.clear(); char buf[4096]; unsigned int red; bool ok;
+  while ((ok=dl_read(f,buf,sizeof(buf),&red)) && red>0 && s.size()<1024*1024) s.append(buf,red);
+  dl_close(f); return ok;
+}
+
+// Written aside and renamed over, so that it's the old state or the new
+static bool dl_writeall(const TCHAR *fn, const std::string &s)
+{ dl_path tmp=dl_path(fn)+DL_T(".tmp");
+  dl_file f=dl_open(tmp.c_str(),true,true); if (f==DL_NOFILE) return false;
+  bool ok=dl_pwrite(f,s.data(),(unsigned int)s.size(),0);
+  dl_close(f);
+  if (ok) ok=dl_rename(tmp.c_str(),fn);
+  if (!ok) dl_delete(tmp.c_str());
+  return ok;
+}
+
+static bool dl_hashfile(const TCHAR *fn, unsigned char *hash, __int64 *size)
+{ TraceSpan span("hash download");
+  dl_file f=dl_open(fn,false,false); if (f==DL_NOFILE) return false;
+  dl_sha256 c; dl_sha256_init(&c);
+  std::vector<unsigned char> buf(1024*1024); unsigned int red; bool ok;
+  while ((ok=dl_read(f,&buf[0],(unsigned int)buf.size(),&red)) && red>0) dl_sha256_update(&c,&buf[0],red);
+  dl_close(f);
+  if (!ok) return false;
+  *size=(__int64)c.len; dl_sha256_final(&c,hash);
+  return true;
+}
+
+static void dl_sleep(unsigned int ms) {std::this_thread::sleep_for(std::chrono::milliseconds(ms));}
+
+
+// The transport: a GET of bytes from..to (inclusive, or to the end if to<0)
+// with If-Range, and then its body a block at a time. A response says where
+// its body starts and how long the whole file is (from Content-Range, or
+// for a 200 the whole thing), and what the server calls this version of it.
+
+typedef struct
+{ int status;
+  __int64 start, total;      // of the body within the file, and the file's size (-1 if it isn't known)
+  __int64 left;              // of the body still to read, or -1 if it runs until the connection closes
+  std::string validator;     // the ETag, or else the Last-Modified
+#ifdef _WIN32
+  HINTERNET req;
+#else
+  int fd;
+  std::string pending;       // body that came in with the headers
+#endif
+} dl_response;
+
+static bool dl_parserange(const char *cr, __int64 *start, __int64 *total)
+{ long long s, e, t;
+  if (sscanf(cr,"bytes %lld-%lld/%lld",&s,&e,&t)!=3) return false;
+  *start=s; *total=t; return true;
+}
+
+#ifdef _WIN32
+typedef struct
+{ HTTPSESSION http; HINTERNET connect;
+  std::wstring path; bool secure;
+} dl_server;
+
+static bool dl_connect(dl_server *s, const TCHAR *url)
+{ URL_COMPONENTS uc; ZeroMemory(&uc,sizeof(uc)); uc.dwStructSize=sizeof(uc);
+  wchar_t host[256], path[2048];
+  uc.lpszHostName=host; uc.dwHostNameLength=256;
+  uc.lpszUrlPath=path; uc.dwUrlPathLength=2048;
+  wchar_t extra[2048]; uc.lpszExtraInfo=extra; uc.dwExtraInfoLength=2048;
+  if (!WinHttpCrackUrl(url,0,0,&uc)) return false;
+  if (uc.nScheme!=INTERNET_SCHEME_HTTP && uc.nScheme!=INTERNET_SCHEME_HTTPS) return false;
+  s->secure = uc.nScheme==INTERNET_SCHEME_HTTPS;
+  s->path = std::wstring(path)+extra; // keep the query, fwlinks are all query
+  if (!OpenHttpSession(&s->http,url)) return false;
+  s->connect = WinHttpConnect(s->http.session,host,uc.nPort,0);
+  if (s->connect==NULL) {CloseHttpSession(&s->http); return false;}
+  return true;
+}
+
+static void dl_disconnect(dl_server *s)
+{ if (s->connect!=NULL) WinHttpCloseHandle(s->connect);
+  CloseHttpSession(&s->http);
+}
+
+static bool dl_queryheader(HINTERNET req, DWORD what, std::string &value)
+{ wchar_t w[512]; DWORD len=sizeof(w);
+  if (!WinHttpQueryHeaders(req,what,WINHTTP_HEADER_NAME_BY_INDEX,w,&len,WINHTTP_NO_HEADER_INDEX)) return false;
+  char a[512]; if (WideCharToMultiByte(CP_ACP,0,w,-1,a,sizeof(a),NULL,NULL)==0) return false;
+  value=a; return true;
+}
+
+static bool dl_get(dl_server *s, __int64 from, __int64 to, const std::string &validator, dl_response *r)
+{ r->req = WinHttpOpenRequest(s->connect,L"GET",s->path.c_str(),NULL,WINHTTP_NO_REFERER,WINHTTP_DEFAULT_ACCEPT_TYPES,s->secure?WINHTTP_FLAG_SECURE:0);
+  if (r->req==NULL) return false;
+  PrepareHttpRequest(&s->http,r->req); // the proxy, and the 30s timeouts the socket below has
+  wchar_t headers[1024];
+  if (to<0) swprintf_s(headers,L"Range: bytes=%lld-",from);
+  else swprintf_s(headers,L"Range: bytes=%lld-%lld",from,to);
+  if (!validator.empty()) {wchar_t v[512]; swprintf_s(v,L"\r\nIf-Range: %S",validator.c_str()); wcscat_s(headers,v);}
+  bool ok = WinHttpSendRequest(r->req,headers,(DWORD)-1,WINHTTP_NO_REQUEST_DATA,0,0,0) && WinHttpReceiveResponse(r->req,NULL);
+  DWORD status=0, len=sizeof(status);
+  if (ok) ok = WinHttpQueryHeaders(r->req,WINHTTP_QUERY_STATUS_CODE|WINHTTP_QUERY_FLAG_NUMBER,WINHTTP_HEADER_NAME_BY_INDEX,&status,&len,WINHTTP_NO_HEADER_INDEX)!=FALSE;
+  r->status=(int)status;
+  if (ok) ok = status==200 || status==206;
+  std::string cl, cr;
+  r->left = ok && dl_queryheader(r->req,WINHTTP_QUERY_CONTENT_LENGTH,cl) ? _atoi64(cl.c_str()) : -1;
+  if (ok && status==206) ok = dl_queryheader(r->req,WINHTTP_QUERY_CONTENT_RANGE,cr) && dl_parserange(cr.c_str(),&r->start,&r->total);
+  if (ok && status==200) {r->start=0; r->total=r->left;}
+  if (ok && !dl_queryheader(r->req,WINHTTP_QUERY_ETAG,r->validator) && !dl_queryheader(r->req,WINHTTP_QUERY_LAST_MODIFIED,r->validator)) r->validator.clear();
+  if (!ok) {WinHttpCloseHandle(r->req); r->req=NULL;}
+  return ok;
+}
+
+static int dl_body(dl_response *r, char *buf, unsigned int len)
+{ if (r->left==0) return 0;
+  if (r->left>0 && len>r->left) len=(unsigned int)r->left;
+  DWORD red=0;
+  if (!WinHttpReadData(r->req,buf,len,&red)) return -1;
+  if (r->left>0) {if (red==0) return -1; r->left-=red;} // cut short
+  return (int)red;
+}
+
+static void dl_end(dl_response *r) {if (r->req!=NULL) WinHttpCloseHandle(r->req); r->req=NULL;}
+
+#else
+typedef struct
+{ std::string host, port, path;
+} dl_server;
+
+static bool dl_connect(dl_server *s, const TCHAR *url)
+{ if (strncmp(url,"http://",7)!=0) return false; // no tls here
+  const char *host=url+7, *slash=strchr(host,'/');
+  std::string hostport = slash ? std::string(host,slash-host) : std::string(host);
+  s->path = slash ? slash : "/";
+  size_t colon = hostport.rfind(':');
+  if (colon==std::string::npos) {s->host=hostport; s->port="80";}
+  else {s->host=hostport.substr(0,colon); s->port=hostport.substr(colon+1);}
+  return !s->host.empty();
+}
+
+static void dl_disconnect(dl_server *) {}
+
+static const char *dl_header(const std::string &head, const char *name)
+{ size_t n=strlen(name);
+  for (size_t at=head.find("\r\n"); at!=std::string::npos; at=head.find("\r\n",at+2))
+    if (strncasecmp(head.c_str()+at+2,name,n)==0) return head.c_str()+at+2+n;
+  return 0;
+}
+
+static bool dl_get(dl_server *s, __int64 from, __int64 to, const std::string &validator, dl_response *r)
+{ r->fd=-1; r->pending.clear();
+  struct addrinfo hints, *ai; memset(&hints,0,sizeof(hints));
+  hints.ai_family=AF_UNSPEC; hints.ai_socktype=SOCK_STREAM;
+  if (getaddrinfo(s->host.c_str(),s->port.c_str(),&hints,&ai)!=0) return false;
+  int fd=-1;
+  for (struct addrinfo *a=ai; a!=0 && fd<0; a=a->ai_next)
+  { fd=socket(a->ai_family,a->ai_socktype|SOCK_CLOEXEC,a->ai_protocol);
+    if (fd>=0 && connect(fd,a->ai_addr,a->ai_addrlen)!=0) {close(fd); fd=-1;}
+  }
+  freeaddrinfo(ai);
+  if (fd<0) return false;
+  struct timeval tv={30,0}; setsockopt(fd,SOL_SOCKET,SO_RCVTIMEO,&tv,sizeof(tv)); // a server that stalls is a failure
+  char range[96];
+  if (to<0) snprintf(range,sizeof(range),"Range: bytes=%lld-\r\n",(long long)from);
+  else snprintf(range,sizeof(range),"Range: bytes=%lld-%lld\r\n",(long long)from,(long long)to);
+  std::string req="GET "+s->path+" HTTP/1.1\r\nHost: "+s->host+"\r\nUser-Agent: Squirrel\r\n"+range;
+  if (!validator.empty()) req+="If-Range: "+validator+"\r\n";
+  req+="Connection: close\r\n\r\n";
+  bool ok = send(fd,req.data(),req.size(),MSG_NOSIGNAL)==(ssize_t)req.size();
+  std::string head; char buf[4096]; ssize_t n; size_t eoh=std::string::npos;
+  while (ok && eoh==std::string::npos && (n=recv(fd,buf,sizeof(buf),0))>0) {head.append(buf,n); eoh=head.find("\r\n\r\n");}
+  int status=0;
+  ok = ok && eoh!=std::string::npos && sscanf(head.c_str(),"HTTP/%*s %d",&status)==1 && (status==200 || status==206);
+  r->status=status;
+  if (ok)
+  { r->pending=head.substr(eoh+4); head.resize(eoh+2);
+    const char *te=dl_header(head,"Transfer-Encoding:"), *cl=dl_header(head,"Content-Length:"), *cr=dl_header(head,"Content-Range:");
+    const char *v=dl_header(head,"ETag:"); if (v==0) v=dl_header(head,"Last-Modified:");
+    if (te!=0) ok=false; // a file we're fetching in ranges shouldn't come chunked
+    r->left = cl!=0 ? atoll(cl) : -1;
+    if (status==206) ok = ok && cr!=0 && dl_parserange(cr+strspn(cr," "),&r->start,&r->total);
+    else {r->start=0; r->total=r->left;}
+    r->validator.clear();
+    if (v!=0) {v+=strspn(v," "); r->validator.assign(v,strcspn(v,"\r"));}
+  }
+  if (!ok) {close(fd); return false;}
+  r->fd=fd;
+  return true;
+}
+
+static int dl_body(dl_response *r, char *buf, unsigned int len)
+{ if (r->left==0) return 0;
+  if (r->left>0 && len>r->left) len=(unsigned int)r->left;
+  int red;
+  if (!r->pending.empty())
+  { red=(int)std::min((size_t)len,r->pending.size());
+    memcpy(buf,r->pending.data(),red); r->pending.erase(0,red);
+  }
+  else
+  { ssize_t n; do n=recv(r->fd,buf,len,0); while (n<0 && errno==EINTR);
+    if (n<0) return -1;
+    red=(int)n;
+  }
+  if (r->left>0) {if (red==0) return -1; r->left-=red;} // cut short
+  return red;
+}
+
+static void dl_end(dl_response *r) {if (r->fd>=0) close(r->fd); r->fd=-1;}
+#endif
+
+
+// A download in progress. Each segment is fetched by one worker at a time,
+// from where it had got to, and the state's the size of each segment's part
+// that's in the temp file.
+
+typedef struct
+{ std::mutex m;              // guards all of it but f, which is only written through
+  dl_server *server;
+  dl_file f;
+  __int64 size, segsize;
+  std::string validator;
+  std::vector<__int64> done; // how much of each segment is in the file
+  std::vector<bool> busy;    // whether a worker has it
+  __int64 total;             // the sum of done
+  __int64 unsaved;           // bytes since the state was last saved
+  unsigned int retries;
+  int err;                   // the first thing to go wrong; the workers stop when it's set
+  dl_path statefn;
+  const DOWNLOADOPTIONS *opts;
+  DOWNLOADSTATS *stats;
+} dl_job;
+
+__int64 dl_seglen(const dl_job *job, size_t i) {return std::min(job->segsize,job->size-(__int64)i*job->segsize);}
+
+// State file: a line each, "SquirrelDownload 1", the size, the segment size,
+// how much of each segment is done, and (last, since it can have spaces in)
+// the validator
+static bool dl_savestate(dl_job *job)
+{ char line[64]; std::string s="SquirrelDownload 1\n";
+  snprintf(line,sizeof(line),"%lld\n%lld\n",(long long)job->size,(long long)job->segsize); s+=line;
+  for (size_t i=0; i<job->done.size(); i++) {snprintf(line,sizeof(line),i==0?"%lld":" %lld",(long long)job->done[i]); s+=line;}
+  s+="\n"+job->validator+"\n";
+  job->unsaved=0;
+  return dl_writeall(job->statefn.c_str(),s);
+}
+
+static bool dl_loadstate(dl_job *job)
+{ std::string s; if (!dl_readall(job->statefn.c_str(),s)) return false;
+  const char *p=s.c_str(); char *e;
+  if (strncmp(p,"SquirrelDownload 1\n",19)!=0) return false;
+  p+=19;
+  job->size=strtoll(p,&e,10); if (*e!='\n') return false; p=e+1;
+  job->segsize=strtoll(p,&e,10); if (*e!='\n' || job->segsize<=0 || job->size<=0) return false; p=e+1;
+  size_t nsegs=(size_t)((job->size+job->segsize-1)/job->segsize);
+  job->done.assign(nsegs,0); job->total=0;
+  for (size_t i=0; i<nsegs; i++)
+  { job->done[i]=strtoll(p,&e,10); if (e==p || job->done[i]<0 || job->done[i]>dl_seglen(job,i)) return false;
+    job->total+=job->done[i]; p=e;
+  }
+  if (*p!='\n') return false;
+  const char *nl=strchr(p+1,'\n'); if (nl==0) return false;
+  job->validator.assign(p+1,nl);
+  return true;
+}
+
+// Counts n more bytes of segment i, saving the state now and then, and asks
+// the callback whether to carry on
+static bool dl_progress(dl_job *job, size_t i, __int64 done, unsigned int n)
+{ std::lock_guard<std::mutex> lock(job->m);
+  job->done[i]=done; job->total+=n; job->unsaved+=n; job->stats->fetched+=n;
+  TraceCount("downloaded bytes",n);
+  if (job->unsaved>=DL_SAVE) dl_savestate(job);
+  if (job->opts->progress!=0 && !job->opts->progress(job->opts->param,job->total,job->size))
+  { if (job->err==DL_OK) job->err=DL_CANCELLED;
+    return false;
+  }
+  return true;
+}
+
+// Fetches the rest of segment i, going again from where it stopped when a
+// request fails, up to job->retries times in a row
+static int dl_segment(dl_job *job, size_t i, char *buf)
+{ __int64 start=(__int64)i*job->segsize, len=dl_seglen(job,i);
+  unsigned int tries=0;
+  for (;;)
+  { __int64 done;
+    { std::lock_guard<std::mutex> lock(job->m);
+      if (job->err!=DL_OK) return DL_OK;
+      done=job->done[i];
+      job->stats->requests++;
+      if (tries>0) job->stats->retries++;
+    }
+    if (done>=len) return DL_OK;
+    if (tries>0) TraceCount("download retries",1);
+    __int64 before=done;
+    dl_response r;
+    if (dl_get(job->server,start+done,start+len-1,job->validator,&r))
+    { if (r.status==200 && job->done.size()==1 && r.total==job->size) // no ranges, so it's the whole file again
+      { std::lock_guard<std::mutex> lock(job->m);
+        job->total-=done; job->done[i]=0; done=before=0;
+      }
+      else if (r.status!=206 || r.start!=start+done || r.total!=job->size) {dl_end(&r); return DL_RESTART;}
+      for (;;)
+      { unsigned int want=(unsigned int)std::min((__int64)DL_BLOCK,len-done);
+        int n = want>0 ? dl_body(&r,buf,want) : 0;
+        if (n<=0) break;
+        if (!dl_pwrite(job->f,buf,n,start+done)) {dl_end(&r); return DL_IO;}
+        done+=n;
+        if (!dl_progress(job,i,done,n)) {dl_end(&r); return DL_CANCELLED;}
+      }
+      dl_end(&r);
+      if (done>=len) return DL_OK;
+    }
+    // it was cut short, or never started; a request that got somewhere doesn't count against the retries
+    if (done>before) tries=0;
+    if (++tries>job->retries) return DL_NET;
+    dl_sleep(std::min(DL_BACKOFF<<std::min(tries-1,5u),DL_MAXBACKOFF));
+  }
+}
+
+static void dl_worker(dl_job *job, bool named)
+{ if (named) TraceThreadName("download worker");
+  std::vector<char> buf(DL_BLOCK);
+  for (;;)
+  { size_t i;
+    { std::lock_guard<std::mutex> lock(job->m);
+      if (job->err!=DL_OK) return;
+      for (i=0; i<job->done.size(); i++) if (!job->busy[i] && job->done[i]<dl_seglen(job,i)) break;
+      if (i==job->done.size()) return;
+      job->busy[i]=true;
+    }
+    int err;
+    { TraceSpan span("download segment");
+      err=dl_segment(job,i,&buf[0]);
+    }
+    std::lock_guard<std::mutex> lock(job->m);
+    job->busy[i]=false;
+    if (err!=DL_OK && job->err==DL_OK) job->err=err;
+  }
+}
+
+// Carries on with the download in part, as its state says, or starts it,
+// and says what the server calls the version it got
+static int dl_fetch(dl_server *server, const dl_path &part, const dl_path &state, const DOWNLOADOPTIONS *opts, DOWNLOADSTATS *stats, std::string &validator)
+{ dl_job job; job.server=server; job.f=DL_NOFILE; job.unsaved=0; job.retries=opts->retries; job.err=DL_OK;
+  job.statefn=state; job.opts=opts; job.stats=stats;
+  __int64 have;
+  if (dl_loadstate(&job) && (job.f=dl_open(part.c_str(),true,false))!=DL_NOFILE && dl_size(job.f,&have) && have==job.size) stats->resumed=job.total;
+  else
+  { if (job.f!=DL_NOFILE) dl_close(job.f);
+    // how big is it, and will it come in ranges?
+    dl_response r; bool ok=false;
+    for (unsigned int tries=0; !ok && tries<=job.retries; tries++)
+    { if (tries>0) {stats->retries++; dl_sleep(std::min(DL_BACKOFF<<std::min(tries-1,5u),DL_MAXBACKOFF));}
+      stats->requests++;
+      ok=dl_get(server,0,0,"",&r);
+    }
+    if (!ok) return DL_NET;
+    dl_end(&r);
+    if (r.total<=0) return DL_NET; // nothing, or no idea how much
+    job.size=r.total; job.validator=r.validator;
+    unsigned int conns = opts->connections;
+    job.segsize = r.status==206 ? std::max((__int64)DL_MINSEG,(job.size/(conns*DL_SEGS)+DL_BLOCK-1)/DL_BLOCK*DL_BLOCK) : job.size;
+    job.done.assign((size_t)((job.size+job.segsize-1)/job.segsize),0); job.total=0;
+    job.f=dl_open(part.c_str(),true,true);
+    if (job.f==DL_NOFILE) return DL_IO;
+    if (!dl_setsize(job.f,job.size) || !dl_savestate(&job)) {dl_close(job.f); return DL_IO;}
+  }
+  stats->size=job.size;
+  job.busy.assign(job.done.size(),false);
+  size_t left=0; for (size_t i=0; i<job.done.size(); i++) if (job.done[i]<dl_seglen(&job,i)) left++;
+  size_t threads=std::min((size_t)opts->connections,left);
+  std::vector<std::thread> others;
+  for (size_t t=1; t<threads; t++) others.push_back(std::thread(dl_worker,&job,true));
+  dl_worker(&job,false);
+  for (size_t t=0; t<others.size(); t++) others[t].join();
+  dl_close(job.f);
+  dl_savestate(&job);
+  validator=job.validator;
+  return job.err;
+}
+
+static void dl_paths(const TCHAR *url, const TCHAR *fn, const DOWNLOADOPTIONS *opts, dl_path &part, dl_path &state, dl_path &index)
+{ if (opts==0 || opts->cachedir==0)
+  { part=dl_path(fn)+DL_T(".part"); state=dl_path(fn)+DL_T(".dlstate"); index.clear();
+    return;
+  }
+  dl_sha256 c; unsigned char h[32]; dl_sha256_init(&c);
+  dl_path u(url); dl_sha256_update(&c,(const unsigned char*)u.c_str(),u.size()*sizeof(TCHAR)); dl_sha256_final(&c,h);
+  dl_path key=dl_path(opts->cachedir)+DL_SLASH+dl_widen(dl_hex(h,16));
+  part=key+DL_T(".part"); state=key+DL_T(".state"); index=key+DL_T(".url");
+}
+
+
+// The .url index: the hash of the file that came from url, and the server's
+// validator for it, a line each
+static bool dl_readindex(const TCHAR *fn, std::string &hex, std::string &validator)
+{ std::string s; if (!dl_readall(fn,s)) return false;
+  size_t eol=s.find('\n');
+  hex=s.substr(0,strspn(s.c_str(),"0123456789abcdef"));
+  validator = eol==std::string::npos ? std::string() : s.substr(eol+1,s.find('\n',eol+1)-eol-1);
+  return true;
+}
+
+// Whether the file the server has is still the one with this validator and
+// size. A one-byte range with If-Range gets a 206 only if it is, and else the
+// whole file, which is dropped. If the server can't be reached at all, the
+// cached file's taken, as nothing better could be got
+static bool dl_revalidate(dl_server *server, const std::string &validator, __int64 size, DOWNLOADSTATS *stats)
+{ dl_response r; r.status=0;
+  stats->requests++;
+  if (!dl_get(server,0,0,validator,&r)) return r.status==0;
+  dl_end(&r);
+  return r.status==206 && r.validator==validator && r.total==size;
+}
+
+
+int DownloadFile(const TCHAR *url, const TCHAR *fn, const DOWNLOADOPTIONS *opts, DOWNLOADSTATS *stats)
+{ DOWNLOADOPTIONS o; if (opts!=0) o=*opts; else memset(&o,0,sizeof(o));
+  if (o.connections==0) o.connections=4;
+  if (o.retries==0) o.retries=5;
+  DOWNLOADSTATS st; memset(&st,0,sizeof(st));
+  if (stats!=0) *stats=st;
+  if (url==0 || fn==0 || *fn==0) return DL_ARGS;
+  TraceSpan span("DownloadFile");
+  dl_path part, state, index; dl_paths(url,fn,&o,part,state,index);
+
+  // straight from the cache: the file with the hash we want, or the one we got
+  // from url last time, if the server says it's still the same
+  dl_server server; bool connected=false;
+  if (o.cachedir!=0)
+  { dl_mkdir(o.cachedir);
+    std::string want, validator;
+    if (o.sha256!=0) want=dl_hex(o.sha256,32);
+    else if (dl_readindex(index.c_str(),want,validator) && validator.empty()) want.clear(); // nothing to ask the server with
+    if (want.size()==64)
+    { dl_path blob=dl_path(o.cachedir)+DL_SLASH+dl_widen(want);
+      unsigned char h[32]; __int64 size;
+      if (dl_hashfile(blob.c_str(),h,&size))
+      { bool fresh=dl_hex(h,32)==want;
+        if (fresh && o.sha256==0)
+        { if (!dl_connect(&server,url)) return DL_ARGS;
+          connected=true;
+          fresh=dl_revalidate(&server,validator,size,&st);
+        }
+        if (fresh && dl_copy(blob.c_str(),fn))
+        { if (connected) dl_disconnect(&server);
+          st.cached=true; st.size=size; memcpy(st.sha256,h,32);
+          if (stats!=0) *stats=st;
+          return DL_OK;
+        }
+        dl_delete(blob.c_str()); // it's been damaged, or the server has a newer one
+      }
+    }
+  }
+
+  if (!connected && !dl_connect(&server,url)) return DL_ARGS;
+  std::string validator;
+  int err=dl_fetch(&server,part,state,&o,&st,validator);
+  // the file's changed on the server since the state was saved, so start again
+  if (err==DL_RESTART) {dl_delete(state.c_str()); err=dl_fetch(&server,part,state,&o,&st,validator);}
+  if (err==DL_RESTART) err=DL_NET;
+  dl_disconnect(&server);
+  if (stats!=0) *stats=st;
+  if (err!=DL_OK) return err;
+
+  unsigned char h[32]; __int64 size;
+  if (!dl_hashfile(part.c_str(),h,&size) || size!=st.size) return DL_IO;
+  memcpy(st.sha256,h,32);
+  if (stats!=0) *stats=st;
+  dl_delete(state.c_str());
+  if (o.sha256!=0 && memcmp(h,o.sha256,32)!=0) {dl_delete(part.c_str()); return DL_HASH;}
+  if (o.cachedir==0) return dl_rename(part.c_str(),fn) ? DL_OK : DL_IO;
+  std::string hex=dl_hex(h,32);
+  dl_path blob=dl_path(o.cachedir)+DL_SLASH+dl_widen(hex);
+  if (!dl_rename(part.c_str(),blob.c_str())) return DL_IO;
+  dl_writeall(index.c_str(),hex+"\n"+validator+"\n");
+  return dl_copy(blob.c_str(),fn) ? DL_OK : DL_IO;
+}
+
+void DownloadEvict(const TCHAR *url, const TCHAR *fn, const DOWNLOADOPTIONS *opts)
+{ if (url==0 || fn==0) return;
+  dl_path part, state, index; dl_paths(url,fn,opts,part,state,index);
+  dl_delete(part.c_str()); dl_delete(state.c_str());
+  if (index.empty()) return;
+  std::string want, validator;
+  if (opts->sha256!=0) want=dl_hex(opts->sha256,32);
+  else dl_readindex(index.c_str(),want,validator);
+  if (want.size()==64) dl_delete((dl_path(opts->cachedir)+DL_SLASH+dl_widen(want)).c_str());
+  dl_delete(index.c_str());
+}
@@ -0,0 +1,65 @@
+#ifndef _download_H
+#define _download_H
+
+// Downloads a big file, such as the .NET Framework installer, over http(s)
+// with several range requests at once. The file is split into segments,
+// which up to DOWNLOADOPTIONS.connections requests fetch into a temp file
+// that's allocated at full size first. How far each segment has got is kept
+// in a state file beside it, so a download that fails, is cancelled or is
+// cut short by a reboot carries on from there the next time. The server's
+// ETag (or Last-Modified) goes back with each request as If-Range, so parts
+// of two different versions of the file never get mixed. A request that
+// fails is made again, for the rest of its segment, a few times with a
+// backoff.
+// The finished file's SHA-256 is checked if DOWNLOADOPTIONS.sha256 says what
+// it should be, and with a cachedir it's kept there by that hash, so getting
+// the same file again by hash is just a copy. Getting it again by url (with no
+// sha256) first asks the server, with If-Range and the validator it sent last
+// time, whether it's still the same file, and fetches it again if not. e.g.
+//   DOWNLOADOPTIONS opts; memset(&opts,0,sizeof(opts));
+//   opts.cachedir=_T("C:\\Users\\me\\AppData\\Local\\SquirrelTemp\\Downloads");
+//   int r=DownloadFile(_T("https://go.microsoft.com/fwlink/?LinkId=2085155"),_T("C:\\Temp\\ndp48.exe"),&opts,0);
+// Like unzipurl.cpp it uses WinHTTP on Windows, through httpsession.cpp so the
+// user's proxy is used, and elsewhere plain http over a socket, which is enough
+// for the bench to test it against a loopback server that drops connections.
+// Either way a request that goes 30s without a byte fails, and is retried.
+
+#include "unzip.h"
+
+#define DL_OK        0
+#define DL_ARGS      1   // a bad url or file name
+#define DL_NET       2   // the server couldn't be reached or wouldn't send it, even after the retries
+#define DL_IO        3   // the file, the temp file or the cache couldn't be written
+#define DL_HASH      4   // it downloaded, but it isn't the file sha256 says
+#define DL_CANCELLED 5   // the progress callback said stop; it'll resume next time
+
+typedef struct
+{ unsigned int connections;  // range requests at once; 0 for 4
+  unsigned int retries;      // times a segment's request is made again after failing; 0 for 5
+  const unsigned char *sha256; // 32 bytes the file must hash to, or 0 to take what comes
+  const TCHAR *cachedir;     // for finished files and unfinished ones' state; 0 to keep the state beside fn
+  bool (*progress)(void *param, __int64 done, __int64 size); // called as it goes; false stops it
+  void *param;
+} DOWNLOADOPTIONS;
+
+typedef struct
+{ __int64 size;              // of the file
+  __int64 fetched;           // bytes that came from the server this time
+  __int64 resumed;           // bytes an earlier attempt had already fetched
+  unsigned int requests;     // made this time, including the retries
+  unsigned int retries;
+  bool cached;               // it was copied from cachedir, and nothing was fetched
+  unsigned char sha256[32];  // of the file
+} DOWNLOADSTATS;
+
+int DownloadFile(const TCHAR *url, const TCHAR *fn, const DOWNLOADOPTIONS *opts, DOWNLOADSTATS *stats);
+// DownloadFile - fetches url into fn, replacing it, or copies it there from the
+// cache. opts and stats may be 0. Returns DL_OK or one of the errors above;
+// after DL_NET or DL_CANCELLED, calling it again with the same url and fn (or
+// cachedir) picks up where it stopped. A DL_HASH download is thrown away.
+
+void DownloadEvict(const TCHAR *url, const TCHAR *fn, const DOWNLOADOPTIONS *opts);
+// DownloadEvict - forgets url's download, finished or not, along with the
+// cached file, once it won't be wanted again.
+
+#endif // _download_H
@@ -0,0 +1,75 @@
+#ifdef _WIN32
+#include "stdafx.h"
+#include "httpsession.h"
+
+#ifndef WINHTTP_ACCESS_TYPE_AUTOMATIC_PROXY
+#define WINHTTP_ACCESS_TYPE_AUTOMATIC_PROXY 4 // Windows 8.1's SDK
+#endif
+
+#define HS_TIMEOUT 30000 // ms; a server that stalls for this long is a failure
+
+
+void hs_take(std::wstring &dst, LPWSTR src)
+{ if (src!=NULL) {dst=src; GlobalFree(src);}
+}
+
+// What Internet Options says for url: a PAC script, found by WPAD or named,
+// then a fixed proxy, and then the netsh one, if it's none of those
+void hs_resolve(HTTPSESSION *hs, const wchar_t *url)
+{ WINHTTP_CURRENT_USER_IE_PROXY_CONFIG ie; ZeroMemory(&ie,sizeof(ie));
+  std::wstring autourl, ieproxy, iebypass;
+  if (WinHttpGetIEProxyConfigForCurrentUser(&ie))
+  { hs_take(autourl,ie.lpszAutoConfigUrl); hs_take(ieproxy,ie.lpszProxy); hs_take(iebypass,ie.lpszProxyBypass);
+  }
+  else ie.fAutoDetect=TRUE; // no Internet Options (a service, say), so WPAD's the best guess
+  //
+  if (ie.fAutoDetect || !autourl.empty())
+  { WINHTTP_AUTOPROXY_OPTIONS ap; ZeroMemory(&ap,sizeof(ap));
+    ap.dwFlags = !autourl.empty() ? WINHTTP_AUTOPROXY_CONFIG_URL : 0;
+    if (ie.fAutoDetect) {ap.dwFlags|=WINHTTP_AUTOPROXY_AUTO_DETECT; ap.dwAutoDetectFlags=WINHTTP_AUTO_DETECT_TYPE_DHCP|WINHTTP_AUTO_DETECT_TYPE_DNS_A;}
+    ap.lpszAutoConfigUrl = !autourl.empty() ? autourl.c_str() : NULL;
+    ap.fAutoLogonIfChallenged = TRUE;
+    WINHTTP_PROXY_INFO pi; ZeroMemory(&pi,sizeof(pi));
+    if (WinHttpGetProxyForUrl(hs->session,url,&ap,&pi))
+    { hs->access = pi.dwAccessType==WINHTTP_ACCESS_TYPE_NAMED_PROXY ? WINHTTP_ACCESS_TYPE_NAMED_PROXY : WINHTTP_ACCESS_TYPE_NO_PROXY;
+      hs_take(hs->proxy,pi.lpszProxy); hs_take(hs->bypass,pi.lpszProxyBypass);
+      return;
+    }
+  }
+  if (!ieproxy.empty()) {hs->access=WINHTTP_ACCESS_TYPE_NAMED_PROXY; hs->proxy=ieproxy; hs->bypass=iebypass; return;}
+  //
+  WINHTTP_PROXY_INFO pi; ZeroMemory(&pi,sizeof(pi));
+  if (WinHttpGetDefaultProxyConfiguration(&pi))
+  { hs->access = pi.dwAccessType==WINHTTP_ACCESS_TYPE_NAMED_PROXY ? WINHTTP_ACCESS_TYPE_NAMED_PROXY : WINHTTP_ACCESS_TYPE_NO_PROXY;
+    hs_take(hs->proxy,pi.lpszProxy); hs_take(hs->bypass,pi.lpszProxyBypass);
+  }
+}
+
+bool OpenHttpSession(HTTPSESSION *hs, const wchar_t *url)
+{ hs->perrequest=false; hs->access=WINHTTP_ACCESS_TYPE_NO_PROXY; hs->proxy.clear(); hs->bypass.clear();
+  hs->session = WinHttpOpen(L"Squirrel",WINHTTP_ACCESS_TYPE_AUTOMATIC_PROXY,WINHTTP_NO_PROXY_NAME,WINHTTP_NO_PROXY_BYPASS,0);
+  if (hs->session!=NULL) return true;
+  // before 8.1, so it's up to us
+  hs->session = WinHttpOpen(L"Squirrel",WINHTTP_ACCESS_TYPE_NO_PROXY,WINHTTP_NO_PROXY_NAME,WINHTTP_NO_PROXY_BYPASS,0);
+  if (hs->session==NULL) return false;
+  hs->perrequest=true;
+  hs_resolve(hs,url);
+  return true;
+}
+
+void PrepareHttpRequest(const HTTPSESSION *hs, HINTERNET req)
+{ // WinHTTP's own give connecting a minute, and resolving the name forever
+  WinHttpSetTimeouts(req,HS_TIMEOUT,HS_TIMEOUT,HS_TIMEOUT,HS_TIMEOUT);
+  if (!hs->perrequest || hs->access!=WINHTTP_ACCESS_TYPE_NAMED_PROXY) return;
+  WINHTTP_PROXY_INFO pi; pi.dwAccessType=WINHTTP_ACCESS_TYPE_NAMED_PROXY;
+  pi.lpszProxy=(LPWSTR)hs->proxy.c_str();
+  pi.lpszProxyBypass=hs->bypass.empty() ? NULL : (LPWSTR)hs->bypass.c_str();
+  WinHttpSetOption(req,WINHTTP_OPTION_PROXY,&pi,sizeof(pi));
+}
+
+void CloseHttpSession(HTTPSESSION *hs)
+{ if (hs->session!=NULL) WinHttpCloseHandle(hs->session);
+  hs->session=NULL;
+}
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef _httpsession_H
+#define _httpsession_H
+
+// A WinHTTP session that goes through the same proxy as the user's browser,
+// for unzipurl.cpp and download.cpp. WINHTTP_ACCESS_TYPE_DEFAULT_PROXY only
+// knows the machine's netsh setting, so behind a proxy that's set in Internet
+// Options, by WPAD or by a PAC script (URLDownloadToFile's, and most
+// corporate networks'), nothing gets through. On Windows 8.1 and later
+// WINHTTP_ACCESS_TYPE_AUTOMATIC_PROXY does it all; before that the session
+// resolves the url's proxy itself, once, from WinHttpGetIEProxyConfigForCurrentUser
+// and WinHttpGetProxyForUrl, and PrepareHttpRequest sets it on each request. e.g.
+//   HTTPSESSION hs; if (!OpenHttpSession(&hs,url)) ...
+//   HINTERNET c=WinHttpConnect(hs.session,host,port,0);
+//   HINTERNET r=WinHttpOpenRequest(c,...); PrepareHttpRequest(&hs,r);
+//   WinHttpSendRequest(r,...);
+//   CloseHttpSession(&hs);
+// Windows only; elsewhere the callers speak plain http over a socket.
+
+#ifdef _WIN32
+#include <winhttp.h>
+#include <string>
+
+typedef struct
+{ HINTERNET session;
+  bool perrequest;           // the proxy's set on each request, from these
+  DWORD access;              // WINHTTP_ACCESS_TYPE_NAMED_PROXY or _NO_PROXY
+  std::wstring proxy, bypass;
+} HTTPSESSION;
+
+bool OpenHttpSession(HTTPSESSION *hs, const wchar_t *url);
+// OpenHttpSession - opens hs->session, for requests to url (and others on its
+// server). False if WinHTTP can't be had at all.
+
+void PrepareHttpRequest(const HTTPSESSION *hs, HINTERNET req);
+// PrepareHttpRequest - sets the timeouts (30s each, as the POSIX callers' sockets
+// have) and the proxy on req, a request from WinHttpOpenRequest on hs's session,
+// before it's sent. The proxy's left alone if the session does that itself.
+
+void CloseHttpSession(HTTPSESSION *hs);
+#endif
+
+#endif // _httpsession_H
@@ -0,0 +1,148 @@
+#ifdef _WIN32
+#include "stdafx.h"
+#else
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#endif
+#include "unzip.h"
+#include "trace.h"
+#include <map>
+#include <mutex>
+#include <string>
+#include <chrono>
+
+
+#define TRACE_BLOCK (64*1024)    // events are written out once there's this much of them
+
+std::atomic<bool> trace_on(false);
+
+typedef struct
+{ std::mutex m;              // guards all of it
+  std::chrono::steady_clock::time_point start;
+  std::string pending;       // events not yet written, starting with the [ until the first write
+  unsigned int events;       // how many there have been, for the commas between them
+  FILE *f;
+  std::map<std::string,__int64> counters;
+} trace_state;
+
+trace_state trace;
+
+
+#ifdef _WIN32
+unsigned long trace_pid() {return GetCurrentProcessId();}
+unsigned long trace_tid() {return GetCurrentThreadId();}
+FILE *trace_fopen(const TCHAR *fn) {FILE *f=0; if (_wfopen_s(&f,fn,L"wb")!=0) return 0; return f;}
+#else
+unsigned long trace_pid() {return (unsigned long)getpid();}
+#ifdef __linux__
+unsigned long trace_tid() {return (unsigned long)syscall(SYS_gettid);}
+#else
+unsigned long trace_tid() {return (unsigned long)(uintptr_t)pthread_self();}
+#endif
+FILE *trace_fopen(const TCHAR *fn) {return fopen(fn,"wb");}
+#endif
+
+// Appends s to d as the inside of a json string
+void trace_escape(std::string &d, const TCHAR *s)
+{
+#ifdef _WIN32
+  int n=WideCharToMultiByte(CP_UTF8,0,s,-1,NULL,0,NULL,NULL); if (n<=1) return;
+  std::string u(n,'\0'); WideCharToMultiByte(CP_UTF8,0,s,-1,&u[0],n,NULL,NULL);
+  const char *c=u.c_str();
+#else
+  const char *c=s;
+#endif
+  for (; *c!=0; c++)
+  { unsigned char ch=(unsigned char)*c;
+    if (ch=='"' || ch=='\\') {d+='\\'; d+=(char)ch;}
+    else if (ch<0x20) {char hex[8]; snprintf(hex,sizeof(hex),"\\u%04x",ch); d+=hex;}
+    else d+=(char)ch;
+  }
+}
+
+// Takes one event, which is already formatted, and writes out a block if
+// there's enough. The caller holds trace.m.
+void trace_add(const std::string &ev)
+{ if (trace.events++!=0) trace.pending+=",\n";
+  trace.pending+=ev;
+  if (trace.f!=0 && trace.pending.size()>=TRACE_BLOCK)
+  { fwrite(trace.pending.data(),1,trace.pending.size(),trace.f);
+    trace.pending.clear();
+  }
+}
+
+
+bool TraceStart(const char *process)
+{ std::lock_guard<std::mutex> lock(trace.m);
+  if (Tracing()) return false;
+  trace.start=std::chrono::steady_clock::now();
+  trace.pending="[\n"; trace.events=0; trace.f=0;
+  trace.counters.clear();
+  char ev[256]; snprintf(ev,sizeof(ev),"{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%lu,\"args\":{\"name\":\"%s\"}}",trace_pid(),process);
+  trace_add(ev);
+  trace_on.store(true,std::memory_order_relaxed);
+  return true;
+}
+
+bool TraceFile(const TCHAR *fn)
+{ std::lock_guard<std::mutex> lock(trace.m);
+  if (!Tracing()) return false;
+  if (trace.f!=0) return true;
+  FILE *f=trace_fopen(fn); if (f==0) return false;
+  trace.f=f;
+  if (fwrite(trace.pending.data(),1,trace.pending.size(),f)!=trace.pending.size()) {fclose(f); trace.f=0; return false;}
+  trace.pending.clear();
+  return true;
+}
+
+void TraceStop()
+{ std::lock_guard<std::mutex> lock(trace.m);
+  if (!Tracing()) return;
+  trace_on.store(false,std::memory_order_relaxed);
+  if (trace.f!=0)
+  { trace.pending+="\n]\n";
+    fwrite(trace.pending.data(),1,trace.pending.size(),trace.f);
+    fclose(trace.f); trace.f=0;
+  }
+  trace.pending.clear(); trace.pending.shrink_to_fit();
+  trace.counters.clear();
+}
+
+__int64 TraceNow()
+{ if (!Tracing()) return 0;
+  return (__int64)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now()-trace.start).count();
+}
+
+void TraceSpanEnd(const char *name, __int64 start, const TCHAR *detail)
+{ if (!Tracing()) return;
+  __int64 now=TraceNow();
+  char buf[256]; snprintf(buf,sizeof(buf),"{\"name\":\"%s\",\"cat\":\"setup\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,\"pid\":%lu,\"tid\":%lu",
+    name,(long long)start,(long long)(now-start),trace_pid(),trace_tid());
+  std::string ev(buf);
+  if (detail!=0) {ev+=",\"args\":{\"detail\":\""; trace_escape(ev,detail); ev+="\"}";}
+  ev+='}';
+  std::lock_guard<std::mutex> lock(trace.m);
+  if (Tracing()) trace_add(ev);
+}
+
+void TraceCount(const char *name, __int64 delta)
+{ if (!Tracing()) return;
+  std::lock_guard<std::mutex> lock(trace.m);
+  if (!Tracing()) return;
+  __int64 value = trace.counters[name] += delta;
+  char ev[256]; snprintf(ev,sizeof(ev),"{\"name\":\"%s\",\"ph\":\"C\",\"ts\":%lld,\"pid\":%lu,\"tid\":%lu,\"args\":{\"value\":%lld}}",
+    name,(long long)TraceNow(),trace_pid(),trace_tid(),(long long)value);
+  trace_add(ev);
+}
+
+void TraceThreadName(const char *name)
+{ if (!Tracing()) return;
+  char ev[256]; snprintf(ev,sizeof(ev),"{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%lu,\"tid\":%lu,\"args\":{\"name\":\"%s\"}}",trace_pid(),trace_tid(),name);
+  std::lock_guard<std::mutex> lock(trace.m);
+  if (Tracing()) trace_add(ev);
+}
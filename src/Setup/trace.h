@@ -0,0 +1,71 @@
+#ifndef _trace_H
+#define _trace_H
+
+// Timeline tracing, written as Chrome trace events, so that a slow install
+// can be loaded into chrome://tracing (or ui.perfetto.dev) to see which phase
+// took the time, on which thread, and how the counts of bytes and files grew
+// meanwhile. e.g.
+//   TraceStart("Setup");
+//   { TraceSpan span("extract"); ... TraceCount("files",1); ... }
+//   TraceFile(_T("C:\\...\\SquirrelSetup.trace.json"));
+//   TraceStop();
+// It's off until TraceStart, and while it's off a span or counter costs one
+// test of a flag. While it's on, events are kept in memory until TraceFile
+// says where they go, and from then on they're written out in 64k blocks, so
+// a trace of an install that crashes is only missing its last few events
+// (and its closing ], which the viewers don't need).
+// Like the unzip engine it builds on Windows and elsewhere, where TCHAR is
+// a UTF-8 char, so the engine's spans show up in the Linux bench too.
+
+#include "unzip.h"
+#include <atomic>
+
+// Read without the lock by every span and counter, on every thread, so it's
+// atomic; relaxed is enough, since TraceStart comes before the threads that
+// trace and the events themselves go through the lock.
+extern std::atomic<bool> trace_on;
+inline bool Tracing() {return trace_on.load(std::memory_order_relaxed);}
+
+bool TraceStart(const char *process);
+// TraceStart - turns tracing on, with the timeline starting from now and this
+// process named process in it. Call it before any threads that trace start.
+
+bool TraceFile(const TCHAR *fn);
+// TraceFile - creates fn and writes out the events so far, and the rest as
+// they come. Returns false if fn can't be created, and they're kept in memory.
+// Once there's a file, later calls leave it be, so a fallback location can be
+// given at the end without checking whether an earlier one worked.
+
+void TraceStop();
+// TraceStop - writes out the last of them and closes the file, and turns
+// tracing off. Without a TraceFile the events are dropped.
+
+__int64 TraceNow();
+// TraceNow - microseconds since TraceStart, or 0 if tracing's off.
+
+void TraceSpanEnd(const char *name, __int64 start, const TCHAR *detail=0);
+// TraceSpanEnd - records a span on this thread from start (a TraceNow) until
+// now, for code that's easier to bracket by hand than with a TraceSpan, such
+// as the stretch between two gotos. Names must be literals, or otherwise live
+// as long as tracing does; detail, if there is one, is copied into the span's
+// args. It does nothing if tracing is off.
+
+void TraceCount(const char *name, __int64 delta);
+// TraceCount - adds delta to the counter called name, and records its new
+// value. Counters start at 0.
+
+void TraceThreadName(const char *name);
+// TraceThreadName - names this thread in the timeline.
+
+class TraceSpan
+{ public:
+  TraceSpan(const char *name, const TCHAR *detail=0) : name(name), detail(detail), start(Tracing()?TraceNow():-1) {}
+  ~TraceSpan() {if (start>=0) TraceSpanEnd(name,start,detail);}
+  private:
+  const char *name; const TCHAR *detail; __int64 start;
+  TraceSpan(const TraceSpan&); TraceSpan &operator=(const TraceSpan&);
+};
+// TraceSpan - a span for the rest of the scope it's declared in. detail must
+// last as long as it does.
+
+#endif // _trace_H
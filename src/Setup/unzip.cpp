@@ -1,5 +1,58 @@
+#ifdef _WIN32
 #include "stdafx.h"
+#else
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <dirent.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/syscall.h>
+#endif
+#endif
 #include "unzip.h"
+#include "trace.h"
+#include <stdarg.h>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <map>
+#include <string>
+#include <algorithm>
+#include <atomic>
+#ifndef UNZ_NO_ZSTD
+#include "../../vendor/zstd/lib/zstd.h"
+#endif
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define UAES_NI
+#include <wmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define UAES_NI_TARGET
+#else
+#include <cpuid.h>
+#define UAES_NI_TARGET __attribute__((target("aes,sse2")))
+#endif
+#define UADLER_SIMD
+#include <immintrin.h>
+#ifdef _MSC_VER
+#define UADLER_SSSE3_TARGET
+#define UADLER_AVX2_TARGET
+#else
+#define UADLER_SSSE3_TARGET __attribute__((target("ssse3")))
+#define UADLER_AVX2_TARGET __attribute__((target("avx2")))
+#endif
+#endif
 
 
 // THIS FILE is almost entirely based upon code by Jean-loup Gailly
@@ -67,6 +120,8 @@
 #define ZIP_HANDLE   1
 #define ZIP_FILENAME 2
 #define ZIP_MEMORY   3
+#define ZIP_SOURCE   4
+#define ZIP_DIGEST   5  // not to anywhere, just for the item's hash (see MakeZipManifest)
 
 
 #define zmalloc(len) malloc(len)
@@ -442,6 +497,12 @@ uLong adler32 (uLong adler, const Byte *buf, uInt len);
 //     }
 //     if (adler != original_adler) error();
 
+uLong ucrc32_combine (uLong crc1, uLong crc2, uLong len2);
+//     Combine two crc's into one. crc1 covers a first block of data, crc2 a
+//   second block of len2 bytes that follows it; the result is the crc of the
+//   two blocks concatenated. Used to stitch together chunks that were
+//   checked independently (e.g. on different threads).
+
 uLong ucrc32   (uLong crc, const Byte *buf, uInt len);
 //     Update a running crc with the bytes buf[0..len-1] and return the updated
 //   crc. If buf is NULL, this function returns the required initial value
@@ -713,7 +774,7 @@ struct inflate_blocks_state {
 #define DUMPBITS(j) {b>>=(j);k-=(j);}
 //   output bytes
 #define WAVAIL (uInt)(q<s->read?s->read-q-1:s->end-q)
-#define LOADOUT {q=s->write;m=(uInt)WAVAIL;m;}
+#define LOADOUT {q=s->write;m=(uInt)WAVAIL;}
 #define WRAP {if(q==s->end&&s->read!=s->window){q=s->window;m=(uInt)WAVAIL;}}
 #define FLUSH {UPDOUT r=inflate_flush(s,z,r); LOADOUT}
 #define NEEDOUT {if(m==0){WRAP if(m==0){FLUSH WRAP if(m==0) LEAVE}}r=Z_OK;}
@@ -1674,7 +1735,7 @@ uInt *v)               // working area: values in order of bit length
 #define C0 *p++ = 0;
 #define C2 C0 C0 C0 C0
 #define C4 C2 C2 C2 C2
-  C4; p;                          // clear c[]--assume BMAX+1 is 16
+  C4                              // clear c[]--assume BMAX+1 is 16
   p = b;  i = n;
   do {
     c[*p++]++;                  // assume all entries <= BMAX
@@ -2187,19 +2248,89 @@ const uLong * get_crc_table()
 }
 
 #define CRC_DO1(buf) crc = crc_table[((int)crc ^ (*buf++)) & 0xff] ^ (crc >> 8);
-#define CRC_DO2(buf)  CRC_DO1(buf); CRC_DO1(buf);
-#define CRC_DO4(buf)  CRC_DO2(buf); CRC_DO2(buf);
-#define CRC_DO8(buf)  CRC_DO4(buf); CRC_DO4(buf);
+
+// Slice-by-8: t[k][n] is the crc of byte n followed by k zero bytes, so eight
+// bytes at a time come down to eight independent lookups rather than a chain
+// of eight dependent ones. It's about six times the speed of a byte at a time.
+typedef struct ucrc_slices
+{ unsigned int t[8][256];
+  ucrc_slices()
+  { for (int n=0; n<256; n++) t[0][n]=(unsigned int)crc_table[n];
+    for (int k=1; k<8; k++) for (int n=0; n<256; n++) t[k][n]=t[0][t[k-1][n]&0xff]^(t[k-1][n]>>8);
+  }
+} ucrc_slices;
+
+const ucrc_slices &ucrc_getslices()
+{ static const ucrc_slices slices; // built once, thread-safely
+  return slices;
+}
 
 uLong ucrc32(uLong crc, const Byte *buf, uInt len)
 { if (buf == Z_NULL) return 0L;
   crc = crc ^ 0xffffffffL;
-  while (len >= 8)  {CRC_DO8(buf); len -= 8;}
+  if (len >= 16)
+  { const unsigned int (*t)[256] = ucrc_getslices().t;
+    unsigned int c = (unsigned int)crc;
+    while (len >= 8)
+    { // the loads are put together a byte at a time, which compilers turn
+      // into one load each on little-endian machines, and is right on others
+      unsigned int one = c ^ (buf[0] | (buf[1]<<8) | (buf[2]<<16) | ((unsigned int)buf[3]<<24));
+      unsigned int two = buf[4] | (buf[5]<<8) | (buf[6]<<16) | ((unsigned int)buf[7]<<24);
+      c = t[7][one&0xff] ^ t[6][(one>>8)&0xff] ^ t[5][(one>>16)&0xff] ^ t[4][one>>24] ^
+          t[3][two&0xff] ^ t[2][(two>>8)&0xff] ^ t[1][(two>>16)&0xff] ^ t[0][two>>24];
+      buf += 8; len -= 8;
+    }
+    crc = c;
+  }
   if (len) do {CRC_DO1(buf);} while (--len);
   return crc ^ 0xffffffffL;
 }
 
 
+// crc32_combine, from zlib 1.2.x. Given crc1 of a first block and crc2 of a
+// second block of len2 bytes, returns the crc of the two blocks concatenated.
+// It works by applying len2 zero bytes to crc1 in log(len2) matrix squarings.
+#define GF2_DIM 32      // dimension of GF(2) vectors (length of CRC)
+
+uLong gf2_matrix_times(const uLong *mat, uLong vec)
+{ uLong sum = 0;
+  while (vec)
+  { if (vec & 1) sum ^= *mat;
+    vec >>= 1;
+    mat++;
+  }
+  return sum;
+}
+
+void gf2_matrix_square(uLong *square, const uLong *mat)
+{ for (int n = 0; n < GF2_DIM; n++) square[n] = gf2_matrix_times(mat, mat[n]);
+}
+
+uLong ucrc32_combine(uLong crc1, uLong crc2, uLong len2)
+{ uLong even[GF2_DIM];    // even-power-of-two zeros operator
+  uLong odd[GF2_DIM];     // odd-power-of-two zeros operator
+  if (len2 == 0) return crc1;
+  // put operator for one zero bit in odd
+  odd[0] = 0xedb88320L;   // CRC-32 polynomial
+  uLong row = 1;
+  for (int n = 1; n < GF2_DIM; n++) {odd[n] = row; row <<= 1;}
+  gf2_matrix_square(even, odd); // put operator for two zero bits in even
+  gf2_matrix_square(odd, even); // put operator for four zero bits in odd
+  // apply len2 zeros to crc1 (first square will put the operator for one
+  // zero byte, eight zero bits, in even)
+  do
+  { gf2_matrix_square(even, odd);
+    if (len2 & 1) crc1 = gf2_matrix_times(even, crc1);
+    len2 >>= 1;
+    if (len2 == 0) break;
+    gf2_matrix_square(odd, even);
+    if (len2 & 1) crc1 = gf2_matrix_times(odd, crc1);
+    len2 >>= 1;
+  } while (len2 != 0);
+  return (crc1 ^ crc2) & 0xffffffffL;
+}
+
+
 
 // =============================================================
 // some decryption routines
@@ -2221,6 +2352,231 @@ char zdecode(unsigned long *keys, char c)
 }
 
 
+// WinZip AES (AE-1 and AE-2, http://www.winzip.com/aes_info.htm).
+// The keys come from PBKDF2-HMAC-SHA1 (1000 rounds) over the password and a
+// per-entry salt; the data is AES-CTR with a little-endian counter that
+// starts at 1; and the first 10 bytes of HMAC-SHA1 over the ciphertext
+// authenticate it. AES uses AES-NI when the cpu has it.
+typedef struct {unsigned int h[5]; unsigned char buf[64]; unsigned __int64 len;} usha1_ctx;
+
+#define USHA1_ROL(x,n) (((x)<<(n))|((x)>>(32-(n))))
+void usha1_block(unsigned int *h, const unsigned char *p)
+{ unsigned int w[80];
+  for (int i=0; i<16; i++) w[i]=((unsigned int)p[4*i]<<24)|((unsigned int)p[4*i+1]<<16)|((unsigned int)p[4*i+2]<<8)|p[4*i+3];
+  for (int i=16; i<80; i++) w[i]=USHA1_ROL(w[i-3]^w[i-8]^w[i-14]^w[i-16],1);
+  unsigned int a=h[0], b=h[1], c=h[2], d=h[3], e=h[4];
+  for (int i=0; i<80; i++)
+  { unsigned int f,k;
+    if (i<20) {f=(b&c)|(~b&d); k=0x5a827999;}
+    else if (i<40) {f=b^c^d; k=0x6ed9eba1;}
+    else if (i<60) {f=(b&c)|(b&d)|(c&d); k=0x8f1bbcdc;}
+    else {f=b^c^d; k=0xca62c1d6;}
+    unsigned int t=USHA1_ROL(a,5)+f+e+k+w[i];
+    e=d; d=c; c=USHA1_ROL(b,30); b=a; a=t;
+  }
+  h[0]+=a; h[1]+=b; h[2]+=c; h[3]+=d; h[4]+=e;
+}
+void usha1_init(usha1_ctx *c)
+{ c->h[0]=0x67452301; c->h[1]=0xefcdab89; c->h[2]=0x98badcfe; c->h[3]=0x10325476; c->h[4]=0xc3d2e1f0;
+  c->len=0;
+}
+void usha1_update(usha1_ctx *c, const unsigned char *p, unsigned int n)
+{ unsigned int used = (unsigned int)(c->len&63); c->len+=n;
+  if (used!=0)
+  { unsigned int take=64-used; if (take>n) take=n;
+    memcpy(c->buf+used,p,take); p+=take; n-=take;
+    if (used+take<64) return;
+    usha1_block(c->h,c->buf);
+  }
+  for (; n>=64; p+=64, n-=64) usha1_block(c->h,p);
+  if (n!=0) memcpy(c->buf,p,n);
+}
+void usha1_final(usha1_ctx *c, unsigned char *out)
+{ unsigned __int64 nbits=c->len*8; unsigned char pad=0x80, zero=0, lenbuf[8];
+  usha1_update(c,&pad,1);
+  while ((c->len&63)!=56) usha1_update(c,&zero,1);
+  for (int i=0; i<8; i++) lenbuf[i]=(unsigned char)(nbits>>(56-8*i));
+  usha1_update(c,lenbuf,8);
+  for (int i=0; i<20; i++) out[i]=(unsigned char)(c->h[i/4]>>(24-8*(i%4)));
+}
+
+typedef struct {usha1_ctx inner, outer;} uhmac_ctx;
+void uhmac_init(uhmac_ctx *c, const unsigned char *key, unsigned int keylen)
+{ unsigned char k[64], pad[64]; memset(k,0,64);
+  if (keylen>64) {usha1_ctx t; usha1_init(&t); usha1_update(&t,key,keylen); usha1_final(&t,k);}
+  else memcpy(k,key,keylen);
+  for (int i=0; i<64; i++) pad[i]=(unsigned char)(k[i]^0x36);
+  usha1_init(&c->inner); usha1_update(&c->inner,pad,64);
+  for (int i=0; i<64; i++) pad[i]=(unsigned char)(k[i]^0x5c);
+  usha1_init(&c->outer); usha1_update(&c->outer,pad,64);
+}
+void uhmac_final(uhmac_ctx *c, unsigned char *out)
+{ unsigned char d[20]; usha1_final(&c->inner,d);
+  usha1_update(&c->outer,d,20); usha1_final(&c->outer,out);
+}
+
+void upbkdf2_sha1(const unsigned char *pwd, unsigned int pwdlen, const unsigned char *salt, unsigned int saltlen, unsigned int iter, unsigned char *out, unsigned int outlen)
+{ uhmac_ctx base; uhmac_init(&base,pwd,pwdlen); // keyed once, then copied for every round
+  for (unsigned int block=1; outlen>0; block++)
+  { unsigned char u[20], t[20], be[4] = {(unsigned char)(block>>24),(unsigned char)(block>>16),(unsigned char)(block>>8),(unsigned char)block};
+    uhmac_ctx c=base; usha1_update(&c.inner,salt,saltlen); usha1_update(&c.inner,be,4); uhmac_final(&c,u);
+    memcpy(t,u,20);
+    for (unsigned int i=1; i<iter; i++)
+    { c=base; usha1_update(&c.inner,u,20); uhmac_final(&c,u);
+      for (int j=0; j<20; j++) t[j]^=u[j];
+    }
+    unsigned int n = outlen<20 ? outlen : 20;
+    memcpy(out,t,n); out+=n; outlen-=n;
+  }
+}
+
+const unsigned char uaes_sbox[256] = {
+  0x63,0x7c,0x77,0x7b,0xf2,0x6b,0x6f,0xc5,0x30,0x01,0x67,0x2b,0xfe,0xd7,0xab,0x76,
+  0xca,0x82,0xc9,0x7d,0xfa,0x59,0x47,0xf0,0xad,0xd4,0xa2,0xaf,0x9c,0xa4,0x72,0xc0,
+  0xb7,0xfd,0x93,0x26,0x36,0x3f,0xf7,0xcc,0x34,0xa5,0xe5,0xf1,0x71,0xd8,0x31,0x15,
+  0x04,0xc7,0x23,0xc3,0x18,0x96,0x05,0x9a,0x07,0x12,0x80,0xe2,0xeb,0x27,0xb2,0x75,
+  0x09,0x83,0x2c,0x1a,0x1b,0x6e,0x5a,0xa0,0x52,0x3b,0xd6,0xb3,0x29,0xe3,0x2f,0x84,
+  0x53,0xd1,0x00,0xed,0x20,0xfc,0xb1,0x5b,0x6a,0xcb,0xbe,0x39,0x4a,0x4c,0x58,0xcf,
+  0xd0,0xef,0xaa,0xfb,0x43,0x4d,0x33,0x85,0x45,0xf9,0x02,0x7f,0x50,0x3c,0x9f,0xa8,
+  0x51,0xa3,0x40,0x8f,0x92,0x9d,0x38,0xf5,0xbc,0xb6,0xda,0x21,0x10,0xff,0xf3,0xd2,
+  0xcd,0x0c,0x13,0xec,0x5f,0x97,0x44,0x17,0xc4,0xa7,0x7e,0x3d,0x64,0x5d,0x19,0x73,
+  0x60,0x81,0x4f,0xdc,0x22,0x2a,0x90,0x88,0x46,0xee,0xb8,0x14,0xde,0x5e,0x0b,0xdb,
+  0xe0,0x32,0x3a,0x0a,0x49,0x06,0x24,0x5c,0xc2,0xd3,0xac,0x62,0x91,0x95,0xe4,0x79,
+  0xe7,0xc8,0x37,0x6d,0x8d,0xd5,0x4e,0xa9,0x6c,0x56,0xf4,0xea,0x65,0x7a,0xae,0x08,
+  0xba,0x78,0x25,0x2e,0x1c,0xa6,0xb4,0xc6,0xe8,0xdd,0x74,0x1f,0x4b,0xbd,0x8b,0x8a,
+  0x70,0x3e,0xb5,0x66,0x48,0x03,0xf6,0x0e,0x61,0x35,0x57,0xb9,0x86,0xc1,0x1d,0x9e,
+  0xe1,0xf8,0x98,0x11,0x69,0xd9,0x8e,0x94,0x9b,0x1e,0x87,0xe9,0xce,0x55,0x28,0xdf,
+  0x8c,0xa1,0x89,0x0d,0xbf,0xe6,0x42,0x68,0x41,0x99,0x2d,0x0f,0xb0,0x54,0xbb,0x16};
+
+typedef struct {unsigned char rk[15*16]; int rounds;} uaes_key; // round keys in FIPS-197 byte order, which is also what aesenc wants
+
+void uaes_setkey(uaes_key *k, const unsigned char *key, int keylen)
+{ int nk=keylen/4, total; unsigned char rcon=1, *w=k->rk;
+  k->rounds=nk+6; total=4*(k->rounds+1);
+  memcpy(w,key,keylen);
+  for (int i=nk; i<total; i++)
+  { unsigned char t[4]; memcpy(t,w+4*(i-1),4);
+    if (i%nk==0)
+    { unsigned char u=t[0];
+      t[0]=(unsigned char)(uaes_sbox[t[1]]^rcon); t[1]=uaes_sbox[t[2]]; t[2]=uaes_sbox[t[3]]; t[3]=uaes_sbox[u];
+      rcon=(unsigned char)((rcon<<1)^((rcon&0x80)?0x1b:0));
+    }
+    else if (nk>6 && i%nk==4) {for (int j=0; j<4; j++) t[j]=uaes_sbox[t[j]];}
+    for (int j=0; j<4; j++) w[4*i+j]=(unsigned char)(w[4*(i-nk)+j]^t[j]);
+  }
+}
+
+#define UAES_XT(x) ((unsigned char)(((x)<<1)^(((x)&0x80)?0x1b:0)))
+void uaes_encrypt_soft(const uaes_key *k, const unsigned char *in, unsigned char *out)
+{ unsigned char s[16], t[16];
+  for (int i=0; i<16; i++) s[i]=(unsigned char)(in[i]^k->rk[i]);
+  for (int r=1; r<=k->rounds; r++)
+  { for (int c=0; c<4; c++) for (int row=0; row<4; row++) t[c*4+row]=uaes_sbox[s[((c+row)&3)*4+row]]; // SubBytes, ShiftRows
+    if (r==k->rounds) memcpy(s,t,16);
+    else for (int c=0; c<4; c++) // MixColumns
+    { unsigned char a0=t[c*4], a1=t[c*4+1], a2=t[c*4+2], a3=t[c*4+3], all=(unsigned char)(a0^a1^a2^a3);
+      s[c*4]=(unsigned char)(a0^all^UAES_XT(a0^a1)); s[c*4+1]=(unsigned char)(a1^all^UAES_XT(a1^a2));
+      s[c*4+2]=(unsigned char)(a2^all^UAES_XT(a2^a3)); s[c*4+3]=(unsigned char)(a3^all^UAES_XT(a3^a0));
+    }
+    for (int i=0; i<16; i++) s[i]^=k->rk[16*r+i];
+  }
+  memcpy(out,s,16);
+}
+
+#ifdef UAES_NI
+bool uaes_have_ni()
+{ static int have=-1;
+  if (have<0)
+  {
+#ifdef _MSC_VER
+    int r[4]; __cpuid(r,1); have=(r[2]>>25)&1;
+#else
+    unsigned int a,b,c,d; have = __get_cpuid(1,&a,&b,&c,&d) ? (int)((c>>25)&1) : 0;
+#endif
+  }
+  return have!=0;
+}
+
+// xors nblocks of keystream into buf, four blocks at a time so that the aesenc latencies overlap
+UAES_NI_TARGET void uaes_ctr_ni(const uaes_key *k, unsigned __int64 *ctr, unsigned char *buf, unsigned int nblocks)
+{ __m128i rk[15]; int nr=k->rounds;
+  for (int i=0; i<=nr; i++) rk[i]=_mm_loadu_si128((const __m128i*)(k->rk+16*i));
+  unsigned int i=0;
+  for (; i+4<=nblocks; i+=4, buf+=64)
+  { __m128i b0=_mm_xor_si128(_mm_set_epi64x(0,(__int64)(*ctr)),rk[0]);
+    __m128i b1=_mm_xor_si128(_mm_set_epi64x(0,(__int64)(*ctr+1)),rk[0]);
+    __m128i b2=_mm_xor_si128(_mm_set_epi64x(0,(__int64)(*ctr+2)),rk[0]);
+    __m128i b3=_mm_xor_si128(_mm_set_epi64x(0,(__int64)(*ctr+3)),rk[0]);
+    *ctr+=4;
+    for (int r=1; r<nr; r++)
+    { b0=_mm_aesenc_si128(b0,rk[r]); b1=_mm_aesenc_si128(b1,rk[r]);
+      b2=_mm_aesenc_si128(b2,rk[r]); b3=_mm_aesenc_si128(b3,rk[r]);
+    }
+    b0=_mm_aesenclast_si128(b0,rk[nr]); b1=_mm_aesenclast_si128(b1,rk[nr]);
+    b2=_mm_aesenclast_si128(b2,rk[nr]); b3=_mm_aesenclast_si128(b3,rk[nr]);
+    _mm_storeu_si128((__m128i*)buf,_mm_xor_si128(b0,_mm_loadu_si128((const __m128i*)buf)));
+    _mm_storeu_si128((__m128i*)(buf+16),_mm_xor_si128(b1,_mm_loadu_si128((const __m128i*)(buf+16))));
+    _mm_storeu_si128((__m128i*)(buf+32),_mm_xor_si128(b2,_mm_loadu_si128((const __m128i*)(buf+32))));
+    _mm_storeu_si128((__m128i*)(buf+48),_mm_xor_si128(b3,_mm_loadu_si128((const __m128i*)(buf+48))));
+  }
+  for (; i<nblocks; i++, buf+=16)
+  { __m128i b=_mm_xor_si128(_mm_set_epi64x(0,(__int64)(*ctr)),rk[0]); *ctr+=1;
+    for (int r=1; r<nr; r++) b=_mm_aesenc_si128(b,rk[r]);
+    b=_mm_aesenclast_si128(b,rk[nr]);
+    _mm_storeu_si128((__m128i*)buf,_mm_xor_si128(b,_mm_loadu_si128((const __m128i*)buf)));
+  }
+}
+#endif
+
+typedef struct
+{ uaes_key key;
+  uhmac_ctx hmac;             // over the ciphertext, as we read it
+  unsigned __int64 ctr;       // next counter block
+  unsigned char ks[16];       // keystream left over from a partial block
+  unsigned int kspos;         // ...and how much of it is used
+  bool ae2;                   // AE-2 entries have no crc; the hmac is all we get
+  unsigned int headlen;       // salt and password verifier, ahead of the ciphertext
+  bool badpassword;           // the password verifier didn't match
+  bool done;                  // authentication code has been checked
+} unz_aes_s;
+
+void uaes_ctr_block(unz_aes_s *aes, unsigned char *ks)
+{ unsigned char c[16]; memset(c,0,16);
+  for (int i=0; i<8; i++) c[i]=(unsigned char)(aes->ctr>>(8*i));
+  aes->ctr++;
+  uaes_encrypt_soft(&aes->key,c,ks);
+}
+
+void uaes_ctr(unz_aes_s *aes, unsigned char *buf, unsigned int len)
+{ while (len>0 && aes->kspos<16) {*buf++ ^= aes->ks[aes->kspos++]; len--;}
+  unsigned int nblocks=len/16;
+#ifdef UAES_NI
+  if (uaes_have_ni()) {uaes_ctr_ni(&aes->key,&aes->ctr,buf,nblocks); buf+=16*nblocks; len-=16*nblocks; nblocks=0;}
+#endif
+  for (; nblocks>0; nblocks--, buf+=16, len-=16)
+  { unsigned char ks[16]; uaes_ctr_block(aes,ks);
+    for (int i=0; i<16; i++) buf[i]^=ks[i];
+  }
+  if (len>0)
+  { uaes_ctr_block(aes,aes->ks); aes->kspos=0;
+    while (len>0) {*buf++ ^= aes->ks[aes->kspos++]; len--;}
+  }
+}
+
+// Sets up decryption for an entry, given its salt and password verifier.
+// Returns false if the password is wrong.
+bool uaes_init(unz_aes_s *aes, int strength, const char *password, const unsigned char *salt, const unsigned char *pv)
+{ int keylen = 8+8*strength, saltlen = 4+4*strength; // 16/24/32 and 8/12/16 bytes
+  unsigned char dk[2*32+2];
+  upbkdf2_sha1((const unsigned char*)(password==0?"":password),password==0?0:(unsigned int)strlen(password),salt,saltlen,1000,dk,2*keylen+2);
+  uaes_setkey(&aes->key,dk,keylen);
+  uhmac_init(&aes->hmac,dk+keylen,keylen);
+  aes->ctr=1; aes->kspos=16; aes->done=false;
+  aes->badpassword = (dk[2*keylen]!=pv[0] || dk[2*keylen+1]!=pv[1]);
+  return !aes->badpassword;
+}
+
+
 
 // adler32.c -- compute the Adler-32 checksum of a data stream
 // Copyright (C) 1995-1998 Mark Adler
@@ -2239,15 +2595,110 @@ char zdecode(unsigned long *keys, char c)
 #define AD_DO8(buf,i)  AD_DO4(buf,i); AD_DO4(buf,i+4);
 #define AD_DO16(buf)   AD_DO8(buf,0); AD_DO8(buf,8);
 
+#ifdef UADLER_SIMD
+// 0 for the scalar loop, 1 for ssse3, 2 for avx2 (which the os must also be saving the ymm registers for)
+int uadler_level()
+{ static int level=-1;
+  if (level<0)
+  { unsigned int c=0, b7=0, xcr0=0;
+#ifdef _MSC_VER
+    int r[4]; __cpuid(r,0); int maxleaf=r[0];
+    __cpuid(r,1); c=(unsigned int)r[2];
+    if (maxleaf>=7) {__cpuidex(r,7,0); b7=(unsigned int)r[1];}
+    if ((c>>27)&1) xcr0=(unsigned int)_xgetbv(0);
+#else
+    unsigned int a,b,d;
+    if (__get_cpuid(1,&a,&b,&c,&d)==0) c=0;
+    if (__get_cpuid_count(7,0,&a,&b7,&d,&d)==0) b7=0;
+    if ((c>>27)&1) __asm__("xgetbv" : "=a"(xcr0), "=d"(d) : "c"(0));
+#endif
+    int l=0;
+    if ((c>>9)&1) l=1;
+    if (l==1 && ((c>>28)&1) && (xcr0&6)==6 && ((b7>>5)&1)) l=2;
+    level=l;
+  }
+  return level;
+}
+
+// Each of these does len bytes, a multiple of 32, and returns the checksum so far.
+// The bytes of a 32-byte block add tap[i]=32-i times s1 to s2, and s1 as it stood
+// at the start of each block adds 32 times over, which is what ps keeps count of.
+UADLER_SSSE3_TARGET uLong uadler_ssse3(uLong adler, const Byte *buf, uInt len)
+{ uLong s1=adler&0xffff, s2=(adler>>16)&0xffff;
+  const __m128i tap1=_mm_setr_epi8(32,31,30,29,28,27,26,25,24,23,22,21,20,19,18,17);
+  const __m128i tap2=_mm_setr_epi8(16,15,14,13,12,11,10,9,8,7,6,5,4,3,2,1);
+  const __m128i zero=_mm_setzero_si128(), ones=_mm_set1_epi16(1);
+  while (len>=32)
+  { uInt n=len/32; if (n>NMAX/32) n=NMAX/32; len-=n*32;
+    s2+=s1*32*n;
+    __m128i ps=zero, v1=zero, v2=zero;
+    do
+    { __m128i b1=_mm_loadu_si128((const __m128i*)buf), b2=_mm_loadu_si128((const __m128i*)(buf+16));
+      ps=_mm_add_epi32(ps,v1);
+      v1=_mm_add_epi32(v1,_mm_add_epi32(_mm_sad_epu8(b1,zero),_mm_sad_epu8(b2,zero)));
+      v2=_mm_add_epi32(v2,_mm_madd_epi16(_mm_maddubs_epi16(b1,tap1),ones));
+      v2=_mm_add_epi32(v2,_mm_madd_epi16(_mm_maddubs_epi16(b2,tap2),ones));
+      buf+=32;
+    } while (--n);
+    v2=_mm_add_epi32(v2,_mm_slli_epi32(ps,5));
+    v1=_mm_add_epi32(v1,_mm_shuffle_epi32(v1,_MM_SHUFFLE(1,0,3,2)));
+    v2=_mm_add_epi32(v2,_mm_shuffle_epi32(v2,_MM_SHUFFLE(2,3,0,1)));
+    v2=_mm_add_epi32(v2,_mm_shuffle_epi32(v2,_MM_SHUFFLE(1,0,3,2)));
+    s1+=(unsigned int)_mm_cvtsi128_si32(v1); s2+=(unsigned int)_mm_cvtsi128_si32(v2);
+    s1%=BASE; s2%=BASE;
+  }
+  return (s2<<16)|s1;
+}
+
+UADLER_AVX2_TARGET uLong uadler_avx2(uLong adler, const Byte *buf, uInt len)
+{ uLong s1=adler&0xffff, s2=(adler>>16)&0xffff;
+  const __m256i tap=_mm256_setr_epi8(32,31,30,29,28,27,26,25,24,23,22,21,20,19,18,17,16,15,14,13,12,11,10,9,8,7,6,5,4,3,2,1);
+  const __m256i zero=_mm256_setzero_si256(), ones=_mm256_set1_epi16(1);
+  while (len>=32)
+  { uInt n=len/32; if (n>NMAX/32) n=NMAX/32; len-=n*32;
+    s2+=s1*32*n;
+    __m256i ps=zero, v1=zero, v2=zero;
+    do
+    { __m256i b=_mm256_loadu_si256((const __m256i*)buf);
+      ps=_mm256_add_epi32(ps,v1);
+      v1=_mm256_add_epi32(v1,_mm256_sad_epu8(b,zero));
+      v2=_mm256_add_epi32(v2,_mm256_madd_epi16(_mm256_maddubs_epi16(b,tap),ones));
+      buf+=32;
+    } while (--n);
+    v2=_mm256_add_epi32(v2,_mm256_slli_epi32(ps,5));
+    __m128i h1=_mm_add_epi32(_mm256_castsi256_si128(v1),_mm256_extracti128_si256(v1,1));
+    __m128i h2=_mm_add_epi32(_mm256_castsi256_si128(v2),_mm256_extracti128_si256(v2,1));
+    h1=_mm_add_epi32(h1,_mm_shuffle_epi32(h1,_MM_SHUFFLE(1,0,3,2)));
+    h2=_mm_add_epi32(h2,_mm_shuffle_epi32(h2,_MM_SHUFFLE(2,3,0,1)));
+    h2=_mm_add_epi32(h2,_mm_shuffle_epi32(h2,_MM_SHUFFLE(1,0,3,2)));
+    s1+=(unsigned int)_mm_cvtsi128_si32(h1); s2+=(unsigned int)_mm_cvtsi128_si32(h2);
+    s1%=BASE; s2%=BASE;
+  }
+  return (s2<<16)|s1;
+}
+#endif
+
 // =========================================================================
 uLong adler32(uLong adler, const Byte *buf, uInt len)
 {
+    if (buf == Z_NULL) return 1L;
+
+#ifdef UADLER_SIMD
+    if (len >= 64) {
+        int level = uadler_level();
+        uInt n = len & ~31u;
+        if (level == 2) adler = uadler_avx2(adler, buf, n);
+        else if (level == 1) adler = uadler_ssse3(adler, buf, n);
+        else n = 0;
+        buf += n;
+        len -= n;
+    }
+#endif
+
     unsigned long s1 = adler & 0xffff;
     unsigned long s2 = (adler >> 16) & 0xffff;
     int k;
 
-    if (buf == Z_NULL) return 1L;
-
     while (len > 0) {
         k = len < NMAX ? len : NMAX;
         len -= k;
@@ -2267,6 +2718,237 @@ uLong adler32(uLong adler, const Byte *buf, uInt len)
 }
 
 
+// BLAKE3 (https://github.com/BLAKE3-team/BLAKE3), which the payload's manifest
+// is made of (see SetUnzipManifest). The input is hashed in 1k chunks, which
+// are the leaves of a binary tree, so chunks can be compressed side by side:
+// four at once with ssse3, eight with avx2. And a power-of-two run of whole
+// chunks is a subtree of its own, so unzReadCurrentFileChunked's workers hash
+// the chunks they've inflated, and the reader only has to join the subtrees.
+#define UB3_CHUNK        1024
+#define UB3_CHUNK_START  1
+#define UB3_CHUNK_END    2
+#define UB3_PARENT       4
+#define UB3_ROOT         8
+#define UB3_MAXDEPTH     54   // subtrees a 2^64 byte input can have waiting
+
+const unsigned int ub3_iv[8]={0x6A09E667,0xBB67AE85,0x3C6EF372,0xA54FF53A,0x510E527F,0x9B05688C,0x1F83D9AB,0x5BE0CD19};
+unsigned int ub3_get32(const unsigned char *p) {return (unsigned int)p[0]|((unsigned int)p[1]<<8)|((unsigned int)p[2]<<16)|((unsigned int)p[3]<<24);}
+void ub3_put32(unsigned char *p, unsigned int x) {p[0]=(unsigned char)x; p[1]=(unsigned char)(x>>8); p[2]=(unsigned char)(x>>16); p[3]=(unsigned char)(x>>24);}
+
+// A round is the g function down the columns of the state, then its diagonals,
+// with the message words in the order the round's schedule gives. G is g for
+// whatever the state's words are: one word, or a word each of 4 or 8 inputs.
+// The schedules are spelled out so that m is only ever indexed by constants.
+#define UB3_ROUND(G,v,m,s0,s1,s2,s3,s4,s5,s6,s7,s8,s9,s10,s11,s12,s13,s14,s15) { \
+  G(v[0],v[4],v[8],v[12],m[s0],m[s1]);   G(v[1],v[5],v[9],v[13],m[s2],m[s3]); \
+  G(v[2],v[6],v[10],v[14],m[s4],m[s5]);  G(v[3],v[7],v[11],v[15],m[s6],m[s7]); \
+  G(v[0],v[5],v[10],v[15],m[s8],m[s9]);  G(v[1],v[6],v[11],v[12],m[s10],m[s11]); \
+  G(v[2],v[7],v[8],v[13],m[s12],m[s13]); G(v[3],v[4],v[9],v[14],m[s14],m[s15]); }
+#define UB3_ROUNDS(G,v,m) \
+  UB3_ROUND(G,v,m,0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15) UB3_ROUND(G,v,m,2,6,3,10,7,0,4,13,1,11,12,5,9,14,15,8) \
+  UB3_ROUND(G,v,m,3,4,10,12,13,2,7,14,6,5,9,0,11,15,8,1) UB3_ROUND(G,v,m,10,7,12,9,14,3,13,15,4,0,11,2,5,8,1,6) \
+  UB3_ROUND(G,v,m,12,13,9,11,15,10,14,8,7,2,5,3,0,1,6,4) UB3_ROUND(G,v,m,9,14,11,5,8,12,15,1,13,3,0,10,2,6,4,7) \
+  UB3_ROUND(G,v,m,11,15,5,0,1,9,8,6,14,10,2,12,3,4,7,13)
+
+#define UB3_ROR(x,n) (((x)>>(n))|((x)<<(32-(n))))
+#define UB3_G1(a,b,c,d,x,y) {a+=b+(x); d=UB3_ROR(d^a,16); c+=d; b=UB3_ROR(b^c,12); a+=b+(y); d=UB3_ROR(d^a,8); c+=d; b=UB3_ROR(b^c,7);}
+
+// Compresses a block of blocklen bytes (zero-padded to 64) into the chaining value cv
+void ub3_compress(unsigned int *cv, const unsigned char *block, unsigned int blocklen, unsigned __int64 counter, unsigned int flags)
+{ unsigned int m[16], v[16];
+  for (int i=0; i<16; i++) m[i]=ub3_get32(block+4*i);
+  for (int i=0; i<8; i++) v[i]=cv[i];
+  for (int i=0; i<4; i++) v[8+i]=ub3_iv[i];
+  v[12]=(unsigned int)counter; v[13]=(unsigned int)(counter>>32); v[14]=blocklen; v[15]=flags;
+  UB3_ROUNDS(UB3_G1,v,m);
+  for (int i=0; i<8; i++) cv[i]=v[i]^v[i+8];
+}
+
+// One input of blocks whole blocks, e.g. a chunk (16 blocks) or a parent (one)
+void ub3_one(const unsigned char *in, unsigned int blocks, unsigned __int64 counter, unsigned int flags, unsigned int fstart, unsigned int fend, unsigned char *out)
+{ unsigned int cv[8]; memcpy(cv,ub3_iv,32);
+  for (unsigned int b=0; b<blocks; b++) ub3_compress(cv,in+64*b,64,counter,flags|(b==0?fstart:0)|(b+1==blocks?fend:0));
+  for (int i=0; i<8; i++) ub3_put32(out+4*i,cv[i]);
+}
+
+#ifdef UADLER_SIMD
+// Four words of each of four inputs in, one word of all four inputs out
+#define UB3_TRANSPOSE4(a,b,c,d) { \
+  __m128i t0=_mm_unpacklo_epi32(a,b), t1=_mm_unpacklo_epi32(c,d), t2=_mm_unpackhi_epi32(a,b), t3=_mm_unpackhi_epi32(c,d); \
+  a=_mm_unpacklo_epi64(t0,t1); b=_mm_unpackhi_epi64(t0,t1); c=_mm_unpacklo_epi64(t2,t3); d=_mm_unpackhi_epi64(t2,t3); }
+
+#define UB3_G4(a,b,c,d,x,y) { \
+  a=_mm_add_epi32(_mm_add_epi32(a,b),x); d=_mm_shuffle_epi8(_mm_xor_si128(d,a),rot16); \
+  c=_mm_add_epi32(c,d); b=_mm_xor_si128(b,c); b=_mm_or_si128(_mm_srli_epi32(b,12),_mm_slli_epi32(b,20)); \
+  a=_mm_add_epi32(_mm_add_epi32(a,b),y); d=_mm_shuffle_epi8(_mm_xor_si128(d,a),rot8); \
+  c=_mm_add_epi32(c,d); b=_mm_xor_si128(b,c); b=_mm_or_si128(_mm_srli_epi32(b,7),_mm_slli_epi32(b,25)); }
+
+// As ub3_one, for four inputs one after another, each word of the state holding that word of all four
+UADLER_SSSE3_TARGET void ub3_four(const unsigned char *in, unsigned int blocks, unsigned __int64 counter, bool inc, unsigned int flags, unsigned int fstart, unsigned int fend, unsigned char *out)
+{ const __m128i rot16=_mm_setr_epi8(2,3,0,1,6,7,4,5,10,11,8,9,14,15,12,13);
+  const __m128i rot8=_mm_setr_epi8(1,2,3,0,5,6,7,4,9,10,11,8,13,14,15,12);
+  unsigned int lo[4], hi[4];
+  for (int l=0; l<4; l++) {unsigned __int64 c=counter+(inc?l:0); lo[l]=(unsigned int)c; hi[l]=(unsigned int)(c>>32);}
+  __m128i h[8], m[16], v[16];
+  for (int i=0; i<8; i++) h[i]=_mm_set1_epi32((int)ub3_iv[i]);
+  size_t stride=(size_t)blocks*64;
+  for (unsigned int b=0; b<blocks; b++)
+  { for (int g=0; g<4; g++)
+    { const unsigned char *p=in+64*b+16*g;
+      m[4*g]=_mm_loadu_si128((const __m128i*)p); m[4*g+1]=_mm_loadu_si128((const __m128i*)(p+stride));
+      m[4*g+2]=_mm_loadu_si128((const __m128i*)(p+2*stride)); m[4*g+3]=_mm_loadu_si128((const __m128i*)(p+3*stride));
+      UB3_TRANSPOSE4(m[4*g],m[4*g+1],m[4*g+2],m[4*g+3]);
+    }
+    for (int i=0; i<8; i++) v[i]=h[i];
+    for (int i=0; i<4; i++) v[8+i]=_mm_set1_epi32((int)ub3_iv[i]);
+    v[12]=_mm_loadu_si128((const __m128i*)lo); v[13]=_mm_loadu_si128((const __m128i*)hi);
+    v[14]=_mm_set1_epi32(64); v[15]=_mm_set1_epi32((int)(flags|(b==0?fstart:0)|(b+1==blocks?fend:0)));
+    UB3_ROUNDS(UB3_G4,v,m);
+    for (int i=0; i<8; i++) h[i]=_mm_xor_si128(v[i],v[i+8]);
+  }
+  UB3_TRANSPOSE4(h[0],h[1],h[2],h[3]); UB3_TRANSPOSE4(h[4],h[5],h[6],h[7]);
+  for (int l=0; l<4; l++) {_mm_storeu_si128((__m128i*)(out+32*l),h[l]); _mm_storeu_si128((__m128i*)(out+32*l+16),h[4+l]);}
+}
+
+#define UB3_G8(a,b,c,d,x,y) { \
+  a=_mm256_add_epi32(_mm256_add_epi32(a,b),x); d=_mm256_shuffle_epi8(_mm256_xor_si256(d,a),rot16); \
+  c=_mm256_add_epi32(c,d); b=_mm256_xor_si256(b,c); b=_mm256_or_si256(_mm256_srli_epi32(b,12),_mm256_slli_epi32(b,20)); \
+  a=_mm256_add_epi32(_mm256_add_epi32(a,b),y); d=_mm256_shuffle_epi8(_mm256_xor_si256(d,a),rot8); \
+  c=_mm256_add_epi32(c,d); b=_mm256_xor_si256(b,c); b=_mm256_or_si256(_mm256_srli_epi32(b,7),_mm256_slli_epi32(b,25)); }
+
+// And for eight inputs, as two fours side by side
+UADLER_AVX2_TARGET void ub3_eight(const unsigned char *in, unsigned int blocks, unsigned __int64 counter, bool inc, unsigned int flags, unsigned int fstart, unsigned int fend, unsigned char *out)
+{ const __m128i r16=_mm_setr_epi8(2,3,0,1,6,7,4,5,10,11,8,9,14,15,12,13), r8=_mm_setr_epi8(1,2,3,0,5,6,7,4,9,10,11,8,13,14,15,12);
+  const __m256i rot16=_mm256_inserti128_si256(_mm256_castsi128_si256(r16),r16,1), rot8=_mm256_inserti128_si256(_mm256_castsi128_si256(r8),r8,1);
+  unsigned int lo[8], hi[8];
+  for (int l=0; l<8; l++) {unsigned __int64 c=counter+(inc?l:0); lo[l]=(unsigned int)c; hi[l]=(unsigned int)(c>>32);}
+  __m256i h[8], m[16], v[16];
+  for (int i=0; i<8; i++) h[i]=_mm256_set1_epi32((int)ub3_iv[i]);
+  size_t stride=(size_t)blocks*64;
+  for (unsigned int b=0; b<blocks; b++)
+  { for (int g=0; g<4; g++)
+    { __m128i q[8]; const unsigned char *p=in+64*b+16*g;
+      for (int l=0; l<8; l++) q[l]=_mm_loadu_si128((const __m128i*)(p+l*stride));
+      UB3_TRANSPOSE4(q[0],q[1],q[2],q[3]); UB3_TRANSPOSE4(q[4],q[5],q[6],q[7]);
+      for (int k=0; k<4; k++) m[4*g+k]=_mm256_inserti128_si256(_mm256_castsi128_si256(q[k]),q[4+k],1);
+    }
+    for (int i=0; i<8; i++) v[i]=h[i];
+    for (int i=0; i<4; i++) v[8+i]=_mm256_set1_epi32((int)ub3_iv[i]);
+    v[12]=_mm256_loadu_si256((const __m256i*)lo); v[13]=_mm256_loadu_si256((const __m256i*)hi);
+    v[14]=_mm256_set1_epi32(64); v[15]=_mm256_set1_epi32((int)(flags|(b==0?fstart:0)|(b+1==blocks?fend:0)));
+    UB3_ROUNDS(UB3_G8,v,m);
+    for (int i=0; i<8; i++) h[i]=_mm256_xor_si256(v[i],v[i+8]);
+  }
+  for (int half=0; half<2; half++)
+  { __m128i q[8];
+    for (int i=0; i<8; i++) q[i] = half==0 ? _mm256_castsi256_si128(h[i]) : _mm256_extracti128_si256(h[i],1);
+    UB3_TRANSPOSE4(q[0],q[1],q[2],q[3]); UB3_TRANSPOSE4(q[4],q[5],q[6],q[7]);
+    for (int l=0; l<4; l++)
+    { _mm_storeu_si128((__m128i*)(out+32*(4*half+l)),q[l]); _mm_storeu_si128((__m128i*)(out+32*(4*half+l)+16),q[4+l]);
+    }
+  }
+}
+#endif
+
+// Hashes n inputs of blocks whole blocks each, which follow one another in in,
+// and puts their chaining values one after another in out. The first input's
+// counter is counter, and with inc the others' count up from it (for chunks);
+// fstart and fend are flags for just the first and last block of each. out may
+// be in, since no input is read once an earlier one's value has been written.
+void ub3_many(const unsigned char *in, size_t n, unsigned int blocks, unsigned __int64 counter, bool inc, unsigned int flags, unsigned int fstart, unsigned int fend, unsigned char *out)
+{ size_t stride=(size_t)blocks*64;
+#ifdef UADLER_SIMD
+  int level=uadler_level();
+  if (level==2) for (; n>=8; n-=8, in+=8*stride, out+=8*32, counter+=inc?8:0) ub3_eight(in,blocks,counter,inc,flags,fstart,fend,out);
+  if (level>=1) for (; n>=4; n-=4, in+=4*stride, out+=4*32, counter+=inc?4:0) ub3_four(in,blocks,counter,inc,flags,fstart,fend,out);
+#endif
+  for (; n>0; n--, in+=stride, out+=32, counter+=inc?1:0) ub3_one(in,blocks,counter,flags,fstart,fend,out);
+}
+
+// The chaining value of len bytes at chunk counter of the input, where len is
+// a power of two number of chunks, two or more, so they make a subtree
+void ub3_subtree(const unsigned char *in, size_t len, unsigned __int64 counter, unsigned char *out)
+{ size_t n=len/UB3_CHUNK;
+  std::vector<unsigned char> cvs(n*32);
+  ub3_many(in,n,UB3_CHUNK/64,counter,true,0,UB3_CHUNK_START,UB3_CHUNK_END,&cvs[0]);
+  for (; n>1; n/=2) ub3_many(&cvs[0],n/2,1,0,false,UB3_PARENT,0,0,&cvs[0]);
+  memcpy(out,&cvs[0],32);
+}
+
+typedef struct
+{ unsigned int cv[8];          // of the chunk so far
+  unsigned int blocks;         // how many of its blocks that's had
+  unsigned char buf[64];       // and the next, which isn't compressed until we know it's not the last
+  unsigned int buflen;
+  unsigned __int64 chunks;     // before this one
+  unsigned char stack[UB3_MAXDEPTH][32]; // chaining values of subtrees not yet joined, biggest first
+  unsigned int depth;
+} ub3_ctx;
+
+void ub3_init(ub3_ctx *c) {memcpy(c->cv,ub3_iv,32); c->blocks=0; c->buflen=0; c->chunks=0; c->depth=0;}
+
+// Joins the subtrees so far into as few as the chunks so far make (one per bit
+// set in their count). That's only done once there's input after them, since
+// the last of them might yet be the root's child, which is flagged differently.
+void ub3_merge(ub3_ctx *c)
+{ unsigned int keep=0; for (unsigned __int64 t=c->chunks; t!=0; t&=t-1) keep++;
+  while (c->depth>keep) {c->depth--; ub3_many(c->stack[c->depth-1],1,1,0,false,UB3_PARENT,0,0,c->stack[c->depth-1]);}
+}
+
+// Adds a subtree of nchunks whole chunks, the next in the input
+void ub3_push(ub3_ctx *c, const unsigned char *cv, unsigned __int64 nchunks)
+{ ub3_merge(c);
+  memcpy(c->stack[c->depth++],cv,32);
+  c->chunks+=nchunks;
+}
+
+void ub3_update(ub3_ctx *c, const unsigned char *p, size_t n)
+{ while (n>0)
+  { if (c->blocks==0 && c->buflen==0 && n>UB3_CHUNK)
+    { // whole chunks with more after them, side by side
+      unsigned char cvs[64*32]; size_t k=(n-1)/UB3_CHUNK; if (k>64) k=64;
+      ub3_many(p,k,UB3_CHUNK/64,c->chunks,true,0,UB3_CHUNK_START,UB3_CHUNK_END,cvs);
+      if (k==64 && (c->chunks&63)==0)
+      { // they're a subtree, and its parents can go side by side too
+        for (size_t j=k; j>1; j/=2) ub3_many(cvs,j/2,1,0,false,UB3_PARENT,0,0,cvs);
+        ub3_push(c,cvs,64);
+      }
+      else for (size_t i=0; i<k; i++) ub3_push(c,cvs+32*i,1);
+      p+=k*UB3_CHUNK; n-=k*UB3_CHUNK; continue;
+    }
+    if (c->buflen==64)
+    { bool end = c->blocks==UB3_CHUNK/64-1;
+      ub3_compress(c->cv,c->buf,64,c->chunks,(c->blocks==0?UB3_CHUNK_START:0)|(end?UB3_CHUNK_END:0));
+      c->blocks++; c->buflen=0;
+      if (end)
+      { unsigned char cv[32]; for (int i=0; i<8; i++) ub3_put32(cv+4*i,c->cv[i]);
+        ub3_push(c,cv,1); memcpy(c->cv,ub3_iv,32); c->blocks=0;
+      }
+      continue;
+    }
+    unsigned int take = 64-c->buflen; if (take>n) take=(unsigned int)n;
+    memcpy(c->buf+c->buflen,p,take); c->buflen+=take; p+=take; n-=take;
+    if (n==0) ub3_merge(c);
+  }
+}
+
+// The hash: the chunk in hand, then the subtrees from the last back, each the
+// right child of a parent; whichever of those is compressed last is the root
+void ub3_final(const ub3_ctx *c, unsigned char *out)
+{ unsigned int cv[8]; memcpy(cv,c->cv,32);
+  unsigned char block[64]; memset(block,0,64); memcpy(block,c->buf,c->buflen);
+  unsigned int blocklen=c->buflen, flags=(c->blocks==0?UB3_CHUNK_START:0)|UB3_CHUNK_END;
+  unsigned __int64 counter=c->chunks;
+  for (unsigned int i=c->depth;; i--)
+  { ub3_compress(cv,block,blocklen,counter,flags|(i==0?UB3_ROOT:0));
+    if (i==0) break;
+    memcpy(block,c->stack[i-1],32); for (int k=0; k<8; k++) ub3_put32(block+32+4*k,cv[k]);
+    memcpy(cv,ub3_iv,32); blocklen=64; counter=0; flags=UB3_PARENT;
+  }
+  for (int k=0; k<8; k++) ub3_put32(out+4*k,cv[k]);
+}
+
+
 
 // zutil.c -- target dependent utility functions for the compression library
 // Copyright (C) 1995-1998 Jean-loup Gailly.
@@ -2378,11 +3060,11 @@ int inflateEnd(z_streamp z)
 }
 
 
-int inflateInit2(z_streamp z)
+int inflateInit2(z_streamp z, int w)
 { const char *version = ZLIB_VERSION; int stream_size = sizeof(z_stream);
   if (version == Z_NULL || version[0] != ZLIB_VERSION[0] || stream_size != sizeof(z_stream)) return Z_VERSION_ERROR;
 
-  int w = -15; // MAX_WBITS: 32K LZ77 window.
+  // w is windowBits, e.g. 15 for MAX_WBITS, a 32K LZ77 window, or -15 for that with no zlib header or check.
   // Warning: reducing MAX_WBITS makes minigzip unable to extract .gz files created by gzip.
   // The memory requirements for deflate are (in bytes):
   //            (1 << (windowBits+2)) +  (1 << (memLevel+9))
@@ -2504,7 +3186,7 @@ int inflate(z_streamp z, int f)
       z->state->sub.check.need += (uLong)IM_NEXTBYTE << 8;
       z->state->mode = IM_DICT1;
     case IM_DICT1:
-      IM_NEEDBYTE; r;
+      IM_NEEDBYTE
       z->state->sub.check.need += (uLong)IM_NEXTBYTE;
       z->adler = z->state->sub.check.need;
       z->state->mode = IM_DICT0;
@@ -2596,168 +3278,744 @@ typedef struct unz_file_info_internal_s
 } unz_file_info_internal;
 
 
-typedef struct
-{ bool is_handle; // either a handle or memory
-  bool canseek;
-  // for handles:
-  HANDLE h; bool herr; unsigned long initial_offset; bool mustclosehandle;
-  // for memory:
-  void *buf; unsigned int len,pos; // if it's a memory block
-} LUFILE;
+// upl_ -- the platform layer. Everything the engine asks of the file system
+// goes through these, with one implementation on Win32 and one on POSIX, so
+// that the same engine builds and behaves the same with MSVC and GCC/Clang.
+// Files are HANDLEs on both; on POSIX a HANDLE holds a file descriptor.
+// Paths are TCHARs; on POSIX they're UTF-8 and backslashes mean slashes.
+// Seekable files are read and written by offset (pread/pwrite) rather than
+// through a shared file pointer.
 
+#ifdef _WIN32
 
-LUFILE *lufopen(void *z,unsigned int len,DWORD flags,ZRESULT *err)
-{ if (flags!=ZIP_HANDLE && flags!=ZIP_FILENAME && flags!=ZIP_MEMORY) {*err=ZR_ARGS; return NULL;}
-  //
-  HANDLE h=0; bool canseek=false; *err=ZR_OK;
-  bool mustclosehandle=false;
-  if (flags==ZIP_HANDLE||flags==ZIP_FILENAME)
-  { if (flags==ZIP_HANDLE)
-    { HANDLE hf = z;
-      h=hf; mustclosehandle=false;
-#ifdef DuplicateHandle
-      BOOL res = DuplicateHandle(GetCurrentProcess(),hf,GetCurrentProcess(),&h,0,FALSE,DUPLICATE_SAME_ACCESS);
-      if (!res) mustclosehandle=true;
-#endif
-    }
-    else
-    { h=CreateFile((const TCHAR*)z,GENERIC_READ,FILE_SHARE_READ,NULL,OPEN_EXISTING,FILE_ATTRIBUTE_NORMAL,NULL);
-      if (h==INVALID_HANDLE_VALUE) {*err=ZR_NOFILE; return NULL;}
-      mustclosehandle=true;
-    }
-    // test if we can seek on it. We can't use GetFileType(h)==FILE_TYPE_DISK since it's not on CE.
-    DWORD res = SetFilePointer(h,0,0,FILE_CURRENT);
-    canseek = (res!=0xFFFFFFFF);
-  }
-  LUFILE *lf = new LUFILE;
-  if (flags==ZIP_HANDLE||flags==ZIP_FILENAME)
-  { lf->is_handle=true; lf->mustclosehandle=mustclosehandle;
-    lf->canseek=canseek;
-    lf->h=h; lf->herr=false;
-    lf->initial_offset=0;
-    if (canseek) lf->initial_offset = SetFilePointer(h,0,NULL,FILE_CURRENT);
-  }
-  else
-  { lf->is_handle=false;
-    lf->canseek=true;
-    lf->mustclosehandle=false;
-    lf->buf=z; lf->len=len; lf->pos=0; lf->initial_offset=0;
-  }
-  *err=ZR_OK;
-  return lf;
+#define UPL_SLASH _T("\\")
+
+HANDLE upl_open(const TCHAR *fn)
+{ return CreateFile(fn,GENERIC_READ,FILE_SHARE_READ,NULL,OPEN_EXISTING,FILE_ATTRIBUTE_NORMAL,NULL);
 }
 
+HANDLE upl_create(const TCHAR *fn,DWORD attr)
+{ return CreateFile(fn,GENERIC_WRITE,0,NULL,CREATE_ALWAYS,attr,NULL);
+}
 
-int lufclose(LUFILE *stream)
-{ if (stream==NULL) return EOF;
-  if (stream->mustclosehandle) CloseHandle(stream->h);
-  delete stream;
-  return 0;
+HANDLE upl_dup(HANDLE h)
+{ HANDLE hdup;
+  if (!DuplicateHandle(GetCurrentProcess(),h,GetCurrentProcess(),&hdup,0,FALSE,DUPLICATE_SAME_ACCESS)) return INVALID_HANDLE_VALUE;
+  return hdup;
 }
 
-int luferror(LUFILE *stream)
-{ if (stream->is_handle && stream->herr) return 1;
-  else return 0;
+void upl_close(HANDLE h) {CloseHandle(h);}
+
+// Where h's file pointer is; false if it hasn't got one (e.g. a pipe)
+bool upl_tell(HANDLE h,__int64 *pos)
+{ LARGE_INTEGER zero, cur; zero.QuadPart=0;
+  if (!SetFilePointerEx(h,zero,&cur,FILE_CURRENT)) return false;
+  *pos=cur.QuadPart; return true;
 }
 
-long int luftell(LUFILE *stream)
-{ if (stream->is_handle && stream->canseek) return SetFilePointer(stream->h,0,NULL,FILE_CURRENT)-stream->initial_offset;
-  else if (stream->is_handle) return 0;
-  else return stream->pos;
+bool upl_size(HANDLE h,__int64 *size)
+{ LARGE_INTEGER li; if (!GetFileSizeEx(h,&li)) return false;
+  *size=li.QuadPart; return true;
 }
 
-int lufseek(LUFILE *stream, long offset, int whence)
-{ if (stream->is_handle && stream->canseek)
-  { if (whence==SEEK_SET) SetFilePointer(stream->h,stream->initial_offset+offset,0,FILE_BEGIN);
-    else if (whence==SEEK_CUR) SetFilePointer(stream->h,offset,NULL,FILE_CURRENT);
-    else if (whence==SEEK_END) SetFilePointer(stream->h,offset,NULL,FILE_END);
-    else return 19; // EINVAL
-    return 0;
-  }
-  else if (stream->is_handle) return 29; // ESPIPE
-  else
-  { if (whence==SEEK_SET) stream->pos=offset;
-    else if (whence==SEEK_CUR) stream->pos+=offset;
-    else if (whence==SEEK_END) stream->pos=stream->len+offset;
-    return 0;
-  }
+bool upl_read(HANDLE h,void *buf,unsigned int len,unsigned int *red)
+{ DWORD r=0; BOOL ok=ReadFile(h,buf,len,&r,NULL); *red=r; return ok!=FALSE;
 }
 
+bool upl_pread(HANDLE h,void *buf,unsigned int len,__int64 off,unsigned int *red)
+{ OVERLAPPED ov; ZeroMemory(&ov,sizeof(ov));
+  ov.Offset=(DWORD)off; ov.OffsetHigh=(DWORD)(off>>32);
+  DWORD r=0; BOOL ok=ReadFile(h,buf,len,&r,&ov); *red=r;
+  return ok!=FALSE || GetLastError()==ERROR_HANDLE_EOF;
+}
 
-size_t lufread(void *ptr,size_t size,size_t n,LUFILE *stream)
-{ unsigned int toread = (unsigned int)(size*n);
-  if (stream->is_handle)
-  { DWORD red; BOOL res = ReadFile(stream->h,ptr,toread,&red,NULL);
-    if (!res) stream->herr=true;
-    return red/size;
-  }
-  if (stream->pos+toread > stream->len) toread = stream->len-stream->pos;
-  memcpy(ptr, (char*)stream->buf + stream->pos, toread); DWORD red = toread;
-  stream->pos += red;
-  return red/size;
+// A read-only view of h's first len bytes; 0 if it can't be mapped (e.g. it
+// won't fit in a 32-bit process's address space)
+const void *upl_map(HANDLE h,__int64 len)
+{ if (len<=0 || (unsigned __int64)len>(SIZE_T)-1) return 0;
+  HANDLE hm = CreateFileMapping(h,NULL,PAGE_READONLY,0,0,NULL);
+  if (hm==NULL) return 0;
+  const void *view = MapViewOfFile(hm,FILE_MAP_READ,0,0,(SIZE_T)len);
+  CloseHandle(hm); // the view keeps the mapping open
+  return view;
 }
 
+void upl_unmap(const void *view,__int64) {UnmapViewOfFile(view);}
 
+bool upl_write(HANDLE h,const void *buf,unsigned int len)
+{ DWORD writ; BOOL ok=WriteFile(h,buf,len,&writ,NULL); return ok!=FALSE && writ==len;
+}
 
+bool upl_pwrite(HANDLE h,const void *buf,unsigned int len,__int64 off)
+{ OVERLAPPED ov; ZeroMemory(&ov,sizeof(ov));
+  ov.Offset=(DWORD)off; ov.OffsetHigh=(DWORD)(off>>32);
+  DWORD writ; BOOL ok=WriteFile(h,buf,len,&writ,&ov); return ok!=FALSE && writ==len;
+}
 
-// file_in_zip_read_info_s contain internal information about a file in zipfile,
-//  when reading and decompress it
-typedef struct
-{
-	char  *read_buffer;         // internal buffer for compressed data
-	z_stream stream;            // zLib stream structure for inflate
+void upl_settimes(HANDLE h,const FILETIME *ctime,const FILETIME *atime,const FILETIME *mtime)
+{ SetFileTime(h,ctime,atime,mtime); // may fail if it was a pipe
+}
 
-	uLong pos_in_zipfile;       // position in byte on the zipfile, for fseek
-	uLong stream_initialised;   // flag set if stream structure is initialised
+// root, if given, has a trailing slash and dir is relative to it
+bool upl_isdir(const TCHAR *root,const TCHAR *dir)
+{ TCHAR cd[MAX_PATH]; *cd=0; if (root!=0) _tcscpy_s(cd,MAX_PATH,root); _tcscat_s(cd,dir);
+  DWORD a=GetFileAttributes(cd); return a!=0xFFFFFFFF && (a&FILE_ATTRIBUTE_DIRECTORY)!=0;
+}
 
-	uLong offset_local_extrafield;// offset of the local extra field
-	uInt  size_local_extrafield;// size of the local extra field
-	uLong pos_local_extrafield;   // position in the local extra field in read
+bool upl_mkdir(const TCHAR *root,const TCHAR *dir)
+{ TCHAR cd[MAX_PATH]; *cd=0; if (root!=0) _tcscpy_s(cd,MAX_PATH,root); _tcscat_s(cd,dir);
+  return CreateDirectory(cd,NULL)!=FALSE;
+}
 
-	uLong crc32;                // crc32 of all data uncompressed
-	uLong crc32_wait;           // crc32 we must obtain after decompress all
-	uLong rest_read_compressed; // number of byte to be decompressed
-	uLong rest_read_uncompressed;//number of byte to be obtained after decomp
-	LUFILE* file;                 // io structore of the zipfile
-	uLong compression_method;   // compression method (0==store)
-	uLong byte_before_the_zipfile;// byte before the zipfile, (>0 for sfx)
-  bool encrypted;               // is it encrypted?
-  unsigned long keys[3];        // decryption keys, initialized by unzOpenCurrentFile
-  int encheadleft;              // the first call(s) to unzReadCurrentFile will read this many encryption-header bytes first
-  char crcenctest;              // if encrypted, we'll check the encryption buffer against this
-} file_in_zip_read_info_s;
+bool upl_delete(const TCHAR *fn)
+{ if (DeleteFile(fn)) return true;
+  SetFileAttributes(fn,FILE_ATTRIBUTE_NORMAL); // it might have been unzipped read-only
+  return DeleteFile(fn)!=FALSE;
+}
 
+bool upl_rename(const TCHAR *from,const TCHAR *to) {return MoveFileEx(from,to,MOVEFILE_REPLACE_EXISTING)!=FALSE;}
+bool upl_link(const TCHAR *from,const TCHAR *to) {return CreateHardLink(to,from,NULL)!=FALSE;}
+bool upl_copy(const TCHAR *from,const TCHAR *to) {return CopyFile(from,to,FALSE)!=FALSE;}
+// CopyFile already clones blocks on the filesystems that can (ReFS), so there's nothing to add
+bool upl_clone(const TCHAR *,const TCHAR *) {return false;}
 
-// unz_s contain internal information about the zipfile
-typedef struct
-{
-	LUFILE* file;               // io structore of the zipfile
-	unz_global_info gi;         // public global information
-	uLong byte_before_the_zipfile;// byte before the zipfile, (>0 for sfx)
-	uLong num_file;             // number of the current file in the zipfile
-	uLong pos_in_central_dir;   // pos of the current file in the central dir
-	uLong current_file_ok;      // flag about the usability of the current file
-	uLong central_pos;          // position of the beginning of the central dir
+void upl_settimesfn(const TCHAR *fn,const FILETIME *ctime,const FILETIME *atime,const FILETIME *mtime)
+{ HANDLE h=CreateFile(fn,FILE_WRITE_ATTRIBUTES,FILE_SHARE_READ|FILE_SHARE_WRITE|FILE_SHARE_DELETE,NULL,OPEN_EXISTING,FILE_ATTRIBUTE_NORMAL,NULL);
+  if (h==INVALID_HANDLE_VALUE) return;
+  SetFileTime(h,ctime,atime,mtime); CloseHandle(h);
+}
 
-	uLong size_central_dir;     // size of the central directory
-	uLong offset_central_dir;   // offset of start of central directory with respect to the starting disk number
+// sets fn's modify time to now
+void upl_touch(const TCHAR *fn)
+{ HANDLE h=CreateFile(fn,FILE_WRITE_ATTRIBUTES,FILE_SHARE_READ|FILE_SHARE_WRITE|FILE_SHARE_DELETE,NULL,OPEN_EXISTING,FILE_ATTRIBUTE_NORMAL,NULL);
+  if (h==INVALID_HANDLE_VALUE) return;
+  FILETIME now; GetSystemTimeAsFileTime(&now);
+  SetFileTime(h,NULL,NULL,&now); CloseHandle(h);
+}
 
-	unz_file_info cur_file_info; // public info about the current file in zip
-	unz_file_info_internal cur_file_info_internal; // private info about it
-    file_in_zip_read_info_s* pfile_in_zip_read; // structure about the current file if we are decompressing it
-} unz_s, *unzFile;
+// Calls proc for each file (not directory) in dir, which has a trailing slash,
+// with its size and modify time. The times only mean anything compared to each other.
+typedef void (*upl_listproc)(void *param,const TCHAR *name,__int64 size,__int64 mtime);
+void upl_list(const TCHAR *dir,upl_listproc proc,void *param)
+{ TCHAR pat[MAX_PATH]; wsprintf(pat,_T("%s*"),dir);
+  WIN32_FIND_DATA fd; HANDLE h=FindFirstFile(pat,&fd);
+  if (h==INVALID_HANDLE_VALUE) return;
+  do
+  { if ((fd.dwFileAttributes&FILE_ATTRIBUTE_DIRECTORY)!=0) continue;
+    __int64 size = ((__int64)fd.nFileSizeHigh<<32) | fd.nFileSizeLow;
+    __int64 mtime = ((__int64)fd.ftLastWriteTime.dwHighDateTime<<32) | fd.ftLastWriteTime.dwLowDateTime;
+    proc(param,fd.cFileName,size,mtime);
+  } while (FindNextFile(h,&fd));
+  FindClose(h);
+}
 
+// Calls proc for each file and directory in dir, which has a trailing slash, but not . or ..
+typedef void (*upl_walkproc)(void *param,const TCHAR *name,bool isdir);
+void upl_walk(const TCHAR *dir,upl_walkproc proc,void *param)
+{ TCHAR pat[MAX_PATH]; wsprintf(pat,_T("%s*"),dir);
+  WIN32_FIND_DATA fd; HANDLE h=FindFirstFile(pat,&fd);
+  if (h==INVALID_HANDLE_VALUE) return;
+  do
+  { if (_tcscmp(fd.cFileName,_T("."))==0 || _tcscmp(fd.cFileName,_T(".."))==0) continue;
+    proc(param,fd.cFileName,(fd.dwFileAttributes&FILE_ATTRIBUTE_DIRECTORY)!=0);
+  } while (FindNextFile(h,&fd));
+  FindClose(h);
+}
 
-int unzStringFileNameCompare (const char* fileName1,const char* fileName2,int iCaseSensitivity);
-//   Compare two filename (fileName1,fileName2).
+bool upl_stat(const TCHAR *fn,__int64 *size,FILETIME *mtime,DWORD *attr)
+{ WIN32_FILE_ATTRIBUTE_DATA fad;
+  if (!GetFileAttributesEx(fn,GetFileExInfoStandard,&fad)) return false;
+  *size = ((__int64)fad.nFileSizeHigh<<32) | fad.nFileSizeLow;
+  *mtime = fad.ftLastWriteTime; *attr = fad.dwFileAttributes;
+  return true;
+}
 
-z_off_t unztell (unzFile file);
-//  Give the current position in uncompressed data
+// the other way from upl_dostime: utc to a zip's local dos time
+void upl_filetimedos(const FILETIME *ft,WORD *dosdate,WORD *dostime)
+{ FILETIME ftl; FileTimeToLocalFileTime(ft,&ftl);
+  if (!FileTimeToDosDateTime(&ftl,dosdate,dostime)) {*dosdate=(1<<5)|1; *dostime=0;}
+}
 
-int unzeof (unzFile file);
-//  return 1 if the end of file was reached, 0 elsewhere
+void upl_getcwd(TCHAR *buf,unsigned int len)
+{ if (GetCurrentDirectory(len,buf)==0) _tcscpy_s(buf,len,UPL_SLASH);
+}
 
-int unzGetLocalExtrafield (unzFile file, voidp buf, unsigned len);
+// wsprintf into buf, which is len long; false if it didn't fit
+bool upl_format(TCHAR *buf,unsigned int len,const TCHAR *fmt,...)
+{ va_list va; va_start(va,fmt);
+  int n=_vsntprintf_s(buf,len,_TRUNCATE,fmt,va);
+  va_end(va);
+  return n>=0;
+}
+
+unsigned int upl_pid() {return GetCurrentProcessId();}
+
+// For the rest of this thread's life, its CPU, I/O and memory priority are low,
+// unless upl_foreground puts them back
+void upl_background() {SetThreadPriority(GetCurrentThread(),THREAD_MODE_BACKGROUND_BEGIN);}
+void upl_foreground() {SetThreadPriority(GetCurrentThread(),THREAD_MODE_BACKGROUND_END);}
+
+FILETIME dosdatetime2filetime(WORD dosdate,WORD dostime);
+
+// a zip's dos time is local, but ZIPENTRY times are utc
+FILETIME upl_dostime(WORD dosdate,WORD dostime)
+{ FILETIME ftd = dosdatetime2filetime(dosdate,dostime);
+  FILETIME ft; LocalFileTimeToFileTime(&ftd,&ft);
+  return ft;
+}
+
+#else
+
+typedef uint16_t WORD;
+typedef int BOOL;
+typedef long long LONGLONG;
+#define __int32 int
+#define _T(x) x
+#define UPL_SLASH "/"
+#define Int32x32To64(a,b) ((LONGLONG)(int32_t)(a)*(LONGLONG)(int32_t)(b))
+#define ZeroMemory(p,n) memset((p),0,(n))
+#define wsprintf sprintf
+#define _tcslen strlen
+#define _tcscpy strcpy
+#define _tcsstr strstr
+#define _tcscmp strcmp
+#define _tcscpy_s(d,n,s) snprintf((d),(n),"%s",(s))
+#define _tcsncpy_s(d,n,s,c) snprintf((d),(n),"%.*s",(int)(c),(s))
+#define strcpy_s(d,n,s) snprintf((d),(n),"%s",(s))
+template <size_t N> inline void _tcscat_s(char (&d)[N],const char *s) {strncat(d,s,N-strlen(d)-1);}
+
+inline int upl_fd(HANDLE h) {return (int)(intptr_t)h;}
+
+// Backslashes are as good as slashes in a zip, but not to open()
+void upl_path(char *dst,const char *src)
+{ snprintf(dst,MAX_PATH,"%s",src);
+  for (char *c=dst; *c!=0; c++) if (*c=='\\') *c='/';
+}
+
+HANDLE upl_open(const TCHAR *fn)
+{ char path[MAX_PATH]; upl_path(path,fn);
+  int fd = open(path,O_RDONLY|O_CLOEXEC);
+  return fd<0 ? INVALID_HANDLE_VALUE : (HANDLE)(intptr_t)fd;
+}
+
+HANDLE upl_create(const TCHAR *fn,DWORD attr)
+{ char path[MAX_PATH]; upl_path(path,fn);
+  int fd = open(path,O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC,(attr&FILE_ATTRIBUTE_READONLY)?0444:0666);
+  return fd<0 ? INVALID_HANDLE_VALUE : (HANDLE)(intptr_t)fd;
+}
+
+HANDLE upl_dup(HANDLE h)
+{ int fd = fcntl(upl_fd(h),F_DUPFD_CLOEXEC,0);
+  return fd<0 ? INVALID_HANDLE_VALUE : (HANDLE)(intptr_t)fd;
+}
+
+void upl_close(HANDLE h) {close(upl_fd(h));}
+
+bool upl_tell(HANDLE h,__int64 *pos)
+{ off_t off = lseek(upl_fd(h),0,SEEK_CUR); if (off<0) return false;
+  *pos=off; return true;
+}
+
+bool upl_size(HANDLE h,__int64 *size)
+{ struct stat st; if (fstat(upl_fd(h),&st)!=0) return false;
+  *size=st.st_size; return true;
+}
+
+bool upl_read(HANDLE h,void *buf,unsigned int len,unsigned int *red)
+{ ssize_t r; do r=read(upl_fd(h),buf,len); while (r<0 && errno==EINTR);
+  *red = r<0 ? 0 : (unsigned int)r; return r>=0;
+}
+
+bool upl_pread(HANDLE h,void *buf,unsigned int len,__int64 off,unsigned int *red)
+{ ssize_t r; do r=pread(upl_fd(h),buf,len,(off_t)off); while (r<0 && errno==EINTR);
+  *red = r<0 ? 0 : (unsigned int)r; return r>=0;
+}
+
+const void *upl_map(HANDLE h,__int64 len)
+{ if (len<=0 || (unsigned long long)len>(size_t)-1) return 0;
+  void *view = mmap(NULL,(size_t)len,PROT_READ,MAP_SHARED,upl_fd(h),0);
+  return view==MAP_FAILED ? 0 : view;
+}
+
+void upl_unmap(const void *view,__int64 len) {munmap((void*)view,(size_t)len);}
+
+bool upl_write(HANDLE h,const void *buf,unsigned int len)
+{ const char *p=(const char*)buf;
+  while (len>0)
+  { ssize_t r=write(upl_fd(h),p,len);
+    if (r<0 && errno==EINTR) continue;
+    if (r<=0) return false;
+    p+=r; len-=(unsigned int)r;
+  }
+  return true;
+}
+
+bool upl_pwrite(HANDLE h,const void *buf,unsigned int len,__int64 off)
+{ const char *p=(const char*)buf;
+  while (len>0)
+  { ssize_t r=pwrite(upl_fd(h),p,len,(off_t)off);
+    if (r<0 && errno==EINTR) continue;
+    if (r<=0) return false;
+    p+=r; len-=(unsigned int)r; off+=r;
+  }
+  return true;
+}
+
+// POSIX has no creation time to set
+void upl_settimes(HANDLE h,const FILETIME *,const FILETIME *atime,const FILETIME *mtime)
+{ struct timespec ts[2]; const FILETIME *ft[2]={atime,mtime};
+  for (int i=0; i<2; i++)
+  { LONGLONG t = (((LONGLONG)ft[i]->dwHighDateTime)<<32 | ft[i]->dwLowDateTime) - 116444736000000000LL;
+    ts[i].tv_sec=(time_t)(t/10000000); ts[i].tv_nsec=(long)(t%10000000)*100;
+    if (ts[i].tv_nsec<0) {ts[i].tv_sec--; ts[i].tv_nsec+=1000000000;}
+  }
+  futimens(upl_fd(h),ts); // may fail if it was a pipe
+}
+
+// root, if given, has a trailing slash and dir is relative to it;
+// we look dir up from root's descriptor with the *at calls
+int upl_openroot(const TCHAR *root)
+{ if (root==0) return AT_FDCWD;
+  char path[MAX_PATH]; upl_path(path,root);
+  return open(path,O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+}
+
+bool upl_isdir(const TCHAR *root,const TCHAR *dir)
+{ int dfd=upl_openroot(root); if (dfd==-1) return false;
+  char path[MAX_PATH]; upl_path(path,*dir==0?".":dir);
+  struct stat st; bool ok = fstatat(dfd,path,&st,0)==0 && S_ISDIR(st.st_mode);
+  if (dfd!=AT_FDCWD) close(dfd);
+  return ok;
+}
+
+bool upl_mkdir(const TCHAR *root,const TCHAR *dir)
+{ int dfd=upl_openroot(root); if (dfd==-1) return false;
+  char path[MAX_PATH]; upl_path(path,dir);
+  bool ok = mkdirat(dfd,path,0777)==0;
+  if (dfd!=AT_FDCWD) close(dfd);
+  return ok;
+}
+
+bool upl_delete(const TCHAR *fn) {char path[MAX_PATH]; upl_path(path,fn); return unlink(path)==0;}
+
+bool upl_rename(const TCHAR *from,const TCHAR *to)
+{ char src[MAX_PATH], dst[MAX_PATH]; upl_path(src,from); upl_path(dst,to);
+  return rename(src,dst)==0;
+}
+
+bool upl_link(const TCHAR *from,const TCHAR *to)
+{ char src[MAX_PATH], dst[MAX_PATH]; upl_path(src,from); upl_path(dst,to);
+  return link(src,dst)==0;
+}
+
+bool upl_copy(const TCHAR *from,const TCHAR *to)
+{ HANDLE hsrc=upl_open(from); if (hsrc==INVALID_HANDLE_VALUE) return false;
+  HANDLE hdst=upl_create(to,0); if (hdst==INVALID_HANDLE_VALUE) {upl_close(hsrc); return false;}
+  char buf[65536]; unsigned int red; bool ok;
+  while ((ok=upl_read(hsrc,buf,sizeof(buf),&red)) && red>0 && (ok=upl_write(hdst,buf,red))) {}
+  upl_close(hsrc); upl_close(hdst);
+  if (!ok) upl_delete(to);
+  return ok;
+}
+
+// a copy-on-write copy, on filesystems that can (btrfs, xfs)
+bool upl_clone(const TCHAR *from,const TCHAR *to)
+{
+#ifdef FICLONE
+  HANDLE hsrc=upl_open(from); if (hsrc==INVALID_HANDLE_VALUE) return false;
+  HANDLE hdst=upl_create(to,0); if (hdst==INVALID_HANDLE_VALUE) {upl_close(hsrc); return false;}
+  bool ok = ioctl(upl_fd(hdst),FICLONE,upl_fd(hsrc))==0;
+  upl_close(hsrc); upl_close(hdst);
+  if (!ok) upl_delete(to);
+  return ok;
+#else
+  return false;
+#endif
+}
+
+void upl_settimesfn(const TCHAR *fn,const FILETIME *ctime,const FILETIME *atime,const FILETIME *mtime)
+{ HANDLE h=upl_open(fn); if (h==INVALID_HANDLE_VALUE) return;
+  upl_settimes(h,ctime,atime,mtime); upl_close(h);
+}
+
+void upl_touch(const TCHAR *fn) {char path[MAX_PATH]; upl_path(path,fn); utimensat(AT_FDCWD,path,NULL,0);}
+
+typedef void (*upl_listproc)(void *param,const TCHAR *name,__int64 size,__int64 mtime);
+void upl_list(const TCHAR *dir,upl_listproc proc,void *param)
+{ char path[MAX_PATH]; upl_path(path,dir);
+  DIR *d=opendir(path); if (d==0) return;
+  struct dirent *de;
+  while ((de=readdir(d))!=0)
+  { struct stat st;
+    if (fstatat(dirfd(d),de->d_name,&st,0)!=0 || !S_ISREG(st.st_mode)) continue;
+    proc(param,de->d_name,st.st_size,(__int64)st.st_mtim.tv_sec*1000000000+st.st_mtim.tv_nsec);
+  }
+  closedir(d);
+}
+
+typedef void (*upl_walkproc)(void *param,const TCHAR *name,bool isdir);
+void upl_walk(const TCHAR *dir,upl_walkproc proc,void *param)
+{ char path[MAX_PATH]; upl_path(path,dir);
+  DIR *d=opendir(path); if (d==0) return;
+  struct dirent *de;
+  while ((de=readdir(d))!=0)
+  { struct stat st;
+    if (strcmp(de->d_name,".")==0 || strcmp(de->d_name,"..")==0) continue;
+    if (fstatat(dirfd(d),de->d_name,&st,0)!=0) continue;
+    if (S_ISDIR(st.st_mode) || S_ISREG(st.st_mode)) proc(param,de->d_name,S_ISDIR(st.st_mode));
+  }
+  closedir(d);
+}
+
+bool upl_stat(const TCHAR *fn,__int64 *size,FILETIME *mtime,DWORD *attr)
+{ char path[MAX_PATH]; upl_path(path,fn);
+  struct stat st; if (stat(path,&st)!=0) return false;
+  *size = S_ISREG(st.st_mode) ? st.st_size : 0;
+  unsigned __int64 t = ((unsigned __int64)st.st_mtim.tv_sec+11644473600ULL)*10000000ULL + st.st_mtim.tv_nsec/100;
+  mtime->dwLowDateTime=(DWORD)t; mtime->dwHighDateTime=(DWORD)(t>>32);
+  *attr = S_ISDIR(st.st_mode) ? FILE_ATTRIBUTE_DIRECTORY : FILE_ATTRIBUTE_ARCHIVE;
+  if ((st.st_mode&0222)==0) *attr|=FILE_ATTRIBUTE_READONLY;
+  return true;
+}
+
+void upl_filetimedos(const FILETIME *ft,WORD *dosdate,WORD *dostime)
+{ unsigned __int64 t = ((unsigned __int64)ft->dwHighDateTime<<32) | ft->dwLowDateTime;
+  time_t tt = (time_t)(t/10000000ULL) - (time_t)11644473600LL;
+  struct tm tm; localtime_r(&tt,&tm);
+  if (tm.tm_year<80) {*dosdate=(1<<5)|1; *dostime=0; return;}
+  *dosdate = (WORD)(((tm.tm_year-80)<<9) | ((tm.tm_mon+1)<<5) | tm.tm_mday);
+  *dostime = (WORD)((tm.tm_hour<<11) | (tm.tm_min<<5) | (tm.tm_sec/2));
+}
+
+void upl_getcwd(TCHAR *buf,unsigned int len)
+{ if (getcwd(buf,len)==0) _tcscpy_s(buf,len,UPL_SLASH);
+}
+
+bool upl_format(TCHAR *buf,unsigned int len,const TCHAR *fmt,...)
+{ va_list va; va_start(va,fmt);
+  int n=vsnprintf(buf,len,fmt,va);
+  va_end(va);
+  return n>=0 && (unsigned int)n<len;
+}
+
+unsigned int upl_pid() {return (unsigned int)getpid();}
+
+// Linux has per-thread nice values and I/O classes; elsewhere it's a no-op
+void upl_background()
+{
+#ifdef __linux__
+  pid_t tid=(pid_t)syscall(SYS_gettid);
+  setpriority(PRIO_PROCESS,(id_t)tid,19);
+  syscall(SYS_ioprio_set,1,(int)tid,3<<13); // IOPRIO_WHO_PROCESS, IOPRIO_CLASS_IDLE
+#endif
+}
+
+// As far as it's let: raising the nice value back needs CAP_SYS_NICE
+void upl_foreground()
+{
+#ifdef __linux__
+  pid_t tid=(pid_t)syscall(SYS_gettid);
+  setpriority(PRIO_PROCESS,(id_t)tid,0);
+  syscall(SYS_ioprio_set,1,(int)tid,(2<<13)|4); // IOPRIO_CLASS_BE, the default level
+#endif
+}
+
+FILETIME timet2filetime(const unsigned int t);
+
+FILETIME upl_dostime(WORD dosdate,WORD dostime)
+{ struct tm tm; memset(&tm,0,sizeof(tm));
+  tm.tm_year = ((dosdate>>9)&0x7f) + 80;
+  tm.tm_mon = ((dosdate>>5)&0xf) - 1;
+  tm.tm_mday = dosdate&0x1f;
+  tm.tm_hour = (dostime>>11)&0x1f;
+  tm.tm_min = (dostime>>5)&0x3f;
+  tm.tm_sec = (dostime&0x1f)*2;
+  tm.tm_isdst = -1;
+  return timet2filetime((unsigned int)mktime(&tm));
+}
+
+#endif
+
+
+
+
+typedef struct
+{ bool is_handle; // either a handle or memory
+  bool canseek;
+  // for handles:
+  HANDLE h; bool herr; __int64 initial_offset; bool mustclosehandle;
+  __int64 hpos;   // if canseek, where we're up to, relative to initial_offset
+  ZIPSOURCE *src; // if set, we read through this rather than h; mustclosehandle means it's ours
+  // for memory:
+  void *buf; unsigned int len,pos; // if it's a memory block
+} LUFILE;
+
+
+LUFILE *lufopen(void *z,unsigned int len,DWORD flags,ZRESULT *err)
+{ if (flags!=ZIP_HANDLE && flags!=ZIP_FILENAME && flags!=ZIP_MEMORY && flags!=ZIP_SOURCE) {*err=ZR_ARGS; return NULL;}
+  //
+  HANDLE h=0; bool canseek=false; *err=ZR_OK;
+  bool mustclosehandle=false; __int64 initial_offset=0;
+  if (flags==ZIP_HANDLE||flags==ZIP_FILENAME)
+  { if (flags==ZIP_HANDLE)
+    { HANDLE hf = z;
+      h=upl_dup(hf); mustclosehandle=true;
+      if (h==INVALID_HANDLE_VALUE) {h=hf; mustclosehandle=false;}
+    }
+    else
+    { h=upl_open((const TCHAR*)z);
+      if (h==INVALID_HANDLE_VALUE) {*err=ZR_NOFILE; return NULL;}
+      mustclosehandle=true;
+    }
+    // test if we can seek on it. We can't use GetFileType(h)==FILE_TYPE_DISK since it's not on CE.
+    canseek = upl_tell(h,&initial_offset);
+  }
+  LUFILE *lf = new LUFILE; lf->src=0;
+  if (flags==ZIP_SOURCE)
+  { const ZIPSOURCE *src = (const ZIPSOURCE*)z;
+    if (src->read==0 || src->size<0)
+    { if (src->close!=0) src->close(src->param);
+      *err=ZR_ARGS; delete lf; return NULL;
+    }
+    lf->is_handle=true; lf->mustclosehandle=true;
+    lf->canseek=true;
+    lf->h=INVALID_HANDLE_VALUE; lf->herr=false;
+    lf->initial_offset=0; lf->hpos=0;
+    lf->src=new ZIPSOURCE; *lf->src=*src;
+  }
+  else if (flags==ZIP_HANDLE||flags==ZIP_FILENAME)
+  { lf->is_handle=true; lf->mustclosehandle=mustclosehandle;
+    lf->canseek=canseek;
+    lf->h=h; lf->herr=false;
+    lf->initial_offset=canseek?initial_offset:0; lf->hpos=0;
+  }
+  else
+  { lf->is_handle=false;
+    lf->canseek=true;
+    lf->mustclosehandle=false;
+    lf->buf=z; lf->len=len; lf->pos=0; lf->initial_offset=0;
+  }
+  *err=ZR_OK;
+  return lf;
+}
+
+
+int lufclose(LUFILE *stream)
+{ if (stream==NULL) return EOF;
+  if (stream->mustclosehandle && stream->src!=0)
+  { if (stream->src->close!=0) stream->src->close(stream->src->param);
+    delete stream->src;
+  }
+  else if (stream->mustclosehandle) upl_close(stream->h);
+  delete stream;
+  return 0;
+}
+
+int luferror(LUFILE *stream)
+{ if (stream->is_handle && stream->herr) return 1;
+  else return 0;
+}
+
+long int luftell(LUFILE *stream)
+{ if (stream->is_handle && stream->canseek) return (long)stream->hpos;
+  else if (stream->is_handle) return 0;
+  else return stream->pos;
+}
+
+int lufseek(LUFILE *stream, long offset, int whence)
+{ if (stream->is_handle && stream->canseek)
+  { __int64 size;
+    if (whence==SEEK_SET) stream->hpos=offset;
+    else if (whence==SEEK_CUR) stream->hpos+=offset;
+    else if (whence==SEEK_END && stream->src!=0) stream->hpos=stream->src->size+offset;
+    else if (whence==SEEK_END && upl_size(stream->h,&size)) stream->hpos=size+offset-stream->initial_offset;
+    else return 19; // EINVAL
+    return 0;
+  }
+  else if (stream->is_handle) return 29; // ESPIPE
+  else
+  { if (whence==SEEK_SET) stream->pos=offset;
+    else if (whence==SEEK_CUR) stream->pos+=offset;
+    else if (whence==SEEK_END) stream->pos=stream->len+offset;
+    return 0;
+  }
+}
+
+
+size_t lufread(void *ptr,size_t size,size_t n,LUFILE *stream)
+{ unsigned int toread = (unsigned int)(size*n);
+  if (stream->is_handle)
+  { unsigned int red; bool res;
+    if (stream->src!=0) {res=stream->src->read(stream->src->param,stream->hpos,ptr,toread,&red); if (!res) red=0; stream->hpos+=red;}
+    else if (stream->canseek) {res=upl_pread(stream->h,ptr,toread,stream->initial_offset+stream->hpos,&red); stream->hpos+=red;}
+    else res=upl_read(stream->h,ptr,toread,&red);
+    if (!res) stream->herr=true;
+    return red/size;
+  }
+  if (stream->pos+toread > stream->len) toread = stream->len-stream->pos;
+  memcpy(ptr, (char*)stream->buf + stream->pos, toread); DWORD red = toread;
+  stream->pos += red;
+  return red/size;
+}
+
+
+
+
+// unz_decoder: how to decompress one zip compression method. Store (0) is
+// handled inline by unzReadCurrentFile; everything else goes through one of
+// these. If init fails it must clean up after itself; otherwise end is
+// called once the entry is closed. The z_stream is only used for its next_in/avail_in/next_out/avail_out
+// and totals, which decode must advance the same way inflate() does, and
+// decode returns Z_OK, Z_STREAM_END, or a zlib error code (Z_BUF_ERROR if it
+// could make no progress). Anything decode needs beyond that lives in *state.
+typedef struct
+{ uLong method;                                   // zip compression method id
+  int (*init)(z_stream *strm, void **state);
+  int (*decode)(z_stream *strm, void *state);
+  void (*end)(z_stream *strm, void *state);
+} unz_decoder;
+
+int unzlocal_InflateInit(z_stream *strm, void **state)
+{ *state=0;
+  strm->zalloc = (alloc_func)0;
+  strm->zfree = (free_func)0;
+  strm->opaque = (voidpf)0;
+  return inflateInit2(strm,-15);
+  // windowBits is passed < 0 to tell that there is no zlib header.
+  // Note that in this case inflate *requires* an extra "dummy" byte
+  // after the compressed stream in order to complete decompression and
+  // return Z_STREAM_END.
+  // In unzip, i don't wait absolutely Z_STREAM_END because I known the
+  // size of both compressed and uncompressed data
+}
+int unzlocal_InflateDecode(z_stream *strm, void *) {return inflate(strm,Z_SYNC_FLUSH);}
+void unzlocal_InflateEnd(z_stream *strm, void *) {inflateEnd(strm);}
+
+const unz_decoder unz_inflate_decoder = {Z_DEFLATED, unzlocal_InflateInit, unzlocal_InflateDecode, unzlocal_InflateEnd};
+
+#ifndef UNZ_NO_ZSTD
+// zstd (method 93 in APPNOTE 6.3.7): each entry is a single zstd frame.
+// The decoder is the vendored one in vendor/zstd.
+#define UNZ_ZSTD_METHOD 93
+
+int unzlocal_ZstdInit(z_stream *, void **state)
+{ ZSTD_DStream *zds = ZSTD_createDStream(); *state=zds;
+  if (zds==0) return Z_MEM_ERROR;
+  if (ZSTD_isError(ZSTD_initDStream(zds))) {ZSTD_freeDStream(zds); *state=0; return Z_STREAM_ERROR;}
+  return Z_OK;
+}
+int unzlocal_ZstdDecode(z_stream *strm, void *state)
+{ ZSTD_inBuffer in = {strm->next_in, strm->avail_in, 0};
+  ZSTD_outBuffer out = {strm->next_out, strm->avail_out, 0};
+  size_t res = ZSTD_decompressStream((ZSTD_DStream*)state,&out,&in);
+  if (ZSTD_isError(res)) return Z_DATA_ERROR;
+  strm->next_in += in.pos; strm->avail_in -= (uInt)in.pos; strm->total_in += (uLong)in.pos;
+  strm->next_out += out.pos; strm->avail_out -= (uInt)out.pos; strm->total_out += (uLong)out.pos;
+  if (res==0) return Z_STREAM_END;
+  if (in.pos==0 && out.pos==0) return Z_BUF_ERROR;
+  return Z_OK;
+}
+void unzlocal_ZstdEnd(z_stream *, void *state) {if (state!=0) ZSTD_freeDStream((ZSTD_DStream*)state);}
+
+const unz_decoder unz_zstd_decoder = {UNZ_ZSTD_METHOD, unzlocal_ZstdInit, unzlocal_ZstdDecode, unzlocal_ZstdEnd};
+#endif
+
+#define UNZ_MAXDECODERS 8
+const unz_decoder *unz_decoders[UNZ_MAXDECODERS] =
+{ &unz_inflate_decoder,
+#ifndef UNZ_NO_ZSTD
+  &unz_zstd_decoder,
+#endif
+};
+
+// unzRegisterDecoder: adds (or replaces) the decoder for d->method. The
+// table is global, so do this before any zip is opened. Returns false if
+// the table is full. Store (method 0) can't be overridden.
+bool unzRegisterDecoder(const unz_decoder *d)
+{ if (d==0 || d->method==0) return false;
+  for (int i=0; i<UNZ_MAXDECODERS; i++)
+  { if (unz_decoders[i]==0 || unz_decoders[i]->method==d->method) {unz_decoders[i]=d; return true;}
+  }
+  return false;
+}
+
+const unz_decoder *unzlocal_FindDecoder(uLong method)
+{ for (int i=0; i<UNZ_MAXDECODERS && unz_decoders[i]!=0; i++)
+  { if (unz_decoders[i]->method==method) return unz_decoders[i];
+  }
+  return 0;
+}
+
+// WinZip AES entries have method 99, and an extra field 0x9901 that holds
+// the vendor version (1=AE-1, 2=AE-2), "AE", the key strength (1-3 for
+// 128/192/256 bits) and the real compression method.
+#define UNZ_AES_METHOD 99
+#define UNZ_AES_EXTRA_ID 0x9901
+
+
+
+
+// file_in_zip_read_info_s contain internal information about a file in zipfile,
+//  when reading and decompress it
+typedef struct
+{
+	char  *read_buffer;         // internal buffer for compressed data
+	z_stream stream;            // zLib stream structure for inflate
+
+	uLong pos_in_zipfile;       // position in byte on the zipfile, for fseek
+	uLong stream_initialised;   // flag set if stream structure is initialised
+
+	uLong offset_local_extrafield;// offset of the local extra field
+	uInt  size_local_extrafield;// size of the local extra field
+	uLong pos_local_extrafield;   // position in the local extra field in read
+
+	uLong crc32;                // crc32 of all data uncompressed
+	uLong crc32_wait;           // crc32 we must obtain after decompress all
+	uLong rest_read_compressed; // number of byte to be decompressed
+	uLong rest_read_uncompressed;//number of byte to be obtained after decomp
+	LUFILE* file;                 // io structore of the zipfile
+	uLong compression_method;   // compression method (0==store)
+	const unz_decoder *decoder;  // how to decompress it (0 for store)
+	void *decoder_state;        // the decoder's own state, if it needs any
+	uLong byte_before_the_zipfile;// byte before the zipfile, (>0 for sfx)
+  bool encrypted;               // is it encrypted?
+  unsigned long keys[3];        // decryption keys, initialized by unzOpenCurrentFile
+  unz_aes_s *aes;               // WinZip AES state, if the entry uses that instead
+  int encheadleft;              // the first call(s) to unzReadCurrentFile will read this many encryption-header bytes first
+  char crcenctest;              // if encrypted, we'll check the encryption buffer against this
+} file_in_zip_read_info_s;
+
+
+// unz_s contain internal information about the zipfile
+typedef struct
+{
+	LUFILE* file;               // io structore of the zipfile
+	unz_global_info gi;         // public global information
+	uLong byte_before_the_zipfile;// byte before the zipfile, (>0 for sfx)
+	uLong num_file;             // number of the current file in the zipfile
+	uLong pos_in_central_dir;   // pos of the current file in the central dir
+	uLong current_file_ok;      // flag about the usability of the current file
+	uLong central_pos;          // position of the beginning of the central dir
+
+	uLong size_central_dir;     // size of the central directory
+	uLong offset_central_dir;   // offset of start of central directory with respect to the starting disk number
+
+	unz_file_info cur_file_info; // public info about the current file in zip
+	unz_file_info_internal cur_file_info_internal; // private info about it
+    file_in_zip_read_info_s* pfile_in_zip_read; // structure about the current file if we are decompressing it
+} unz_s, *unzFile;
+
+
+int unzStringFileNameCompare (const char* fileName1,const char* fileName2,int iCaseSensitivity);
+//   Compare two filename (fileName1,fileName2).
+
+z_off_t unztell (unzFile file);
+//  Give the current position in uncompressed data
+
+int unzeof (unzFile file);
+//  return 1 if the end of file was reached, 0 elsewhere
+
+int unzGetLocalExtrafield (unzFile file, voidp buf, unsigned len);
 //  Read extra field from the current file (opened by unzOpenCurrentFile)
 //  This is the local-header version of the extra field (sometimes, there is
 //    more info in the local-header version than in the central-header)
@@ -2795,7 +4053,7 @@ int unzlocal_getByte(LUFILE *fin,int *pi)
 int unzlocal_getShort (LUFILE *fin,uLong *pX)
 {
     uLong x ;
-    int i;
+    int i = 0; // what a failed read leaves, for the shifts below
     int err;
 
     err = unzlocal_getByte(fin,&i);
@@ -2815,7 +4073,7 @@ int unzlocal_getShort (LUFILE *fin,uLong *pX)
 int unzlocal_getLong (LUFILE *fin,uLong *pX)
 {
     uLong x ;
-    int i;
+    int i = 0; // what a failed read leaves, for the shifts below
     int err;
 
     err = unzlocal_getByte(fin,&i);
@@ -2979,8 +4237,8 @@ int unzClose (unzFile file)
 		return UNZ_PARAMERROR;
 	s=(unz_s*)file;
 
-    if (s->pfile_in_zip_read!=NULL)
-        unzCloseCurrentFile(file);
+	if (s->pfile_in_zip_read!=NULL)
+		unzCloseCurrentFile(file);
 
 	lufclose(s->file);
 	if (s) zfree(s); // unused s=0;
@@ -2988,6 +4246,22 @@ int unzClose (unzFile file)
 }
 
 
+//  A second reader of the same zip, for another thread: it shares the handle
+//  or memory block but has its own position, so it can read at the same time.
+//  The original must outlive it. Handles are only read with upl_pread, so
+//  this needs a zip we can seek in. Close it with unzClose as usual.
+unzFile unzlocal_Clone(unzFile file)
+{ unz_s *s=(unz_s*)file;
+  if (s==NULL || !s->file->canseek) return NULL;
+  unz_s *c=(unz_s*)zmalloc(sizeof(unz_s));
+  if (c==NULL) return NULL;
+  *c=*s; c->pfile_in_zip_read=NULL;
+  c->file=new LUFILE; *c->file=*s->file;
+  c->file->mustclosehandle=false;
+  return c;
+}
+
+
 //  Write info about the ZipFile in the *pglobal_info structure.
 //  No preparation of the structure is needed
 //  return UNZ_OK if there is no problem.
@@ -3049,10 +4323,12 @@ int unzlocal_GetCurrentFileInfoInternal (unzFile file, unz_file_info *pfile_info
 
 	// we check the magic
 	if (err==UNZ_OK)
+	{
 		if (unzlocal_getLong(s->file,&uMagic) != UNZ_OK)
 			err=UNZ_ERRNO;
 		else if (uMagic!=0x02014b50)
 			err=UNZ_BADZIPFILE;
+	}
 
 	if (unzlocal_getShort(s->file,&file_info.version) != UNZ_OK)
 		err=UNZ_ERRNO;
@@ -3129,10 +4405,12 @@ int unzlocal_GetCurrentFileInfoInternal (unzFile file, unz_file_info *pfile_info
 			uSizeRead = extraFieldBufferSize;
 
 		if (lSeek!=0)
+		{
 			if (lufseek(s->file,lSeek,SEEK_CUR)==0)
 				lSeek=0;
 			else
 				err=UNZ_ERRNO;
+		}
 		if ((file_info.size_file_extra>0) && (extraFieldBufferSize>0))
 			if (lufread(extraField,(uInt)uSizeRead,1,s->file)!=1)
 				err=UNZ_ERRNO;
@@ -3154,10 +4432,12 @@ int unzlocal_GetCurrentFileInfoInternal (unzFile file, unz_file_info *pfile_info
 			uSizeRead = commentBufferSize;
 
 		if (lSeek!=0)
+		{
 			if (lufseek(s->file,lSeek,SEEK_CUR)==0)
 				{} // unused lSeek=0;
 			else
 				err=UNZ_ERRNO;
+		}
 		if ((file_info.size_file_comment>0) && (commentBufferSize>0))
 			if (lufread(szComment,(uInt)uSizeRead,1,s->file)!=1)
 				err=UNZ_ERRNO;
@@ -3250,8 +4530,8 @@ int unzLocateFile (unzFile file, const char *szFileName, int iCaseSensitivity)
 	if (file==NULL)
 		return UNZ_PARAMERROR;
 
-    if (strlen(szFileName)>=UNZ_MAXFILENAMEINZIP)
-        return UNZ_PARAMERROR;
+	if (strlen(szFileName)>=UNZ_MAXFILENAMEINZIP)
+		return UNZ_PARAMERROR;
 
 	s=(unz_s*)file;
 	if (!s->current_file_ok)
@@ -3301,10 +4581,12 @@ int unzlocal_CheckCurrentFileCoherencyHeader (unz_s *s,uInt *piSizeVar,
 
 
 	if (err==UNZ_OK)
+	{
 		if (unzlocal_getLong(s->file,&uMagic) != UNZ_OK)
 			err=UNZ_ERRNO;
 		else if (uMagic!=0x04034b50)
 			err=UNZ_BADZIPFILE;
+	}
 
 	if (unzlocal_getShort(s->file,&uData) != UNZ_OK)
 		err=UNZ_ERRNO;
@@ -3318,9 +4600,9 @@ int unzlocal_CheckCurrentFileCoherencyHeader (unz_s *s,uInt *piSizeVar,
 	else if ((err==UNZ_OK) && (uData!=s->cur_file_info.compression_method))
 		err=UNZ_BADZIPFILE;
 
-    if ((err==UNZ_OK) && (s->cur_file_info.compression_method!=0) &&
-                         (s->cur_file_info.compression_method!=Z_DEFLATED))
-        err=UNZ_BADZIPFILE;
+	if ((err==UNZ_OK) && (s->cur_file_info.compression_method!=0) && (s->cur_file_info.compression_method!=UNZ_AES_METHOD) &&
+		(unzlocal_FindDecoder(s->cur_file_info.compression_method)==0))
+		err=UNZ_BADZIPFILE;
 
 	if (unzlocal_getLong(s->file,&uData) != UNZ_OK) // date/time
 		err=UNZ_ERRNO;
@@ -3366,6 +4648,44 @@ int unzlocal_CheckCurrentFileCoherencyHeader (unz_s *s,uInt *piSizeVar,
 
 
 
+int unzlocal_GetAesExtra(unz_s *s, uLong offset_local_extrafield, uInt size_local_extrafield, int *strength, bool *ae2, uLong *method)
+{ std::vector<unsigned char> extra(size_local_extrafield);
+  if (size_local_extrafield==0) return UNZ_BADZIPFILE;
+  if (lufseek(s->file,offset_local_extrafield+s->byte_before_the_zipfile,SEEK_SET)!=0) return UNZ_ERRNO;
+  if (lufread(&extra[0],size_local_extrafield,1,s->file)!=1) return UNZ_ERRNO;
+  for (uInt pos=0; pos+4<=size_local_extrafield; )
+  { unsigned int id = extra[pos]|(extra[pos+1]<<8), size = extra[pos+2]|(extra[pos+3]<<8);
+    const unsigned char *d = &extra[pos+4];
+    if (pos+4+size>size_local_extrafield) break;
+    if (id==UNZ_AES_EXTRA_ID && size>=7)
+    { unsigned int version = d[0]|(d[1]<<8);
+      if ((version!=1 && version!=2) || d[2]!='A' || d[3]!='E' || d[4]<1 || d[4]>3) return UNZ_BADZIPFILE;
+      *ae2 = version==2; *strength=d[4]; *method = d[5]|(d[6]<<8);
+      if (*method==UNZ_AES_METHOD || (*method!=0 && unzlocal_FindDecoder(*method)==0)) return UNZ_BADZIPFILE;
+      return UNZ_OK;
+    }
+    pos += 4+size;
+  }
+  return UNZ_BADZIPFILE;
+}
+
+// Reads the salt and password verifier from the front of the entry's data,
+// and derives the keys. A wrong password isn't an error here; it's reported
+// by the first unzReadCurrentFile, same as for traditional encryption.
+int unzlocal_AesOpen(unz_s *s, uInt iSizeVar, int strength, bool ae2, const char *password, unz_aes_s **paes)
+{ unsigned int saltlen = 4+4*strength;
+  unsigned char head[16+2];
+  if (s->cur_file_info.compressed_size < saltlen+2+10) return UNZ_BADZIPFILE;
+  if (lufseek(s->file,s->cur_file_info_internal.offset_curfile + SIZEZIPLOCALHEADER + iSizeVar + s->byte_before_the_zipfile,SEEK_SET)!=0) return UNZ_ERRNO;
+  if (lufread(head,saltlen+2,1,s->file)!=1) return UNZ_ERRNO;
+  unz_aes_s *aes = (unz_aes_s*)zmalloc(sizeof(unz_aes_s));
+  if (aes==0) return UNZ_INTERNALERROR;
+  aes->ae2=ae2; aes->headlen=saltlen+2;
+  uaes_init(aes,strength,password,head,head+saltlen);
+  *paes=aes;
+  return UNZ_OK;
+}
+
 //  Open for reading data the current file in the zipfile.
 //  If there is no error and the file is opened, the return value is UNZ_OK.
 int unzOpenCurrentFile (unzFile file, const char *password)
@@ -3384,8 +4704,8 @@ int unzOpenCurrentFile (unzFile file, const char *password)
 	if (!s->current_file_ok)
 		return UNZ_PARAMERROR;
 
-    if (s->pfile_in_zip_read != NULL)
-        unzCloseCurrentFile(file);
+	if (s->pfile_in_zip_read != NULL)
+		unzCloseCurrentFile(file);
 
 	if (unzlocal_CheckCurrentFileCoherencyHeader(s,&iSizeVar,
 				&offset_local_extrafield,&size_local_extrafield)!=UNZ_OK)
@@ -3408,34 +4728,47 @@ int unzOpenCurrentFile (unzFile file, const char *password)
 
 	pfile_in_zip_read_info->stream_initialised=0;
 
-	if ((s->cur_file_info.compression_method!=0) && (s->cur_file_info.compression_method!=Z_DEFLATED))
-        { // unused err=UNZ_BADZIPFILE;
-        }
-	Store = s->cur_file_info.compression_method==0;
+	uLong method = s->cur_file_info.compression_method;
+	unz_aes_s *aes = 0;
+	if (method==UNZ_AES_METHOD)
+	{ int strength=0; bool ae2=false;
+	  err = unzlocal_GetAesExtra(s,offset_local_extrafield,size_local_extrafield,&strength,&ae2,&method);
+	  if (err==UNZ_OK) err = unzlocal_AesOpen(s,iSizeVar,strength,ae2,password,&aes);
+	  if (err!=UNZ_OK)
+	  { zfree(pfile_in_zip_read_info->read_buffer); zfree(pfile_in_zip_read_info);
+	    return err;
+	  }
+	}
+
+	Store = method==0;
+	pfile_in_zip_read_info->decoder = Store ? 0 : unzlocal_FindDecoder(method);
+	pfile_in_zip_read_info->decoder_state = 0;
+	if (!Store && pfile_in_zip_read_info->decoder==0)
+	{ // CheckCurrentFileCoherencyHeader should already have refused this one
+	  if (aes!=0) zfree(aes);
+	  zfree(pfile_in_zip_read_info->read_buffer); zfree(pfile_in_zip_read_info);
+	  return UNZ_BADZIPFILE;
+	}
 
 	pfile_in_zip_read_info->crc32_wait=s->cur_file_info.crc;
 	pfile_in_zip_read_info->crc32=0;
-	pfile_in_zip_read_info->compression_method = s->cur_file_info.compression_method;
+	pfile_in_zip_read_info->compression_method = method;
 	pfile_in_zip_read_info->file=s->file;
 	pfile_in_zip_read_info->byte_before_the_zipfile=s->byte_before_the_zipfile;
 
+    pfile_in_zip_read_info->stream.total_in = 0;
     pfile_in_zip_read_info->stream.total_out = 0;
 
 	if (!Store)
 	{
-	  pfile_in_zip_read_info->stream.zalloc = (alloc_func)0;
-	  pfile_in_zip_read_info->stream.zfree = (free_func)0;
-	  pfile_in_zip_read_info->stream.opaque = (voidpf)0;
-
-          err=inflateInit2(&pfile_in_zip_read_info->stream);
+	  err=pfile_in_zip_read_info->decoder->init(&pfile_in_zip_read_info->stream,&pfile_in_zip_read_info->decoder_state);
 	  if (err == Z_OK)
 	    pfile_in_zip_read_info->stream_initialised=1;
-        // windowBits is passed < 0 to tell that there is no zlib header.
-        // Note that in this case inflate *requires* an extra "dummy" byte
-        // after the compressed stream in order to complete decompression and
-        // return Z_STREAM_END.
-        // In unzip, i don't wait absolutely Z_STREAM_END because I known the
-        // size of both compressed and uncompressed data
+	  else
+	  { if (aes!=0) zfree(aes);
+	    zfree(pfile_in_zip_read_info->read_buffer); zfree(pfile_in_zip_read_info);
+	    return UNZ_INTERNALERROR;
+	  }
 	}
 	pfile_in_zip_read_info->rest_read_compressed = s->cur_file_info.compressed_size ;
 	pfile_in_zip_read_info->rest_read_uncompressed = s->cur_file_info.uncompressed_size ;
@@ -3453,6 +4786,14 @@ int unzOpenCurrentFile (unzFile file, const char *password)
             s->cur_file_info_internal.offset_curfile + SIZEZIPLOCALHEADER +
 			  iSizeVar;
 
+  pfile_in_zip_read_info->aes = aes;
+  if (aes!=0)
+  { // skip the salt and verifier, and stop short of the authentication code
+    pfile_in_zip_read_info->encrypted=false; pfile_in_zip_read_info->encheadleft=0;
+    pfile_in_zip_read_info->pos_in_zipfile += aes->headlen;
+    pfile_in_zip_read_info->rest_read_compressed -= aes->headlen+10;
+  }
+
 	pfile_in_zip_read_info->stream.avail_in = (uInt)0;
 
 	s->pfile_in_zip_read = pfile_in_zip_read_info;
@@ -3461,13 +4802,39 @@ int unzOpenCurrentFile (unzFile file, const char *password)
 }
 
 
+// Once an AES entry has been read to the end: authenticate whatever
+// ciphertext the decoder didn't need, then check the code that follows it.
+int unzlocal_AesFinish(file_in_zip_read_info_s *p)
+{ unz_aes_s *aes = p->aes;
+  if (aes->done) return UNZ_OK;
+  aes->done=true;
+  while (p->rest_read_compressed>0)
+  { uInt uReadThis = UNZ_BUFSIZE;
+    if (p->rest_read_compressed<uReadThis) uReadThis = (uInt)p->rest_read_compressed;
+    if (lufseek(p->file,p->pos_in_zipfile+p->byte_before_the_zipfile,SEEK_SET)!=0) return UNZ_ERRNO;
+    if (lufread(p->read_buffer,uReadThis,1,p->file)!=1) return UNZ_ERRNO;
+    usha1_update(&aes->hmac.inner,(unsigned char*)p->read_buffer,uReadThis);
+    p->pos_in_zipfile += uReadThis;
+    p->rest_read_compressed -= uReadThis;
+  }
+  unsigned char code[10], mac[20];
+  if (lufseek(p->file,p->pos_in_zipfile+p->byte_before_the_zipfile,SEEK_SET)!=0) return UNZ_ERRNO;
+  if (lufread(code,10,1,p->file)!=1) return UNZ_ERRNO;
+  uhmac_final(&aes->hmac,mac);
+  if (memcmp(code,mac,10)!=0) return UNZ_CRCERROR;
+  return UNZ_OK;
+}
+
+
 //  Read bytes from the current file.
 //  buf contain buffer where data must be copied
 //  len the size of buf.
 //  return the number of byte copied if somes bytes are copied (and also sets *reached_eof)
 //  return 0 if the end of file was reached. (and also sets *reached_eof).
 //  return <0 with error code if there is an error. (in which case *reached_eof is meaningless)
-//    (UNZ_ERRNO for IO error, or zLib error for uncompress error)
+//    (UNZ_ERRNO for IO error, or zLib error for uncompress error,
+//    or UNZ_CRCERROR if an AES entry fails authentication, or its data ends
+//    short of the size in its header)
 int unzReadCurrentFile  (unzFile file, voidp buf, unsigned len, bool *reached_eof)
 { int err=UNZ_OK;
   uInt iRead = 0;
@@ -3479,6 +4846,9 @@ int unzReadCurrentFile  (unzFile file, voidp buf, unsigned len, bool *reached_eo
   file_in_zip_read_info_s* pfile_in_zip_read_info = s->pfile_in_zip_read;
   if (pfile_in_zip_read_info==NULL) return UNZ_PARAMERROR;
   if ((pfile_in_zip_read_info->read_buffer == NULL)) return UNZ_END_OF_LIST_OF_FILE;
+  if (pfile_in_zip_read_info->aes!=0 && pfile_in_zip_read_info->aes->badpassword) return UNZ_PASSWORD;
+  // an empty item's over before it starts, and the loop below wouldn't say so
+  if (pfile_in_zip_read_info->rest_read_uncompressed==0) {if (reached_eof!=0) *reached_eof=true; return 0;}
   if (len==0) return 0;
 
   pfile_in_zip_read_info->stream.next_out = (Byte*)buf;
@@ -3500,7 +4870,11 @@ int unzReadCurrentFile  (unzFile file, voidp buf, unsigned len, bool *reached_eo
       pfile_in_zip_read_info->stream.next_in = (Byte*)pfile_in_zip_read_info->read_buffer;
       pfile_in_zip_read_info->stream.avail_in = (uInt)uReadThis;
       //
-      if (pfile_in_zip_read_info->encrypted)
+      if (pfile_in_zip_read_info->aes!=0)
+      { usha1_update(&pfile_in_zip_read_info->aes->hmac.inner,pfile_in_zip_read_info->stream.next_in,uReadThis);
+        uaes_ctr(pfile_in_zip_read_info->aes,pfile_in_zip_read_info->stream.next_in,uReadThis);
+      }
+      else if (pfile_in_zip_read_info->encrypted)
       { char *buf = (char*)pfile_in_zip_read_info->stream.next_in;
         for (unsigned int i=0; i<uReadThis; i++) buf[i]=zdecode(pfile_in_zip_read_info->keys,buf[i]);
       }
@@ -3520,14 +4894,14 @@ int unzReadCurrentFile  (unzFile file, voidp buf, unsigned len, bool *reached_eo
     }
 
     if (pfile_in_zip_read_info->compression_method==0)
-    { uInt uDoCopy,i ;
+    { uInt uDoCopy;
       if (pfile_in_zip_read_info->stream.avail_out < pfile_in_zip_read_info->stream.avail_in)
       { uDoCopy = pfile_in_zip_read_info->stream.avail_out ;
       }
       else
       { uDoCopy = pfile_in_zip_read_info->stream.avail_in ;
       }
-      for (i=0;i<uDoCopy;i++) *(pfile_in_zip_read_info->stream.next_out+i) = *(pfile_in_zip_read_info->stream.next_in+i);
+      memcpy(pfile_in_zip_read_info->stream.next_out,pfile_in_zip_read_info->stream.next_in,uDoCopy);
       pfile_in_zip_read_info->crc32 = ucrc32(pfile_in_zip_read_info->crc32,pfile_in_zip_read_info->stream.next_out,uDoCopy);
       pfile_in_zip_read_info->rest_read_uncompressed-=uDoCopy;
       pfile_in_zip_read_info->stream.avail_in -= uDoCopy;
@@ -3542,25 +4916,31 @@ int unzReadCurrentFile  (unzFile file, voidp buf, unsigned len, bool *reached_eo
     { uLong uTotalOutBefore,uTotalOutAfter;
       const Byte *bufBefore;
       uLong uOutThis;
-      int flush=Z_SYNC_FLUSH;
       uTotalOutBefore = pfile_in_zip_read_info->stream.total_out;
       bufBefore = pfile_in_zip_read_info->stream.next_out;
       //
-      err=inflate(&pfile_in_zip_read_info->stream,flush);
+      err=pfile_in_zip_read_info->decoder->decode(&pfile_in_zip_read_info->stream,pfile_in_zip_read_info->decoder_state);
       //
       uTotalOutAfter = pfile_in_zip_read_info->stream.total_out;
       uOutThis = uTotalOutAfter-uTotalOutBefore;
       pfile_in_zip_read_info->crc32 = ucrc32(pfile_in_zip_read_info->crc32,bufBefore,(uInt)(uOutThis));
       pfile_in_zip_read_info->rest_read_uncompressed -= uOutThis;
       iRead += (uInt)(uTotalOutAfter - uTotalOutBefore);
+      // a stream that ends early would otherwise pass for the whole item: the crc's only checked at the end
+      if (err==Z_STREAM_END && pfile_in_zip_read_info->rest_read_uncompressed!=0) return UNZ_CRCERROR;
       if (err==Z_STREAM_END || pfile_in_zip_read_info->rest_read_uncompressed==0)
       { if (reached_eof!=0) *reached_eof=true;
+        if (pfile_in_zip_read_info->aes!=0 && (err=unzlocal_AesFinish(pfile_in_zip_read_info))!=UNZ_OK) return err;
         return iRead;
       }
       if (err!=Z_OK) break;
     }
   }
 
+  if (err==Z_OK && pfile_in_zip_read_info->aes!=0 && pfile_in_zip_read_info->rest_read_uncompressed==0)
+  { err=unzlocal_AesFinish(pfile_in_zip_read_info);
+    if (err!=UNZ_OK) return err;
+  }
   if (err==Z_OK) return iRead;
   return err;
 }
@@ -3666,10 +5046,15 @@ int unzCloseCurrentFile (unzFile file)
 
 
 	if (pfile_in_zip_read_info->rest_read_uncompressed == 0)
-	{
-		if (pfile_in_zip_read_info->crc32 != pfile_in_zip_read_info->crc32_wait)
+	{ // AE-2 leaves the crc out; its authentication code was checked instead
+		bool checkcrc = pfile_in_zip_read_info->aes==0 || !pfile_in_zip_read_info->aes->ae2;
+		if (checkcrc && pfile_in_zip_read_info->crc32 != pfile_in_zip_read_info->crc32_wait)
 			err=UNZ_CRCERROR;
 	}
+	if (pfile_in_zip_read_info->aes!=0)
+	{ zfree(pfile_in_zip_read_info->aes);
+	  pfile_in_zip_read_info->aes=0;
+	}
 
 
 	if (pfile_in_zip_read_info->read_buffer!=0)
@@ -3679,7 +5064,7 @@ int unzCloseCurrentFile (unzFile file)
         }
 	pfile_in_zip_read_info->read_buffer = NULL;
 	if (pfile_in_zip_read_info->stream_initialised)
-		inflateEnd(&pfile_in_zip_read_info->stream);
+		pfile_in_zip_read_info->decoder->end(&pfile_in_zip_read_info->stream,pfile_in_zip_read_info->decoder_state);
 
 	pfile_in_zip_read_info->stream_initialised = 0;
         if (pfile_in_zip_read_info!=0) zfree(pfile_in_zip_read_info); // unused pfile_in_zip_read_info=0;
@@ -3712,6 +5097,263 @@ int unzGetGlobalComment (unzFile file, char *szComment, uLong uSizeBuf)
 
 
 
+// Chunked, parallel inflate of a single large entry.
+// Our packager splits big deflated entries into independently decodable
+// chunks: every chunk_size uncompressed bytes it does a full flush (which
+// byte-aligns the output and forgets the 32K history), and it records where
+// each chunk starts in a private extra field in the local header:
+//
+//   id          2 bytes   0x5153 ("SQ")
+//   size        2 bytes   10 + 4*count
+//   version     1 byte    1
+//   reserved    1 byte    0
+//   chunk_size  4 bytes   uncompressed bytes per chunk; the last may be short
+//   count       4 bytes   number of chunks
+//   offsets     4*count   start of each chunk, relative to the entry's data
+//
+// Since no chunk refers back into the one before it, each can be inflated
+// on its own thread, and their crcs are stitched together with
+// ucrc32_combine. Entries without the field are inflated serially as before.
+
+#define UNZ_CHUNKINDEX_ID    0x5153
+#define UNZ_CHUNKINDEX_VER   1
+#define UNZ_CHUNK_MAXSIZE    (64*1024*1024) // refuse (and inflate serially) anything with bigger chunks
+#define UNZ_CHUNK_MAXTHREADS 8
+// Big stored entries go through the same machinery, in ranges of their own
+// making: the workers crc the ranges while the sink writes the earlier ones.
+#define UNZ_STORED_MINSIZE   (4*1024*1024)
+#define UNZ_STORED_CHUNK     (1024*1024)
+
+typedef struct
+{ uLong chunk_size;           // uncompressed bytes per chunk
+  uLong count;                // number of chunks
+  std::vector<uLong> offsets; // compressed offset of each chunk from the start of the data
+} unz_chunk_index;
+
+typedef bool (*unz_chunk_sink)(void *param, const void *buf, unsigned int len);
+// receives the uncompressed data, in order. Return false to abandon the read.
+
+
+uLong unzlocal_getLE32(const unsigned char *p)
+{ return (uLong)p[0] | ((uLong)p[1]<<8) | ((uLong)p[2]<<16) | ((uLong)p[3]<<24);
+}
+
+//  Parse the chunk index out of an extra field. Returns false if there isn't
+//  one, or if it doesn't exactly tile the entry.
+bool unzlocal_ParseChunkIndex(const unsigned char *extra, unsigned int extralen,
+  uLong compressed_size, uLong uncompressed_size, unz_chunk_index *idx)
+{ unsigned int epos=0;
+  while (epos+4<=extralen)
+  { unsigned int id = extra[epos] | (extra[epos+1]<<8);
+    unsigned int size = extra[epos+2] | (extra[epos+3]<<8);
+    if (epos+4+size>extralen) return false;
+    if (id!=UNZ_CHUNKINDEX_ID) {epos+=4+size; continue;}
+    const unsigned char *p = extra+epos+4;
+    if (size<10 || p[0]!=UNZ_CHUNKINDEX_VER) return false;
+    idx->chunk_size = unzlocal_getLE32(p+2);
+    idx->count = unzlocal_getLE32(p+6);
+    if (idx->count<2 || (size-10)/4!=idx->count || (size-10)%4!=0) return false;
+    if (idx->chunk_size==0 || idx->chunk_size>UNZ_CHUNK_MAXSIZE) return false;
+    unsigned __int64 covered = (unsigned __int64)idx->chunk_size*idx->count;
+    if (covered<uncompressed_size || covered-idx->chunk_size>=uncompressed_size) return false;
+    idx->offsets.resize(idx->count);
+    for (uLong i=0; i<idx->count; i++)
+    { idx->offsets[i] = unzlocal_getLE32(p+10+4*i);
+      // every chunk must have at least one byte of its own
+      if (i==0 && idx->offsets[i]!=0) return false;
+      if (i>0 && idx->offsets[i]<=idx->offsets[i-1]) return false;
+      if (idx->offsets[i]>=compressed_size) return false;
+    }
+    return true;
+  }
+  return false;
+}
+
+//  Fetch the chunk index of the current file, which must have just been
+//  opened with unzOpenCurrentFile. Encrypted entries are never chunked.
+bool unzGetCurrentChunkIndex(unzFile file, unz_chunk_index *idx)
+{ unz_s *s = (unz_s*)file;
+  if (s==NULL || s->pfile_in_zip_read==NULL) return false;
+  file_in_zip_read_info_s *p = s->pfile_in_zip_read;
+  if (p->compression_method!=Z_DEFLATED || p->encrypted || p->aes!=0 || p->stream.total_out!=0) return false;
+  int extralen = unzGetLocalExtrafield(file,NULL,0);
+  if (extralen<=0) return false;
+  unsigned char *extra = new unsigned char[extralen];
+  bool ok = unzGetLocalExtrafield(file,extra,extralen)==extralen &&
+            unzlocal_ParseChunkIndex(extra,extralen,s->cur_file_info.compressed_size,s->cur_file_info.uncompressed_size,idx);
+  delete[] extra;
+  return ok;
+}
+
+//  The same for a big stored entry, which needs no index to be split up.
+bool unzGetCurrentStoredIndex(unzFile file, unz_chunk_index *idx)
+{ unz_s *s = (unz_s*)file;
+  if (s==NULL || s->pfile_in_zip_read==NULL) return false;
+  file_in_zip_read_info_s *p = s->pfile_in_zip_read;
+  if (p->compression_method!=0 || p->encrypted || p->aes!=0 || p->stream.total_out!=0) return false;
+  uLong size = s->cur_file_info.uncompressed_size;
+  if (size<UNZ_STORED_MINSIZE || s->cur_file_info.compressed_size!=size) return false;
+  idx->chunk_size=UNZ_STORED_CHUNK;
+  idx->count=(size+UNZ_STORED_CHUNK-1)/UNZ_STORED_CHUNK;
+  idx->offsets.resize(idx->count);
+  for (uLong i=0; i<idx->count; i++) idx->offsets[i]=i*UNZ_STORED_CHUNK;
+  return true;
+}
+
+
+typedef struct
+{ char *out;                  // chunk_size bytes, allocated on first use
+  uLong len;                  // how many of them this chunk produced
+  uLong crc;                  // and their crc
+  unsigned char cv[32];       // and their BLAKE3 subtree, if the reader wants one
+  int state;                  // 0=free, 1=being inflated, 2=ready to be handed to the sink
+} unz_chunk_slot;
+
+// Shared between the reader and its workers. Chunk i is inflated into
+// slots[i%nslots], so at most nslots chunks are in memory at once.
+typedef struct
+{ const unz_chunk_index *idx;
+  LUFILE *file; uLong pos;    // the entry's data starts at pos within file
+  uLong comp_size, unc_size;
+  bool stored;                // so the chunks are read straight into the slots
+  bool subtrees;              // whether the workers hash whole chunks for the reader
+  std::mutex m;               // guards everything below
+  std::condition_variable cv;
+  std::mutex io;              // guards file
+  std::vector<unz_chunk_slot> slots;
+  uLong next;                 // next chunk to hand to a worker
+  uLong written;              // number of chunks the sink has consumed
+  bool background;            // the workers lower their priority, see SetUnzipThrottle
+  int err;
+} unz_chunk_job;
+
+
+//  Inflate one self-contained chunk. It must produce exactly outlen bytes.
+int unzlocal_InflateChunk(Byte *in, uLong inlen, Byte *out, uLong outlen)
+{ z_stream zs; memset(&zs,0,sizeof(zs));
+  if (inflateInit2(&zs,-15)!=Z_OK) return UNZ_INTERNALERROR;
+  zs.next_in=in; zs.avail_in=(uInt)inlen;
+  zs.next_out=out; zs.avail_out=(uInt)outlen;
+  int err=Z_OK;
+  while (zs.avail_out>0 && err==Z_OK) err=inflate(&zs,Z_SYNC_FLUSH);
+  inflateEnd(&zs);
+  if (zs.total_out!=outlen) return (err==Z_OK || err==Z_STREAM_END || err==Z_BUF_ERROR) ? Z_DATA_ERROR : err;
+  return UNZ_OK;
+}
+
+void unzlocal_ChunkWorker(unz_chunk_job *job)
+{ const unz_chunk_index *idx = job->idx;
+  TraceThreadName("inflate worker");
+  if (job->background) upl_background();
+  uLong nslots = (uLong)job->slots.size();
+  std::vector<Byte> in;
+  for (;;)
+  { uLong i;
+    { std::unique_lock<std::mutex> lock(job->m);
+      job->cv.wait(lock,[&]{return job->err!=UNZ_OK || job->next>=idx->count || job->next<job->written+nslots;});
+      if (job->err!=UNZ_OK || job->next>=idx->count) return;
+      i = job->next++;
+      job->slots[i%nslots].state=1;
+    }
+    TraceSpan span("inflate chunk");
+    unz_chunk_slot *slot = &job->slots[i%nslots];
+    uLong start = idx->offsets[i];
+    uLong end = (i+1<idx->count) ? idx->offsets[i+1] : job->comp_size;
+    slot->len = (i+1<idx->count) ? idx->chunk_size : job->unc_size-(idx->count-1)*idx->chunk_size;
+    int err = UNZ_OK;
+    if (slot->out==NULL)
+    { slot->out = (char*)zmalloc(idx->chunk_size);
+      if (slot->out==NULL) err=UNZ_INTERNALERROR;
+    }
+    if (job->stored && end-start!=slot->len) err=UNZ_BADZIPFILE;
+    Byte *dst = (Byte*)slot->out;
+    if (!job->stored) {in.resize(end-start); dst=&in[0];}
+    if (err==UNZ_OK)
+    { std::lock_guard<std::mutex> lock(job->io);
+      if (lufseek(job->file,job->pos+start,SEEK_SET)!=0) err=UNZ_ERRNO;
+      else if (lufread(dst,(uInt)(end-start),1,job->file)!=1) err=UNZ_ERRNO;
+    }
+    if (err==UNZ_OK && !job->stored) err = unzlocal_InflateChunk(&in[0],end-start,(Byte*)slot->out,slot->len);
+    if (err==UNZ_OK) slot->crc = ucrc32(0,(Byte*)slot->out,(uInt)slot->len);
+    if (err==UNZ_OK && job->subtrees && i+1<idx->count) ub3_subtree((Byte*)slot->out,slot->len,(unsigned __int64)i*(idx->chunk_size/UB3_CHUNK),slot->cv);
+    { std::lock_guard<std::mutex> lock(job->m);
+      if (err==UNZ_OK) slot->state=2;
+      else if (job->err==UNZ_OK) job->err=err;
+    }
+    job->cv.notify_all();
+  }
+}
+
+
+//  Read the whole of the current file, which has a chunk index (or is a big
+//  stored one, see unzGetCurrentStoredIndex), inflating its chunks in parallel
+//  and handing them to sink in order. The current
+//  file must have just been opened with unzOpenCurrentFile, and afterwards
+//  it is left fully read, so unzCloseCurrentFile does its usual crc check.
+//  If b3 isn't 0, the data's hashed into it (which must be fresh); when the
+//  chunks are a power of two of BLAKE3's, each is hashed by its worker, and
+//  only the last by the reader. There are at most maxthreads workers (0 for one
+//  per core), and with background they run at background priority.
+//  Returns UNZ_OK, UNZ_CRCERROR, UNZ_ERRNO (for io or sink errors) or a zlib error.
+int unzReadCurrentFileChunked(unzFile file, const unz_chunk_index *idx, unz_chunk_sink sink, void *param, ub3_ctx *b3, unsigned int maxthreads, bool background)
+{ unz_s *s = (unz_s*)file;
+  if (s==NULL || s->pfile_in_zip_read==NULL) return UNZ_PARAMERROR;
+  file_in_zip_read_info_s *p = s->pfile_in_zip_read;
+  if (p->read_buffer==NULL || p->stream.total_out!=0) return UNZ_PARAMERROR;
+
+  unsigned int nthreads = std::thread::hardware_concurrency();
+  if (nthreads>UNZ_CHUNK_MAXTHREADS) nthreads=UNZ_CHUNK_MAXTHREADS;
+  if (maxthreads>0 && nthreads>maxthreads) nthreads=maxthreads;
+  if (nthreads>idx->count) nthreads=(unsigned int)idx->count;
+  if (nthreads<1) nthreads=1;
+
+  unz_chunk_job job;
+  job.idx=idx;
+  job.file=p->file; job.pos=p->pos_in_zipfile+p->byte_before_the_zipfile;
+  job.comp_size=s->cur_file_info.compressed_size; job.unc_size=s->cur_file_info.uncompressed_size;
+  job.stored = p->compression_method==0;
+  uLong per = idx->chunk_size/UB3_CHUNK;
+  job.subtrees = b3!=0 && idx->chunk_size%UB3_CHUNK==0 && (per&(per-1))==0;
+  unz_chunk_slot empty = {NULL,0,0,{0},0};
+  job.slots.resize(nthreads+2,empty); // a little slack, so workers needn't wait on a slow sink
+  job.next=0; job.written=0; job.background=background; job.err=UNZ_OK;
+
+  std::vector<std::thread> workers;
+  for (unsigned int t=0; t<nthreads; t++) workers.push_back(std::thread(unzlocal_ChunkWorker,&job));
+
+  uLong crc=0; int err=UNZ_OK;
+  for (uLong i=0; i<idx->count && err==UNZ_OK; i++)
+  { unz_chunk_slot *slot = &job.slots[i%job.slots.size()];
+    { std::unique_lock<std::mutex> lock(job.m);
+      job.cv.wait(lock,[&]{return slot->state==2 || job.err!=UNZ_OK;});
+      if (job.err!=UNZ_OK) {err=job.err; break;}
+    }
+    // the slot is ours until we mark it free again
+    if (!sink(param,slot->out,(unsigned int)slot->len)) err=UNZ_ERRNO;
+    crc = ucrc32_combine(crc,slot->crc,slot->len);
+    if (b3!=0 && job.subtrees && i+1<idx->count) ub3_push(b3,slot->cv,per);
+    else if (b3!=0) ub3_update(b3,(const unsigned char*)slot->out,slot->len);
+    { std::lock_guard<std::mutex> lock(job.m);
+      slot->state=0; job.written++;
+      if (err!=UNZ_OK && job.err==UNZ_OK) job.err=err;
+    }
+    job.cv.notify_all();
+  }
+  for (size_t t=0; t<workers.size(); t++) workers[t].join();
+  for (size_t n=0; n<job.slots.size(); n++) if (job.slots[n].out!=NULL) zfree(job.slots[n].out);
+  if (err!=UNZ_OK) return err;
+
+  p->crc32 = crc;
+  p->pos_in_zipfile += job.comp_size;
+  p->rest_read_compressed = 0;
+  p->rest_read_uncompressed = 0;
+  p->stream.total_out = job.unc_size;
+  if (crc!=p->crc32_wait) return UNZ_CRCERROR;
+  return UNZ_OK;
+}
+
+
+
 
 
 int unzOpenCurrentFile (unzFile file, const char *password);
@@ -3729,6 +5371,7 @@ FILETIME timet2filetime(const lutime_t t)
   return ft;
 }
 
+#ifdef _WIN32
 FILETIME dosdatetime2filetime(WORD dosdate,WORD dostime)
 { // date: bits 0-4 are day of month 1-31. Bits 5-8 are month 1..12. Bits 9-15 are year-1980
   // time: bits 0-4 are seconds/2, bits 5-10 are minute 0..59. Bits 11-15 are hour 0..23
@@ -3743,44 +5386,165 @@ FILETIME dosdatetime2filetime(WORD dosdate,WORD dostime)
   FILETIME ft; SystemTimeToFileTime(&st,&ft);
   return ft;
 }
+#endif
+
+
+
+typedef struct {int index; std::basic_string<TCHAR> fn;} unz_dupfile;
+
+// Pacing for SetUnzipThrottle, which every worker of a TUnzip shares. The cap
+// is kept by a deadline, starting from when the throttle's set, that each
+// block written pushes on by its share of a second; a worker that gets more
+// than a little ahead of it sleeps, and the last one sleeps out the rest once
+// it's done, so the whole never comes in over the cap. Sleeps overshoot (by up
+// to a timer tick on Windows), so the deadline may fall a little behind before
+// it's caught up with, and that's made up later; but it never starts behind.
+#define UNZ_THROTTLE_SLEEP 10        // ms ahead of the cap a worker gets before it sleeps
+#define UNZ_THROTTLE_CATCHUP 50      // ms the deadline can fall behind, once it's been kept to
+#define UNZ_THROTTLE_POLL 100        // ms between asking busy, and how long to wait when it says so
+#define UNZ_THROTTLE_PATIENCE 30000  // ms to wait in all, unless ZIPTHROTTLE says otherwise
+
+typedef struct
+{ ZIPTHROTTLE t;
+  std::mutex m;              // guards everything below
+  std::chrono::steady_clock::time_point due;    // when the bytes so far may have been written by
+  std::chrono::steady_clock::time_point polled; // when busy was last asked
+  std::chrono::steady_clock::time_point resume; // when busy last said to wait until
+  unsigned int waited;       // ms spent waiting on busy
+} unz_throttle;
+
+unz_throttle *unzlocal_NewThrottle(const ZIPTHROTTLE *t)
+{ unz_throttle *th=new unz_throttle;
+  th->t=*t; if (th->t.patience==0) th->t.patience=UNZ_THROTTLE_PATIENCE;
+  th->due=std::chrono::steady_clock::now();
+  th->polled=th->resume=th->due-std::chrono::hours(1);
+  th->waited=0;
+  return th;
+}
+
+// Whether the throttle's been lifted, see ZIPTHROTTLE.lift; then it's as if
+// there were none
+bool unzlocal_Lifted(const unz_throttle *th) {return th!=0 && th->t.lift!=0 && *th->t.lift!=0;}
+unsigned int unzlocal_ThrottleThreads(const unz_throttle *th) {return th!=0 && !unzlocal_Lifted(th) ? th->t.threads : 0;}
+bool unzlocal_ThrottleBackground(const unz_throttle *th) {return th!=0 && !unzlocal_Lifted(th) && th->t.background;}
+
+// Called once a worker's written len more bytes: it sleeps for as long as the
+// cap, or the busy callback, says to
+void unzlocal_Throttle(unz_throttle *th, unsigned int len)
+{ if (th==0 || unzlocal_Lifted(th)) return;
+  typedef std::chrono::steady_clock clk;
+  clk::time_point now=clk::now(), until=now;
+  bool ask=false;
+  { std::lock_guard<std::mutex> lock(th->m);
+    if (th->t.mbps>0)
+    { if (th->due<now-std::chrono::milliseconds(UNZ_THROTTLE_CATCHUP)) th->due=now-std::chrono::milliseconds(UNZ_THROTTLE_CATCHUP);
+      th->due+=std::chrono::microseconds((__int64)len/th->t.mbps);
+      if (th->due>now+std::chrono::milliseconds(UNZ_THROTTLE_SLEEP)) until=th->due;
+    }
+    if (th->resume>until) until=th->resume;
+    if (th->t.busy!=0 && th->waited<th->t.patience && now>=th->polled+std::chrono::milliseconds(UNZ_THROTTLE_POLL)) {th->polled=now; ask=true;}
+  }
+  // one worker asks, and the rest see its answer in resume
+  if (ask && th->t.busy(th->t.param))
+  { std::lock_guard<std::mutex> lock(th->m);
+    th->resume=now+std::chrono::milliseconds(UNZ_THROTTLE_POLL); th->waited+=UNZ_THROTTLE_POLL;
+    if (th->resume>until) until=th->resume;
+    TraceCount("throttle yields",1);
+  }
+  if (until>now) {TraceSpan span("throttle"); std::this_thread::sleep_until(until);}
+}
 
+// Called once UnzipItem or UnzipAll has written the lot: it sleeps out the
+// last of the deadline, which unzlocal_Throttle leaves up to
+// UNZ_THROTTLE_SLEEP of
+void unzlocal_ThrottleDone(unz_throttle *th)
+{ if (th==0 || th->t.mbps==0 || unzlocal_Lifted(th)) return;
+  std::chrono::steady_clock::time_point until;
+  { std::lock_guard<std::mutex> lock(th->m); until=th->due;
+  }
+  if (until>std::chrono::steady_clock::now()) {TraceSpan span("throttle"); std::this_thread::sleep_until(until);}
+}
 
+// What we keep about each item from the central directory, see TUnzip::Scan
+typedef struct
+{ uLong cdpos;              // where its central directory entry is
+  uLong offset;             // where its local header is
+  uLong comp_size, unc_size;
+  int dupgroup;             // the first item that looks the same as it, or -1
+} unz_iteminfo;
 
 class TUnzip
 { public:
-  TUnzip(const char *pwd) : uf(0), unzbuf(0), currentfile(-1), czei(-1), password(0) {if (pwd!=0) {password=new char[strlen(pwd)+1]; strcpy_s(password,MAX_PATH,pwd);}}
-  ~TUnzip() {if (password!=0) delete[] password; password=0; if (unzbuf!=0) delete[] unzbuf; unzbuf=0;}
+  TUnzip(const char *pwd) : uf(0), currentfile(-1), czei(-1), password(0), unzbuf(0), progress(0), progressparam(0), total_unc(0), cachemax(0), cacheflags(0), cacheadded(false), dedup(ZIPDEDUP_COPY), throttle(0), ownthrottle(false) {*cachedir=0; if (pwd!=0) {password=new char[strlen(pwd)+1]; strcpy_s(password,strlen(pwd)+1,pwd);}}
+  ~TUnzip() {if (password!=0) delete[] password; password=0; if (unzbuf!=0) delete[] unzbuf; unzbuf=0; if (ownthrottle) delete throttle; throttle=0;}
 
   unzFile uf; int currentfile; ZIPENTRY cze; int czei;
   char *password;
   char *unzbuf;            // lazily created and destroyed, used by Unzip
   TCHAR rootdir[MAX_PATH]; // includes a trailing slash
+  ZIPPROGRESSPROC progress; void *progressparam; // optional, see SetUnzipProgress
+  ZIPPROGRESS zp;          // what we last told (or will next tell) progress
+  __int64 total_unc;       // uncompressed bytes unzipped so far, all items
+  __int64 lastunc;         // zp.unc_done at the last DATA report
+  std::chrono::steady_clock::time_point tstart, tlast;
+  TCHAR cachedir[MAX_PATH];// content-addressed store, see SetUnzipCache. Empty for none
+  __int64 cachemax; DWORD cacheflags;
+  bool cacheadded;         // so Close knows to trim it
+  DWORD dedup;             // see SetUnzipDedup
+  std::vector<unz_iteminfo> items; // empty until Scan
+  std::map<int,unz_dupfile> dupfile; // per group, a file we've unzipped one of its items to
+  std::vector<unsigned char> manifest; // each item's size and hash, see SetUnzipManifest. Empty for none
+  ub3_ctx memhash;         // of the item being unzipped to memory, when there's a manifest
+  unz_throttle *throttle;  // see SetUnzipThrottle, or 0. A worker shares its parent's
+  bool ownthrottle;
 
   ZRESULT Open(void *z,unsigned int len,DWORD flags);
   ZRESULT Get(int index,ZIPENTRY *ze);
   ZRESULT Find(const TCHAR *name,bool ic,int *index,ZIPENTRY *ze);
   ZRESULT Unzip(int index,void *dst,unsigned int len,DWORD flags);
   ZRESULT SetUnzipBaseDir(const TCHAR *dir);
+  ZRESULT SetProgress(ZIPPROGRESSPROC proc,void *param) {progress=proc; progressparam=param; return ZR_OK;}
+  ZRESULT SetCache(const TCHAR *dir,__int64 maxsize,DWORD flags);
+  ZRESULT SetDedup(DWORD mode) {if (mode>ZIPDEDUP_LINK) return ZR_ARGS; dedup=mode; return ZR_OK;}
+  ZRESULT SetManifest(const void *m,unsigned int len);
+  ZRESULT SetThrottle(const ZIPTHROTTLE *t);
+  ZRESULT MakeManifest(unsigned int threads,void *buf,unsigned int *len);
+  ZRESULT Plan(unsigned int threads,std::vector<ZIPPLANITEM> *plan);
+  ZRESULT UnzipAll(unsigned int threads,unsigned char *digests=0);
   ZRESULT Close();
+
+  void Scan();
+  void GoTo(int index);
+  TUnzip *Worker();
+
+  const unsigned char *Expected(int index);
+  bool Matches(int index,const ub3_ctx *b3);
+
+  bool CacheFetch(const TCHAR *key,const TCHAR *fn,long size,unsigned long crc,const unsigned char *want);
+  void CacheStore(const TCHAR *key,const TCHAR *fn,const unsigned char *sha);
+  void CacheTrim();
+
+  bool DupFetch(int index,const TCHAR *fn,const ZIPENTRY *ze);
+
+  ZRESULT ReportReused(const ZIPENTRY *ze);
+  bool ReportStart(const ZIPENTRY *ze);
+  bool ReportData(__int64 comp_done,unsigned int unc_delta);
+  ZRESULT ReportEnd(ZRESULT result);
 };
 
 
 ZRESULT TUnzip::Open(void *z,unsigned int len,DWORD flags)
 { if (uf!=0 || currentfile!=-1) return ZR_NOTINITED;
+  TraceSpan span("open zip");
   //
-#ifdef GetCurrentDirectory
-  GetCurrentDirectory(MAX_PATH,rootdir);
-#else
-  _tcscpy(rootdir,_T("\\"));
-#endif
+  upl_getcwd(rootdir,MAX_PATH);
   TCHAR lastchar = rootdir[_tcslen(rootdir)-1];
-  if (lastchar!='\\' && lastchar!='/') _tcscat_s(rootdir,_T("\\"));
+  if (lastchar!='\\' && lastchar!='/') _tcscat_s(rootdir,UPL_SLASH);
   //
   if (flags==ZIP_HANDLE)
   { // test if we can seek on it. We can't use GetFileType(h)==FILE_TYPE_DISK since it's not on CE.
-    DWORD res = SetFilePointer(z,0,0,FILE_CURRENT);
-    bool canseek = (res!=0xFFFFFFFF);
-    if (!canseek) return ZR_SEEK;
+    __int64 pos;
+    if (!upl_tell(z,&pos)) return ZR_SEEK;
   }
   ZRESULT e; LUFILE *f = lufopen(z,len,flags,&e);
   if (f==NULL) return e;
@@ -3793,13 +5557,14 @@ ZRESULT TUnzip::SetUnzipBaseDir(const TCHAR *dir)
 {
   _tcscpy_s(rootdir, MAX_PATH, dir);
   TCHAR lastchar = rootdir[_tcslen(rootdir)-1];
-  if (lastchar!='\\' && lastchar!='/') _tcscat_s(rootdir,_T("\\"));
+  if (lastchar!='\\' && lastchar!='/') _tcscat_s(rootdir,UPL_SLASH);
   return ZR_OK;
 }
 
 ZRESULT TUnzip::Get(int index,ZIPENTRY *ze)
 { if (index<-1 || index>=(int)uf->gi.number_entry) return ZR_ARGS;
-  if (currentfile!=-1) unzCloseCurrentFile(uf); currentfile=-1;
+  if (currentfile!=-1) unzCloseCurrentFile(uf);
+  currentfile=-1;
   if (index==czei && index!=-1) {memcpy(ze,&cze,sizeof(ZIPENTRY)); return ZR_OK;}
   if (index==-1)
   { ze->index = uf->gi.number_entry;
@@ -3812,8 +5577,7 @@ ZRESULT TUnzip::Get(int index,ZIPENTRY *ze)
     ze->unc_size=0;
     return ZR_OK;
   }
-  if (index<(int)uf->num_file) unzGoToFirstFile(uf);
-  while ((int)uf->num_file<index) unzGoToNextFile(uf);
+  GoTo(index);
   unz_file_info ufi; char fn[MAX_PATH];
   unzGetCurrentFileInfo(uf,&ufi,fn,MAX_PATH,NULL,0,NULL,0);
   // now get the extra header. We do this ourselves, instead of
@@ -3882,8 +5646,7 @@ ZRESULT TUnzip::Get(int index,ZIPENTRY *ze)
   //
   WORD dostime = (WORD)(ufi.dosDate&0xFFFF);
   WORD dosdate = (WORD)((ufi.dosDate>>16)&0xFFFF);
-  FILETIME ftd = dosdatetime2filetime(dosdate,dostime);
-  FILETIME ft; LocalFileTimeToFileTime(&ftd,&ft);
+  FILETIME ft = upl_dostime(dosdate,dostime);
   ze->atime=ft; ze->ctime=ft; ze->mtime=ft;
   // the zip will always have at least that dostime. But if it also has
   // an extra header, then we'll instead get the info from that.
@@ -3933,7 +5696,8 @@ ZRESULT TUnzip::Find(const TCHAR *tname,bool ic,int *index,ZIPENTRY *ze)
     if (ze!=NULL) {ZeroMemory(ze,sizeof(ZIPENTRY)); ze->index=-1;}
     return ZR_NOTFOUND;
   }
-  if (currentfile!=-1) unzCloseCurrentFile(uf); currentfile=-1;
+  if (currentfile!=-1) unzCloseCurrentFile(uf);
+  currentfile=-1;
   int i = (int)uf->num_file;
   if (index!=NULL) *index=i;
   if (ze!=NULL)
@@ -3944,7 +5708,8 @@ ZRESULT TUnzip::Find(const TCHAR *tname,bool ic,int *index,ZIPENTRY *ze)
 }
 
 void EnsureDirectory(const TCHAR *rootdir, const TCHAR *dir)
-{ if (rootdir!=0 && GetFileAttributes(rootdir)==0xFFFFFFFF) CreateDirectory(rootdir,0);
+{ if (*dir!=0 && upl_isdir(rootdir,dir)) return; // usually an earlier item made it already
+  if (rootdir!=0 && !upl_isdir(0,rootdir)) upl_mkdir(0,rootdir);
   if (*dir==0) return;
   const TCHAR *lastslash=dir, *c=lastslash;
   while (*c!=0) {if (*c=='/' || *c=='\\') lastslash=c; c++;}
@@ -3955,47 +5720,379 @@ void EnsureDirectory(const TCHAR *rootdir, const TCHAR *dir)
     EnsureDirectory(rootdir,tmp);
     name++;
   }
-  TCHAR cd[MAX_PATH]; *cd=0; if (rootdir!=0) _tcscpy_s(cd, MAX_PATH, rootdir); _tcscat_s(cd,dir);
-  if (GetFileAttributes(cd)==0xFFFFFFFF) CreateDirectory(cd,NULL);
+  if (!upl_isdir(rootdir,dir)) upl_mkdir(rootdir,dir);
+}
+
+
+
+// The cache is a flat directory of blobs named <crc32>-<size>, each with a
+// <crc32>-<size>.meta beside it. The .meta's modify time says when the blob
+// was last used, and with ZIPCACHE_STRONG it holds the blob's SHA-1. Blobs
+// are written under a temporary name and renamed into place, so several
+// setups can share one cache. They're copied in and out (CopyFile clones
+// where the filesystem can) unless ZIPCACHE_LINK says to hard-link them, as
+// a linked file that's later rewritten in place rewrites the blob too.
+#define UNZ_CACHE_MINSIZE (64*1024) // smaller than this is cheaper to inflate than to look up
+
+ZRESULT TUnzip::SetCache(const TCHAR *dir,__int64 maxsize,DWORD flags)
+{ if (dir==0 || *dir==0) {*cachedir=0; return ZR_OK;}
+  _tcscpy_s(cachedir, MAX_PATH, dir);
+  TCHAR lastchar = cachedir[_tcslen(cachedir)-1];
+  if (lastchar!='\\' && lastchar!='/') _tcscat_s(cachedir,UPL_SLASH);
+  EnsureDirectory(0,cachedir);
+  cachemax=maxsize; cacheflags=flags;
+  return ZR_OK;
+}
+
+bool unzlocal_ReadCacheMeta(const TCHAR *key,unsigned char *sha)
+{ TCHAR meta[MAX_PATH]; if (!upl_format(meta,MAX_PATH,_T("%s.meta"),key)) return false;
+  HANDLE h=upl_open(meta); if (h==INVALID_HANDLE_VALUE) return false;
+  unsigned int red; bool ok = upl_read(h,sha,20,&red) && red==20;
+  upl_close(h);
+  return ok;
+}
+
+// If the store has this item, puts a copy (or a link) of it at fn. The blob
+// has to have the item's crc, which is far cheaper to check than inflating
+// is; with ZIPCACHE_STRONG, its SHA-1 too, and with a manifest, want is the
+// item's hash, and the blob has to have that as well.
+bool TUnzip::CacheFetch(const TCHAR *key,const TCHAR *fn,long size,unsigned long crc,const unsigned char *want)
+{ TCHAR meta[MAX_PATH]; if (!upl_format(meta,MAX_PATH,_T("%s.meta"),key)) return false;
+  HANDLE h=upl_open(key); if (h==INVALID_HANDLE_VALUE) return false;
+  __int64 blobsize; bool ok = upl_size(h,&blobsize) && blobsize==size;
+  bool strong = (cacheflags&ZIPCACHE_STRONG)!=0;
+  if (ok)
+  { unsigned char sha[20], got[20], b3[32];
+    ok = !strong || unzlocal_ReadCacheMeta(key,sha);
+    if (ok)
+    { if (unzbuf==0) unzbuf=new char[16384];
+      usha1_ctx c; usha1_init(&c); ub3_ctx b; ub3_init(&b); __int64 pos=0; unsigned int red; uLong blobcrc=0;
+      while (upl_pread(h,unzbuf,16384,pos,&red) && red>0)
+      { blobcrc=ucrc32(blobcrc,(const Byte*)unzbuf,red);
+        if (strong) usha1_update(&c,(unsigned char*)unzbuf,red);
+        if (want!=0) ub3_update(&b,(unsigned char*)unzbuf,red);
+        pos+=red;
+      }
+      ok = pos==size && blobcrc==crc;
+      if (ok && strong) {usha1_final(&c,got); ok=memcmp(sha,got,20)==0;}
+      if (ok && want!=0) {ub3_final(&b,b3); ok=memcmp(want,b3,32)==0;}
+    }
+  }
+  upl_close(h);
+  if (!ok) {upl_delete(key); upl_delete(meta); return false;} // it'll be stored again once we've unzipped it
+  upl_delete(fn);
+  bool linkit = (cacheflags&ZIPCACHE_LINK)!=0;
+  if (!(linkit && upl_link(key,fn)) && !upl_copy(key,fn)) return false;
+  upl_touch(meta);
+  return true;
+}
+
+// Adds fn, which we just unzipped, to the store
+void TUnzip::CacheStore(const TCHAR *key,const TCHAR *fn,const unsigned char *sha)
+{ static std::atomic<unsigned int> counter(0);
+  TCHAR tmp[MAX_PATH], meta[MAX_PATH];
+  if (!upl_format(tmp,MAX_PATH,_T("%s.%u-%u.tmp"),key,upl_pid(),(unsigned int)counter++)) return;
+  if (!upl_format(meta,MAX_PATH,_T("%s.meta"),key)) return;
+  bool linkit = (cacheflags&ZIPCACHE_LINK)!=0;
+  if (!(linkit && upl_link(fn,tmp)) && !upl_copy(fn,tmp)) return;
+  if (!upl_rename(tmp,key)) {upl_delete(tmp); return;}
+  HANDLE h=upl_create(meta,0);
+  if (h!=INVALID_HANDLE_VALUE) {if (sha!=0) upl_write(h,sha,20); upl_close(h);}
+  cacheadded=true;
+}
+
+typedef struct {std::basic_string<TCHAR> name; __int64 size, used;} unz_cacheblob;
+typedef struct {std::vector<unz_cacheblob> blobs; std::map<std::basic_string<TCHAR>,__int64> metas;} unz_cachelist;
+
+void unzlocal_CacheListProc(void *param,const TCHAR *name,__int64 size,__int64 mtime)
+{ unz_cachelist *list=(unz_cachelist*)param;
+  size_t len=_tcslen(name);
+  if (len>5 && _tcscmp(name+len-5,_T(".meta"))==0) {list->metas[std::basic_string<TCHAR>(name,len-5)]=mtime; return;}
+  unz_cacheblob b; b.name=name; b.size=size; b.used=mtime;
+  list->blobs.push_back(b);
+}
+
+bool unzlocal_CacheOlder(const unz_cacheblob &a,const unz_cacheblob &b) {return a.used<b.used;}
+
+// Deletes the least recently used blobs until the store is within cachemax.
+// Anything without a .meta (e.g. a temporary left by a crash) goes by its own time.
+void TUnzip::CacheTrim()
+{ unz_cachelist list; upl_list(cachedir,unzlocal_CacheListProc,&list);
+  __int64 total=0;
+  for (size_t i=0; i<list.blobs.size(); i++)
+  { std::map<std::basic_string<TCHAR>,__int64>::iterator m=list.metas.find(list.blobs[i].name);
+    if (m!=list.metas.end()) list.blobs[i].used=m->second;
+    total+=list.blobs[i].size;
+  }
+  std::sort(list.blobs.begin(),list.blobs.end(),unzlocal_CacheOlder);
+  for (size_t i=0; i<list.blobs.size() && total>cachemax; i++)
+  { TCHAR fn[MAX_PATH], meta[MAX_PATH];
+    if (!upl_format(fn,MAX_PATH,_T("%s%s"),cachedir,list.blobs[i].name.c_str())) continue;
+    if (!upl_delete(fn)) continue; // in use, perhaps
+    total-=list.blobs[i].size;
+    if (upl_format(meta,MAX_PATH,_T("%s.meta"),fn)) upl_delete(meta);
+  }
+}
+
+
+#define UNZ_DEDUP_MINSIZE (16*1024) // smaller duplicates aren't worth comparing
+
+// One pass over the central directory, for what the scheduler and duplicate
+// detection need to know about every item
+void TUnzip::Scan()
+{ typedef std::pair<std::pair<uLong,uLong>,std::pair<uLong,uLong> > unz_dupkey;
+  std::map<unz_dupkey,int> first;
+  int n=(int)uf->gi.number_entry;
+  items.clear(); items.reserve(n);
+  int err=unzGoToFirstFile(uf);
+  for (int i=0; i<n && err==UNZ_OK; i++, err=unzGoToNextFile(uf))
+  { const unz_file_info &fi=uf->cur_file_info;
+    unz_iteminfo it={uf->pos_in_central_dir,uf->cur_file_info_internal.offset_curfile,fi.compressed_size,fi.uncompressed_size,-1};
+    items.push_back(it);
+    if (fi.uncompressed_size<UNZ_DEDUP_MINSIZE || (fi.flag&1)!=0) continue;
+    unz_dupkey k(std::make_pair(fi.crc,fi.uncompressed_size),std::make_pair(fi.compressed_size,fi.compression_method));
+    std::map<unz_dupkey,int>::iterator f=first.find(k);
+    if (f==first.end()) first[k]=i;
+    else {items[f->second].dupgroup=f->second; items[i].dupgroup=f->second;}
+  }
+}
+
+// Makes index the current item. Once we've scanned, that's a jump rather than a walk.
+void TUnzip::GoTo(int index)
+{ if (index<(int)items.size() && index!=(int)uf->num_file)
+  { uf->pos_in_central_dir=items[index].cdpos; uf->num_file=index;
+    int err=unzlocal_GetCurrentFileInfoInternal(uf,&uf->cur_file_info,&uf->cur_file_info_internal,NULL,0,NULL,0,NULL,0);
+    uf->current_file_ok = (err==UNZ_OK);
+    return;
+  }
+  if (index<(int)uf->num_file) unzGoToFirstFile(uf);
+  while ((int)uf->num_file<index) unzGoToNextFile(uf);
+}
+
+
+// Duplicates. Scan groups items by (crc, sizes, method); only when an item's
+// group already has a file on disk do we compare the compressed bytes of the
+// two, so a zip without duplicates costs nothing more than the scan.
+
+// Whether the items whose local headers are at a and b have the same len bytes
+// of data. buf is 16k of scratch.
+bool unzlocal_SameData(unz_s *s,uLong a,uLong b,uLong len,char *buf)
+{ uLong off[2]={a,b};
+  for (int i=0; i<2; i++)
+  { uLong namelen, extralen;
+    if (lufseek(s->file,off[i]+26+s->byte_before_the_zipfile,SEEK_SET)!=0) return false;
+    if (unzlocal_getShort(s->file,&namelen)!=UNZ_OK || unzlocal_getShort(s->file,&extralen)!=UNZ_OK) return false;
+    off[i]+=SIZEZIPLOCALHEADER+namelen+extralen;
+  }
+  char *bufa=buf, *bufb=buf+8192;
+  for (uLong done=0; done<len;)
+  { uInt n = len-done<8192 ? (uInt)(len-done) : 8192;
+    if (lufseek(s->file,off[0]+done+s->byte_before_the_zipfile,SEEK_SET)!=0 || lufread(bufa,1,n,s->file)!=n) return false;
+    if (lufseek(s->file,off[1]+done+s->byte_before_the_zipfile,SEEK_SET)!=0 || lufread(bufb,1,n,s->file)!=n) return false;
+    if (memcmp(bufa,bufb,n)!=0) return false;
+    done+=n;
+  }
+  return true;
+}
+
+// If we've unzipped an item with the same contents to a file already, puts a
+// copy (or a link) of that at fn rather than inflating it again
+bool TUnzip::DupFetch(int index,const TCHAR *fn,const ZIPENTRY *ze)
+{ std::map<int,unz_dupfile>::iterator d=dupfile.find(items[index].dupgroup);
+  if (d==dupfile.end()) return false;
+  const TCHAR *src=d->second.fn.c_str();
+  if (d->second.index==index || _tcscmp(src,fn)==0) return false;
+  const unsigned char *a=Expected(d->second.index), *b=Expected(index);
+  if (a!=0 && b!=0 && memcmp(a,b,40)!=0) return false; // the manifest says they differ
+  HANDLE h=upl_open(src); if (h==INVALID_HANDLE_VALUE) return false;
+  __int64 size; bool ok = upl_size(h,&size) && size==ze->unc_size;
+  upl_close(h);
+  if (!ok) return false; // the caller has done something with it since
+  if (unzbuf==0) unzbuf=new char[16384];
+  if (!unzlocal_SameData(uf,items[d->second.index].offset,items[index].offset,uf->cur_file_info.compressed_size,unzbuf)) return false;
+  upl_delete(fn);
+  if (dedup==ZIPDEDUP_LINK && upl_link(src,fn)) return true;
+  if (!upl_clone(src,fn) && !upl_copy(src,fn)) return false;
+  upl_settimesfn(fn,&ze->ctime,&ze->atime,&ze->mtime);
+  return true;
+}
+
+
+// The manifest. It's kept as its records, 40 bytes an item: the item's size
+// (8 bytes, little-endian) and the BLAKE3 of its contents.
+const char unz_manifest_magic[17]="Squirrel digests";
+
+ZRESULT TUnzip::SetManifest(const void *m,unsigned int len)
+{ if (m==0) {manifest.clear(); return ZR_OK;}
+  const unsigned char *p=(const unsigned char*)m;
+  if (len<24 || memcmp(p,unz_manifest_magic,16)!=0 || unzlocal_getLE32(p+16)!=1) return ZR_CORRUPT;
+  uLong n=unzlocal_getLE32(p+20);
+  if (n!=uf->gi.number_entry || len!=ZIPMANIFEST_SIZE(n)) return ZR_CORRUPT;
+  manifest.assign(p+24,p+len);
+  return ZR_OK;
+}
+
+// A worker's throttle is its parent's, so it's only ever set on the HZIP
+ZRESULT TUnzip::SetThrottle(const ZIPTHROTTLE *t)
+{ if (!ownthrottle && throttle!=0) return ZR_ZMODE;
+  if (ownthrottle) delete throttle;
+  throttle=0; ownthrottle=false;
+  if (t==0) return ZR_OK;
+  throttle=unzlocal_NewThrottle(t); ownthrottle=true;
+  return ZR_OK;
+}
+
+// Unzips everything to nowhere, for the hashes, and writes them up
+ZRESULT TUnzip::MakeManifest(unsigned int threads,void *buf,unsigned int *len)
+{ uLong n=uf->gi.number_entry; unsigned int size=ZIPMANIFEST_SIZE(n);
+  if (buf==0) {*len=size; return ZR_OK;}
+  if (*len<size) {*len=size; return ZR_MEMSIZE;}
+  std::vector<unsigned char> digests(32*n+1);
+  ZRESULT zr=UnzipAll(threads,&digests[0]); if (zr!=ZR_OK) return zr;
+  unsigned char *p=(unsigned char*)buf;
+  memcpy(p,unz_manifest_magic,16); ub3_put32(p+16,1); ub3_put32(p+20,(unsigned int)n);
+  for (uLong i=0; i<n; i++)
+  { unsigned char *rec=p+24+40*i;
+    ub3_put32(rec,(unsigned int)items[i].unc_size); ub3_put32(rec+4,0);
+    memcpy(rec+8,&digests[32*i],32);
+  }
+  *len=size;
+  return ZR_OK;
+}
+
+// The record for an item, if there's a manifest
+const unsigned char *TUnzip::Expected(int index)
+{ if (manifest.empty() || index<0 || (size_t)index>=manifest.size()/40) return 0;
+  return &manifest[40*(size_t)index];
+}
+
+bool TUnzip::Matches(int index,const ub3_ctx *b3)
+{ const unsigned char *rec=Expected(index); if (rec==0) return true;
+  unsigned char got[32]; ub3_final(b3,got);
+  return memcmp(rec+8,got,32)==0;
 }
 
 
+// For items we didn't have to inflate, the callback still sees them go by
+ZRESULT TUnzip::ReportReused(const ZIPENTRY *ze)
+{ if (progress==0) return ZR_OK;
+  ReportStart(ze); ReportData(ze->comp_size,(unsigned int)ze->unc_size);
+  return ReportEnd(ZR_OK);
+}
+
+bool TUnzip::ReportStart(const ZIPENTRY *ze)
+{ zp.event=ZIPPROGRESS_START; zp.index=ze->index; zp.name=ze->name;
+  zp.comp_size=ze->comp_size; zp.unc_size=ze->unc_size;
+  zp.comp_done=0; zp.unc_done=0; zp.total_unc_done=total_unc;
+  zp.mbps=0; zp.result=ZR_OK;
+  tstart=tlast=std::chrono::steady_clock::now(); lastunc=0;
+  return progress(progressparam,&zp);
+}
+
+// Called for every buffer written, but only passes it on about ten times a second
+bool TUnzip::ReportData(__int64 comp_done,unsigned int unc_delta)
+{ zp.comp_done=comp_done; zp.unc_done+=unc_delta; total_unc+=unc_delta;
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  double secs = std::chrono::duration<double>(now-tlast).count();
+  if (secs<0.1) return true;
+  zp.event=ZIPPROGRESS_DATA; zp.total_unc_done=total_unc;
+  zp.mbps = (double)(zp.unc_done-lastunc)/secs/1e6;
+  tlast=now; lastunc=zp.unc_done;
+  return progress(progressparam,&zp);
+}
+
+ZRESULT TUnzip::ReportEnd(ZRESULT result)
+{ double secs = std::chrono::duration<double>(std::chrono::steady_clock::now()-tstart).count();
+  zp.event=ZIPPROGRESS_END; zp.total_unc_done=total_unc; zp.result=result;
+  zp.mbps = secs>0 ? (double)zp.unc_done/secs/1e6 : 0;
+  progress(progressparam,&zp);
+  return result;
+}
+
+
+// Files we created ourselves are written by offset; a caller's handle might be
+// a pipe, so that's written in sequence (pos<0); and for ZIP_DIGEST there's none
+bool UnzipWrite(HANDLE h, const void *buf, unsigned int len, __int64 *pos)
+{ if (h==INVALID_HANDLE_VALUE) return true;
+  if (*pos<0) return upl_write(h,buf,len);
+  if (!upl_pwrite(h,buf,len,*pos)) return false;
+  *pos+=len; return true;
+}
+
+typedef struct
+{ HANDLE h;
+  __int64 pos;
+  usha1_ctx *sha;          // if the cache wants a hash of what we wrote
+  bool failed;
+  bool cancelled;
+  TUnzip *unz;
+} TUnzipSink;
+
+bool UnzipSinkToHandle(void *param, const void *buf, unsigned int len)
+{ TUnzipSink *sink = (TUnzipSink*)param;
+  if (!UnzipWrite(sink->h,buf,len,&sink->pos)) {sink->failed=true; return false;}
+  if (sink->sha!=0) usha1_update(sink->sha,(const unsigned char*)buf,len);
+  TUnzip *unz = sink->unz;
+  unzlocal_Throttle(unz->throttle,len);
+  if (unz->progress!=0)
+  { // the chunks come back whole, so all we know of the compressed side is the average
+    __int64 unc_done = unz->zp.unc_done+len;
+    __int64 comp_done = unz->zp.unc_size>0 ? (__int64)((double)unz->zp.comp_size*unc_done/unz->zp.unc_size) : 0;
+    if (!unz->ReportData(comp_done,len)) {sink->cancelled=true; return false;}
+  }
+  return true;
+}
 
 ZRESULT TUnzip::Unzip(int index,void *dst,unsigned int len,DWORD flags)
-{ if (flags!=ZIP_MEMORY && flags!=ZIP_FILENAME && flags!=ZIP_HANDLE) return ZR_ARGS;
+{ if (flags!=ZIP_MEMORY && flags!=ZIP_FILENAME && flags!=ZIP_HANDLE && flags!=ZIP_DIGEST) return ZR_ARGS;
   if (flags==ZIP_MEMORY)
   { if (index!=currentfile)
     { if (currentfile!=-1) unzCloseCurrentFile(uf); currentfile=-1;
       if (index>=(int)uf->gi.number_entry) return ZR_ARGS;
-      if (index<(int)uf->num_file) unzGoToFirstFile(uf);
-      while ((int)uf->num_file<index) unzGoToNextFile(uf);
-      unzOpenCurrentFile(uf,password); currentfile=index;
+      GoTo(index);
+      const unsigned char *rec=Expected(index);
+      if (rec!=0 && unzlocal_getLE32(rec)!=uf->cur_file_info.uncompressed_size) return ZR_CORRUPT;
+      unzOpenCurrentFile(uf,password); currentfile=index; ub3_init(&memhash);
     }
     bool reached_eof;
     int res = unzReadCurrentFile(uf,dst,len,&reached_eof);
-    if (res<=0) {unzCloseCurrentFile(uf); currentfile=-1;}
-    if (reached_eof) return ZR_OK;
+    if (res>0 && !manifest.empty()) ub3_update(&memhash,(const unsigned char*)dst,res);
+    if (res<=0 || reached_eof)
+    { // the crc's only checked once it's closed. reached_eof means nothing
+      // if res is an error, e.g. an AES item's code didn't match at the end
+      int closed=unzCloseCurrentFile(uf); currentfile=-1;
+      if (res>=0 && reached_eof) return closed==UNZ_CRCERROR || !Matches(index,&memhash) ? ZR_CORRUPT : ZR_OK;
+    }
     if (res>0) return ZR_MORE;
     if (res==UNZ_PASSWORD) return ZR_PASSWORD;
+    if (res==UNZ_CRCERROR) return ZR_CORRUPT;
     return ZR_FLATE;
   }
-  // otherwise we're writing to a handle or a file
-  if (currentfile!=-1) unzCloseCurrentFile(uf); currentfile=-1;
+  // otherwise we're writing to a handle or a file, or just hashing
+  if (currentfile!=-1) unzCloseCurrentFile(uf);
+  currentfile=-1;
   if (index>=(int)uf->gi.number_entry) return ZR_ARGS;
-  if (index<(int)uf->num_file) unzGoToFirstFile(uf);
-  while ((int)uf->num_file<index) unzGoToNextFile(uf);
+  if (flags==ZIP_FILENAME && dedup!=ZIPDEDUP_OFF && items.empty()) Scan();
+  GoTo(index);
   ZIPENTRY ze; Get(index,&ze);
+  // a manifest that has the item another size needn't wait for it to be inflated
+  const unsigned char *rec=Expected(index);
+  if (rec!=0 && unzlocal_getLE32(rec)!=uf->cur_file_info.uncompressed_size) return ZR_CORRUPT;
   // zipentry=directory is handled specially
   if ((ze.attr&FILE_ATTRIBUTE_DIRECTORY)!=0)
-  { if (flags==ZIP_HANDLE) return ZR_OK; // don't do anything
+  { if (flags==ZIP_DIGEST) {ub3_ctx b; ub3_init(&b); ub3_final(&b,(unsigned char*)dst); return ZR_OK;}
+    if (flags==ZIP_HANDLE) return ZR_OK; // don't do anything
     const TCHAR *dir = (const TCHAR*)dst;
     bool isabsolute = (dir[0]=='/' || dir[0]=='\\' || (dir[0]!=0 && dir[1]==':'));
     if (isabsolute) EnsureDirectory(0,dir); else EnsureDirectory(rootdir,dir);
     return ZR_OK;
   }
   // otherwise, we write the zipentry to a file/handle
-  HANDLE h;
+  HANDLE h; TCHAR fn[MAX_PATH];
+  bool cacheit=false; TCHAR cachekey[MAX_PATH];
+  bool dupit=false;
   if (flags==ZIP_HANDLE) h=dst;
+  else if (flags==ZIP_DIGEST) h=INVALID_HANDLE_VALUE;
   else
   { const TCHAR *ufn = (const TCHAR*)dst;
     // We'll qualify all relative names to our root dir, and leave absolute names as they are
@@ -4007,40 +6104,427 @@ ZRESULT TUnzip::Unzip(int index,void *dst,unsigned int len,DWORD flags)
     // is how the user retrieve's the file's name within the zip) never returns absolute paths.
     const TCHAR *name=ufn; const TCHAR *c=name; while (*c!=0) {if (*c=='/' || *c=='\\') name=c+1; c++;}
     TCHAR dir[MAX_PATH]; _tcscpy_s(dir, MAX_PATH, ufn); if (name==ufn) *dir=0; else dir[name-ufn]=0;
-    TCHAR fn[MAX_PATH];
     bool isabsolute = (dir[0]=='/' || dir[0]=='\\' || (dir[0]!=0 && dir[1]==':'));
-    if (isabsolute) {wsprintf(fn,_T("%s%s"),dir,name); EnsureDirectory(0,dir);}
-    else {wsprintf(fn,_T("%s%s%s"),rootdir,dir,name); EnsureDirectory(rootdir,dir);}
+    bool fits = isabsolute ? upl_format(fn,MAX_PATH,_T("%s%s"),dir,name) : upl_format(fn,MAX_PATH,_T("%s%s%s"),rootdir,dir,name);
+    if (!fits) return ZR_NOFILE; // rather than write to a truncated name
+    if (isabsolute) EnsureDirectory(0,dir); else EnsureDirectory(rootdir,dir);
     //
-    h = CreateFile(fn,GENERIC_WRITE,0,NULL,CREATE_ALWAYS,ze.attr,NULL);
+    dupit = dedup!=ZIPDEDUP_OFF && index<(int)items.size() && items[index].dupgroup!=-1;
+    if (dupit && DupFetch(index,fn,&ze)) return ReportReused(&ze);
+    cacheit = *cachedir!=0 && ze.unc_size>=UNZ_CACHE_MINSIZE && (uf->cur_file_info.flag&1)==0;
+    // one whose key won't fit isn't cached at all
+    if (cacheit) cacheit = upl_format(cachekey,MAX_PATH,_T("%s%08lx-%lu"),cachedir,(unsigned long)uf->cur_file_info.crc,(unsigned long)ze.unc_size);
+    if (cacheit)
+    { if (CacheFetch(cachekey,fn,ze.unc_size,(unsigned long)uf->cur_file_info.crc,rec!=0?rec+8:0))
+      { if (dupit) {unz_dupfile d={index,fn}; dupfile[items[index].dupgroup]=d;}
+        return ReportReused(&ze);
+      }
+    }
+    h = upl_create(fn,ze.attr);
+  }
+  if (h==INVALID_HANDLE_VALUE && flags!=ZIP_DIGEST) return ZR_NOFILE;
+  bool ownh = flags==ZIP_FILENAME;
+  __int64 wpos = flags==ZIP_HANDLE ? -1 : 0;
+  if (progress!=0 && !ReportStart(&ze))
+  { if (ownh) upl_close(h);
+    return ReportEnd(ZR_CANCELLED);
   }
-  if (h==INVALID_HANDLE_VALUE) return ZR_NOFILE;
   unzOpenCurrentFile(uf,password);
-  if (unzbuf==0) unzbuf=new char[16384]; DWORD haderr=0;
+  if (unzbuf==0) unzbuf=new char[16384];
+  DWORD haderr=0;
+  usha1_ctx sha; bool hashit = cacheit && (cacheflags&ZIPCACHE_STRONG)!=0;
+  if (hashit) usha1_init(&sha);
+  ub3_ctx b3; bool digestit = rec!=0 || flags==ZIP_DIGEST;
+  if (digestit) ub3_init(&b3);
   //
-
-  for (; haderr==0;)
+  unz_chunk_index idx;
+  if (unzGetCurrentChunkIndex(uf,&idx) || unzGetCurrentStoredIndex(uf,&idx))
+  { // big entries written by our packager can be inflated in parallel, and big
+    // stored ones can always have their crc checked in parallel. The workers
+    // hash them too, for the manifest.
+    TUnzipSink sink = {h,wpos,hashit?&sha:0,false,false,this};
+    int res = unzReadCurrentFileChunked(uf,&idx,UnzipSinkToHandle,&sink,digestit?&b3:0,
+      unzlocal_ThrottleThreads(throttle), unzlocal_ThrottleBackground(throttle));
+    if (sink.failed) haderr=ZR_WRITE;
+    else if (sink.cancelled) haderr=ZR_CANCELLED;
+    else if (res==UNZ_CRCERROR) haderr=ZR_CORRUPT;
+    else if (res!=UNZ_OK) haderr=ZR_FLATE;
+  }
+  else for (; haderr==0;)
   { bool reached_eof;
     int res = unzReadCurrentFile(uf,unzbuf,16384,&reached_eof);
     if (res==UNZ_PASSWORD) {haderr=ZR_PASSWORD; break;}
+    if (res==UNZ_CRCERROR) {haderr=ZR_CORRUPT; break;}
     if (res<0) {haderr=ZR_FLATE; break;}
-    if (res>0) {DWORD writ; BOOL bres=WriteFile(h,unzbuf,res,&writ,NULL); if (!bres) {haderr=ZR_WRITE; break;}}
+    if (res>0 && !UnzipWrite(h,unzbuf,res,&wpos)) {haderr=ZR_WRITE; break;}
+    if (hashit && res>0) usha1_update(&sha,(unsigned char*)unzbuf,res);
+    if (digestit && res>0) ub3_update(&b3,(unsigned char*)unzbuf,res);
+    if (res>0) unzlocal_Throttle(throttle,res);
+    if (progress!=0 && !ReportData(ze.comp_size-(__int64)uf->pfile_in_zip_read->rest_read_compressed,res)) {haderr=ZR_CANCELLED; break;}
     if (reached_eof) break;
     if (res==0) {haderr=ZR_FLATE; break;}
   }
-  if (!haderr) SetFileTime(h,&ze.ctime,&ze.atime,&ze.mtime); // may fail if it was a pipe
-  if (flags!=ZIP_HANDLE) CloseHandle(h);
-  unzCloseCurrentFile(uf);
+  // the crc's only checked once it's closed, and then the hash, if there's a manifest
+  if (unzCloseCurrentFile(uf)==UNZ_CRCERROR && haderr==0) haderr=ZR_CORRUPT;
+  if (haderr==0 && flags==ZIP_DIGEST) ub3_final(&b3,(unsigned char*)dst);
+  else if (haderr==0 && !Matches(index,&b3)) haderr=ZR_CORRUPT;
+  if (!haderr && h!=INVALID_HANDLE_VALUE) upl_settimes(h,&ze.ctime,&ze.atime,&ze.mtime);
+  if (ownh) upl_close(h);
+  if (cacheit && haderr==0)
+  { unsigned char digest[20]; if (hashit) usha1_final(&sha,digest);
+    CacheStore(cachekey,fn,hashit?digest:0);
+  }
+  if (dupit && haderr==0) {unz_dupfile d={index,fn}; dupfile[items[index].dupgroup]=d;}
+  if (progress!=0) return ReportEnd(haderr);
   if (haderr!=0) return haderr;
   return ZR_OK;
 }
 
-ZRESULT TUnzip::Close()
+// The scheduler. UnzipAll hands the items to its workers a task at a time,
+// where a task is one big item, or a run of small items next to each other in
+// the zip (so they're read in one sweep, without a trip to the queue each),
+// or all the items in a duplicate group (so it's only inflated once). With
+// one worker the tasks go in local header order, for sequential reads; with
+// more, the biggest go first so that none is left running on its own at the
+// end, but tasks within a factor of two of each other still go in order.
+#define UNZ_PLAN_TINY (64*1024)      // items smaller than this are batched
+#define UNZ_PLAN_BATCH (1024*1024)   // up to this many bytes a batch
+#define UNZ_PLAN_BATCHITEMS 256      // or this many items
+#define UNZ_PLAN_MAXTHREADS 8
+
+typedef struct
+{ std::vector<int> members;  // in the order they'll be unzipped
+  __int64 weight;            // bytes to inflate
+  uLong offset;              // of the first member
+  int sizeclass;             // floor(log2(weight))
+} unz_plantask;
+
+bool unzlocal_TaskInOrder(const unz_plantask &a,const unz_plantask &b) {return a.offset<b.offset;}
+bool unzlocal_TaskBigger(const unz_plantask &a,const unz_plantask &b)
+{ if (a.sizeclass!=b.sizeclass) return a.sizeclass>b.sizeclass;
+  return a.offset<b.offset;
+}
+
+unsigned int unzlocal_PlanThreads(unsigned int threads)
+{ if (threads==0) threads=std::thread::hardware_concurrency();
+  if (threads>UNZ_PLAN_MAXTHREADS) threads=UNZ_PLAN_MAXTHREADS;
+  if (threads<1) threads=1;
+  return threads;
+}
+
+ZRESULT TUnzip::Plan(unsigned int threads,std::vector<ZIPPLANITEM> *plan)
 { if (currentfile!=-1) unzCloseCurrentFile(uf); currentfile=-1;
-  if (uf!=0) unzClose(uf); uf=0;
+  if (items.empty()) Scan();
+  if (items.size()!=uf->gi.number_entry) return ZR_CORRUPT;
+  threads=unzlocal_PlanThreads(threads);
+  std::vector<int> order(items.size());
+  for (size_t i=0; i<order.size(); i++) order[i]=(int)i;
+  std::stable_sort(order.begin(),order.end(),[this](int a,int b){return items[a].offset<items[b].offset;});
+  //
+  std::vector<unz_plantask> tasks; std::map<int,size_t> grouptask;
+  unz_plantask batch; batch.weight=0; batch.offset=0;
+  for (size_t o=0; o<order.size(); o++)
+  { int i=order[o]; const unz_iteminfo &it=items[i];
+    bool grouped = dedup!=ZIPDEDUP_OFF && it.dupgroup!=-1;
+    if (grouped)
+    { std::map<int,size_t>::iterator g=grouptask.find(it.dupgroup);
+      if (g!=grouptask.end()) {tasks[g->second].members.push_back(i); continue;}
+      grouptask[it.dupgroup]=tasks.size();
+    }
+    if (grouped || it.unc_size>=UNZ_PLAN_TINY)
+    { unz_plantask t; t.members.push_back(i); t.weight=it.unc_size; t.offset=it.offset;
+      tasks.push_back(t); continue;
+    }
+    if (batch.members.empty()) batch.offset=it.offset;
+    batch.members.push_back(i); batch.weight+=it.unc_size;
+    if (batch.weight>=UNZ_PLAN_BATCH || batch.members.size()>=UNZ_PLAN_BATCHITEMS)
+    { tasks.push_back(batch); batch.members.clear(); batch.weight=0;
+    }
+  }
+  if (!batch.members.empty()) tasks.push_back(batch);
+  for (size_t t=0; t<tasks.size(); t++)
+  { tasks[t].sizeclass=0;
+    for (__int64 w=tasks[t].weight; w>1; w>>=1) tasks[t].sizeclass++;
+  }
+  if (threads==1) std::stable_sort(tasks.begin(),tasks.end(),unzlocal_TaskInOrder);
+  else std::stable_sort(tasks.begin(),tasks.end(),unzlocal_TaskBigger);
+  //
+  plan->clear(); plan->reserve(items.size());
+  for (size_t t=0; t<tasks.size(); t++)
+  { for (size_t m=0; m<tasks[t].members.size(); m++)
+    { const unz_iteminfo &it=items[tasks[t].members[m]];
+      ZIPPLANITEM pi; pi.index=tasks[t].members[m]; pi.task=(int)t; pi.offset=(long)it.offset;
+      pi.comp_size=(long)it.comp_size; pi.unc_size=(long)it.unc_size;
+      plan->push_back(pi);
+    }
+  }
+  return ZR_OK;
+}
+
+
+// Another TUnzip on the same zip, with the same settings, for a worker thread
+TUnzip *TUnzip::Worker()
+{ unzFile c=unzlocal_Clone(uf); if (c==NULL) return NULL;
+  TUnzip *w=new TUnzip(password);
+  w->uf=c;
+  _tcscpy_s(w->rootdir,MAX_PATH,rootdir); _tcscpy_s(w->cachedir,MAX_PATH,cachedir);
+  w->cachemax=cachemax; w->cacheflags=cacheflags; w->dedup=dedup;
+  w->items=items; w->manifest=manifest;
+  w->throttle=throttle;
+  return w;
+}
+
+typedef struct
+{ TUnzip *unz;               // the one UnzipAll was called on
+  std::vector<ZIPPLANITEM> plan;
+  std::vector<size_t> starts;// where each task starts in plan, and then plan.size()
+  unsigned char *digests;    // for MakeManifest: 32 bytes an item, and nothing's written
+  std::mutex m;              // guards everything below, and the calls to unz->progress
+  std::condition_variable cv;// notified as each worker finishes
+  size_t next;               // the next task to hand out
+  size_t finished;           // workers that have run out of tasks
+  ZRESULT err;               // the first thing to go wrong; the workers stop when it's set
+} unz_schedule;
+
+typedef struct {unz_schedule *sched; TUnzip *w; __int64 seen; bool background;} unz_worker;
+
+// Workers report through here, so the caller's callback is only ever called
+// once at a time and total_unc_done counts all of them
+bool unzlocal_WorkerProgress(void *param,const ZIPPROGRESS *zp)
+{ unz_worker *wk=(unz_worker*)param; unz_schedule *s=wk->sched; TUnzip *unz=s->unz;
+  std::lock_guard<std::mutex> lock(s->m);
+  unz->total_unc += zp->total_unc_done-wk->seen; wk->seen=zp->total_unc_done;
+  if (s->err==ZR_CANCELLED) return false;
+  ZIPPROGRESS fwd=*zp; fwd.total_unc_done=unz->total_unc;
+  if (unz->progress(unz->progressparam,&fwd)) return true;
+  if (s->err==ZR_OK) s->err=ZR_CANCELLED;
+  return false;
+}
+
+void unzlocal_ScheduleWorker(unz_worker *wk)
+{ unz_schedule *s=wk->sched;
+  for (;;)
+  { if (wk->background && unzlocal_Lifted(wk->w->throttle)) {upl_foreground(); wk->background=false;}
+    size_t t;
+    { std::lock_guard<std::mutex> lock(s->m);
+      if (s->err!=ZR_OK || s->next+1>=s->starts.size()) return;
+      t=s->next++;
+    }
+    for (size_t i=s->starts[t]; i<s->starts[t+1]; i++)
+    { ZIPENTRY ze; int index=s->plan[i].index;
+      ZRESULT zr=wk->w->Get(index,&ze);
+      if (zr==ZR_OK)
+      { TraceSpan span(s->digests!=0?"hash":"unzip",ze.name);
+        if (s->digests!=0) zr=wk->w->Unzip(index,s->digests+32*(size_t)index,0,ZIP_DIGEST);
+        else zr=wk->w->Unzip(index,ze.name,0,ZIP_FILENAME);
+      }
+      if (zr==ZR_OK && s->digests==0) {TraceCount("unzipped files",1); TraceCount("unzipped bytes",ze.unc_size>0?ze.unc_size:0);}
+      std::lock_guard<std::mutex> lock(s->m);
+      if (zr!=ZR_OK && s->err==ZR_OK) s->err=zr;
+      if (s->err!=ZR_OK) return;
+    }
+  }
+}
+
+ZRESULT TUnzip::UnzipAll(unsigned int threads,unsigned char *digests)
+{ TraceSpan span(digests!=0?"MakeManifest":"UnzipAll");
+  unz_schedule s; s.unz=this; s.digests=digests; s.next=0; s.finished=0; s.err=ZR_OK;
+  unsigned int full=unzlocal_PlanThreads(threads);
+  threads=full;
+  if (unzlocal_ThrottleThreads(throttle)>0 && threads>throttle->t.threads) threads=throttle->t.threads;
+  ZRESULT zr;
+  { TraceSpan span("plan");
+    zr=Plan(threads,&s.plan); if (zr!=ZR_OK) return zr;
+  }
+  for (size_t i=0; i<s.plan.size(); i++) if (i==0 || s.plan[i].task!=s.plan[i-1].task) s.starts.push_back(i);
+  s.starts.push_back(s.plan.size());
+  if (threads>s.starts.size()-1) threads=(unsigned int)s.starts.size()-1;
+  if (full>s.starts.size()-1) full=(unsigned int)s.starts.size()-1;
+  //
+  std::vector<unz_worker> wks; wks.reserve(full>threads?full:threads); // the workers point into it
+  bool background = unzlocal_ThrottleBackground(throttle);
+  for (unsigned int t=0; t<threads; t++)
+  { unz_worker wk={&s,Worker(),0,background};
+    if (wk.w==NULL) break;
+    wks.push_back(wk);
+  }
+  if (wks.empty() && threads>0) return ZR_NOALLOC;
+  for (size_t t=0; t<wks.size(); t++) if (progress!=0) wks[t].w->SetProgress(unzlocal_WorkerProgress,&wks[t]);
+  // the calling thread is the first worker, unless they're to be in the
+  // background, which it mightn't get back out of
+  std::vector<std::thread> others;
+  auto run = [&s](unz_worker *wk)
+  { TraceThreadName("unzip worker");
+    if (wk->background) upl_background();
+    unzlocal_ScheduleWorker(wk);
+    std::lock_guard<std::mutex> lock(s.m); s.finished++; s.cv.notify_all();
+  };
+  for (size_t t=background?0:1; t<wks.size(); t++) others.push_back(std::thread(run,&wks[t]));
+  if (!wks.empty() && !background) unzlocal_ScheduleWorker(&wks[0]);
+  // if the throttle's lifted while they're at it, the rest of the tasks get
+  // as many workers as there'd have been without it
+  if (background && throttle->t.lift!=0 && full>wks.size())
+  { { std::unique_lock<std::mutex> lock(s.m);
+      while (s.finished<others.size() && !unzlocal_Lifted(throttle)) s.cv.wait_for(lock,std::chrono::milliseconds(UNZ_THROTTLE_POLL));
+    }
+    if (unzlocal_Lifted(throttle))
+    { TraceCount("throttle lifted",1);
+      while (wks.size()<full)
+      { unz_worker wk={&s,Worker(),0,false};
+        if (wk.w==NULL) break;
+        wks.push_back(wk);
+        if (progress!=0) wks.back().w->SetProgress(unzlocal_WorkerProgress,&wks.back());
+        others.push_back(std::thread(run,&wks.back()));
+      }
+    }
+  }
+  for (size_t t=0; t<others.size(); t++) others[t].join();
+  unzlocal_ThrottleDone(throttle);
+  //
+  for (size_t t=0; t<wks.size(); t++)
+  { if (wks[t].w->cacheadded) cacheadded=true;
+    wks[t].w->cacheadded=false; wks[t].w->Close(); delete wks[t].w;
+  }
+  return s.err;
+}
+
+
+ZRESULT TUnzip::Close()
+{ if (currentfile!=-1) unzCloseCurrentFile(uf);
+  currentfile=-1;
+  if (cacheadded) CacheTrim();
+  cacheadded=false;
+  items.clear(); dupfile.clear();
+  if (uf!=0) unzClose(uf);
+  uf=0;
+  return ZR_OK;
+}
+
+
+
+// Inflates a deflate stream that isn't in a zip. A zlib stream's header and
+// check are inflate's own (nowrap=0, so its blocks keep an adler32); a gzip
+// stream's are read here, around a raw inflate, and its crc kept with ucrc32.
+#define US_BODY     0  // inflating
+#define US_GZHEAD   1  // the fixed ten bytes of a gzip header
+#define US_GZXLEN   2  // FEXTRA's length
+#define US_GZEXTRA  3  // and its bytes
+#define US_GZNAME   4  // FNAME, up to its 0
+#define US_GZCOMM   5  // FCOMMENT, up to its 0
+#define US_GZHCRC   6  // FHCRC, the low 16 bits of the crc of the header so far
+#define US_GZTRAIL  7  // crc32 and isize, four bytes each, little-endian
+#define US_DONE     8
+#define US_BAD      9
+
+class TUnzipStream
+{ public:
+  TUnzipStream(DWORD f) : format(f), inited(false) {}
+  ~TUnzipStream() {if (inited) inflateEnd(&zs);}
+
+  DWORD format;
+  z_stream zs; bool inited;
+  int mode;
+  unsigned int flg;    // gzip header flags still to be read
+  unsigned int need;   // bytes still to come in this field
+  uLong field;         // the field so far, little-endian
+  uLong hcrc;          // crc of the gzip header so far
+  uLong crc,size;      // of the member's output so far
+
+  ZRESULT Open();
+  void GzipNext();
+  bool GzipByte(Byte c);
+  ZRESULT Unzip(const Byte *in,unsigned int inlen,unsigned int *inused,Byte *out,unsigned int outlen,unsigned int *outmade);
+};
+
+ZRESULT TUnzipStream::Open()
+{ if (format!=ZSTREAM_RAW && format!=ZSTREAM_ZLIB && format!=ZSTREAM_GZIP) return ZR_ARGS;
+  zs.zalloc=(alloc_func)0; zs.zfree=(free_func)0; zs.opaque=(voidpf)0;
+  int err=inflateInit2(&zs,format==ZSTREAM_ZLIB?15:-15);
+  if (err==Z_MEM_ERROR) return ZR_NOALLOC;
+  if (err!=Z_OK) return ZR_FLATE;
+  inited=true;
+  mode = format==ZSTREAM_GZIP ? US_GZHEAD : US_BODY;
+  need=10; field=0; hcrc=0; crc=0; size=0;
   return ZR_OK;
 }
 
+void TUnzipStream::GzipNext()
+{ need=0; field=0;
+  if (flg&4) {mode=US_GZXLEN; need=2;}
+  else if (flg&8) mode=US_GZNAME;
+  else if (flg&16) mode=US_GZCOMM;
+  else if (flg&2) {mode=US_GZHCRC; need=2;}
+  else mode=US_BODY;
+}
+
+// takes one byte of a gzip header or trailer; false if it's bad
+bool TUnzipStream::GzipByte(Byte c)
+{ if (mode!=US_GZHCRC && mode!=US_GZTRAIL) hcrc=ucrc32(hcrc,&c,1);
+  switch (mode)
+  { case US_GZHEAD:
+      // 1f 8b, method 8, flags, then mtime, xfl and os, which don't matter here
+      need--;
+      if (need==9 && c!=0x1f) return false;
+      if (need==8 && c!=0x8b) return false;
+      if (need==7 && c!=8) return false;
+      if (need==6) {if (c&0xe0) return false; flg=c;}
+      if (need==0) GzipNext();
+      return true;
+    case US_GZXLEN:
+      field|=(uLong)c<<(8*(2-need)); need--;
+      if (need==0) {flg&=~4u; need=(unsigned int)field; mode=US_GZEXTRA; if (need==0) GzipNext();}
+      return true;
+    case US_GZEXTRA:
+      need--; if (need==0) GzipNext();
+      return true;
+    case US_GZNAME: case US_GZCOMM:
+      if (c==0) {flg&=~(mode==US_GZNAME?8u:16u); GzipNext();}
+      return true;
+    case US_GZHCRC:
+      field|=(uLong)c<<(8*(2-need)); need--;
+      if (need==0) {if (field!=(hcrc&0xffff)) return false; flg&=~2u; GzipNext();}
+      return true;
+    case US_GZTRAIL:
+      field|=(uLong)c<<(8*((8-need)&3)); need--;
+      if (need==4) {if (field!=crc) return false; field=0;}
+      if (need==0) {if (field!=(size&0xffffffff)) return false; mode=US_DONE;}
+      return true;
+  }
+  return false;
+}
+
+ZRESULT TUnzipStream::Unzip(const Byte *in,unsigned int inlen,unsigned int *inused,Byte *out,unsigned int outlen,unsigned int *outmade)
+{ static Byte none=0;
+  const Byte *p=in, *pe=in+inlen; Byte *o=out, *oe=out+outlen;
+  ZRESULT zr=ZR_MORE;
+  for (;;)
+  { if (mode==US_BAD) {zr=ZR_CORRUPT; break;}
+    if (mode==US_DONE)
+    { if (format!=ZSTREAM_GZIP || p==pe) {zr=ZR_OK; break;}
+      inflateReset(&zs); mode=US_GZHEAD; need=10; field=0; hcrc=0; crc=0; size=0;
+    }
+    if (mode!=US_BODY)
+    { if (p==pe) break;
+      if (!GzipByte(*p++)) mode=US_BAD;
+      continue;
+    }
+    zs.next_in=(Byte*)(p<pe?p:&none); zs.avail_in=(uInt)(pe-p);
+    zs.next_out=(o<oe?o:&none); zs.avail_out=(uInt)(oe-o);
+    int err=inflate(&zs,Z_SYNC_FLUSH);
+    uInt made=(uInt)(zs.next_out-(o<oe?o:&none)), ate=(uInt)(pe-p)-zs.avail_in;
+    if (format==ZSTREAM_GZIP) crc=ucrc32(crc,o,made);
+    size+=made; o+=made; p+=ate;
+    if (err==Z_STREAM_END) {if (format==ZSTREAM_GZIP) {mode=US_GZTRAIL; need=8; field=0;} else mode=US_DONE; continue;}
+    if (err==Z_OK && (made!=0 || ate!=0)) continue;
+    if (err==Z_OK) break;
+    if (err==Z_BUF_ERROR) break;         // it needs more in, or more room
+    if (err==Z_MEM_ERROR) {zr=ZR_NOALLOC; break;}
+    mode=US_BAD;                         // Z_DATA_ERROR, or Z_NEED_DICT
+  }
+  if (inused!=0) *inused=(unsigned int)(p-in);
+  if (outmade!=0) *outmade=(unsigned int)(o-out);
+  return zr;
+}
 
 
 
@@ -4068,6 +6552,7 @@ unsigned int FormatZipMessageU(ZRESULT code, TCHAR *buf,unsigned int len)
     case ZR_FAILED: msg=_T("Caller: there was a previous error"); break;
     case ZR_ENDED: msg=_T("Caller: additions to the zip have already been ended"); break;
     case ZR_ZMODE: msg=_T("Caller: mixing creation and opening of zip"); break;
+    case ZR_CANCELLED: msg=_T("Caller: cancelled from the progress callback"); break;
     case ZR_NOTINITED: msg=_T("Zip-bug: internal initialisation not completed"); break;
     case ZR_SEEK: msg=_T("Zip-bug: trying to seek the unseekable"); break;
     case ZR_MISSIZE: msg=_T("Zip-bug: the anticipated size turned out wrong"); break;
@@ -4097,6 +6582,69 @@ HZIP OpenZipInternal(void *z,unsigned int len,DWORD flags, const char *password)
 HZIP OpenZipHandle(HANDLE h, const char *password) {return OpenZipInternal((void*)h,0,ZIP_HANDLE,password);}
 HZIP OpenZip(const TCHAR *fn, const char *password) {return OpenZipInternal((void*)fn,0,ZIP_FILENAME,password);}
 HZIP OpenZip(void *z,unsigned int len, const char *password) {return OpenZipInternal(z,len,ZIP_MEMORY,password);}
+HZIP OpenZipSource(const ZIPSOURCE *src, const char *password) {return OpenZipInternal((void*)src,0,ZIP_SOURCE,password);}
+
+// OpenZipOverlay's source: the executable up to the end of its zip, through a
+// view of it if one could be mapped, and by reads if not. The executable's own
+// bytes in front of the zip are what unzOpenInternal's SFX handling skips.
+typedef struct
+{ HANDLE h; const unsigned char *view; __int64 size;
+} TOverlaySource;
+
+static const char zipoverlay_magic[16] = {'S','q','u','i','r','r','e','l',' ','p','a','y','l','o','a','d'};
+
+static bool overlay_read(void *param,__int64 pos,void *buf,unsigned int len,unsigned int *red)
+{ TOverlaySource *os = (TOverlaySource*)param;
+  if (pos>=os->size) {*red=0; return true;}
+  if ((__int64)len>os->size-pos) len=(unsigned int)(os->size-pos);
+  if (os->view==0) return upl_pread(os->h,buf,len,pos,red);
+  memcpy(buf,os->view+pos,len); *red=len; return true;
+}
+
+static void overlay_close(void *param)
+{ TOverlaySource *os = (TOverlaySource*)param;
+  if (os->view!=0) upl_unmap(os->view,os->size);
+  upl_close(os->h); delete os;
+}
+
+static unsigned int overlay_get32(const unsigned char *p) {return p[0]|(p[1]<<8)|(p[2]<<16)|((unsigned int)p[3]<<24);}
+
+// Where the zip appended to h's executable ends, which is where its trailer
+// starts; false if there's no trailer. An Authenticode signature always goes
+// last, so if there is one the trailer is just in front of it.
+static bool overlay_find(HANDLE h,__int64 *zipend,__int64 *zipsize)
+{ __int64 end; if (!upl_size(h,&end)) return false;
+  unsigned char hdr[0x40], pe[24+2]; unsigned int red;
+  if (upl_pread(h,hdr,sizeof(hdr),0,&red) && red==sizeof(hdr) && hdr[0]=='M' && hdr[1]=='Z')
+  { __int64 peoff = overlay_get32(hdr+0x3c);
+    if (upl_pread(h,pe,sizeof(pe),peoff,&red) && red==sizeof(pe) && overlay_get32(pe)==0x00004550)
+    { unsigned int dircount = (pe[24]|(pe[25]<<8))==0x20b ? 108 : 92; // PE32+ or PE32
+      unsigned char dir[4+8*5];
+      if (upl_pread(h,dir,sizeof(dir),peoff+24+dircount,&red) && red==sizeof(dir) && overlay_get32(dir)>4)
+      { __int64 sigat=overlay_get32(dir+4+8*4), sigsize=overlay_get32(dir+4+8*4+4);
+        if (sigat!=0 && sigsize!=0 && sigat<=end) end=sigat;
+      }
+    }
+  }
+  unsigned char trailer[ZIPOVERLAY_SIZE];
+  if (end<ZIPOVERLAY_SIZE || !upl_pread(h,trailer,ZIPOVERLAY_SIZE,end-ZIPOVERLAY_SIZE,&red) || red!=ZIPOVERLAY_SIZE) return false;
+  if (memcmp(trailer+16,zipoverlay_magic,16)!=0 || overlay_get32(trailer+8)!=1) return false;
+  if (overlay_get32(trailer+12)!=ucrc32(0,trailer,12)) return false;
+  __int64 size = overlay_get32(trailer) | ((__int64)overlay_get32(trailer+4)<<32);
+  if (size<22 || size>end-ZIPOVERLAY_SIZE) return false;
+  *zipend=end-ZIPOVERLAY_SIZE; *zipsize=size; return true;
+}
+
+HZIP OpenZipOverlay(const TCHAR *fn, const char *password)
+{ HANDLE h = upl_open(fn);
+  if (h==INVALID_HANDLE_VALUE) {lasterrorU=ZR_NOFILE; return 0;}
+  __int64 zipend, zipsize;
+  if (!overlay_find(h,&zipend,&zipsize)) {upl_close(h); lasterrorU=ZR_CORRUPT; return 0;}
+  TOverlaySource *os = new TOverlaySource;
+  os->h=h; os->size=zipend; os->view=(const unsigned char*)upl_map(h,zipend);
+  ZIPSOURCE src; src.param=os; src.size=zipend; src.read=overlay_read; src.close=overlay_close;
+  return OpenZipSource(&src,password);
+}
 
 
 ZRESULT GetZipItem(HZIP hz, int index, ZIPENTRY *ze)
@@ -4124,6 +6672,7 @@ ZRESULT UnzipItemInternal(HZIP hz, int index, void *dst, unsigned int len, DWORD
   if (han->flag!=1) {lasterrorU=ZR_ZMODE;return ZR_ZMODE;}
   TUnzip *unz = han->unz;
   lasterrorU = unz->Unzip(index,dst,len,flags);
+  unzlocal_ThrottleDone(unz->throttle);
   return lasterrorU;
 }
 ZRESULT UnzipItemHandle(HZIP hz, int index, HANDLE h) {return UnzipItemInternal(hz,index,(void*)h,0,ZIP_HANDLE);}
@@ -4140,6 +6689,115 @@ ZRESULT SetUnzipBaseDir(HZIP hz, const TCHAR *dir)
 }
 
 
+ZRESULT SetUnzipProgress(HZIP hz, ZIPPROGRESSPROC proc, void *param)
+{ if (hz==0) {lasterrorU=ZR_ARGS;return ZR_ARGS;}
+  TUnzipHandleData *han = (TUnzipHandleData*)hz;
+  if (han->flag!=1) {lasterrorU=ZR_ZMODE;return ZR_ZMODE;}
+  TUnzip *unz = han->unz;
+  lasterrorU = unz->SetProgress(proc,param);
+  return lasterrorU;
+}
+
+
+ZRESULT SetUnzipCache(HZIP hz, const TCHAR *dir, __int64 maxsize, DWORD flags)
+{ if (hz==0) {lasterrorU=ZR_ARGS;return ZR_ARGS;}
+  TUnzipHandleData *han = (TUnzipHandleData*)hz;
+  if (han->flag!=1) {lasterrorU=ZR_ZMODE;return ZR_ZMODE;}
+  TUnzip *unz = han->unz;
+  lasterrorU = unz->SetCache(dir,maxsize,flags);
+  return lasterrorU;
+}
+
+
+ZRESULT SetUnzipDedup(HZIP hz, DWORD mode)
+{ if (hz==0) {lasterrorU=ZR_ARGS;return ZR_ARGS;}
+  TUnzipHandleData *han = (TUnzipHandleData*)hz;
+  if (han->flag!=1) {lasterrorU=ZR_ZMODE;return ZR_ZMODE;}
+  TUnzip *unz = han->unz;
+  lasterrorU = unz->SetDedup(mode);
+  return lasterrorU;
+}
+
+
+ZRESULT SetUnzipManifest(HZIP hz, const void *manifest, unsigned int len)
+{ if (hz==0) {lasterrorU=ZR_ARGS;return ZR_ARGS;}
+  TUnzipHandleData *han = (TUnzipHandleData*)hz;
+  if (han->flag!=1) {lasterrorU=ZR_ZMODE;return ZR_ZMODE;}
+  TUnzip *unz = han->unz;
+  lasterrorU = unz->SetManifest(manifest,len);
+  return lasterrorU;
+}
+
+
+ZRESULT SetUnzipThrottle(HZIP hz, const ZIPTHROTTLE *throttle)
+{ if (hz==0) {lasterrorU=ZR_ARGS;return ZR_ARGS;}
+  TUnzipHandleData *han = (TUnzipHandleData*)hz;
+  if (han->flag!=1) {lasterrorU=ZR_ZMODE;return ZR_ZMODE;}
+  TUnzip *unz = han->unz;
+  lasterrorU = unz->SetThrottle(throttle);
+  return lasterrorU;
+}
+
+
+ZRESULT MakeZipManifest(HZIP hz, unsigned int threads, void *buf, unsigned int *len)
+{ if (hz==0 || len==0) {lasterrorU=ZR_ARGS;return ZR_ARGS;}
+  TUnzipHandleData *han = (TUnzipHandleData*)hz;
+  if (han->flag!=1) {lasterrorU=ZR_ZMODE;return ZR_ZMODE;}
+  TUnzip *unz = han->unz;
+  lasterrorU = unz->MakeManifest(threads,buf,len);
+  return lasterrorU;
+}
+
+
+ZRESULT GetUnzipPlan(HZIP hz, unsigned int threads, ZIPPLANITEM *plan, int *count)
+{ if (hz==0 || count==0) {lasterrorU=ZR_ARGS;return ZR_ARGS;}
+  TUnzipHandleData *han = (TUnzipHandleData*)hz;
+  if (han->flag!=1) {lasterrorU=ZR_ZMODE;return ZR_ZMODE;}
+  TUnzip *unz = han->unz;
+  std::vector<ZIPPLANITEM> p;
+  lasterrorU = unz->Plan(threads,&p);
+  if (lasterrorU!=ZR_OK) return lasterrorU;
+  for (int i=0; plan!=0 && i<*count && i<(int)p.size(); i++) plan[i]=p[i];
+  *count=(int)p.size();
+  return lasterrorU;
+}
+
+
+ZRESULT UnzipAll(HZIP hz, unsigned int threads)
+{ if (hz==0) {lasterrorU=ZR_ARGS;return ZR_ARGS;}
+  TUnzipHandleData *han = (TUnzipHandleData*)hz;
+  if (han->flag!=1) {lasterrorU=ZR_ZMODE;return ZR_ZMODE;}
+  TUnzip *unz = han->unz;
+  lasterrorU = unz->UnzipAll(threads);
+  return lasterrorU;
+}
+
+
+HUNZSTREAM OpenUnzipStream(DWORD format)
+{ TUnzipStream *us = new TUnzipStream(format);
+  lasterrorU = us->Open();
+  if (lasterrorU!=ZR_OK) {delete us; return 0;}
+  return (HUNZSTREAM)us;
+}
+
+ZRESULT UnzipStream(HUNZSTREAM hs, const void *in, unsigned int inlen, unsigned int *inused,
+                    void *out, unsigned int outlen, unsigned int *outmade)
+{ if (inused!=0) *inused=0;
+  if (outmade!=0) *outmade=0;
+  if (hs==0 || (in==0 && inlen!=0) || (out==0 && outlen!=0)) {lasterrorU=ZR_ARGS;return ZR_ARGS;}
+  TUnzipStream *us = (TUnzipStream*)hs;
+  lasterrorU = us->Unzip((const Byte*)in,inlen,inused,(Byte*)out,outlen,outmade);
+  return lasterrorU;
+}
+
+ZRESULT CloseUnzipStream(HUNZSTREAM hs)
+{ if (hs==0) {lasterrorU=ZR_ARGS;return ZR_ARGS;}
+  delete (TUnzipStream*)hs;
+  lasterrorU=ZR_OK;
+  return ZR_OK;
+}
+
+
 ZRESULT CloseZipU(HZIP hz)
 { if (hz==0) {lasterrorU=ZR_ARGS;return ZR_ARGS;}
   TUnzipHandleData *han = (TUnzipHandleData*)hz;
@@ -8,6 +8,25 @@
 // by Lucian Wischik to simplify and extend its use in Windows/C++. Also
 // encryption and unicode filenames have been added.
 
+#ifndef _WIN32
+// Elsewhere, the few Win32 types that this api uses. Names are UTF-8, and a
+// HANDLE is a file descriptor: OpenZipHandle((HANDLE)(intptr_t)fd,0).
+#include <stdint.h>
+typedef void *HANDLE;
+typedef char TCHAR;
+typedef uint32_t DWORD;
+typedef struct {DWORD dwLowDateTime, dwHighDateTime;} FILETIME;
+#define DECLARE_HANDLE(n) typedef struct n##__ *n
+#define INVALID_HANDLE_VALUE ((HANDLE)(intptr_t)-1)
+#define MAX_PATH 260
+#define __int64 long long
+#define FILE_ATTRIBUTE_READONLY  0x01
+#define FILE_ATTRIBUTE_HIDDEN    0x02
+#define FILE_ATTRIBUTE_SYSTEM    0x04
+#define FILE_ATTRIBUTE_DIRECTORY 0x10
+#define FILE_ATTRIBUTE_ARCHIVE   0x20
+#endif
+
 
 #ifndef _zip_H
 DECLARE_HANDLE(HZIP);
@@ -27,15 +46,29 @@ typedef struct
 } ZIPENTRY;
 
 
+typedef struct
+{ void *param;
+  __int64 size;              // of the whole zip
+  bool (*read)(void *param, __int64 pos, void *buf, unsigned int len, unsigned int *red);
+  void (*close)(void *param);// may be 0
+} ZIPSOURCE;
+// A zip that's read through callbacks, e.g. over http (see unzipurl.h). read
+// puts up to len bytes from pos into buf and says how many in *red; it may be
+// called on several threads at once, by UnzipAll. close is called once the zip
+// has been closed, or straight away if OpenZipSource fails.
+
+
 HZIP OpenZip(const TCHAR *fn, const char *password);
 HZIP OpenZip(void *z,unsigned int len, const char *password);
 HZIP OpenZipHandle(HANDLE h, const char *password);
+HZIP OpenZipSource(const ZIPSOURCE *src, const char *password);
 // OpenZip - opens a zip file and returns a handle with which you can
 // subsequently examine its contents. You can open a zip file from:
 // from a pipe:             OpenZipHandle(hpipe_read,0);
 // from a file (by handle): OpenZipHandle(hfile,0);
 // from a file (by name):   OpenZip("c:\\test.zip","password");
 // from a memory block:     OpenZip(bufstart, buflen,0);
+// from anywhere else:      OpenZipSource(&src,0);
 // If the file is opened through a pipe, then items may only be
 // accessed in increasing order, and an item may only be unzipped once,
 // although GetZipItem can be called immediately before and after unzipping
@@ -46,6 +79,27 @@ HZIP OpenZipHandle(HANDLE h, const char *password);
 // but for real windows, the zip makes its own copy of your handle, so you
 // can close yours anytime.
 
+HZIP OpenZipOverlay(const TCHAR *fn, const char *password);
+#define ZIPOVERLAY_SIZE 32
+// OpenZipOverlay - opens the zip that's appended to the executable fn, as
+// WriteZipToSetup --overlay appends the payload to Setup.exe. Rather than
+// being read in up front, the file is mapped and items are read through the
+// view as they're unzipped, so a huge zip is only paged in as it's needed (if
+// it can't be mapped, e.g. for want of address space, it's read by offset
+// instead). The zip is found from a ZIPOVERLAY_SIZE byte trailer at the end
+// of the file, or just before its Authenticode signature, which then covers
+// both the zip and the trailer. All little-endian, the trailer is:
+//    0  8 bytes  the zip's size; it ends where the trailer starts
+//    8  4 bytes  version, 1
+//   12  4 bytes  CRC-32 of bytes 0-11
+//   16 16 bytes  "Squirrel payload"
+// The zip starts where the executable's last section ends, after up to 7
+// bytes of zeros (so that the trailer ends 8-byte aligned, where signtool
+// puts a signature), so what's downloaded of the file so far is enough to find
+// its first items. Its offsets are its own, as if it were on its own: the
+// executable in front of it is skipped as self-extractors' stubs are. Fails
+// with ZR_CORRUPT if fn has no trailer.
+
 ZRESULT GetZipItem(HZIP hz, int index, ZIPENTRY *ze);
 // GetZipItem - call this to get information about an item in the zip.
 // If index is -1 and the file wasn't opened through a pipe,
@@ -90,9 +144,161 @@ ZRESULT SetUnzipBaseDir(HZIP hz, const TCHAR *dir);
 // (defaults to current-directory).
 
 
+typedef struct
+{ DWORD event;               // ZIPPROGRESS_START, ZIPPROGRESS_DATA or ZIPPROGRESS_END
+  int index;                 // the item being unzipped
+  const TCHAR *name;         // its name within the zip
+  __int64 comp_size,unc_size;// its sizes, compressed and uncompressed,
+  __int64 comp_done,unc_done;// and how far through them we are
+  __int64 total_unc_done;    // uncompressed bytes unzipped through this HZIP so far, all items
+  double mbps;               // uncompressed MB/s since the last report (at END, over the whole item)
+  ZRESULT result;            // at END, what UnzipItem is about to return
+} ZIPPROGRESS;
+#define ZIPPROGRESS_START 1
+#define ZIPPROGRESS_DATA  2
+#define ZIPPROGRESS_END   3
+
+typedef bool (*ZIPPROGRESSPROC)(void *param, const ZIPPROGRESS *zp);
+
+ZRESULT SetUnzipProgress(HZIP hz, ZIPPROGRESSPROC proc, void *param);
+// SetUnzipProgress - has UnzipItem call proc while it unzips an item to a file or
+// handle (not to a memory block): once with ZIPPROGRESS_START, then with ZIPPROGRESS_DATA
+// about ten times a second while it's working, then once with ZIPPROGRESS_END.
+// If proc returns false from START or DATA then UnzipItem stops and returns
+// ZR_CANCELLED, leaving the item partly written. proc is called on the thread
+// that called UnzipItem. Pass proc=0 to turn it off; without one, unzipping costs
+// no more than it used to.
+
+ZRESULT SetUnzipCache(HZIP hz, const TCHAR *dir, __int64 maxsize, DWORD flags);
+#define ZIPCACHE_STRONG 1
+#define ZIPCACHE_LINK   2
+// SetUnzipCache - keeps a content-addressed store of unzipped items in dir, keyed
+// by their crc32 and size, which any number of zips (and processes) can share.
+// When UnzipItem unzips an item to a file by name, it first looks in the store,
+// and if the item's there, and its crc checks out, it copies it (cloning it where
+// the filesystem can) rather than inflating it; otherwise it adds the item to the
+// store once it's unzipped. Only unencrypted items of 64k or more are cached, and
+// an item that comes from the store keeps the file times it had when it went in.
+// With ZIPCACHE_STRONG, the store also keeps a SHA-1 of each item and checks it
+// every time it's used. ZIPCACHE_LINK hard-links items in and out of the store
+// instead of copying them, which is only safe if nothing rewrites an unzipped
+// file in place: that would change the blob for everyone else who uses it.
+// CloseZip trims the store to maxsize bytes, least recently used first.
+// Pass dir=0 to stop using it.
+
+ZRESULT SetUnzipDedup(HZIP hz, DWORD mode);
+#define ZIPDEDUP_OFF  0
+#define ZIPDEDUP_COPY 1
+#define ZIPDEDUP_LINK 2
+// SetUnzipDedup - items with the same crc32, sizes and method are usually the
+// same file under different names. When UnzipItem unzips one of them to a file
+// by name, and it has already unzipped another to a file, it compares their
+// compressed bytes and, if they match, copies that file (cloning it where the
+// filesystem can) rather than inflating it again. ZIPDEDUP_LINK hard-links it
+// instead, so the two names share one file, times and all. The default is
+// ZIPDEDUP_COPY; only unencrypted items of 16k or more are considered, and
+// if the earlier file has since been deleted or resized the item is inflated.
+
+ZRESULT SetUnzipManifest(HZIP hz, const void *manifest, unsigned int len);
+#define ZIPMANIFEST_SIZE(n) (24+40*(n))
+// SetUnzipManifest - has UnzipItem check each item against a manifest of the
+// zip, as MakeZipManifest makes it, which has every item's size and BLAKE3.
+// The item is hashed as it's unzipped (a big one by the threads that inflate
+// its chunks, so it costs next to no time) and if it doesn't match, or its
+// size doesn't, UnzipItem returns ZR_CORRUPT. Items that come from the cache
+// are checked too, and items are only treated as duplicates if their hashes
+// match. UnzipItem also returns ZR_CORRUPT for a bad crc32, manifest or not.
+// The manifest is copied; pass 0 to stop using it. Fails with ZR_CORRUPT if
+// it isn't a manifest, or isn't for as many items as the zip has. All
+// little-endian, it's ZIPMANIFEST_SIZE(number of items) bytes:
+//    0 16 bytes  "Squirrel digests"
+//   16  4 bytes  version, 1
+//   20  4 bytes  number of items
+//   24           for each item, in order: 8 bytes its size, 32 bytes its BLAKE3
+//                (a folder's is the BLAKE3 of nothing)
+
+typedef struct
+{ unsigned int threads;      // workers at most, both UnzipAll's and those inflating a big item's chunks; 0 for no limit
+  unsigned int mbps;         // uncompressed MB a second at most, across all the workers; 0 for no limit
+  bool background;           // the workers run at background CPU and I/O priority
+  bool (*busy)(void *param); // asked every 100ms or so; while it says true, the workers wait
+  void *param;
+  unsigned int patience;     // ms to wait for busy, in all, before carrying on regardless; 0 for 30000
+  const volatile long *lift; // once *lift isn't 0 (it's set on another thread), it's as if there were no throttle; 0 for never
+} ZIPTHROTTLE;
+
+ZRESULT SetUnzipThrottle(HZIP hz, const ZIPTHROTTLE *throttle);
+// SetUnzipThrottle - for unzipping that mustn't get in the way of anything
+// else: an install at logon, say. UnzipItem and UnzipAll sleep between the
+// blocks they write to keep to the cap, and wait while busy (if there is one)
+// says the machine is wanted for something more important, until they've
+// waited patience ms altogether. With background, UnzipAll's workers (all of
+// them threads of its own, then, rather than the caller) and the chunk
+// workers lower their priority: THREAD_MODE_BACKGROUND_BEGIN on Windows, and
+// nice 19 with the idle I/O class on Linux. The throttle is copied; pass 0 to
+// stop throttling. Setting *lift stops it from another thread part way
+// through, for when the unzipping's wanted after all: the cap and busy are
+// forgotten, UnzipAll's workers go back to normal priority as they start
+// their next task, and UnzipAll starts as many more as it'd have had without
+// threads (within 100ms, if it's in the background). What the throttled part
+// did stands; an item that's part way through finishes as it started.
+
+ZRESULT MakeZipManifest(HZIP hz, unsigned int threads, void *buf, unsigned int *len);
+// MakeZipManifest - unzips every item, as UnzipAll does but only to hash it,
+// and puts the manifest in buf. *len is buf's size, and is set to the
+// manifest's; pass buf=0 to just get that.
+
+
+typedef struct
+{ int index;              // the item
+  long offset;            // where its local header is in the zip
+  long comp_size;         // sizes of the item
+  long unc_size;
+  int task;               // workers take a whole task at a time, in task order
+} ZIPPLANITEM;
+
+ZRESULT UnzipAll(HZIP hz, unsigned int threads);
+// UnzipAll - unzips every item to its own name under the base directory, as
+// UnzipItem(hz,i,ze.name) would, on up to threads threads (0 for one per core,
+// up to 8). Big items go to the workers first and small ones in batches, in the
+// order GetUnzipPlan shows. The progress callback, if any, is called from the
+// workers, but only one at a time. It stops at the first item that fails, and
+// returns that item's error.
+
+ZRESULT GetUnzipPlan(HZIP hz, unsigned int threads, ZIPPLANITEM *plan, int *count);
+// GetUnzipPlan - the order UnzipAll would unzip the items in with that many
+// threads: the first *count of them go in plan, and *count is set to the number
+// of items. Pass plan=0 to just get the count. Items with the same task are
+// unzipped by one worker in the order given.
+
 ZRESULT CloseZip(HZIP hz);
 // CloseZip - the zip handle must be closed with this function.
 
+
+DECLARE_HANDLE(HUNZSTREAM);
+// An HUNZSTREAM inflates one deflate stream that isn't in a zip, e.g. a .gz,
+// a buffer at a time.
+
+#define ZSTREAM_RAW  0       // bare deflate data, as in a zip
+#define ZSTREAM_ZLIB 1       // with a zlib header and Adler-32 check (RFC 1950)
+#define ZSTREAM_GZIP 2       // with a gzip header and a CRC-32 and size check (RFC 1952)
+
+HUNZSTREAM OpenUnzipStream(DWORD format);
+// OpenUnzipStream - format is one of the above. Returns 0 if it isn't.
+
+ZRESULT UnzipStream(HUNZSTREAM hs, const void *in, unsigned int inlen, unsigned int *inused,
+                    void *out, unsigned int outlen, unsigned int *outmade);
+// UnzipStream - inflates from in to out, and says how much of each it used.
+// Returns ZR_MORE if the stream hasn't ended yet: call it again with the rest
+// of in, or more of it, and/or more room in out. Returns ZR_OK once the stream
+// has ended and its check matched, after which any more input is left unused,
+// except with gzip, where it's taken to be the next member (as gzip -d does).
+// Returns ZR_CORRUPT if the data or its header or check is bad; a zlib stream
+// that needs a preset dictionary counts as bad.
+
+ZRESULT CloseUnzipStream(HUNZSTREAM hs);
+// CloseUnzipStream - frees the stream, whether or not it had ended.
+
 unsigned int FormatZipMessage(ZRESULT code, TCHAR *buf,unsigned int len);
 // FormatZipMessage - given an error code, formats it as a string.
 // It returns the length of the error message. If buf/len points
@@ -123,6 +329,7 @@ unsigned int FormatZipMessage(ZRESULT code, TCHAR *buf,unsigned int len);
 #define ZR_MISSIZE    0x00060000     // the indicated input file size turned out mistaken
 #define ZR_PARTIALUNZ 0x00070000     // the file had already been partially unzipped
 #define ZR_ZMODE      0x00080000     // tried to mix creating/opening a zip
+#define ZR_CANCELLED  0x00090000     // the progress callback asked us to stop
 // The following come from bugs within the zip library itself
 #define ZR_BUGMASK    0xFF000000
 #define ZR_NOTINITED  0x01000000     // initialisation didn't work
@@ -0,0 +1,284 @@
+#ifdef _WIN32
+#include "stdafx.h"
+#include "httpsession.h"
+#else
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#endif
+#include "unzip.h"
+#include "unzipurl.h"
+#include "trace.h"
+#include <vector>
+#include <map>
+#include <mutex>
+#include <string>
+#include <algorithm>
+
+
+#define URL_BLOCK    (64*1024)
+#define URL_TAIL     (2*URL_BLOCK)      // enough for the end record and the longest zip comment
+#define URL_AHEAD    4                  // blocks fetched ahead of a read that doesn't follow on
+#define URL_MAXAHEAD 64                 // and the most, for one that does
+#define URL_CACHE    (32*1024*1024)     // blocks beyond this are dropped, least recently used first
+
+typedef struct
+{ std::vector<char> data;
+  unsigned int used;         // when it was last read, by url_source::clock
+} url_block;
+
+typedef struct
+{ std::mutex m;              // guards all of it; fetches happen one at a time
+  URLSOURCESTATS stats;
+  std::map<__int64,url_block> blocks;
+  __int64 cached;            // bytes in blocks
+  unsigned int clock;
+  __int64 lastend;           // where the last fetch stopped
+  unsigned int ahead;        // blocks to fetch past the next miss
+#ifdef _WIN32
+  HTTPSESSION http; HINTERNET connect;
+  std::wstring path; bool secure;
+#else
+  std::string host, port, path;
+#endif
+} url_source;
+
+
+// The transport: a GET of bytes from..to (inclusive), or the last -from bytes if
+// from<0. It gives back the body, and where it starts and how long the whole
+// thing is, from the Content-Range. A server that ignores the range and
+// answers 200 with the whole file is a failure: every miss would fetch it all
+// again, so it's better to say so at once.
+
+bool url_parserange(const char *cr, __int64 *start, __int64 *total)
+{ long long s, e, t;
+  if (sscanf(cr,"bytes %lld-%lld/%lld",&s,&e,&t)!=3) return false;
+  *start=s; *total=t; return true;
+}
+
+#ifdef _WIN32
+bool url_open(url_source *u, const TCHAR *url)
+{ URL_COMPONENTS uc; ZeroMemory(&uc,sizeof(uc)); uc.dwStructSize=sizeof(uc);
+  wchar_t host[256], path[2048];
+  uc.lpszHostName=host; uc.dwHostNameLength=256;
+  uc.lpszUrlPath=path; uc.dwUrlPathLength=2048;
+  if (!WinHttpCrackUrl(url,0,0,&uc)) return false;
+  if (uc.nScheme!=INTERNET_SCHEME_HTTP && uc.nScheme!=INTERNET_SCHEME_HTTPS) return false;
+  u->secure = uc.nScheme==INTERNET_SCHEME_HTTPS;
+  u->path = path;
+  if (!OpenHttpSession(&u->http,url)) return false;
+  u->connect = WinHttpConnect(u->http.session,host,uc.nPort,0);
+  if (u->connect==NULL) {CloseHttpSession(&u->http); return false;}
+  return true;
+}
+
+void url_close(url_source *u)
+{ if (u->connect!=NULL) WinHttpCloseHandle(u->connect);
+  CloseHttpSession(&u->http);
+}
+
+bool url_get(url_source *u, __int64 from, __int64 to, std::vector<char> &body, __int64 *start, __int64 *total)
+{ HINTERNET req = WinHttpOpenRequest(u->connect,L"GET",u->path.c_str(),NULL,WINHTTP_NO_REFERER,WINHTTP_DEFAULT_ACCEPT_TYPES,u->secure?WINHTTP_FLAG_SECURE:0);
+  if (req==NULL) return false;
+  PrepareHttpRequest(&u->http,req);
+  wchar_t range[64];
+  if (from<0) swprintf_s(range,L"Range: bytes=%lld",from);
+  else swprintf_s(range,L"Range: bytes=%lld-%lld",from,to);
+  bool ok = WinHttpSendRequest(req,range,(DWORD)-1,WINHTTP_NO_REQUEST_DATA,0,0,0) && WinHttpReceiveResponse(req,NULL);
+  DWORD status=0, len=sizeof(status);
+  if (ok) ok = WinHttpQueryHeaders(req,WINHTTP_QUERY_STATUS_CODE|WINHTTP_QUERY_FLAG_NUMBER,WINHTTP_HEADER_NAME_BY_INDEX,&status,&len,WINHTTP_NO_HEADER_INDEX)!=FALSE;
+  if (ok) ok = status==206;
+  if (ok)
+  { wchar_t wcr[128]; char cr[128]; len=sizeof(wcr);
+    ok = WinHttpQueryHeaders(req,WINHTTP_QUERY_CONTENT_RANGE,WINHTTP_HEADER_NAME_BY_INDEX,wcr,&len,WINHTTP_NO_HEADER_INDEX)!=FALSE;
+    if (ok) ok = WideCharToMultiByte(CP_ACP,0,wcr,-1,cr,sizeof(cr),NULL,NULL)!=0 && url_parserange(cr,start,total);
+  }
+  body.clear();
+  char buf[65536]; DWORD red;
+  while (ok && (ok=WinHttpReadData(req,buf,sizeof(buf),&red)!=FALSE) && red>0) body.insert(body.end(),buf,buf+red);
+  WinHttpCloseHandle(req);
+  return ok;
+}
+
+#else
+bool url_open(url_source *u, const TCHAR *url)
+{ if (strncmp(url,"http://",7)!=0) return false; // no tls here
+  const char *host=url+7, *slash=strchr(host,'/');
+  std::string hostport = slash ? std::string(host,slash-host) : std::string(host);
+  u->path = slash ? slash : "/";
+  size_t colon = hostport.rfind(':');
+  if (colon==std::string::npos) {u->host=hostport; u->port="80";}
+  else {u->host=hostport.substr(0,colon); u->port=hostport.substr(colon+1);}
+  return !u->host.empty();
+}
+
+void url_close(url_source *) {}
+
+int url_connect(url_source *u)
+{ struct addrinfo hints, *res, *ai; memset(&hints,0,sizeof(hints));
+  hints.ai_family=AF_UNSPEC; hints.ai_socktype=SOCK_STREAM;
+  if (getaddrinfo(u->host.c_str(),u->port.c_str(),&hints,&res)!=0) return -1;
+  int fd=-1;
+  for (ai=res; ai!=0 && fd==-1; ai=ai->ai_next)
+  { fd=socket(ai->ai_family,ai->ai_socktype|SOCK_CLOEXEC,ai->ai_protocol);
+    if (fd!=-1 && connect(fd,ai->ai_addr,ai->ai_addrlen)!=0) {close(fd); fd=-1;}
+  }
+  freeaddrinfo(res);
+  if (fd!=-1) {struct timeval tv={30,0}; setsockopt(fd,SOL_SOCKET,SO_RCVTIMEO,&tv,sizeof(tv));} // as WinHTTP's, in PrepareHttpRequest
+  return fd;
+}
+
+// the value of header name (which ends in ": "), or 0
+const char *url_header(const std::string &head, const char *name)
+{ for (size_t line=head.find("\r\n"); line!=std::string::npos; line=head.find("\r\n",line+2))
+  { if (strncasecmp(head.c_str()+line+2,name,strlen(name))==0) return head.c_str()+line+2+strlen(name);
+  }
+  return 0;
+}
+
+bool url_dechunk(std::vector<char> &body)
+{ std::vector<char> out; size_t pos=0;
+  for (;;)
+  { body.push_back(0); unsigned long n=strtoul(&body[pos],0,16); body.pop_back();
+    size_t eol=pos; while (eol+1<body.size() && !(body[eol]=='\r' && body[eol+1]=='\n')) eol++;
+    if (eol+1>=body.size()) return false;
+    pos=eol+2;
+    if (n==0) break;
+    if (pos+n+2>body.size()) return false;
+    out.insert(out.end(),body.begin()+pos,body.begin()+pos+n);
+    pos+=n+2;
+  }
+  body.swap(out); return true;
+}
+
+bool url_get(url_source *u, __int64 from, __int64 to, std::vector<char> &body, __int64 *start, __int64 *total)
+{ int fd=url_connect(u); if (fd==-1) return false;
+  char req[4096];
+  int len = from<0 ? snprintf(req,sizeof(req),"GET %s HTTP/1.1\r\nHost: %s:%s\r\nRange: bytes=%lld\r\nConnection: close\r\nUser-Agent: Squirrel\r\n\r\n",u->path.c_str(),u->host.c_str(),u->port.c_str(),(long long)from)
+                   : snprintf(req,sizeof(req),"GET %s HTTP/1.1\r\nHost: %s:%s\r\nRange: bytes=%lld-%lld\r\nConnection: close\r\nUser-Agent: Squirrel\r\n\r\n",u->path.c_str(),u->host.c_str(),u->port.c_str(),(long long)from,(long long)to);
+  bool ok = len>0 && len<(int)sizeof(req) && send(fd,req,len,MSG_NOSIGNAL)==len;
+  std::vector<char> resp; char buf[65536]; ssize_t red;
+  while (ok && (red=recv(fd,buf,sizeof(buf),0))>0) resp.insert(resp.end(),buf,buf+red);
+  close(fd);
+  if (!ok) return false;
+  const char blank[]="\r\n\r\n";
+  std::vector<char>::iterator eoh=std::search(resp.begin(),resp.end(),blank,blank+4);
+  if (eoh==resp.end()) return false;
+  std::string head(resp.begin(),eoh+2);
+  int status=0; if (sscanf(head.c_str(),"HTTP/%*s %d",&status)!=1) return false;
+  if (status!=206) return false;
+  body.assign(eoh+4,resp.end());
+  const char *te=url_header(head,"Transfer-Encoding: ");
+  if (te!=0 && strncasecmp(te,"chunked",7)==0 && !url_dechunk(body)) return false;
+  const char *cr=url_header(head,"Content-Range: ");
+  return cr!=0 && url_parserange(cr,start,total);
+}
+#endif
+
+
+// Puts what a fetch brought back into the cache, a block at a time. Only
+// whole blocks (or the last, short one) are kept.
+void url_store(url_source *u, const std::vector<char> &body, __int64 start)
+{ u->stats.requests++; u->stats.fetched+=body.size();
+  TraceCount("http requests",1); TraceCount("http bytes",(__int64)body.size());
+  __int64 end=start+(__int64)body.size();
+  for (__int64 b=(start+URL_BLOCK-1)/URL_BLOCK; b*URL_BLOCK<end; b++)
+  { __int64 bs=b*URL_BLOCK, be=bs+URL_BLOCK; if (be>u->stats.size) be=u->stats.size;
+    if (be>end || u->blocks.count(b)!=0) continue;
+    url_block &blk=u->blocks[b];
+    blk.data.assign(body.begin()+(size_t)(bs-start),body.begin()+(size_t)(be-start));
+    blk.used=++u->clock; u->cached+=blk.data.size();
+  }
+  u->lastend=end;
+  while (u->cached>URL_CACHE)
+  { std::map<__int64,url_block>::iterator old=u->blocks.begin();
+    for (std::map<__int64,url_block>::iterator i=u->blocks.begin(); i!=u->blocks.end(); i++) if (i->second.used<old->second.used) old=i;
+    u->cached-=old->second.data.size(); u->blocks.erase(old);
+  }
+}
+
+// Fetches block b, and the missing blocks after it as far as the read-ahead goes
+bool url_fetch(url_source *u, __int64 b)
+{ if (b*URL_BLOCK==u->lastend) {u->ahead*=2; if (u->ahead>URL_MAXAHEAD) u->ahead=URL_MAXAHEAD;}
+  else u->ahead=URL_AHEAD;
+  __int64 nblocks=(u->stats.size+URL_BLOCK-1)/URL_BLOCK, e=b+1;
+  while (e<nblocks && e<b+u->ahead && u->blocks.count(e)==0) e++;
+  __int64 to=e*URL_BLOCK; if (to>u->stats.size) to=u->stats.size;
+  std::vector<char> body; __int64 start, total;
+  { TraceSpan span("http fetch");
+    if (!url_get(u,b*URL_BLOCK,to-1,body,&start,&total) || total!=u->stats.size) return false;
+  }
+  url_store(u,body,start);
+  return u->blocks.count(b)!=0;
+}
+
+bool url_read(void *param, __int64 pos, void *buf, unsigned int len, unsigned int *red)
+{ url_source *u=(url_source*)param;
+  std::lock_guard<std::mutex> lock(u->m);
+  *red=0;
+  if (pos>=u->stats.size) return true;
+  if (pos+len>u->stats.size) len=(unsigned int)(u->stats.size-pos);
+  while (len>0)
+  { __int64 b=pos/URL_BLOCK;
+    std::map<__int64,url_block>::iterator blk=u->blocks.find(b);
+    if (blk==u->blocks.end())
+    { if (!url_fetch(u,b)) return false;
+      blk=u->blocks.find(b);
+    }
+    blk->second.used=++u->clock;
+    unsigned int off=(unsigned int)(pos-b*URL_BLOCK);
+    unsigned int n=(unsigned int)blk->second.data.size()-off; if (n>len) n=len;
+    memcpy((char*)buf+*red,&blk->second.data[off],n);
+    *red+=n; pos+=n; len-=n; u->stats.served+=n;
+  }
+  return true;
+}
+
+__int64 url_get32(const unsigned char *p) {return p[0]|(p[1]<<8)|(p[2]<<16)|((__int64)p[3]<<24);}
+
+void url_free(void *param)
+{ url_source *u=(url_source*)param;
+  url_close(u);
+  delete u;
+}
+
+
+bool OpenUrlSource(const TCHAR *url, ZIPSOURCE *src)
+{ url_source *u=new url_source;
+  memset(&u->stats,0,sizeof(u->stats)); u->cached=0; u->clock=0; u->lastend=-1; u->ahead=URL_AHEAD;
+#ifdef _WIN32
+  u->http.session=NULL; u->connect=NULL;
+#endif
+  if (!url_open(u,url)) {url_free(u); return false;}
+  // the end of the zip, which tells us how big it is and where the central directory is
+  std::vector<char> tail; __int64 start, total;
+  if (!url_get(u,-URL_TAIL,0,tail,&start,&total)) {url_free(u); return false;}
+  u->stats.size=total; u->lastend=total;
+  url_store(u,tail,start);
+  // then the whole central directory in one go, as far as the tail doesn't have it
+  __int64 covered=(start+URL_BLOCK-1)/URL_BLOCK*URL_BLOCK; // url_store kept the tail from here
+  for (size_t i = tail.size()<22 ? 0 : tail.size()-21; i-->0; )
+  { const unsigned char *p=(const unsigned char*)&tail[i];
+    if (p[0]!=0x50 || p[1]!=0x4b || p[2]!=0x05 || p[3]!=0x06) continue;
+    __int64 cdsize=url_get32(p+12), cdoff=url_get32(p+16);
+    __int64 from=cdoff/URL_BLOCK*URL_BLOCK, to=(cdoff+cdsize+URL_BLOCK-1)/URL_BLOCK*URL_BLOCK;
+    if (to>covered) to=covered;
+    if (to>total) to=total;
+    std::vector<char> cd; __int64 cs, ct;
+    if (from<to && url_get(u,from,to-1,cd,&cs,&ct) && ct==total) url_store(u,cd,cs);
+    break;
+  }
+  src->param=u; src->size=total; src->read=url_read; src->close=url_free;
+  return true;
+}
+
+void GetUrlSourceStats(const ZIPSOURCE *src, URLSOURCESTATS *stats)
+{ url_source *u=(url_source*)src->param;
+  std::lock_guard<std::mutex> lock(u->m);
+  *stats=u->stats;
+}
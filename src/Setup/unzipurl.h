@@ -0,0 +1,44 @@
+#ifndef _unzipurl_H
+#define _unzipurl_H
+
+// A ZIPSOURCE (see unzip.h) that reads a zip over http with range requests,
+// so that only the parts that are needed get downloaded: the end record and
+// central directory when it's opened, then each item's bytes as it's unzipped.
+// e.g. to get just Update.exe out of a full package on a server,
+//   ZIPSOURCE src; if (!OpenUrlSource(_T("https://example.com/MyApp-1.0.0-full.nupkg"),&src)) ...
+//   HZIP hz = OpenZipSource(&src,0);
+//   int i; ZIPENTRY ze; FindZipItem(hz,_T("lib/net45/Update.exe"),true,&i,&ze);
+//   UnzipItem(hz,i,_T("Update.exe"));
+//   CloseZip(hz);
+// Reads are served from a cache of 64k blocks. A miss fetches every missing
+// block it needs in one request, and while the reads keep running on from
+// the last fetch (as they do when an item is being unzipped) each request
+// fetches twice as far ahead as the last, up to 4MB.
+// On Windows it uses WinHTTP, through httpsession.cpp so that https and the
+// user's proxy (Internet Options, WPAD or PAC) work; elsewhere it speaks plain
+// http over a socket, which is enough for the tests and bench. Either way a
+// server that goes quiet for 30s fails the read.
+// A server that ignores Range, and answers 200 with the whole zip, can't be
+// read this way: OpenUrlSource fails on its first reply rather than fetch the
+// whole zip again at every miss.
+// Only the bench uses this so far, so it isn't built into Setup.exe.
+
+#include "unzip.h"
+
+typedef struct
+{ __int64 size;              // of the zip
+  unsigned int requests;     // requests made so far
+  __int64 fetched;           // bytes they brought back
+  __int64 served;            // bytes the unzipper has read, from the cache or not
+} URLSOURCESTATS;
+
+bool OpenUrlSource(const TCHAR *url, ZIPSOURCE *src);
+// OpenUrlSource - fetches the end of the zip, and its central directory, and
+// fills in src for OpenZipSource, which then owns it. Returns false if the
+// server couldn't be reached or wouldn't say how big the zip is.
+
+void GetUrlSourceStats(const ZIPSOURCE *src, URLSOURCESTATS *stats);
+// GetUrlSourceStats - how much it's fetched so far, for tuning. src must be
+// the one that was passed to OpenZipSource, and the zip must still be open.
+
+#endif
@@ -6,6 +6,8 @@
 #include "FxHelper.h"
 #include "UpdateRunner.h"
 #include "MachineInstaller.h"
+#include "trace.h"
+#include "checkinstall.h"
 #include <cstdio>
 #include <string>
 
@@ -17,6 +19,7 @@ typedef BOOL(WINAPI *SetDefaultDllDirectoriesFunction)(DWORD DirectoryFlags);
 // If we pre-load them with an absolute path then we are good.
 static void PreloadLibs()
 {
+	TraceSpan span("PreloadLibs");
 	wchar_t sys32Folder[MAX_PATH];
 	GetSystemDirectory(sys32Folder, MAX_PATH);
 
@@ -47,37 +50,100 @@ static void MitigateDllHijacking()
 	PreloadLibs();
 }
 
+// Writes out the trace, to %TEMP% if Setup stopped before it got as far as
+// choosing where SquirrelSetup.log goes
+static void FinishTrace()
+{
+	if (!Tracing()) {
+		return;
+	}
+
+	wchar_t traceFile[MAX_PATH];
+	DWORD len = GetTempPath(MAX_PATH, traceFile);
+	if (len > 0 && len < MAX_PATH && wcscat_s(traceFile, L"SquirrelSetup.trace.json") == 0) {
+		TraceFile(traceFile);
+	}
+
+	TraceStop();
+}
+
 int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
                       _In_opt_ HINSTANCE hPrevInstance,
                       _In_ LPWSTR lpCmdLine,
                       _In_ int nCmdShow)
 {
+	// --trace, or SQUIRREL_TRACE in the environment, writes a timeline of the
+	// install next to SquirrelSetup.log as SquirrelSetup.trace.json, for
+	// chrome://tracing; see trace.h
+	if (wcsstr(lpCmdLine, L"--trace") != NULL || _wgetenv(L"SQUIRREL_TRACE") != NULL) {
+		TraceStart("Setup");
+		TraceThreadName("main");
+	}
+
+	// --checkInstall runs at every logon on a machine-wide install, and it's
+	// nearly always installed already, so that's found out first of all,
+	// from the environment and without loading anything; see checkinstall.h
+	bool checkInstall = wcsstr(lpCmdLine, L"--checkInstall") != NULL;
+	int installCheck = CHECKINSTALL_UNKNOWN;
+	__int64 phase;
+
+	if (checkInstall) {
+		phase = TraceNow();
+		wchar_t ourFile[MAX_PATH];
+		if (GetModuleFileName(NULL, ourFile, _countof(ourFile)) != 0) {
+			installCheck = CheckInstallFromEnvironment(ourFile);
+		}
+		TraceSpanEnd("CheckInstall", phase);
+
+		if (installCheck == CHECKINSTALL_SKIP) {
+			FinishTrace();
+			return 0;
+		}
+	}
+
+	phase = TraceNow();
 	MitigateDllHijacking();
+	TraceSpanEnd("MitigateDllHijacking", phase);
 
 	int exitCode = -1;
 	CString cmdLine(lpCmdLine);
-
-	if (cmdLine.Find(L"--checkInstall") >= 0) {
-		// If we're already installed, exit as fast as possible
-		if (!MachineInstaller::ShouldSilentInstall()) {
-			return 0;
+	CBackgroundExtraction extraction;
+
+	if (checkInstall) {
+		// The environment only ever says skip; otherwise ask the long way round
+		if (installCheck == CHECKINSTALL_UNKNOWN) {
+			phase = TraceNow();
+			bool shouldInstall = MachineInstaller::ShouldSilentInstall();
+			TraceSpanEnd("ShouldSilentInstall", phase);
+
+			if (!shouldInstall) {
+				FinishTrace();
+				return 0;
+			}
 		}
 
 		// Make sure update.exe gets silent
 		wcscat(lpCmdLine, L" --silent");
 	}
 
+	phase = TraceNow();
 	HRESULT hr = ::CoInitialize(NULL);
 	ATLASSERT(SUCCEEDED(hr));
+	TraceSpanEnd("CoInitialize", phase);
 
+	phase = TraceNow();
 	AtlInitCommonControls(ICC_COOL_CLASSES | ICC_BAR_CLASSES);
 	_Module = new CAppModule();
 	hr = _Module->Init(NULL, hInstance);
+	TraceSpanEnd("AtlInitCommonControls", phase);
 
 	bool isQuiet = (cmdLine.Find(L"-s") >= 0);
 	bool weAreUACElevated = CUpdateRunner::AreWeUACElevated() == S_OK;
 	bool attemptingToRerun = (cmdLine.Find(L"--rerunningWithoutUAC") >= 0);
 
+	// (Wine always reports admin privileges, so don't believe it there)
+	bool mustRerunWithoutUAC = weAreUACElevated && CUpdateRunner::AreWeInWine() != S_OK;
+
 	if (weAreUACElevated && attemptingToRerun) {
 		CUpdateRunner::DisplayErrorMessage(CString(L"Please re-run this installer as a normal user instead of \"Run as Administrator\"."), NULL);
 		exitCode = E_FAIL;
@@ -91,10 +157,17 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
 		goto out;
 	}
 
+	phase = TraceNow();
 	NetVersion requiredVersion = CFxHelper::GetRequiredDotNetVersion();
-
-	if (!CFxHelper::IsDotNetInstalled(requiredVersion)) {
-		hr = CFxHelper::InstallDotNetFramework(requiredVersion, isQuiet);
+	bool dotNetInstalled = CFxHelper::IsDotNetInstalled(requiredVersion);
+	TraceSpanEnd("IsDotNetInstalled", phase);
+
+	if (!dotNetInstalled) {
+		phase = TraceNow();
+		// Unpack the payload while the framework downloads and installs, unless
+		// we're about to start over as another process
+		hr = CFxHelper::InstallDotNetFramework(requiredVersion, isQuiet, mustRerunWithoutUAC ? NULL : &extraction);
+		TraceSpanEnd("InstallDotNetFramework", phase);
 		if (FAILED(hr)) {
 			exitCode = hr; // #yolo
 			CUpdateRunner::DisplayErrorMessage(CString(L"Failed to install the .NET Framework, try installing the latest version manually"), NULL);
@@ -110,8 +183,7 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
 
 	// If we're UAC-elevated, we shouldn't be because it will give us permissions
 	// problems later. Just silently rerun ourselves.
-	// (Skip this check in Wine, which always reports admin privileges)
-	if (weAreUACElevated && CUpdateRunner::AreWeInWine() != S_OK) {
+	if (mustRerunWithoutUAC) {
 		wchar_t buf[4096];
 		HMODULE hMod = GetModuleHandle(NULL);
 		GetModuleFileNameW(hMod, buf, 4096);
@@ -122,9 +194,15 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
 		goto out;
 	}
 
-	exitCode = CUpdateRunner::ExtractUpdaterAndRun(lpCmdLine, false);
+	phase = TraceNow();
+	exitCode = CUpdateRunner::ExtractUpdaterAndRun(lpCmdLine, false, &extraction);
+	TraceSpanEnd("ExtractUpdaterAndRun", phase);
 
 out:
+	// Nothing to do if it was used; if it wasn't, Update.exe won't be run
+	extraction.Cancel();
+
 	_Module->Term();
+	FinishTrace();
 	return exitCode;
 }
@@ -0,0 +1,840 @@
+#ifdef _WIN32
+#include "stdafx.h"
+#else
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+typedef uint16_t WORD;
+#define _T(x) x
+#define _tcslen strlen
+#endif
+#include "zip.h"
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+
+
+// zip.cpp -- makes zips, deflating their items on several threads. The
+// deflater is a small one of our own after zlib's deflate.c and trees.c
+// (hash chains, lazy matching, and a fixed, dynamic or stored choice for
+// every block), but where zlib streams through a sliding window, this one
+// is handed a whole item, or a whole chunk of one, at a time.
+// Files are read and written through the engine's platform layer, and
+// checksummed with its crc, so this needs unzip.cpp alongside it.
+
+typedef unsigned char Byte;
+typedef unsigned long uLong;
+typedef std::basic_string<TCHAR> zip_tstring;
+
+uLong ucrc32(uLong crc, const Byte *buf, unsigned int len);
+uLong ucrc32_combine(uLong crc1, uLong crc2, uLong len2);
+HANDLE upl_open(const TCHAR *fn);
+HANDLE upl_create(const TCHAR *fn,DWORD attr);
+void upl_close(HANDLE h);
+bool upl_pread(HANDLE h,void *buf,unsigned int len,__int64 off,unsigned int *red);
+bool upl_pwrite(HANDLE h,const void *buf,unsigned int len,__int64 off);
+bool upl_delete(const TCHAR *fn);
+bool upl_stat(const TCHAR *fn,__int64 *size,FILETIME *mtime,DWORD *attr);
+typedef void (*upl_walkproc)(void *param,const TCHAR *name,bool isdir);
+void upl_walk(const TCHAR *dir,upl_walkproc proc,void *param);
+void upl_filetimedos(const FILETIME *ft,WORD *dosdate,WORD *dostime);
+extern ZRESULT lasterrorU;
+
+#ifdef _WIN32
+#define ZIP_SLASH _T('\\')
+#else
+#define ZIP_SLASH '/'
+#endif
+
+
+
+
+// ---------------------------------------------------------------- deflate
+
+#define ZD_WSIZE    32768
+#define ZD_WMASK    (ZD_WSIZE-1)
+#define ZD_MAXDIST  (ZD_WSIZE-262)  // as zlib's MAX_DIST, so a match never reaches a slot that's been reused
+#define ZD_HBITS    15
+#define ZD_HMASK    ((1<<ZD_HBITS)-1)
+#define ZD_MINMATCH 3
+#define ZD_MAXMATCH 258
+#define ZD_TOOFAR   4096            // a 3-byte match further back than this costs more than its literals
+#define ZD_SYMS     16384           // literals and matches per block
+#define ZD_STORED   65535           // most bytes in one stored block
+
+typedef struct
+{ unsigned short good;   // reduce the chain search once we have a match this long
+  unsigned short lazy;   // don't look for a better match than this (or, greedy, insert matches only up to this)
+  unsigned short nice;   // stop searching once we have a match this long
+  unsigned short chain;  // the most hash chain links to follow
+  bool lazyeval;         // deflate_slow rather than deflate_fast
+} zd_config;
+
+// zlib's configuration_table, levels 1 to 9
+const zd_config zd_configs[10] =
+{ {0,0,0,0,false},
+  {4,4,8,4,false}, {4,5,16,8,false}, {4,6,32,32,false},
+  {4,4,16,16,true}, {8,16,32,32,true}, {8,16,128,128,true},
+  {8,32,128,256,true}, {32,128,258,1024,true}, {32,258,258,4096,true}
+};
+
+const unsigned short zd_lbase[29] = {3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258};
+const Byte zd_lextra[29] = {0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0};
+const unsigned short zd_dbase[30] = {1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577};
+const Byte zd_dextra[30] = {0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13};
+const Byte zd_clorder[19] = {16,17,18,0,8,7,9,6,10,5,11,4,12,3,13,2,14,1,15};
+
+void ziplocal_Codes(const Byte *lens,int n,unsigned short *codes);
+
+// length-3 to length code, and distance-1 to distance code the way zlib's
+// _dist_code does it: directly below 256, and by (dist-1)>>7 above. And the
+// fixed codes.
+typedef struct zd_tables_s
+{ Byte lcode[256]; Byte dcode[512];
+  Byte fl[288], fd[30]; unsigned short fc[288], fdc[30];
+  zd_tables_s()
+  { for (int c=0; c<29; c++) for (int l=zd_lbase[c]; l<zd_lbase[c]+(1<<zd_lextra[c]) && l<=ZD_MAXMATCH; l++) lcode[l-3]=(Byte)c;
+    for (int c=0; c<30; c++) for (int d=zd_dbase[c]; d<zd_dbase[c]+(1<<zd_dextra[c]); d++)
+    { if (d<=256) dcode[d-1]=(Byte)c;
+      else dcode[256+((d-1)>>7)]=(Byte)c;
+    }
+    for (int i=0; i<288; i++) fl[i] = i<144 ? 8 : i<256 ? 9 : i<280 ? 7 : 8;
+    for (int i=0; i<30; i++) fd[i]=5;
+    ziplocal_Codes(fl,288,fc); ziplocal_Codes(fd,30,fdc);
+  }
+} zd_tables;
+
+const zd_tables &zd_tab() {static zd_tables t; return t;}
+inline unsigned int zd_dcode(const zd_tables &t,unsigned int dist) {return dist<=256 ? t.dcode[dist-1] : t.dcode[256+((dist-1)>>7)];}
+
+
+// The canonical codes for a set of code lengths, bit-reversed, ready to send
+void ziplocal_Codes(const Byte *lens,int n,unsigned short *codes)
+{ unsigned int count[16]={0}, next[16]={0}, code=0;
+  for (int i=0; i<n; i++) count[lens[i]]++;
+  count[0]=0;
+  for (int l=1; l<16; l++) {code=(code+count[l-1])<<1; next[l]=code;}
+  for (int i=0; i<n; i++)
+  { unsigned int c=next[lens[i]]++, r=0;
+    for (int b=0; b<lens[i]; b++) {r=(r<<1)|(c&1); c>>=1;}
+    codes[i]=(unsigned short)r;
+  }
+}
+
+// Moffat and Katajainen's in-place minimum-redundancy code: a[] holds n>=2
+// weights in increasing order, and is left holding their code lengths.
+void ziplocal_MinRedundancy(unsigned int *a,int n)
+{ int root=0, leaf=2, next;
+  a[0]+=a[1];
+  for (next=1; next<n-1; next++)
+  { if (leaf>=n || a[root]<a[leaf]) {a[next]=a[root]; a[root++]=next;} else a[next]=a[leaf++];
+    if (leaf>=n || (root<next && a[root]<a[leaf])) {a[next]+=a[root]; a[root++]=next;} else a[next]+=a[leaf++];
+  }
+  a[n-2]=0;
+  for (next=n-3; next>=0; next--) a[next]=a[a[next]]+1;
+  int avbl=1, used=0, dpth=0; root=n-2; next=n-1;
+  while (avbl>0)
+  { while (root>=0 && (int)a[root]==dpth) {used++; root--;}
+    while (avbl>used) {a[next--]=dpth; avbl--;}
+    avbl=2*used; dpth++; used=0;
+  }
+}
+
+// Code lengths of at most maxlen for n symbols with the given frequencies,
+// and their codes. As in zlib, there are always at least two codes, so that
+// even an unused tree is complete.
+void ziplocal_Huffman(const unsigned int *freq,int n,int maxlen,Byte *lens,unsigned short *codes)
+{ int sym[288]; unsigned int a[288]; int used=0;
+  for (int i=0; i<n; i++) {lens[i]=0; if (freq[i]!=0) sym[used++]=i;}
+  for (int i=0; used<2 && i<n; i++) if (freq[i]==0) sym[used++]=i;
+  std::sort(sym,sym+used,[freq](int x,int y) {return freq[x]!=freq[y] ? freq[x]<freq[y] : x<y;});
+  for (int i=0; i<used; i++) a[i]=freq[sym[i]]!=0 ? freq[sym[i]] : 1;
+  ziplocal_MinRedundancy(a,used);
+  // too long: shorten to maxlen, then lengthen shorter codes until the kraft sum is back to 1
+  unsigned int count[33]={0};
+  for (int i=0; i<used; i++) count[a[i]<(unsigned int)maxlen?a[i]:maxlen]++;
+  unsigned int total=0;
+  for (int l=maxlen; l>0; l--) total+=count[l]<<(maxlen-l);
+  while (total!=(1u<<maxlen))
+  { count[maxlen]--;
+    for (int l=maxlen-1; l>0; l--) if (count[l]!=0) {count[l]--; count[l+1]+=2; break;}
+    total--;
+  }
+  int k=0;
+  for (int l=maxlen; l>0; l--) for (unsigned int c=count[l]; c>0; c--) lens[sym[k++]]=(Byte)l;
+  ziplocal_Codes(lens,n,codes);
+}
+
+
+class TZipDeflate
+{ public:
+  TZipDeflate() : head(1<<ZD_HBITS), prev(ZD_WSIZE), sl(ZD_SYMS), sd(ZD_SYMS) {}
+  void Deflate(const Byte *in,unsigned int len,int level,bool last,std::vector<Byte> *out);
+
+  private:
+  std::vector<int> head, prev;           // hash chains, by position
+  std::vector<unsigned short> sl, sd;    // the block's symbols: a literal (sd=0) or a length and distance
+  unsigned int nsym;
+  const Byte *in; unsigned int n;
+  std::vector<Byte> *out; unsigned __int64 bb; unsigned int bn;
+
+  void Bits(unsigned int v,unsigned int len)
+  { bb|=(unsigned __int64)v<<bn; bn+=len;
+    while (bn>=8) {out->push_back((Byte)bb); bb>>=8; bn-=8;}
+  }
+  void Align() {if (bn>0) Bits(0,8-bn);}
+  void Insert(unsigned int pos)
+  { unsigned int h=((in[pos]<<10)^(in[pos+1]<<5)^in[pos+2])&ZD_HMASK;
+    prev[pos&ZD_WMASK]=head[h]; head[h]=(int)pos;
+  }
+  int Longest(unsigned int pos,int best,unsigned int *dist,const zd_config &cfg);
+  void Block(unsigned int start,unsigned int end,bool final);
+  void Stored(unsigned int start,unsigned int end,bool final);
+};
+
+// the length of the common prefix of a and b, up to max
+inline unsigned int ziplocal_MatchLen(const Byte *a,const Byte *b,unsigned int max)
+{ unsigned int l=0;
+  while (l+8<=max)
+  { unsigned __int64 x,y; memcpy(&x,a+l,8); memcpy(&y,b+l,8);
+    if (x!=y) {x^=y; while ((x&0xff)==0) {x>>=8; l++;} return l;}
+    l+=8;
+  }
+  while (l<max && a[l]==b[l]) l++;
+  return l;
+}
+
+// the longest match for pos that's longer than best, back along its hash chain
+int TZipDeflate::Longest(unsigned int pos,int best,unsigned int *dist,const zd_config &cfg)
+{ unsigned int max = n-pos<ZD_MAXMATCH ? n-pos : ZD_MAXMATCH;
+  if ((int)max<=best) return best;
+  int limit = pos>ZD_MAXDIST ? (int)(pos-ZD_MAXDIST) : 0;
+  unsigned int chain=cfg.chain; if (best>=cfg.good) chain>>=2;
+  const Byte *p=in+pos;
+  for (int c=prev[pos&ZD_WMASK]; c>=limit && chain>0; c=prev[c&ZD_WMASK], chain--)
+  { const Byte *m=in+c;
+    if (m[best]!=p[best] || m[0]!=p[0] || m[1]!=p[1]) continue;
+    int l=(int)ziplocal_MatchLen(m,p,max);
+    if (l>best) {best=l; *dist=pos-c; if (l>=cfg.nice || l>=(int)max) break;}
+  }
+  return best;
+}
+
+void TZipDeflate::Stored(unsigned int start,unsigned int end,bool final)
+{ do
+  { unsigned int len = end-start<ZD_STORED ? end-start : ZD_STORED;
+    Bits(final && start+len==end ? 1 : 0,1); Bits(0,2); Align();
+    Bits(len,16); Bits(~len&0xffff,16);
+    out->insert(out->end(),in+start,in+start+len);
+    start+=len;
+  } while (start<end);
+}
+
+// Sends the block of symbols that covers in[start,end), whichever way is smallest
+void TZipDeflate::Block(unsigned int start,unsigned int end,bool final)
+{ const zd_tables &t=zd_tab();
+  unsigned int lf[286]={0}, df[30]={0};
+  unsigned __int64 extra=0, fixedbits=0;
+  for (unsigned int i=0; i<nsym; i++)
+  { if (sd[i]==0) {lf[sl[i]]++; fixedbits+= sl[i]<144 ? 8 : 9; continue;}
+    unsigned int lc=t.lcode[sl[i]-3], dc=zd_dcode(t,sd[i]);
+    lf[257+lc]++; df[dc]++;
+    extra+=zd_lextra[lc]+zd_dextra[dc];
+    fixedbits+=(257+lc<280 ? 7 : 8)+5;
+  }
+  lf[256]=1;
+  Byte ll[286], dl[30]; unsigned short lc[286], dc[30];
+  ziplocal_Huffman(lf,286,15,ll,lc);
+  ziplocal_Huffman(df,30,15,dl,dc);
+  int nl=286; while (nl>257 && ll[nl-1]==0) nl--;
+  int nd=30; while (nd>1 && dl[nd-1]==0) nd--;
+
+  // the code lengths, run-length coded with 16 (repeat the last 3-6 times), 17 (3-10 zeros) and 18 (11-138 zeros)
+  Byte seq[286+30], rs[286+30], rx[286+30]; int ns=0, nr=0;
+  for (int i=0; i<nl; i++) seq[ns++]=ll[i];
+  for (int i=0; i<nd; i++) seq[ns++]=dl[i];
+  unsigned int cf[19]={0};
+  for (int i=0; i<ns; )
+  { int run=1; while (i+run<ns && seq[i+run]==seq[i]) run++;
+    if (seq[i]==0 && run>=3)
+    { int r = run>138 ? 138 : run;
+      if (r>=11) {rs[nr]=18; rx[nr++]=(Byte)(r-11);} else {rs[nr]=17; rx[nr++]=(Byte)(r-3);}
+      i+=r;
+    }
+    else if (seq[i]!=0 && run>=4)
+    { rs[nr]=seq[i]; rx[nr++]=0; i++;
+      int r = run-1>6 ? 6 : run-1;
+      rs[nr]=16; rx[nr++]=(Byte)(r-3); i+=r;
+    }
+    else {rs[nr]=seq[i]; rx[nr++]=0; i++;}
+  }
+  for (int i=0; i<nr; i++) cf[rs[i]]++;
+  Byte cl[19]; unsigned short cc[19];
+  ziplocal_Huffman(cf,19,7,cl,cc);
+  int ncl=19; while (ncl>4 && cl[zd_clorder[ncl-1]]==0) ncl--;
+
+  unsigned __int64 dynbits = 3+5+5+4+3*ncl+extra;
+  for (int i=0; i<nr; i++) dynbits+=cl[rs[i]]+(rs[i]==16?2:rs[i]==17?3:rs[i]==18?7:0);
+  for (int i=0; i<286; i++) dynbits+=(unsigned __int64)lf[i]*ll[i];
+  for (int i=0; i<30; i++) dynbits+=(unsigned __int64)df[i]*dl[i];
+  fixedbits += 3+7+extra;
+  unsigned __int64 storedbits = 3+((8-((bn+3)&7))&7)+32+8*(unsigned __int64)(end-start);
+  storedbits += (unsigned __int64)((end-start)/ZD_STORED)*(3+5+32);
+
+  if (storedbits<=dynbits && storedbits<=fixedbits) {Stored(start,end,final); return;}
+  const Byte *pl=ll, *pd=dl; const unsigned short *pc=lc, *pdc=dc;
+  if (fixedbits<=dynbits)
+  { Bits(final?1:0,1); Bits(1,2);
+    pl=t.fl; pd=t.fd; pc=t.fc; pdc=t.fdc;
+  }
+  else
+  { Bits(final?1:0,1); Bits(2,2);
+    Bits(nl-257,5); Bits(nd-1,5); Bits(ncl-4,4);
+    for (int i=0; i<ncl; i++) Bits(cl[zd_clorder[i]],3);
+    for (int i=0; i<nr; i++)
+    { Bits(cc[rs[i]],cl[rs[i]]);
+      if (rs[i]==16) Bits(rx[i],2); else if (rs[i]==17) Bits(rx[i],3); else if (rs[i]==18) Bits(rx[i],7);
+    }
+  }
+  for (unsigned int i=0; i<nsym; i++)
+  { if (sd[i]==0) {Bits(pc[sl[i]],pl[sl[i]]); continue;}
+    unsigned int l=t.lcode[sl[i]-3], d=zd_dcode(t,sd[i]);
+    Bits(pc[257+l],pl[257+l]); if (zd_lextra[l]) Bits(sl[i]-zd_lbase[l],zd_lextra[l]);
+    Bits(pdc[d],pd[d]); if (zd_dextra[d]) Bits(sd[i]-zd_dbase[d],zd_dextra[d]);
+  }
+  Bits(pc[256],pl[256]);
+}
+
+// Deflates in[0,len) onto out. If it's the last (or only) chunk of its item,
+// the stream ends there; otherwise it ends with a full flush (an empty stored
+// block), byte-aligned, and the next chunk must not refer back into this one.
+void TZipDeflate::Deflate(const Byte *src,unsigned int len,int level,bool last,std::vector<Byte> *dst)
+{ in=src; n=len; out=dst; bb=0; bn=0; nsym=0;
+  const zd_config &cfg=zd_configs[level<1?1:level>9?9:level];
+  std::fill(head.begin(),head.end(),-1);
+  unsigned int start=0, done=0, pos=0;
+  #define ZD_SYM(l,d) {sl[nsym]=(unsigned short)(l); sd[nsym]=(unsigned short)(d); nsym++;}
+  #define ZD_FLUSH {if (nsym==ZD_SYMS) {Block(start,done,false); start=done; nsym=0;}}
+  if (!cfg.lazyeval)
+  { while (pos<n)
+    { int ml=ZD_MINMATCH-1; unsigned int md=0;
+      if (pos+2<n) {Insert(pos); ml=Longest(pos,ml,&md,cfg); if (ml==ZD_MINMATCH && md>ZD_TOOFAR) ml=ZD_MINMATCH-1;}
+      if (ml>=ZD_MINMATCH)
+      { ZD_SYM(ml,md);
+        if (ml<=cfg.lazy) for (unsigned int p=pos+1; p<pos+ml; p++) if (p+2<n) Insert(p);
+        pos+=ml;
+      }
+      else {ZD_SYM(in[pos],0); pos++;}
+      done=pos; ZD_FLUSH
+    }
+  }
+  else
+  { int ml=ZD_MINMATCH-1; unsigned int md=0; bool avail=false;
+    while (pos<n)
+    { if (pos+2<n) Insert(pos);
+      int pl=ml; unsigned int pd=md; ml=ZD_MINMATCH-1;
+      if (pos+2<n && pl<cfg.lazy)
+      { ml=Longest(pos,pl>ml?pl:ml,&md,cfg);
+        if (ml<=pl) ml=ZD_MINMATCH-1;
+        else if (ml==ZD_MINMATCH && md>ZD_TOOFAR) ml=ZD_MINMATCH-1;
+      }
+      if (pl>=ZD_MINMATCH && ml<=pl)
+      { ZD_SYM(pl,pd);
+        unsigned int end=pos-1+pl;
+        for (unsigned int p=pos+1; p<end; p++) if (p+2<n) Insert(p);
+        pos=end; done=end; avail=false; ml=ZD_MINMATCH-1;
+      }
+      else if (avail) {ZD_SYM(in[pos-1],0); pos++; done=pos-1;}
+      else {avail=true; pos++;}
+      ZD_FLUSH
+    }
+    if (avail) {ZD_SYM(in[n-1],0); done=n;}
+  }
+  #undef ZD_SYM
+  #undef ZD_FLUSH
+  Block(start,n,last);
+  if (!last) {Bits(0,3); Align(); Bits(0,16); Bits(0xffff,16);}
+  Align();
+}
+
+
+
+
+// ---------------------------------------------------------------- the zip
+
+#define ZIP_CHUNK      (1024*1024)   // big files are deflated in chunks of this
+#define ZIP_MAXCHUNKS  ((65535-4-10)/4) // as many as fit in the index's extra field
+#define ZIP_CHUNKINDEX 0x5153        // "SQ", the same as unzip.cpp's UNZ_CHUNKINDEX_ID
+#define ZIP_MAXTHREADS 32
+#define ZIP_LOCAL64    0xfff00000    // items this big get room for zip64 sizes in their local header, in case deflate grows them
+#define ZIP_PADDING    0xa220        // the growth hint extra field, which fills that room if they aren't needed after all
+#define ZIP_STORERATIO 97            // an item that deflates to more than this percent of its size is stored
+#define ZIP_SAMPLE     65536         // a big item's compressibility is judged from this much at each of
+#define ZIP_SAMPLES    4             // this many places, spread out along it
+
+typedef struct
+{ std::string name;          // utf-8, with slashes, and a trailing one for a folder
+  zip_tstring fn;            // the file to read it from, if it's not in mem
+  std::vector<Byte> mem;
+  bool isdir;
+  __int64 size;
+  WORD dosdate, dostime; DWORD attr;
+  // these are filled in as it's written
+  WORD method; uLong crc; __int64 comp_size, offset;
+  unsigned int chunk, nchunks; int firsttask;
+  bool local64;              // its local header has room for zip64 sizes
+  bool chunkindex;           // and a chunk index
+} zip_item;
+
+typedef struct
+{ int item;
+  __int64 start; unsigned int len; // of the item's uncompressed bytes
+  std::vector<Byte> out;
+  uLong crc;
+  WORD method;               // its item's, unless deflate didn't pay and a one-chunk item was stored instead
+  bool done; ZRESULT zr;
+} zip_task;
+
+
+class TZip
+{ public:
+  TZip() : h(INVALID_HANDLE_VALUE), level(6), threads(0), flags(0) {}
+  ~TZip() {if (h!=INVALID_HANDLE_VALUE) upl_close(h);}
+
+  ZRESULT Create(const TCHAR *fn);
+  ZRESULT SetOptions(int level,unsigned int threads,DWORD flags);
+  ZRESULT Add(const std::string &name,const TCHAR *fn,const void *src,unsigned int len,bool isdir);
+  ZRESULT AddDir(const TCHAR *dstzn,const TCHAR *dir);
+  ZRESULT Close();
+
+  private:
+  zip_tstring zipfn; HANDLE h; __int64 pos;
+  int level; unsigned int threads; DWORD flags;
+  std::vector<zip_item> items;
+  std::vector<zip_task> tasks;
+  std::mutex m; std::condition_variable cv;
+  size_t next, written, window; bool abort;
+
+  void Work();
+  ZRESULT Read(const zip_item &it,__int64 start,unsigned int len,std::vector<Byte> &buf,const Byte **src);
+  bool Compressible(const zip_item &it,TZipDeflate &zd);
+  ZRESULT Run(zip_task &t,TZipDeflate &zd,std::vector<Byte> &buf);
+  ZRESULT Write(const std::vector<Byte> &buf);
+  void LocalHeader(const zip_item &it,const std::vector<unsigned int> &offsets,std::vector<Byte> &hdr);
+  ZRESULT WriteItem(zip_item &it);
+  ZRESULT WriteCentral();
+};
+
+
+std::string ziplocal_Utf8(const TCHAR *s)
+{ std::string r;
+#ifdef _WIN32
+  int n=WideCharToMultiByte(CP_UTF8,0,s,-1,NULL,0,NULL,NULL);
+  if (n>1) {r.resize(n-1); WideCharToMultiByte(CP_UTF8,0,s,-1,&r[0],n,NULL,NULL);}
+#else
+  r=s;
+#endif
+  std::replace(r.begin(),r.end(),'\\','/');
+  size_t lead=r.find_first_not_of('/'); r.erase(0,lead==std::string::npos?r.size():lead);
+  return r;
+}
+
+void ziplocal_Put16(std::vector<Byte> &v,unsigned int x) {v.push_back((Byte)x); v.push_back((Byte)(x>>8));}
+void ziplocal_Put32(std::vector<Byte> &v,unsigned int x) {ziplocal_Put16(v,x&0xffff); ziplocal_Put16(v,x>>16);}
+void ziplocal_Put64(std::vector<Byte> &v,unsigned __int64 x) {ziplocal_Put32(v,(unsigned int)x); ziplocal_Put32(v,(unsigned int)(x>>32));}
+
+
+ZRESULT TZip::Create(const TCHAR *fn)
+{ h=upl_create(fn,0);
+  if (h==INVALID_HANDLE_VALUE) return ZR_NOFILE;
+  zipfn=fn; pos=0;
+  return ZR_OK;
+}
+
+ZRESULT TZip::SetOptions(int l,unsigned int t,DWORD f)
+{ if (l<0 || l>9) return ZR_ARGS;
+  level=l; threads=t; flags=f;
+  return ZR_OK;
+}
+
+ZRESULT TZip::Add(const std::string &name,const TCHAR *fn,const void *src,unsigned int len,bool isdir)
+{ zip_item it; it.name=name; it.isdir=isdir; it.size=0;
+  if (it.name.empty()) return ZR_ARGS;
+  FILETIME mtime;
+  if (fn!=0)
+  { if (!upl_stat(fn,&it.size,&mtime,&it.attr) || (it.attr&FILE_ATTRIBUTE_DIRECTORY)!=0) return ZR_NOFILE;
+    it.fn=fn;
+  }
+  else
+  { if (src!=0) it.mem.assign((const Byte*)src,(const Byte*)src+len);
+    it.size=it.mem.size();
+    it.attr = isdir ? FILE_ATTRIBUTE_DIRECTORY : FILE_ATTRIBUTE_ARCHIVE;
+#ifdef _WIN32
+    GetSystemTimeAsFileTime(&mtime);
+#else
+    unsigned __int64 now=((unsigned __int64)time(0)+11644473600ULL)*10000000ULL;
+    mtime.dwLowDateTime=(DWORD)now; mtime.dwHighDateTime=(DWORD)(now>>32);
+#endif
+  }
+  if (isdir && it.name[it.name.size()-1]!='/') it.name+='/';
+  if (flags&ZIPOPT_DETERMINISTIC)
+  { it.dosdate=(1<<5)|1; it.dostime=0;
+    it.attr = isdir ? FILE_ATTRIBUTE_DIRECTORY : FILE_ATTRIBUTE_ARCHIVE;
+  }
+  else upl_filetimedos(&mtime,&it.dosdate,&it.dostime);
+  items.push_back(it);
+  return ZR_OK;
+}
+
+typedef struct
+{ zip_tstring dir;           // on disk, with a trailing slash
+  std::string name;          // in the zip, with a trailing slash (or empty)
+} zip_walkdir;
+
+typedef struct
+{ zip_walkdir cur;
+  std::vector<zip_walkdir> subs;
+  std::vector<std::pair<std::string,zip_tstring> > files;  // names in the zip, and on disk
+  bool any;
+} zip_walk;
+
+void ziplocal_WalkProc(void *param,const TCHAR *name,bool isdir)
+{ zip_walk *w=(zip_walk*)param; w->any=true;
+  zip_tstring path=w->cur.dir+name;
+  if (isdir) {zip_walkdir sub; sub.dir=path+ZIP_SLASH; sub.name=w->cur.name+ziplocal_Utf8(name)+"/"; w->subs.push_back(sub);}
+  else w->files.push_back(std::make_pair(w->cur.name+ziplocal_Utf8(name),path));
+}
+
+ZRESULT TZip::AddDir(const TCHAR *dstzn,const TCHAR *dir)
+{ zip_walk w; zip_walkdir top; top.dir=dir;
+  if (top.dir.empty() || (top.dir[top.dir.size()-1]!='/' && top.dir[top.dir.size()-1]!=ZIP_SLASH)) top.dir+=ZIP_SLASH;
+  top.name=ziplocal_Utf8(dstzn); if (!top.name.empty() && top.name[top.name.size()-1]!='/') top.name+='/';
+  // a folder goes in only if it's empty; the others are there in their files' names
+  std::vector<std::pair<std::string,zip_tstring> > empties;
+  w.subs.push_back(top);
+  while (!w.subs.empty())
+  { w.cur=w.subs.back(); w.subs.pop_back(); w.any=false;
+    upl_walk(w.cur.dir.c_str(),ziplocal_WalkProc,&w);
+    if (!w.any && !w.cur.name.empty()) empties.push_back(std::make_pair(w.cur.name,zip_tstring()));
+  }
+  // one order for all of it, by name, so that it doesn't depend on the file system
+  std::vector<std::pair<std::string,zip_tstring> > all=w.files;
+  all.insert(all.end(),empties.begin(),empties.end());
+  std::sort(all.begin(),all.end());
+  for (size_t i=0; i<all.size(); i++)
+  { ZRESULT zr = all[i].second.empty() ? Add(all[i].first,0,0,0,true) : Add(all[i].first,all[i].second.c_str(),0,0,false);
+    if (zr!=ZR_OK) return zr;
+  }
+  return ZR_OK;
+}
+
+
+
+// Workers take tasks in order, but never more than window past the last one
+// written, so however far ahead they get only so much is held in memory.
+void TZip::Work()
+{ TZipDeflate zd; std::vector<Byte> buf;
+  for (;;)
+  { size_t i;
+    { std::unique_lock<std::mutex> lock(m);
+      cv.wait(lock,[this] {return abort || next>=tasks.size() || next<written+window;});
+      if (abort || next>=tasks.size()) return;
+      i=next++;
+    }
+    ZRESULT zr=Run(tasks[i],zd,buf);
+    { std::lock_guard<std::mutex> lock(m);
+      tasks[i].zr=zr; tasks[i].done=true;
+    }
+    cv.notify_all();
+  }
+}
+
+// len bytes of the item from start, either in buf or (if it's in memory) where they are
+ZRESULT TZip::Read(const zip_item &it,__int64 start,unsigned int len,std::vector<Byte> &buf,const Byte **src)
+{ if (it.fn.empty()) {*src=it.mem.data()+start; return ZR_OK;}
+  buf.resize(len);
+  HANDLE hf=upl_open(it.fn.c_str());
+  if (hf==INVALID_HANDLE_VALUE) return ZR_NOFILE;
+  unsigned int got=0; bool ok=true;
+  while (ok && got<len)
+  { unsigned int red=0;
+    ok=upl_pread(hf,&buf[got],len-got,start+got,&red);
+    if (red==0) break;
+    got+=red;
+  }
+  upl_close(hf);
+  if (!ok) return ZR_READ;
+  if (got<len) return ZR_MISSIZE; // it's shrunk since it was added
+  *src=buf.data();
+  return ZR_OK;
+}
+
+// Whether a chunked item is worth deflating, from a fast deflate of a few
+// samples of it. An installer's payload is mostly a .nupkg, which is a zip
+// already, and deflating that again gains next to nothing, while costing
+// Setup an inflate rather than a copy. (A one-chunk item doesn't need this:
+// Run just stores it if its deflate didn't pay.)
+bool TZip::Compressible(const zip_item &it,TZipDeflate &zd)
+{ std::vector<Byte> buf, out; __int64 in=0, made=0;
+  for (int i=0; i<ZIP_SAMPLES; i++)
+  { __int64 start=(it.size-ZIP_SAMPLE)/(ZIP_SAMPLES-1)*i;
+    const Byte *src;
+    if (Read(it,start,ZIP_SAMPLE,buf,&src)!=ZR_OK) return true; // and let Run report it
+    out.clear(); zd.Deflate(src,ZIP_SAMPLE,1,true,&out);
+    in+=ZIP_SAMPLE; made+=out.size();
+  }
+  return made*100<=in*ZIP_STORERATIO;
+}
+
+ZRESULT TZip::Run(zip_task &t,TZipDeflate &zd,std::vector<Byte> &buf)
+{ const zip_item &it=items[t.item];
+  const Byte *src;
+  ZRESULT zr=Read(it,t.start,t.len,buf,&src);
+  if (zr!=ZR_OK) return zr;
+  t.crc=ucrc32(0,src,t.len);
+  t.out.clear(); t.method=it.method;
+  if (it.method==8)
+  { t.out.reserve(t.len+t.len/8+64);
+    zd.Deflate(src,t.len,level,t.start+t.len==it.size,&t.out);
+    if (it.nchunks==1 && (flags&ZIPOPT_DEFLATEALL)==0 && (__int64)t.out.size()*100>(__int64)t.len*ZIP_STORERATIO) {t.out.clear(); t.method=0;}
+  }
+  if (t.method==0) t.out.assign(src,src+t.len);
+  return ZR_OK;
+}
+
+ZRESULT TZip::Write(const std::vector<Byte> &buf)
+{ if (buf.empty()) return ZR_OK;
+  if (!upl_pwrite(h,buf.data(),(unsigned int)buf.size(),pos)) return ZR_WRITE;
+  pos+=buf.size();
+  return ZR_OK;
+}
+
+// Whether an item's sizes don't fit the old fields. Then both headers have
+// 0xffffffff for both sizes and a zip64 field with both, so that they agree,
+// as unzip.cpp checks they do
+bool ziplocal_Zip64(const zip_item &it) {return it.size>=0xffffffff || it.comp_size>=0xffffffff;}
+
+void TZip::LocalHeader(const zip_item &it,const std::vector<unsigned int> &offsets,std::vector<Byte> &hdr)
+{ hdr.clear();
+  bool zip64=ziplocal_Zip64(it);
+  unsigned int gp=0x0800; // names are utf-8
+  if (it.method==8) gp |= level>=8 ? 2 : level==2 ? 4 : level==1 ? 6 : 0;
+  ziplocal_Put32(hdr,0x04034b50);
+  ziplocal_Put16(hdr,zip64?45:20);
+  ziplocal_Put16(hdr,gp);
+  ziplocal_Put16(hdr,it.method);
+  ziplocal_Put16(hdr,it.dostime); ziplocal_Put16(hdr,it.dosdate);
+  ziplocal_Put32(hdr,it.crc);
+  ziplocal_Put32(hdr,zip64?0xffffffff:(unsigned int)it.comp_size);
+  ziplocal_Put32(hdr,zip64?0xffffffff:(unsigned int)it.size);
+  ziplocal_Put16(hdr,(unsigned int)it.name.size());
+  ziplocal_Put16(hdr,(it.local64?20:0)+(it.chunkindex?4+10+4*it.nchunks:0));
+  hdr.insert(hdr.end(),it.name.begin(),it.name.end());
+  if (it.local64 && zip64)
+  { ziplocal_Put16(hdr,0x0001); ziplocal_Put16(hdr,16);
+    ziplocal_Put64(hdr,it.size); ziplocal_Put64(hdr,it.comp_size);
+  }
+  else if (it.local64)
+  { ziplocal_Put16(hdr,ZIP_PADDING); ziplocal_Put16(hdr,16);
+    ziplocal_Put16(hdr,0xa028); ziplocal_Put16(hdr,0); hdr.insert(hdr.end(),12,0);
+  }
+  if (it.chunkindex)
+  { ziplocal_Put16(hdr,ZIP_CHUNKINDEX); ziplocal_Put16(hdr,10+4*it.nchunks);
+    hdr.push_back(1); hdr.push_back(0); // version, reserved
+    ziplocal_Put32(hdr,it.chunk); ziplocal_Put32(hdr,it.nchunks);
+    for (unsigned int c=0; c<it.nchunks; c++) ziplocal_Put32(hdr,c<offsets.size()?offsets[c]:0);
+  }
+}
+
+// The local header goes out first with the crc and sizes zero, then each
+// chunk as it's ready, and then the header again, filled in.
+ZRESULT TZip::WriteItem(zip_item &it)
+{ it.offset=pos; it.crc=0; it.comp_size=0;
+  std::vector<unsigned int> offsets; std::vector<Byte> hdr;
+  LocalHeader(it,offsets,hdr);
+  ZRESULT zr=Write(hdr); if (zr!=ZR_OK) return zr;
+  for (unsigned int c=0; c<it.nchunks; c++)
+  { zip_task &t=tasks[it.firsttask+c];
+    { std::unique_lock<std::mutex> lock(m);
+      cv.wait(lock,[&t] {return t.done;});
+    }
+    if (t.zr!=ZR_OK) return t.zr;
+    if (t.method!=it.method) it.method=t.method; // only ever a one-chunk item, so no worker is reading it
+    it.crc = c==0 ? t.crc : ucrc32_combine(it.crc,t.crc,t.len);
+    offsets.push_back((unsigned int)it.comp_size);
+    it.comp_size+=t.out.size();
+    zr=Write(t.out); if (zr!=ZR_OK) return zr;
+    std::vector<Byte>().swap(t.out);
+    { std::lock_guard<std::mutex> lock(m);
+      written++;
+    }
+    cv.notify_all();
+  }
+  LocalHeader(it,offsets,hdr);
+  if (!upl_pwrite(h,hdr.data(),(unsigned int)hdr.size(),it.offset)) return ZR_WRITE;
+  return ZR_OK;
+}
+
+ZRESULT TZip::WriteCentral()
+{ __int64 start=pos; std::vector<Byte> hdr;
+  for (size_t i=0; i<items.size(); i++)
+  { const zip_item &it=items[i];
+    bool bigu=ziplocal_Zip64(it), bigc=bigu, bigo=it.offset>=0xffffffff;
+    unsigned int n64=(bigu?8:0)+(bigc?8:0)+(bigo?8:0);
+    unsigned int version = n64!=0 ? 45 : 20;
+    unsigned int gp=0x0800;
+    if (it.method==8) gp |= level>=8 ? 2 : level==2 ? 4 : level==1 ? 6 : 0;
+    hdr.clear();
+    ziplocal_Put32(hdr,0x02014b50);
+    ziplocal_Put16(hdr,version);     // made by: MS-DOS, so attr is the dos attributes
+    ziplocal_Put16(hdr,version);     // needed to extract
+    ziplocal_Put16(hdr,gp);
+    ziplocal_Put16(hdr,it.method);
+    ziplocal_Put16(hdr,it.dostime); ziplocal_Put16(hdr,it.dosdate);
+    ziplocal_Put32(hdr,it.crc);
+    ziplocal_Put32(hdr,bigc?0xffffffff:(unsigned int)it.comp_size);
+    ziplocal_Put32(hdr,bigu?0xffffffff:(unsigned int)it.size);
+    ziplocal_Put16(hdr,(unsigned int)it.name.size());
+    ziplocal_Put16(hdr,n64!=0?4+n64:0);
+    ziplocal_Put16(hdr,0);           // comment
+    ziplocal_Put16(hdr,0);           // disk
+    ziplocal_Put16(hdr,0);           // internal attributes
+    ziplocal_Put32(hdr,it.attr&0xff);
+    ziplocal_Put32(hdr,bigo?0xffffffff:(unsigned int)it.offset);
+    hdr.insert(hdr.end(),it.name.begin(),it.name.end());
+    if (n64!=0)
+    { ziplocal_Put16(hdr,0x0001); ziplocal_Put16(hdr,n64);
+      if (bigu) ziplocal_Put64(hdr,it.size);
+      if (bigc) ziplocal_Put64(hdr,it.comp_size);
+      if (bigo) ziplocal_Put64(hdr,it.offset);
+    }
+    ZRESULT zr=Write(hdr); if (zr!=ZR_OK) return zr;
+  }
+  __int64 size=pos-start; unsigned __int64 count=items.size();
+  bool big = count>=0xffff || size>=0xffffffff || start>=0xffffffff;
+  hdr.clear();
+  if (big)
+  { __int64 end64=pos;
+    ziplocal_Put32(hdr,0x06064b50);
+    ziplocal_Put64(hdr,44);          // the size of the rest of this record
+    ziplocal_Put16(hdr,45); ziplocal_Put16(hdr,45);
+    ziplocal_Put32(hdr,0); ziplocal_Put32(hdr,0);
+    ziplocal_Put64(hdr,count); ziplocal_Put64(hdr,count);
+    ziplocal_Put64(hdr,size); ziplocal_Put64(hdr,start);
+    ziplocal_Put32(hdr,0x07064b50);
+    ziplocal_Put32(hdr,0); ziplocal_Put64(hdr,end64); ziplocal_Put32(hdr,1);
+  }
+  ziplocal_Put32(hdr,0x06054b50);
+  ziplocal_Put16(hdr,0); ziplocal_Put16(hdr,0);
+  ziplocal_Put16(hdr,count>=0xffff?0xffff:(unsigned int)count);
+  ziplocal_Put16(hdr,count>=0xffff?0xffff:(unsigned int)count);
+  ziplocal_Put32(hdr,size>=0xffffffff?0xffffffff:(unsigned int)size);
+  ziplocal_Put32(hdr,start>=0xffffffff?0xffffffff:(unsigned int)start);
+  ziplocal_Put16(hdr,0);             // comment
+  return Write(hdr);
+}
+
+ZRESULT TZip::Close()
+{ if (h==INVALID_HANDLE_VALUE) return ZR_ENDED;
+  tasks.clear();
+  TZipDeflate zd;
+  for (size_t i=0; i<items.size(); i++)
+  { zip_item &it=items[i];
+    it.method = it.isdir || it.size==0 || level==0 ? 0 : 8;
+    it.chunk=ZIP_CHUNK;
+    if (it.size>(__int64)ZIP_CHUNK*ZIP_MAXCHUNKS) it.chunk=(unsigned int)((it.size+ZIP_MAXCHUNKS-1)/ZIP_MAXCHUNKS);
+    it.nchunks=(unsigned int)((it.size+it.chunk-1)/it.chunk);
+    if (it.method==8 && it.nchunks>=2 && (flags&ZIPOPT_DEFLATEALL)==0 && !Compressible(it,zd)) it.method=0;
+    it.firsttask=(int)tasks.size();
+    it.local64 = it.size>=ZIP_LOCAL64;
+    it.chunkindex = it.method==8 && it.nchunks>=2 && !it.local64;
+    for (unsigned int c=0; c<it.nchunks; c++)
+    { zip_task t; t.item=(int)i; t.start=(__int64)c*it.chunk;
+      t.len = it.size-t.start<it.chunk ? (unsigned int)(it.size-t.start) : it.chunk;
+      t.crc=0; t.method=it.method; t.done=false; t.zr=ZR_OK;
+      tasks.push_back(t);
+    }
+  }
+  unsigned int nt=threads; if (nt==0) nt=std::thread::hardware_concurrency();
+  if (nt==0) nt=1;
+  if (nt>ZIP_MAXTHREADS) nt=ZIP_MAXTHREADS;
+  next=0; written=0; window=2*nt+2; abort=false;
+  std::vector<std::thread> workers;
+  for (unsigned int i=0; i<nt; i++) workers.push_back(std::thread(&TZip::Work,this));
+  ZRESULT zr=ZR_OK;
+  for (size_t i=0; i<items.size() && zr==ZR_OK; i++) zr=WriteItem(items[i]);
+  if (zr==ZR_OK) zr=WriteCentral();
+  { std::lock_guard<std::mutex> lock(m);
+    abort=true;
+  }
+  cv.notify_all();
+  for (size_t i=0; i<workers.size(); i++) workers[i].join();
+  upl_close(h); h=INVALID_HANDLE_VALUE;
+  if (zr!=ZR_OK) upl_delete(zipfn.c_str());
+  items.clear(); tasks.clear();
+  return zr;
+}
+
+
+
+
+typedef struct
+{ DWORD flag;
+  TZip *zip;
+} TZipHandleData;
+
+HZIP CreateZip(const TCHAR *fn)
+{ TZip *zip = new TZip();
+  lasterrorU = zip->Create(fn);
+  if (lasterrorU!=ZR_OK) {delete zip; return 0;}
+  TZipHandleData *han = new TZipHandleData;
+  han->flag=2; han->zip=zip; return (HZIP)han;
+}
+
+ZRESULT SetZipOptions(HZIP hz, int level, unsigned int threads, DWORD flags)
+{ if (hz==0) {lasterrorU=ZR_ARGS;return ZR_ARGS;}
+  TZipHandleData *han = (TZipHandleData*)hz;
+  if (han->flag!=2) {lasterrorU=ZR_ZMODE;return ZR_ZMODE;}
+  lasterrorU = han->zip->SetOptions(level,threads,flags);
+  return lasterrorU;
+}
+
+ZRESULT ZipAddInternal(HZIP hz, const TCHAR *dstzn, const TCHAR *fn, const void *src, unsigned int len, bool isdir)
+{ if (hz==0 || dstzn==0) {lasterrorU=ZR_ARGS;return ZR_ARGS;}
+  TZipHandleData *han = (TZipHandleData*)hz;
+  if (han->flag!=2) {lasterrorU=ZR_ZMODE;return ZR_ZMODE;}
+  lasterrorU = han->zip->Add(ziplocal_Utf8(dstzn),fn,src,len,isdir);
+  return lasterrorU;
+}
+ZRESULT ZipAdd(HZIP hz, const TCHAR *dstzn, const TCHAR *fn) {return ZipAddInternal(hz,dstzn,fn,0,0,false);}
+ZRESULT ZipAdd(HZIP hz, const TCHAR *dstzn, const void *src, unsigned int len) {return ZipAddInternal(hz,dstzn,0,src,len,false);}
+ZRESULT ZipAddFolder(HZIP hz, const TCHAR *dstzn) {return ZipAddInternal(hz,dstzn,0,0,0,true);}
+
+ZRESULT ZipAddDir(HZIP hz, const TCHAR *dstzn, const TCHAR *dir)
+{ if (hz==0 || dstzn==0 || dir==0) {lasterrorU=ZR_ARGS;return ZR_ARGS;}
+  TZipHandleData *han = (TZipHandleData*)hz;
+  if (han->flag!=2) {lasterrorU=ZR_ZMODE;return ZR_ZMODE;}
+  lasterrorU = han->zip->AddDir(dstzn,dir);
+  return lasterrorU;
+}
+
+ZRESULT CloseZipZ(HZIP hz)
+{ if (hz==0) {lasterrorU=ZR_ARGS;return ZR_ARGS;}
+  TZipHandleData *han = (TZipHandleData*)hz;
+  if (han->flag!=2) {lasterrorU=ZR_ZMODE;return ZR_ZMODE;}
+  lasterrorU = han->zip->Close();
+  delete han->zip;
+  delete han;
+  return lasterrorU;
+}
+
+bool IsZipHandleZ(HZIP hz)
+{ if (hz==0) return false;
+  TZipHandleData *han = (TZipHandleData*)hz;
+  return (han->flag==2);
+}
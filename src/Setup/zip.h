@@ -0,0 +1,60 @@
+#ifndef _zip_H
+#include "unzip.h"
+#define _zip_H
+
+// ZIPPING functions -- for making zips, the other way from unzip.h, whose
+// HZIP, ZRESULT and result codes these share. It makes zips as our packager
+// does: items are deflated on several threads at once, a big file in 1MB
+// chunks of its own, and the zip comes out the same whatever the number of
+// threads. Like the zips SetupZipBuilder has always made, a chunked item has a
+// chunk index in its local header, so that Setup can inflate it in parallel
+// too (see unzReadCurrentFileChunked in unzip.cpp). ZIP64 records are written
+// for any item, offset or count that doesn't fit the old ones.
+// Setup.exe only ever unzips, so this isn't built into it; the bench
+// (bench/Makefile) builds it beside unzip.cpp and times it against zlib.
+//
+// e.g.
+//   HZIP hz = CreateZip(_T("payload.zip"));
+//   SetZipOptions(hz,9,0,ZIPOPT_DETERMINISTIC);
+//   ZipAddDir(hz,_T(""),_T("c:\\build\\payload"));
+//   ZipAdd(hz,_T("RELEASES"),buf,len);
+//   CloseZip(hz);     // this is where the work happens
+
+HZIP CreateZip(const TCHAR *fn);
+// CreateZip - starts a new zip file, replacing any that's there.
+
+ZRESULT SetZipOptions(HZIP hz, int level, unsigned int threads, DWORD flags);
+#define ZIPOPT_DETERMINISTIC 1
+#define ZIPOPT_DEFLATEALL    2
+// SetZipOptions - level is 0 (store everything) to 9 (smallest), as zlib's;
+// the default is 6. threads is how many to deflate on (0, the default, for one
+// per core, up to 32). With ZIPOPT_DETERMINISTIC every item gets the same
+// time (1980-01-01 00:00) and attributes (archive, or directory), so that the
+// same files make the same zip byte for byte, whenever and wherever it's run.
+// An item that deflate would shrink by less than 3% (a .nupkg, or anything
+// else that's compressed already) is stored instead, so that Setup can just
+// copy it out; a big item is judged by deflating a few samples of it, quickly.
+// ZIPOPT_DEFLATEALL deflates every item regardless.
+
+ZRESULT ZipAdd(HZIP hz, const TCHAR *dstzn, const TCHAR *fn);
+ZRESULT ZipAdd(HZIP hz, const TCHAR *dstzn, const void *src, unsigned int len);
+ZRESULT ZipAddFolder(HZIP hz, const TCHAR *dstzn);
+// ZipAdd - adds the file fn, or len bytes from src (which are copied), as the
+// item dstzn. ZipAddFolder adds an empty folder item. Nothing is read or
+// written until CloseZip, and items go in the zip in the order they're added.
+
+ZRESULT ZipAddDir(HZIP hz, const TCHAR *dstzn, const TCHAR *dir);
+// ZipAddDir - adds everything under dir (its files, and any empty folders) as
+// items under dstzn ("" for the top of the zip). Names are sorted (bytewise,
+// in UTF-8) so the order doesn't depend on the file system.
+
+ZRESULT CloseZipZ(HZIP hz);
+// CloseZip - deflates everything, writes the zip and frees the handle. If it
+// fails, the zip file is deleted.
+
+bool IsZipHandleZ(HZIP hz);
+
+#undef CloseZip
+#define CloseZip(hz) (IsZipHandleZ(hz)?CloseZipZ(hz):CloseZipU(hz))
+
+#endif // _zip_H
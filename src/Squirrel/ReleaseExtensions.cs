@@ -25,4 +25,51 @@ public static SemanticVersion ToSemanticVersion(this string fileName)
             return new SemanticVersion(version);
         }
     }
+
+    // NB: StubExecutable's CompareAppVersions ranks the app-* folders the
+    // same way, so that the .current-app pointer names the one its scan
+    // would find: by the numbers, then a release above its prereleases,
+    // then tags that are the same word and a number by the number (so
+    // beta10 is above beta9), and otherwise by the tags, ignoring case
+    public class AppVersionComparer : IComparer<SemanticVersion>
+    {
+        public static readonly AppVersionComparer Instance = new AppVersionComparer();
+
+        static readonly Regex _numberedTagRegex = new Regex(@"^(.*?)0*(\d+)$", RegexOptions.Compiled);
+
+        public int Compare(SemanticVersion x, SemanticVersion y)
+        {
+            var ret = compareNumbers(x.Version, y.Version);
+            if (ret != 0) return ret;
+
+            if (String.IsNullOrEmpty(x.SpecialVersion) || String.IsNullOrEmpty(y.SpecialVersion)) {
+                return (String.IsNullOrEmpty(x.SpecialVersion) ? 1 : 0) - (String.IsNullOrEmpty(y.SpecialVersion) ? 1 : 0);
+            }
+
+            var xm = _numberedTagRegex.Match(x.SpecialVersion);
+            var ym = _numberedTagRegex.Match(y.SpecialVersion);
+            if (xm.Success && ym.Success && String.Equals(xm.Groups[1].Value, ym.Groups[1].Value, StringComparison.OrdinalIgnoreCase)) {
+                var xn = xm.Groups[2].Value;
+                var yn = ym.Groups[2].Value;
+                if (xn.Length != yn.Length) return xn.Length < yn.Length ? -1 : 1;
+
+                ret = String.CompareOrdinal(xn, yn);
+                if (ret != 0) return ret;
+            }
+
+            return String.Compare(x.SpecialVersion, y.SpecialVersion, StringComparison.OrdinalIgnoreCase);
+        }
+
+        static int compareNumbers(Version x, Version y)
+        {
+            var xs = new[] { x.Major, x.Minor, Math.Max(x.Build, 0), Math.Max(x.Revision, 0) };
+            var ys = new[] { y.Major, y.Minor, Math.Max(y.Build, 0), Math.Max(y.Revision, 0) };
+
+            for (int i = 0; i < xs.Length; i++) {
+                if (xs[i] != ys[i]) return xs[i].CompareTo(ys[i]);
+            }
+
+            return 0;
+        }
+    }
 }
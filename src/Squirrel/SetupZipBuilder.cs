@@ -0,0 +1,395 @@
+using System;
+using System.Collections.Generic;
+using System.IO;
+using System.Linq;
+using System.Text;
+using System.Threading;
+using Squirrel.SimpleSplat;
+using SharpCompress.Compressors;
+using SharpCompress.Compressors.Deflate;
+
+namespace Squirrel
+{
+    public enum SetupZipCompression
+    {
+        Deflate,
+        Zstandard,
+    }
+
+    /// <summary>
+    /// Writes the zip file that gets embedded into Setup.exe. It is a plain
+    /// zip that any tool can read, except that big members are deflated as a
+    /// series of independent chunks: we do a full flush every ChunkSize bytes
+    /// and record where each chunk starts in a private extra field, so that
+    /// Setup can inflate the chunks on several threads at once (see
+    /// unzReadCurrentFileChunked in Setup's unzip.cpp for the layout).
+    /// With SetupZipCompression.Zstandard, members are instead stored as
+    /// zstd frames (method 93), which Setup decompresses a good deal faster;
+    /// WriteZipToSetup.exe --zstd, which ships next to Update.exe, makes them.
+    /// Members that are compressed already (the .nupkg is a zip) are stored
+    /// either way, since compressing them again gains next to nothing and
+    /// costs Setup a decompress where it could just copy.
+    /// </summary>
+    internal class SetupZipBuilder : IEnableLogger
+    {
+        public const ushort ChunkIndexExtraFieldId = 0x5153; // "SQ"
+        const byte chunkIndexVersion = 1;
+
+        // The extra field length is a ushort; leave room for its own header
+        const int maxChunks = (ushort.MaxValue - 4 - 10) / 4;
+
+        const ushort methodStore = 0;
+        const ushort methodDeflate = 8;
+        const ushort methodZstd = 93;
+
+        // A member is stored unless deflate would get it below this much of
+        // its size, judged from a fast deflate of a few samples of it
+        const double storeRatio = 0.97;
+        const int sampleSize = 64 * 1024;
+        const int sampleCount = 4;
+
+        public int ChunkSize { get; set; } = 4 * 1024 * 1024;
+        public CompressionLevel CompressionLevel { get; set; } = CompressionLevel.Default;
+        public SetupZipCompression Compression { get; set; } = SetupZipCompression.Deflate;
+        public int ZstdLevel { get; set; } = 19;
+        public bool StoreIncompressible { get; set; } = true;
+
+        class ZipEntryInfo
+        {
+            public byte[] Name;
+            public uint DosDateTime;
+            public ushort Method;
+            public uint Crc;
+            public long CompressedSize;
+            public long UncompressedSize;
+            public long LocalHeaderOffset;
+        }
+
+        public void CreateFromDirectory(string sourceDirectory, string outputFile)
+        {
+            var root = new DirectoryInfo(sourceDirectory);
+            var rootLength = root.FullName.TrimEnd(Path.DirectorySeparatorChar).Length + 1;
+
+            // Sort the members so that the same inputs always give the same zip
+            var files = root.GetAllFilesRecursively()
+                .Select(x => new { File = x, Name = x.FullName.Substring(rootLength).Replace(Path.DirectorySeparatorChar, '/') })
+                .OrderBy(x => x.Name, StringComparer.Ordinal)
+                .ToList();
+
+            var entries = new List<ZipEntryInfo>();
+            using (var output = File.Create(outputFile)) {
+                foreach (var file in files) {
+                    entries.Add(writeEntry(output, file.File, file.Name));
+                }
+
+                writeCentralDirectory(output, entries);
+            }
+        }
+
+        ZipEntryInfo writeEntry(Stream output, FileInfo file, string name)
+        {
+            var length = file.Length;
+            if (length > UInt32.MaxValue) {
+                throw new NotSupportedException(String.Format("{0} is too large to embed in Setup.exe", file.FullName));
+            }
+
+            var entry = new ZipEntryInfo {
+                Name = Encoding.UTF8.GetBytes(name),
+                DosDateTime = toDosDateTime(file.LastWriteTime),
+                Method = length == 0 ? methodStore : methodDeflate,
+                UncompressedSize = length,
+                LocalHeaderOffset = output.Position,
+            };
+
+            if (length > 0 && StoreIncompressible && !isCompressible(file)) {
+                this.Log().Info("Storing {0}, which doesn't compress", name);
+                entry.Method = methodStore;
+            }
+
+            if (entry.Method != methodStore && Compression == SetupZipCompression.Zstandard) {
+                entry.Method = methodZstd;
+                return writeZstdEntry(output, file, entry);
+            }
+
+            long chunkSize = ChunkSize;
+            var chunkCount = (length + chunkSize - 1) / chunkSize;
+            if (chunkCount > maxChunks) {
+                chunkSize = (length + maxChunks - 1) / maxChunks;
+                chunkCount = (length + chunkSize - 1) / chunkSize;
+            }
+
+            var chunked = entry.Method == methodDeflate && chunkCount > 1;
+            var extra = new byte[chunked ? 4 + 10 + 4 * chunkCount : 0];
+
+            // Sizes and crc are patched in once we know them
+            writeLocalHeader(output, entry, extra);
+            var dataStart = output.Position;
+
+            var crc = new Crc32();
+            var offsets = new List<long>();
+
+            if (entry.Method == methodDeflate) {
+                using (var input = file.OpenRead())
+                using (var deflate = new DeflateStream(new NonClosingStream(output), CompressionMode.Compress, CompressionLevel)) {
+                    var buf = new byte[81920];
+
+                    for (long chunk = 0; chunk < Math.Max(chunkCount, 1); chunk++) {
+                        offsets.Add(output.Position - dataStart);
+
+                        var isLastChunk = chunk == chunkCount - 1;
+                        var left = Math.Min(chunkSize, length - chunk * chunkSize);
+                        while (left > 0) {
+                            var read = input.Read(buf, 0, (int)Math.Min(buf.Length, left));
+                            if (read <= 0) throw new IOException(String.Format("{0} changed while we were reading it", file.FullName));
+
+                            crc.Update(buf, 0, read);
+                            left -= read;
+
+                            if (left > 0 || isLastChunk) {
+                                deflate.Write(buf, 0, read);
+                                continue;
+                            }
+
+                            // End of a chunk: push the last byte through with a
+                            // full flush, which byte-aligns the output and resets
+                            // the history, so that the next chunk stands alone
+                            if (read > 1) deflate.Write(buf, 0, read - 1);
+                            deflate.FlushMode = FlushType.Full;
+                            deflate.Write(buf, read - 1, 1);
+                            deflate.FlushMode = FlushType.None;
+                        }
+                    }
+                }
+            } else if (length > 0) {
+                using (var input = file.OpenRead()) {
+                    var buf = new byte[81920];
+                    var left = length;
+                    while (left > 0) {
+                        var read = input.Read(buf, 0, (int)Math.Min(buf.Length, left));
+                        if (read <= 0) throw new IOException(String.Format("{0} changed while we were reading it", file.FullName));
+
+                        crc.Update(buf, 0, read);
+                        output.Write(buf, 0, read);
+                        left -= read;
+                    }
+                }
+            }
+
+            if (chunked) {
+                this.Log().Info("Deflated {0} as {1} chunks of {2} bytes", name, chunkCount, chunkSize);
+                writeChunkIndex(extra, chunkSize, offsets);
+            }
+
+            finishEntry(output, file, entry, crc.Value, dataStart, extra);
+            return entry;
+        }
+
+        // Deflates up to sampleCount slices of the file, spread along it, at
+        // the fastest level. A small file is one or more whole slices.
+        static bool isCompressible(FileInfo file)
+        {
+            var length = file.Length;
+            var slices = (int)Math.Min(sampleCount, (length + sampleSize - 1) / sampleSize);
+            var buf = new byte[sampleSize];
+            long sampled = 0, compressed = 0;
+
+            using (var input = file.OpenRead()) {
+                for (int i = 0; i < slices; i++) {
+                    input.Position = length <= (long)sampleSize * sampleCount ?
+                        (long)i * sampleSize :
+                        (length - sampleSize) / (sampleCount - 1) * i;
+
+                    var size = 0;
+                    int read;
+                    while (size < buf.Length && (read = input.Read(buf, size, buf.Length - size)) > 0) size += read;
+
+                    using (var ms = new MemoryStream()) {
+                        using (var deflate = new DeflateStream(new NonClosingStream(ms), CompressionMode.Compress, CompressionLevel.BestSpeed)) {
+                            deflate.Write(buf, 0, size);
+                        }
+
+                        sampled += size;
+                        compressed += ms.Length;
+                    }
+                }
+            }
+
+            return compressed < sampled * storeRatio;
+        }
+
+        ZipEntryInfo writeZstdEntry(Stream output, FileInfo file, ZipEntryInfo entry)
+        {
+            var extra = new byte[0];
+            writeLocalHeader(output, entry, extra);
+            var dataStart = output.Position;
+
+            var crc = new Crc32();
+            var compressed = Path.GetTempFileName();
+
+            try {
+                var writeZipToSetup = Utility.FindWriteZipToSetup();
+                var args = String.Format("--zstd {0} \"{1}\" \"{2}\"", ZstdLevel, file.FullName, compressed);
+                var result = Utility.InvokeProcessAsync(writeZipToSetup, args, CancellationToken.None).Result;
+                if (result.Item1 != 0) {
+                    throw new Exception(String.Format("Failed to compress {0} with {1}: {2}", file.FullName, writeZipToSetup, result.Item2));
+                }
+
+                using (var input = file.OpenRead()) {
+                    var buf = new byte[81920];
+                    int read;
+                    while ((read = input.Read(buf, 0, buf.Length)) > 0) crc.Update(buf, 0, read);
+                }
+
+                using (var input = File.OpenRead(compressed)) {
+                    input.CopyTo(output);
+                }
+            } finally {
+                File.Delete(compressed);
+            }
+
+            finishEntry(output, file, entry, crc.Value, dataStart, extra);
+            return entry;
+        }
+
+        static void finishEntry(Stream output, FileInfo file, ZipEntryInfo entry, uint crc, long dataStart, byte[] extra)
+        {
+            entry.Crc = crc;
+            entry.CompressedSize = output.Position - dataStart;
+            if (entry.CompressedSize > UInt32.MaxValue) {
+                throw new NotSupportedException(String.Format("{0} is too large to embed in Setup.exe", file.FullName));
+            }
+
+            var end = output.Position;
+            output.Position = entry.LocalHeaderOffset;
+            writeLocalHeader(output, entry, extra);
+            output.Position = end;
+        }
+
+        static ushort versionNeeded(ZipEntryInfo entry)
+        {
+            // APPNOTE 6.3.7 has zstd at 6.3, and we only need 2.0 otherwise
+            return (ushort)(entry.Method == methodZstd ? 63 : 20);
+        }
+
+        static void writeChunkIndex(byte[] extra, long chunkSize, List<long> offsets)
+        {
+            using (var bw = new BinaryWriter(new MemoryStream(extra))) {
+                bw.Write(ChunkIndexExtraFieldId);
+                bw.Write((ushort)(extra.Length - 4));
+                bw.Write(chunkIndexVersion);
+                bw.Write((byte)0);
+                bw.Write((uint)chunkSize);
+                bw.Write((uint)offsets.Count);
+                foreach (var offset in offsets) bw.Write((uint)offset);
+            }
+        }
+
+        static void writeLocalHeader(Stream output, ZipEntryInfo entry, byte[] extra)
+        {
+            using (var bw = new BinaryWriter(new NonClosingStream(output))) {
+                bw.Write(0x04034b50);
+                bw.Write(versionNeeded(entry));     // version needed to extract
+                bw.Write((ushort)0x0800);           // flags: names are UTF-8
+                bw.Write(entry.Method);
+                bw.Write(entry.DosDateTime);
+                bw.Write(entry.Crc);
+                bw.Write((uint)entry.CompressedSize);
+                bw.Write((uint)entry.UncompressedSize);
+                bw.Write((ushort)entry.Name.Length);
+                bw.Write((ushort)extra.Length);
+                bw.Write(entry.Name);
+                bw.Write(extra);
+            }
+        }
+
+        static void writeCentralDirectory(Stream output, List<ZipEntryInfo> entries)
+        {
+            if (entries.Count > UInt16.MaxValue || output.Position > UInt32.MaxValue) {
+                throw new NotSupportedException("Too much data to embed in Setup.exe");
+            }
+
+            var start = output.Position;
+            using (var bw = new BinaryWriter(new NonClosingStream(output))) {
+                foreach (var entry in entries) {
+                    bw.Write(0x02014b50);
+                    bw.Write(versionNeeded(entry)); // version made by: MS-DOS
+                    bw.Write(versionNeeded(entry)); // version needed to extract
+                    bw.Write((ushort)0x0800);
+                    bw.Write(entry.Method);
+                    bw.Write(entry.DosDateTime);
+                    bw.Write(entry.Crc);
+                    bw.Write((uint)entry.CompressedSize);
+                    bw.Write((uint)entry.UncompressedSize);
+                    bw.Write((ushort)entry.Name.Length);
+                    bw.Write((ushort)0);            // extra field length
+                    bw.Write((ushort)0);            // comment length
+                    bw.Write((ushort)0);            // disk number start
+                    bw.Write((ushort)0);            // internal attributes
+                    bw.Write((uint)0x20);           // external attributes: FILE_ATTRIBUTE_ARCHIVE
+                    bw.Write((uint)entry.LocalHeaderOffset);
+                    bw.Write(entry.Name);
+                }
+
+                var size = output.Position - start;
+                bw.Write(0x06054b50);
+                bw.Write((ushort)0);                // number of this disk
+                bw.Write((ushort)0);                // disk with the central directory
+                bw.Write((ushort)entries.Count);
+                bw.Write((ushort)entries.Count);
+                bw.Write((uint)size);
+                bw.Write((uint)start);
+                bw.Write((ushort)0);                // comment length
+            }
+        }
+
+        static uint toDosDateTime(DateTime dt)
+        {
+            if (dt.Year < 1980) dt = new DateTime(1980, 1, 1);
+            if (dt.Year > 2107) dt = new DateTime(2107, 12, 31, 23, 59, 58);
+
+            var date = ((dt.Year - 1980) << 9) | (dt.Month << 5) | dt.Day;
+            var time = (dt.Hour << 11) | (dt.Minute << 5) | (dt.Second / 2);
+            return (uint)date << 16 | (uint)time;
+        }
+
+        // Lets us hand our output to a BinaryWriter or DeflateStream without
+        // it getting closed out from under us when they're disposed
+        class NonClosingStream : Stream
+        {
+            readonly Stream inner;
+            public NonClosingStream(Stream inner) { this.inner = inner; }
+
+            public override bool CanRead => false;
+            public override bool CanSeek => false;
+            public override bool CanWrite => true;
+            public override long Length => inner.Length;
+            public override long Position { get => inner.Position; set => throw new NotSupportedException(); }
+
+            public override void Flush() => inner.Flush();
+            public override int Read(byte[] buffer, int offset, int count) => throw new NotSupportedException();
+            public override long Seek(long offset, SeekOrigin origin) => throw new NotSupportedException();
+            public override void SetLength(long value) => throw new NotSupportedException();
+            public override void Write(byte[] buffer, int offset, int count) => inner.Write(buffer, offset, count);
+        }
+    }
+
+    internal class Crc32
+    {
+        static readonly uint[] table = Enumerable.Range(0, 256).Select(n => {
+            var c = (uint)n;
+            for (int k = 0; k < 8; k++) c = (c & 1) != 0 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+            return c;
+        }).ToArray();
+
+        uint crc = 0xffffffff;
+
+        public uint Value => crc ^ 0xffffffff;
+
+        public void Update(byte[] buffer, int offset, int count)
+        {
+            for (int i = offset; i < offset + count; i++) {
+                crc = table[(crc ^ buffer[i]) & 0xff] ^ (crc >> 8);
+            }
+        }
+    }
+}
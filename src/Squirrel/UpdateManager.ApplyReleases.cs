@@ -98,6 +98,12 @@ public async Task<string> ApplyReleases(UpdateInfo updateInfo, bool silentInstal
                     this.Log().WarnException("Failed to clean dead versions, continuing anyways", ex);
                 }
 
+                try {
+                    writeCurrentAppPointer();
+                } catch (Exception ex) {
+                    this.Log().WarnException("Failed to write the current app pointer, continuing anyways", ex);
+                }
+
                 progress(100);
 
                 return ret;
@@ -676,6 +682,51 @@ async Task cleanDeadVersions(SemanticVersion currentVersion, SemanticVersion new
                 ReleaseEntry.WriteReleaseFile(new[] { releaseEntry }, releasesFile);
             }
 
+            // NB: StubExecutable reads this on every launch instead of scanning
+            // all of the app-* folders, for as long as the root folder's last
+            // write time is still the one recorded in it. Adding or removing an
+            // app-* folder changes that, so the stub falls back to the scan
+            // until we write it again.
+            internal void writeCurrentAppPointer()
+            {
+                var pointerFile = Path.Combine(rootAppDirectory, ".current-app");
+
+                // NB: Pick the folder the stub's scan would, which isn't
+                // quite SemanticVersion's order; see AppVersionComparer
+                var currentApp = getReleases()
+                    .Where(x => !File.Exists(Path.Combine(x.FullName, ".not-finished")))
+                    .MaxBy(x => x.Name.ToSemanticVersion(), AppVersionComparer.Instance)
+                    .FirstOrDefault();
+
+                if (currentApp == null || currentApp.Name.Any(x => x >= 0x80 || Char.IsWhiteSpace(x))) {
+                    if (File.Exists(pointerFile)) File.Delete(pointerFile);
+                    return;
+                }
+
+                var generation = 0L;
+                if (File.Exists(pointerFile)) {
+                    var lines = File.ReadAllLines(pointerFile);
+                    if (lines.Length > 1) long.TryParse(lines[1], out generation);
+                } else {
+                    // NB: Creating the file touches the root folder, so it has
+                    // to be there before we look at its last write time
+                    using (File.Create(pointerFile)) { }
+                    File.SetAttributes(pointerFile, FileAttributes.Hidden);
+                }
+
+                var lastWrite = Directory.GetLastWriteTimeUtc(rootAppDirectory).ToFileTimeUtc();
+                var bytes = Encoding.ASCII.GetBytes(String.Format("squirrel-current-app 1\n{0}\n{1}\n{2}\n{0}\n", generation + 1, lastWrite, currentApp.Name));
+
+                // NB: Rewrite it in place, since replacing it would touch the
+                // root folder again
+                using (var fs = new FileStream(pointerFile, FileMode.Open, FileAccess.Write, FileShare.ReadWrite | FileShare.Delete)) {
+                    fs.Write(bytes, 0, bytes.Length);
+                    fs.SetLength(bytes.Length);
+                }
+
+                this.Log().Info("Current app pointer is now {0}, generation {1}", currentApp.Name, generation + 1);
+            }
+
             static void markAppFolderAsDead(string appFolderPath)
             {
                 File.WriteAllText(Path.Combine(appFolderPath, ".dead"), "");
@@ -374,6 +374,20 @@ static string find7Zip()
             }
         }
 
+        // NB: In the tests it's the one the solution built, beside the tests' own build output
+        public static string FindWriteZipToSetup()
+        {
+            if (ModeDetector.InUnitTestRunner()) {
+                var buildDir = Path.Combine(
+                    Path.GetDirectoryName(Assembly.GetExecutingAssembly().CodeBase.Replace("file:///", "")),
+                    "..", "..", "Win32"
+                );
+                return FindHelperExecutable("WriteZipToSetup.exe", new[] { buildDir });
+            } else {
+                return FindHelperExecutable("WriteZipToSetup.exe");
+            }
+        }
+
         public static async Task ExtractZipToDirectory(string zipFilePath, string outFolder)
         {
             var sevenZip = find7Zip();
@@ -4,8 +4,6 @@
 #include "stdafx.h"
 #include "StubExecutable.h"
 
-#include "semver200.h"
-
 using namespace std;
 
 bool FileExists(const std::wstring& filePath) {
@@ -13,53 +11,181 @@ bool FileExists(const std::wstring& filePath) {
     return (fileAttributes != INVALID_FILE_ATTRIBUTES) && !(fileAttributes & FILE_ATTRIBUTE_DIRECTORY);
 }
 
-wchar_t* FindRootAppDir() 
+// Our own path, split into the root app directory and the exe's name
+bool FindRootAppDirAndName(std::wstring& rootDir, std::wstring& exeName)
 {
-	wchar_t* ourDirectory = new wchar_t[MAX_PATH];
+	wchar_t ourPath[MAX_PATH];
+
+	DWORD len = GetModuleFileName(GetModuleHandle(NULL), ourPath, MAX_PATH);
+	if (len == 0 || len >= MAX_PATH) {
+		return false;
+	}
 
-	GetModuleFileName(GetModuleHandle(NULL), ourDirectory, MAX_PATH);
-	wchar_t* lastSlash = wcsrchr(ourDirectory, L'\\');
+	wchar_t* lastSlash = wcsrchr(ourPath, L'\\');
 	if (!lastSlash) {
-		delete[] ourDirectory;
-		return NULL;
+		return false;
 	}
 
-	// Null-terminate the string at the slash so now it's a directory
-	*lastSlash = 0x0;
-	return ourDirectory;
+	exeName.assign(lastSlash + 1);
+	rootDir.assign(ourPath, lastSlash - ourPath);
+	return true;
 }
 
-wchar_t* FindOwnExecutableName() 
+// Update.exe writes .current-app in the root app directory after each install
+// or update, naming the app-* directory it left current:
+//
+//   squirrel-current-app 1
+//   <generation>
+//   <the root directory's last write time then, as a FILETIME>
+//   app-<version>
+//   <generation>
+//
+// Adding or removing an app-* directory changes the root's last write time, so
+// while it still matches, the directory named is the one FindLatestAppDir would
+// find, and we can skip the scan. The generation goes at both ends so that a
+// file caught half rewritten doesn't parse. Returns "" if it's missing or stale.
+std::wstring ReadCurrentAppDir(const std::wstring& rootDir)
 {
-	wchar_t* ourDirectory = new wchar_t[MAX_PATH];
+	WIN32_FILE_ATTRIBUTE_DATA rootInfo;
+	if (!GetFileAttributesEx(rootDir.c_str(), GetFileExInfoStandard, &rootInfo)) {
+		return std::wstring();
+	}
 
-	GetModuleFileName(GetModuleHandle(NULL), ourDirectory, MAX_PATH);
-	wchar_t* lastSlash = wcsrchr(ourDirectory, L'\\');
-	if (!lastSlash) {
-		delete[] ourDirectory;
-		return NULL;
+	std::wstring pointerPath = rootDir + L"\\.current-app";
+	HANDLE hFile = CreateFile(pointerPath.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (hFile == INVALID_HANDLE_VALUE) {
+		return std::wstring();
+	}
+
+	char buf[512];
+	DWORD bytesRead = 0;
+	BOOL ok = ReadFile(hFile, buf, sizeof(buf) - 1, &bytesRead, NULL);
+	CloseHandle(hFile);
+	if (!ok || bytesRead == sizeof(buf) - 1) {
+		return std::wstring();
+	}
+	buf[bytesRead] = 0;
+
+	char appDir[256];
+	unsigned __int64 generation = 0, lastWrite = 0, generationAgain = 0;
+	int consumed = 0;
+	int fields = sscanf_s(buf, "squirrel-current-app 1 %I64u %I64u %255s %I64u %n",
+		&generation, &lastWrite, appDir, (unsigned)_countof(appDir), &generationAgain, &consumed);
+	if (fields != 4 || consumed != (int)bytesRead || generation != generationAgain) {
+		return std::wstring();
+	}
+
+	unsigned __int64 rootLastWrite = ((unsigned __int64)rootInfo.ftLastWriteTime.dwHighDateTime << 32) | rootInfo.ftLastWriteTime.dwLowDateTime;
+	if (lastWrite != rootLastWrite) {
+		return std::wstring();
+	}
+
+	// Only ever a sibling app-* directory
+	if (strncmp(appDir, "app-", 4) != 0 || strpbrk(appDir, "\\/:") || strstr(appDir, "..")) {
+		return std::wstring();
+	}
+
+	std::wstring ret = rootDir + L"\\";
+	for (const char* c = appDir; *c; c++) {
+		if ((unsigned char)*c >= 0x80) {
+			return std::wstring();
+		}
+		ret += (wchar_t)*c;
 	}
 
-	wchar_t* ret = _wcsdup(lastSlash + 1);
-	delete[] ourDirectory;
 	return ret;
 }
 
-std::wstring FindLatestAppDir() 
+// An app-* directory's version, as Update.exe reads it into a SemanticVersion:
+// up to four numbers, and then maybe a -tag that starts with
+// a letter and goes on in letters, digits and hyphens
+struct AppVersion {
+	unsigned long long nums[4];
+	std::wstring tag;
+};
+
+bool ParseAppVersion(const std::wstring& s, AppVersion& ver)
 {
-	std::wstring ourDir;
-	ourDir.assign(FindRootAppDir());
+	size_t i = 0;
+	for (int n = 0; n < 4; n++) {
+		ver.nums[n] = 0;
+	}
+	for (int n = 0; ; n++) {
+		if (n == 4 || i == s.size() || s[i] < L'0' || s[i] > L'9') {
+			return false;
+		}
+		while (i < s.size() && s[i] >= L'0' && s[i] <= L'9') {
+			ver.nums[n] = ver.nums[n] * 10 + (s[i++] - L'0');
+		}
+		if (i == s.size() || s[i] != L'.') {
+			break;
+		}
+		i++;
+	}
+	if (i == s.size()) {
+		ver.tag.clear();
+		return true;
+	}
+	if (s[i] != L'-' || i + 1 == s.size() || !iswalpha(s[i + 1]) || s[i + 1] >= 0x80) {
+		return false;
+	}
+	ver.tag = s.substr(i + 1);
+	for (size_t j = 0; j < ver.tag.size(); j++) {
+		if (ver.tag[j] >= 0x80 || !(iswalnum(ver.tag[j]) || ver.tag[j] == L'-')) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// The order the scan ranks versions in, which Update.exe's AppVersionComparer
+// shares so that .current-app names the directory the scan would find: by the
+// numbers, then a release above its prereleases, then tags that are the same
+// word and a number by the number (so beta10 is above beta9), and otherwise by
+// the tags, ignoring case. ApplyReleasesTests checks the C# side with
+// prerelease versions. Returns <0, 0 or >0.
+int CompareAppVersions(const AppVersion& l, const AppVersion& r)
+{
+	for (int n = 0; n < 4; n++) {
+		if (l.nums[n] != r.nums[n]) {
+			return l.nums[n] < r.nums[n] ? -1 : 1;
+		}
+	}
+	if (l.tag.empty() || r.tag.empty()) {
+		return (int)l.tag.empty() - (int)r.tag.empty();
+	}
+
+	size_t lp = l.tag.find_last_not_of(L"0123456789") + 1, rp = r.tag.find_last_not_of(L"0123456789") + 1;
+	if (lp < l.tag.size() && rp < r.tag.size() && lp == rp && _wcsnicmp(l.tag.c_str(), r.tag.c_str(), lp) == 0) {
+		size_t ln = l.tag.find_first_not_of(L'0', lp), rn = r.tag.find_first_not_of(L'0', rp);
+		if (ln == std::wstring::npos) ln = l.tag.size();
+		if (rn == std::wstring::npos) rn = r.tag.size();
+		if (l.tag.size() - ln != r.tag.size() - rn) {
+			return l.tag.size() - ln < r.tag.size() - rn ? -1 : 1;
+		}
+		int cmp = l.tag.compare(ln, std::wstring::npos, r.tag, rn, std::wstring::npos);
+		if (cmp != 0) {
+			return cmp;
+		}
+	}
+	return _wcsicmp(l.tag.c_str(), r.tag.c_str());
+}
+
+std::wstring FindLatestAppDir(const std::wstring& rootDir) 
+{
+	std::wstring ourDir(rootDir);
 
 	ourDir += L"\\app-*";
 
 	WIN32_FIND_DATA fileInfo = { 0 };
 	HANDLE hFile = FindFirstFile(ourDir.c_str(), &fileInfo);
 	if (hFile == INVALID_HANDLE_VALUE) {
-		return NULL;
+		return std::wstring();
 	}
 
-	version::Semver200_version acc("0.0.0");
+	AppVersion acc;
 	std::wstring acc_s;
+	bool found = false;
 
 	do {
 		std::wstring appVer = fileInfo.cFileName;
@@ -68,9 +194,10 @@ std::wstring FindLatestAppDir()
 			continue;
 		}
 
-		std::string s(appVer.begin(), appVer.end());
-
-		version::Semver200_version thisVer(s);
+		AppVersion thisVer;
+		if (!ParseAppVersion(appVer, thisVer)) {
+			continue;
+		}
 
 		// Skip the directory which contains a .not-finished file
 		std::wstring appFolder = fileInfo.cFileName;
@@ -79,22 +206,20 @@ std::wstring FindLatestAppDir()
 			continue;
 		}
 
-		if (thisVer > acc) {
+		if (!found || CompareAppVersions(thisVer, acc) > 0) {
 			acc = thisVer;
 			acc_s = appVer;
+			found = true;
 		}
 	} while (FindNextFile(hFile, &fileInfo));
 
-	if (acc == version::Semver200_version("0.0.0")) {
-		return NULL;
-	}
+	FindClose(hFile);
 
-	ourDir.assign(FindRootAppDir());
-	std::wstringstream ret;
-	ret << ourDir << L"\\app-" << acc_s;
+	if (!found) {
+		return std::wstring();
+	}
 
-	FindClose(hFile);
-	return ret.str();
+	return rootDir + L"\\app-" + acc_s;
 }
 
 int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
@@ -102,10 +227,19 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
                      _In_ LPWSTR    lpCmdLine,
                      _In_ int       nCmdShow)
 {
-	std::wstring appName;
-	appName.assign(FindOwnExecutableName());
+	std::wstring rootDir, appName;
+	if (!FindRootAppDirAndName(rootDir, appName)) {
+		return -1;
+	}
+
+	std::wstring workingDir(ReadCurrentAppDir(rootDir));
+	if (workingDir.empty()) {
+		workingDir = FindLatestAppDir(rootDir);
+	}
+	if (workingDir.empty()) {
+		return -1;
+	}
 
-	std::wstring workingDir(FindLatestAppDir());
 	std::wstring fullPath(workingDir + L"\\" + appName);
 
 	STARTUPINFO si = { 0 };
@@ -26,6 +26,7 @@ internal class StartupOption
         internal bool noMsi { get; private set; } = (Environment.OSVersion.Platform != PlatformID.Win32NT);        // NB: WiX doesn't work under Mono / Wine
         internal bool packageAs64Bit { get; private set; } = false;
         internal bool noDelta { get; private set; } = false;
+        internal SetupZipCompression setupCompression { get; private set; } = SetupZipCompression.Deflate;
         internal bool onlyUpdateShortcuts { get; private set; } = false;
                
         public StartupOption(string[] args) {
@@ -66,6 +67,7 @@ internal class StartupOption
                 { "no-msi", "Don't generate an MSI package", v => noMsi = true},
                 { "no-delta", "Don't generate delta packages to save time", v => noDelta = true},
                 { "framework-version=", "Set the required .NET framework version, e.g. net461", v => frameworkVersion = v },
+                { "setup-compression=", "Compression for the files inside Setup.exe, 'deflate' (default) or 'zstd'", v => setupCompression = parseSetupCompression(v) },
                 { "msi-win64", "Mark the MSI as 64-bit, which is useful in Enterprise deployment scenarios", _ => packageAs64Bit = true},
                 { "updateOnly", "Update shortcuts that already exist, rather than creating new ones", _ => onlyUpdateShortcuts = true},
             };
@@ -79,6 +81,14 @@ internal class StartupOption
             return opts;
         }
 
+        static SetupZipCompression parseSetupCompression(string v) {
+            switch (v.ToLowerInvariant()) {
+            case "deflate": return SetupZipCompression.Deflate;
+            case "zstd": return SetupZipCompression.Zstandard;
+            default: throw new OptionException(String.Format("Unknown compression '{0}', expected 'deflate' or 'zstd'", v), "setup-compression");
+            }
+        }
+
         internal void WriteOptionDescriptions() {
             optionSet.WriteOptionDescriptions(Console.Out);
         }
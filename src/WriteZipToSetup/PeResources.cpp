@@ -0,0 +1,659 @@
+#ifdef _WIN32
+#include "stdafx.h"
+#else
+#include <stdio.h>
+#include <string.h>
+#endif
+#include "PeResources.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <map>
+
+// Offsets into the PE headers, from the PE/COFF spec; the COFF header's
+// are from the "PE\0\0" before it, and the rest from the start of their own
+#define COFF_SECTIONCOUNT     6
+#define COFF_SYMBOLTABLE      12
+#define COFF_OPTIONALSIZE     20
+#define OPT_INITIALIZEDSIZE   8
+#define OPT_SECTIONALIGN      32
+#define OPT_FILEALIGN         36
+#define OPT_IMAGESIZE         56
+#define OPT_HEADERSSIZE       60
+#define OPT_CHECKSUM          64
+#define SECTION_SIZE          40
+#define SECTION_VIRTUALSIZE   8
+#define SECTION_RVA           12
+#define SECTION_RAWSIZE       16
+#define SECTION_RAWPOINTER    20
+#define SECTION_FLAGS         36
+#define DIR_SECURITY          4     // the Authenticode signature, by file offset rather than RVA
+#define DIR_RESOURCE          2
+#define DIR_BASERELOC         5
+#define SCN_INITIALIZED_DATA  0x00000040
+#define SCN_MEM_READ          0x40000000
+#define RESOURCE_SUBDIR       0x80000000
+
+#define PE_BLOCKSIZE          (1 << 20)   // for reading and writing files, so that a big one takes few calls
+
+static uint16_t Get16(const std::vector<uint8_t>& v, size_t at) { return (uint16_t)(v[at] | (v[at + 1] << 8)); }
+static uint32_t Get32(const std::vector<uint8_t>& v, size_t at) { return Get16(v, at) | ((uint32_t)Get16(v, at + 2) << 16); }
+static void Set16(std::vector<uint8_t>& v, size_t at, uint32_t x) { v[at] = (uint8_t)x; v[at + 1] = (uint8_t)(x >> 8); }
+static void Set32(std::vector<uint8_t>& v, size_t at, uint32_t x) { Set16(v, at, x & 0xFFFF); Set16(v, at + 2, x >> 16); }
+static void Put16(std::vector<uint8_t>& v, uint32_t x) { v.push_back((uint8_t)x); v.push_back((uint8_t)(x >> 8)); }
+static void Put32(std::vector<uint8_t>& v, uint32_t x) { Put16(v, x & 0xFFFF); Put16(v, x >> 16); }
+static uint32_t Align(uint32_t x, uint32_t to) { return (x + to - 1) / to * to; }
+
+static FILE* OpenStream(const PePath& path, bool write)
+{
+	FILE* f = NULL;
+#ifdef _WIN32
+	if (_wfopen_s(&f, path.c_str(), write ? L"wb" : L"rb") != 0) f = NULL;
+#else
+	f = fopen(path.c_str(), write ? "wb" : "rb");
+#endif
+	return f;
+}
+
+bool PeFileSize(const PePath& path, uint64_t& size)
+{
+#ifdef _WIN32
+	struct _stat64 st;
+	if (_wstat64(path.c_str(), &st) != 0) return false;
+#else
+	struct stat st;
+	if (stat(path.c_str(), &st) != 0) return false;
+#endif
+	size = (uint64_t)st.st_size;
+	return true;
+}
+
+static bool Seek(FILE* f, uint64_t offset)
+{
+#ifdef _WIN32
+	return _fseeki64(f, (int64_t)offset, SEEK_SET) == 0;
+#else
+	return fseeko(f, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+bool PeReadFile(const PePath& path, uint64_t offset, size_t size, std::vector<uint8_t>& data)
+{
+	FILE* f = OpenStream(path, false);
+	if (!f) return false;
+
+	// Straight into place, rather than through a buffer
+	data.resize(size);
+	size_t done = 0, read = 1;
+	bool ok = Seek(f, offset);
+	while (ok && done < size && read > 0) {
+		read = fread(&data[done], 1, std::min(size - done, (size_t)PE_BLOCKSIZE), f);
+		done += read;
+	}
+
+	ok = ok && done == size && !ferror(f);
+	fclose(f);
+	return ok;
+}
+
+bool PeReadFile(const PePath& path, std::vector<uint8_t>& data)
+{
+	uint64_t size;
+	return PeFileSize(path, size) && size <= SIZE_MAX && PeReadFile(path, 0, (size_t)size, data);
+}
+
+bool PeWriteFile(const PePath& path, const std::vector<uint8_t>& data)
+{
+	FILE* f = OpenStream(path, true);
+	if (!f) return false;
+
+	bool ok = data.empty() || fwrite(data.data(), 1, data.size(), f) == data.size();
+	return fclose(f) == 0 && ok;
+}
+
+bool PeImage::Load(const PePath& path)
+{
+	resources.clear();
+	overlay.clear();
+
+	// The headers first, to find out how much more to read
+	uint64_t fileSize;
+	if (!PeFileSize(path, fileSize) || !PeReadFile(path, 0, (size_t)std::min(fileSize, (uint64_t)PE_BLOCKSIZE), image)) {
+		return Fail("couldn't read the file");
+	}
+	if (image.size() < 0x40 || image[0] != 'M' || image[1] != 'Z') return Fail("not an executable");
+
+	peOffset = Get32(image, 0x3C);
+	if ((uint64_t)peOffset + 24 + 2 > image.size() || Get32(image, peOffset) != 0x00004550) return Fail("not a PE image");
+
+	sectionCount = Get16(image, peOffset + COFF_SECTIONCOUNT);
+	uint16_t optSize = Get16(image, peOffset + COFF_OPTIONALSIZE);
+	optOffset = peOffset + 24;
+	sectionOffset = optOffset + optSize;
+	if ((uint64_t)sectionOffset + (uint64_t)sectionCount * SECTION_SIZE > image.size()) return Fail("the section table is cut off");
+
+	uint16_t magic = Get16(image, optOffset);
+	if (magic != 0x10B && magic != 0x20B) return Fail("unknown optional header");
+	pe32Plus = magic == 0x20B;
+
+	// The data directories come after the fields that PE32+ widens to 64 bits
+	uint32_t dirCountAt = pe32Plus ? 108 : 92;
+	dirOffset = optOffset + dirCountAt + 4;
+	if (optSize < dirCountAt + 4 || Get32(image, optOffset + dirCountAt) <= DIR_BASERELOC ||
+		dirOffset + 8 * (DIR_BASERELOC + 1) > sectionOffset) {
+		return Fail("too few data directories");
+	}
+
+	// Then the sections; anything past them, bar a signature, is the overlay
+	uint32_t sectionsEnd = Get32(image, optOffset + OPT_HEADERSSIZE);
+	for (int i = 0; i < sectionCount; i++) {
+		const uint32_t header = sectionOffset + i * SECTION_SIZE;
+		uint32_t raw = Get32(image, header + SECTION_RAWPOINTER), rawSize = Get32(image, header + SECTION_RAWSIZE);
+		if ((uint64_t)raw + rawSize > fileSize) return Fail("a section is cut off");
+		if (rawSize != 0) sectionsEnd = std::max(sectionsEnd, raw + rawSize);
+	}
+	if (sectionsEnd > fileSize) return Fail("the headers are cut off");
+	if (sectionsEnd > image.size() && !PeReadFile(path, 0, sectionsEnd, image)) return Fail("couldn't read the file");
+	image.resize(sectionsEnd);
+
+	// A small overlay is read in; a big one (a payload, say) is left where it
+	// is, and copied across when the image is saved
+	const uint64_t signatureAt = Get32(image, dirOffset + 8 * DIR_SECURITY);
+	const uint64_t signatureSize = Get32(image, dirOffset + 8 * DIR_SECURITY + 4);
+	uint64_t ranges[2][2] = { { sectionsEnd, fileSize }, { fileSize, fileSize } };
+	if (signatureSize != 0 && signatureAt >= sectionsEnd && signatureAt < fileSize) {
+		ranges[0][1] = signatureAt;
+		ranges[1][0] = std::min(signatureAt + signatureSize, fileSize);
+	}
+	const bool small = (ranges[0][1] - ranges[0][0]) + (ranges[1][1] - ranges[1][0]) <= PE_BLOCKSIZE;
+	for (const auto& range : ranges) {
+		const uint64_t size = range[1] - range[0];
+		if (size == 0) continue;
+		if (!small) {
+			overlay.push_back(PeOverlayPart(path, range[0], size));
+			continue;
+		}
+
+		std::vector<uint8_t> bytes;
+		if (!PeReadFile(path, range[0], (size_t)size, bytes)) return Fail("couldn't read the file");
+		overlay.push_back(PeOverlayPart(std::move(bytes)));
+	}
+
+	uint32_t rva = Get32(image, dirOffset + 8 * DIR_RESOURCE);
+	if (rva == 0) return true;
+
+	int section = SectionOf(rva);
+	if (section < 0) return Fail("the resources aren't in any section");
+
+	const uint32_t header = sectionOffset + section * SECTION_SIZE;
+	uint32_t base = Get32(image, header + SECTION_RAWPOINTER) + (rva - Get32(image, header + SECTION_RVA));
+	uint32_t size = Get32(image, header + SECTION_RAWSIZE) - (rva - Get32(image, header + SECTION_RVA));
+	if ((uint64_t)base + size > image.size()) return Fail("the resources are cut off");
+
+	PeResource top;
+	top.language = 0;
+	top.codePage = 0;
+	return ParseDirectory(base, size, 0, 0, top);
+}
+
+// Walks the type, name and language levels of the tree, collecting what's at
+// the bottom of it; base and size are where the tree is in the file
+bool PeImage::ParseDirectory(uint32_t base, uint32_t size, uint32_t offset, int depth, PeResource& path)
+{
+	if ((uint64_t)offset + 16 > size) return Fail("a resource directory is cut off");
+
+	const uint32_t at = base + offset;
+	uint32_t count = Get16(image, at + 12) + Get16(image, at + 14);
+	if ((uint64_t)offset + 16 + 8 * (uint64_t)count > size) return Fail("a resource directory is cut off");
+
+	for (uint32_t i = 0; i < count; i++) {
+		uint32_t nameField = Get32(image, at + 16 + 8 * i);
+		uint32_t dataField = Get32(image, at + 16 + 8 * i + 4);
+
+		PeResourceId id;
+		if (nameField & RESOURCE_SUBDIR) {
+			if (!ReadName(base, size, nameField & ~RESOURCE_SUBDIR, id.name)) return false;
+		} else {
+			id.id = (uint16_t)nameField;
+		}
+
+		if (depth == 0) path.type = id;
+		else if (depth == 1) path.name = id;
+		else if (id.IsName()) return Fail("a resource's language is a string");
+		else path.language = id.id;
+
+		if (dataField & RESOURCE_SUBDIR) {
+			if (depth == 2) return Fail("the resource tree is more than three levels deep");
+			if (!ParseDirectory(base, size, dataField & ~RESOURCE_SUBDIR, depth + 1, path)) return false;
+			continue;
+		}
+
+		if (depth != 2) return Fail("a resource isn't under a type, name and language");
+		if ((uint64_t)dataField + 16 > size) return Fail("a resource's data entry is cut off");
+
+		uint32_t dataRva = Get32(image, base + dataField);
+		uint32_t dataSize = Get32(image, base + dataField + 4);
+		int64_t dataAt = RvaToOffset(dataRva, dataSize);
+		if (dataAt < 0) return Fail("a resource's data is outside the image");
+
+		PeResource r = path;
+		r.codePage = Get32(image, base + dataField + 8);
+		r.data.assign(image.begin() + (size_t)dataAt, image.begin() + (size_t)dataAt + dataSize);
+		resources.push_back(r);
+	}
+
+	return true;
+}
+
+bool PeImage::ReadName(uint32_t base, uint32_t size, uint32_t offset, std::u16string& name)
+{
+	if ((uint64_t)offset + 2 > size) return Fail("a resource name is cut off");
+
+	uint32_t length = Get16(image, base + offset);
+	if (length == 0) return Fail("a resource name is empty");
+	if ((uint64_t)offset + 2 + 2 * length > size) return Fail("a resource name is cut off");
+
+	name.clear();
+	for (uint32_t i = 0; i < length; i++) name.push_back((char16_t)Get16(image, base + offset + 2 + 2 * i));
+	return true;
+}
+
+int PeImage::SectionOf(uint32_t rva) const
+{
+	for (int i = 0; i < sectionCount; i++) {
+		const uint32_t header = sectionOffset + i * SECTION_SIZE;
+		uint32_t start = Get32(image, header + SECTION_RVA);
+		if (rva >= start && rva - start < Get32(image, header + SECTION_RAWSIZE)) return i;
+	}
+	return -1;
+}
+
+int64_t PeImage::RvaToOffset(uint32_t rva, uint32_t size) const
+{
+	int section = SectionOf(rva);
+	if (section < 0) return -1;
+
+	const uint32_t header = sectionOffset + section * SECTION_SIZE;
+	uint32_t into = rva - Get32(image, header + SECTION_RVA);
+	uint64_t at = (uint64_t)Get32(image, header + SECTION_RAWPOINTER) + into;
+	if ((uint64_t)into + size > Get32(image, header + SECTION_RAWSIZE) || at + size > image.size()) return -1;
+	return (int64_t)at;
+}
+
+void PeImage::SetResource(const PeResourceId& type, const PeResourceId& name, uint16_t language, const void* data, size_t size)
+{
+	const uint8_t* bytes = (const uint8_t*)data;
+	SetResource(type, name, language, std::vector<uint8_t>(bytes, bytes + size));
+}
+
+void PeImage::SetResource(const PeResourceId& type, const PeResourceId& name, uint16_t language, std::vector<uint8_t>&& data)
+{
+	for (PeResource& r : resources) {
+		if (r.type == type && r.name == name && r.language == language) {
+			r.data = std::move(data);
+			return;
+		}
+	}
+
+	PeResource r;
+	r.type = type;
+	r.name = name;
+	r.language = language;
+	r.codePage = 0;
+	r.data = std::move(data);
+	resources.push_back(std::move(r));
+}
+
+const PeResource* PeImage::Find(const PeResourceId& type, const PeResourceId& name, uint16_t language) const
+{
+	for (const PeResource& r : resources) {
+		if (r.type == type && r.name == name && r.language == language) return &r;
+	}
+	return NULL;
+}
+
+// The loader binary-searches each level: names first, ordered without regard
+// to case, and then numbers
+static int CompareIds(const PeResourceId& a, const PeResourceId& b)
+{
+	if (a.IsName() != b.IsName()) return a.IsName() ? -1 : 1;
+	if (!a.IsName()) return a.id < b.id ? -1 : a.id > b.id ? 1 : 0;
+
+	for (size_t i = 0; i < a.name.size() && i < b.name.size(); i++) {
+		char16_t x = a.name[i], y = b.name[i];
+		if (x >= u'a' && x <= u'z') x -= u'a' - u'A';
+		if (y >= u'a' && y <= u'z') y -= u'a' - u'A';
+		if (x != y) return x < y ? -1 : 1;
+	}
+	if (a.name.size() != b.name.size()) return a.name.size() < b.name.size() ? -1 : 1;
+	return a.name < b.name ? -1 : a.name > b.name ? 1 : 0;
+}
+
+// Lays out the tree as the linker does: the directories, then the data
+// entries, then the name strings, and then the data, for the tree to go at
+// rva; it's added to the end of tree
+void PeImage::BuildTree(uint32_t rva, std::vector<uint8_t>& tree) const
+{
+	std::vector<const PeResource*> sorted;
+	for (const PeResource& r : resources) sorted.push_back(&r);
+	std::stable_sort(sorted.begin(), sorted.end(), [](const PeResource* a, const PeResource* b) {
+		int c = CompareIds(a->type, b->type);
+		if (c == 0) c = CompareIds(a->name, b->name);
+		return c != 0 ? c < 0 : a->language < b->language;
+	});
+
+	// Each directory's entries: an id, and the index of either a directory
+	// or (in a name's directory, whose entries are languages) a resource
+	struct Entry { PeResourceId id; size_t target; };
+	std::vector<std::vector<Entry>> dirs(1);
+	std::vector<bool> leaves(1, false);
+	std::vector<const PeResource*> used;
+	size_t typeDir = 0, nameDir = 0;
+	for (size_t i = 0; i < sorted.size(); i++) {
+		const PeResource* r = sorted[i];
+		bool newType = i == 0 || !(r->type == sorted[i - 1]->type);
+		bool newName = newType || !(r->name == sorted[i - 1]->name);
+		if (!newName && r->language == sorted[i - 1]->language) continue; // a duplicate; the first one wins
+
+		if (newType) {
+			typeDir = dirs.size();
+			dirs[0].push_back(Entry { r->type, typeDir });
+			dirs.push_back(std::vector<Entry>());
+			leaves.push_back(false);
+		}
+		if (newName) {
+			nameDir = dirs.size();
+			dirs[typeDir].push_back(Entry { r->name, nameDir });
+			dirs.push_back(std::vector<Entry>());
+			leaves.push_back(true);
+		}
+		dirs[nameDir].push_back(Entry { PeResourceId(r->language), used.size() });
+		used.push_back(r);
+	}
+
+	std::vector<uint32_t> dirAt;
+	uint32_t at = 0;
+	for (const std::vector<Entry>& d : dirs) {
+		dirAt.push_back(at);
+		at += 16 + 8 * (uint32_t)d.size();
+	}
+
+	const uint32_t entriesAt = at;
+	at += 16 * (uint32_t)used.size();
+
+	std::map<std::u16string, uint32_t> nameAt;
+	for (const std::vector<Entry>& d : dirs) {
+		for (const Entry& e : d) {
+			if (!e.id.IsName() || nameAt.count(e.id.name)) continue;
+			nameAt[e.id.name] = at;
+			at += 2 + 2 * (uint32_t)e.id.name.size();
+		}
+	}
+
+	std::vector<uint32_t> dataAt;
+	for (const PeResource* r : used) {
+		at = Align(at, 8);
+		dataAt.push_back(at);
+		at += (uint32_t)r->data.size();
+	}
+
+	const size_t base = tree.size();
+	for (size_t d = 0; d < dirs.size(); d++) {
+		uint32_t named = 0;
+		for (const Entry& e : dirs[d]) if (e.id.IsName()) named++;
+
+		Put32(tree, 0);                     // characteristics
+		Put32(tree, 0);                     // time stamp: none, so the same input makes the same image
+		Put16(tree, 0);                     // version
+		Put16(tree, 0);
+		Put16(tree, named);
+		Put16(tree, (uint32_t)dirs[d].size() - named);
+
+		for (const Entry& e : dirs[d]) {
+			Put32(tree, e.id.IsName() ? RESOURCE_SUBDIR | nameAt[e.id.name] : e.id.id);
+			Put32(tree, leaves[d] ? entriesAt + 16 * (uint32_t)e.target : RESOURCE_SUBDIR | dirAt[e.target]);
+		}
+	}
+
+	for (size_t i = 0; i < used.size(); i++) {
+		Put32(tree, rva + dataAt[i]);
+		Put32(tree, (uint32_t)used[i]->data.size());
+		Put32(tree, used[i]->codePage);
+		Put32(tree, 0);
+	}
+
+	for (const auto& n : nameAt) {
+		Put16(tree, (uint32_t)n.first.size());
+		for (char16_t c : n.first) Put16(tree, c);
+	}
+
+	for (size_t i = 0; i < used.size(); i++) {
+		tree.resize(base + dataAt[i], 0);
+		tree.insert(tree.end(), used[i]->data.begin(), used[i]->data.end());
+	}
+}
+
+// The PE checksum: the file's 16-bit words, summed with their carries folded
+// back in, plus the file's length. The checksum itself is left as zero while
+// it's summed, so that it counts for nothing.
+struct Checksum
+{
+	uint64_t sum = 0, size = 0;
+
+	void Add(const uint8_t* data, size_t length)
+	{
+		size_t i = 0;
+		if ((size & 1) && length > 0) sum += (uint32_t)data[i++] << 8;
+		for (; i + 1 < length; i += 2) sum += data[i] | (data[i + 1] << 8);
+		if (i < length) sum += data[i];
+		size += length;
+	}
+
+	uint32_t Value() const
+	{
+		uint64_t folded = sum;
+		while (folded >> 16) folded = (folded & 0xFFFF) + (folded >> 16);
+		return (uint32_t)(folded + size);
+	}
+};
+
+static bool WriteSummed(FILE* f, const uint8_t* data, size_t size, Checksum& checksum)
+{
+	checksum.Add(data, size);
+	return size == 0 || fwrite(data, 1, size, f) == size;
+}
+
+// part's bytes of part.file, in large blocks
+static bool CopySummed(FILE* f, const PeOverlayPart& part, Checksum& checksum)
+{
+	FILE* in = OpenStream(part.file, false);
+	if (!in) return false;
+
+	std::vector<uint8_t> block(PE_BLOCKSIZE);
+	uint64_t left = part.size;
+	bool ok = Seek(in, part.offset);
+	while (ok && left > 0) {
+		size_t want = (size_t)std::min(left, (uint64_t)block.size());
+		ok = fread(block.data(), 1, want, in) == want && WriteSummed(f, block.data(), want, checksum);
+		left -= want;
+	}
+	fclose(in);
+	return ok;
+}
+
+bool PeImage::Save(const PePath& path)
+{
+	if (image.empty()) return Fail("nothing's been loaded");
+
+	const uint32_t sectionAlign = Get32(image, optOffset + OPT_SECTIONALIGN);
+	const uint32_t fileAlign = Get32(image, optOffset + OPT_FILEALIGN);
+	if (sectionAlign == 0 || fileAlign == 0) return Fail("the image has no alignment");
+
+	// Where the sections' data ends, which is where any overlay starts; and
+	// whether the sections are in order, both in memory and in the file
+	uint32_t sectionsEnd = Get32(image, optOffset + OPT_HEADERSSIZE);
+	uint32_t firstRaw = UINT32_MAX;
+	bool inOrder = true;
+	for (int i = 0; i < sectionCount; i++) {
+		const uint32_t header = sectionOffset + i * SECTION_SIZE;
+		uint32_t raw = Get32(image, header + SECTION_RAWPOINTER), rawSize = Get32(image, header + SECTION_RAWSIZE);
+		if ((uint64_t)raw + rawSize > image.size()) return Fail("a section is cut off");
+		if (rawSize == 0) continue;
+
+		if (raw < sectionsEnd || (i > 0 && Get32(image, header + SECTION_RVA) < Get32(image, header - SECTION_SIZE + SECTION_RVA))) inOrder = false;
+		sectionsEnd = std::max(sectionsEnd, raw + rawSize);
+		firstRaw = std::min(firstRaw, raw);
+	}
+
+	// Where the tree goes: over the old one if there's nothing after it but
+	// .reloc, which only the data directory refers to, so that it can move
+	const uint32_t oldRva = Get32(image, dirOffset + 8 * DIR_RESOURCE);
+	const uint32_t relocRva = Get32(image, dirOffset + 8 * DIR_BASERELOC);
+	int section = oldRva ? SectionOf(oldRva) : -1;
+	if (section >= 0 && Get32(image, sectionOffset + section * SECTION_SIZE + SECTION_RVA) != oldRva) section = -1;
+	bool inPlace = inOrder && section >= 0;
+	int reloc = -1;
+	for (int i = section + 1; inPlace && i < sectionCount; i++) {
+		const uint32_t header = sectionOffset + i * SECTION_SIZE;
+		uint32_t start = Get32(image, header + SECTION_RVA);
+		if (i == section + 1 && i == sectionCount - 1 && Get32(image, header + SECTION_RAWSIZE) != 0 &&
+			relocRva >= start && relocRva - start < Get32(image, header + SECTION_RAWSIZE)) {
+			reloc = i;
+		} else {
+			inPlace = false;
+		}
+	}
+
+	// Room for the image (with the old tree and .reloc), the new tree and
+	// padding, so that the payload's never copied to grow out
+	std::vector<uint8_t> out;
+	size_t room = image.size() + 2 * fileAlign;
+	for (const PeResource& r : resources) room += r.data.size() + 128 + 2 * (r.type.name.size() + r.name.name.size() + 2);
+	out.reserve(room);
+	uint32_t treeRva, treeSize;
+	int64_t initializedGrowth;
+
+	if (inPlace) {
+		const uint32_t header = sectionOffset + section * SECTION_SIZE;
+		const uint32_t raw = Get32(image, header + SECTION_RAWPOINTER);
+		const uint32_t oldRawSize = Get32(image, header + SECTION_RAWSIZE);
+
+		treeRva = oldRva;
+		out.assign(image.begin(), image.begin() + raw);
+		BuildTree(treeRva, out);
+		treeSize = (uint32_t)out.size() - raw;
+		out.resize(Align((uint32_t)out.size(), fileAlign), 0);
+
+		Set32(out, header + SECTION_VIRTUALSIZE, treeSize);
+		Set32(out, header + SECTION_RAWSIZE, (uint32_t)out.size() - raw);
+		initializedGrowth = (int64_t)(out.size() - raw) - oldRawSize;
+
+		if (reloc >= 0) {
+			const uint32_t relocHeader = sectionOffset + reloc * SECTION_SIZE;
+			const uint32_t oldStart = Get32(image, relocHeader + SECTION_RVA);
+			const uint32_t start = Align(treeRva + treeSize, sectionAlign);
+			const uint32_t relocRaw = Get32(image, relocHeader + SECTION_RAWPOINTER);
+
+			Set32(out, relocHeader + SECTION_RVA, start);
+			Set32(out, relocHeader + SECTION_RAWPOINTER, (uint32_t)out.size());
+			Set32(out, dirOffset + 8 * DIR_BASERELOC, relocRva - oldStart + start);
+			out.insert(out.end(), image.begin() + relocRaw, image.begin() + relocRaw + Get32(image, relocHeader + SECTION_RAWSIZE));
+		}
+	} else {
+		// A new section at the end, if there's room for its header
+		const uint32_t header = sectionOffset + sectionCount * SECTION_SIZE;
+		if (header + SECTION_SIZE > Get32(image, optOffset + OPT_HEADERSSIZE) || header + SECTION_SIZE > firstRaw) {
+			return Fail("there's no room in the headers for another section");
+		}
+
+		uint32_t end = 0;
+		for (int i = 0; i < sectionCount; i++) {
+			const uint32_t h = sectionOffset + i * SECTION_SIZE;
+			end = std::max(end, Get32(image, h + SECTION_RVA) + std::max(Get32(image, h + SECTION_VIRTUALSIZE), Get32(image, h + SECTION_RAWSIZE)));
+		}
+
+		treeRva = Align(end, sectionAlign);
+		out.assign(image.begin(), image.begin() + sectionsEnd);
+		out.resize(Align((uint32_t)out.size(), fileAlign), 0);
+		const uint32_t raw = (uint32_t)out.size();
+		BuildTree(treeRva, out);
+		treeSize = (uint32_t)out.size() - raw;
+		out.resize(Align((uint32_t)out.size(), fileAlign), 0);
+
+		std::fill(out.begin() + header, out.begin() + header + SECTION_SIZE, 0);
+		memcpy(&out[header], section >= 0 ? ".rsrc1" : ".rsrc", section >= 0 ? 6 : 5);
+		Set32(out, header + SECTION_VIRTUALSIZE, treeSize);
+		Set32(out, header + SECTION_RVA, treeRva);
+		Set32(out, header + SECTION_RAWSIZE, (uint32_t)out.size() - raw);
+		Set32(out, header + SECTION_RAWPOINTER, raw);
+		Set32(out, header + SECTION_FLAGS, SCN_INITIALIZED_DATA | SCN_MEM_READ);
+		Set16(out, peOffset + COFF_SECTIONCOUNT, sectionCount + 1);
+		initializedGrowth = (int64_t)(out.size() - raw);
+	}
+
+	// The overlay goes after, without the signature, which the change has
+	// broken anyway
+	Set32(out, dirOffset + 8 * DIR_SECURITY, 0);
+	Set32(out, dirOffset + 8 * DIR_SECURITY + 4, 0);
+
+	// A COFF symbol table (MinGW leaves one) lives in the overlay too, unless
+	// the overlay's been replaced
+	const uint32_t symbols = Get32(image, peOffset + COFF_SYMBOLTABLE);
+	if (symbols >= sectionsEnd) {
+		uint64_t overlaySize = 0;
+		for (const PeOverlayPart& part : overlay) overlaySize += part.size;
+		Set32(out, peOffset + COFF_SYMBOLTABLE, symbols - sectionsEnd < overlaySize ? symbols - sectionsEnd + (uint32_t)out.size() : 0);
+	}
+
+	Set32(out, dirOffset + 8 * DIR_RESOURCE, treeRva);
+	Set32(out, dirOffset + 8 * DIR_RESOURCE + 4, treeSize);
+	Set32(out, optOffset + OPT_INITIALIZEDSIZE, (uint32_t)(Get32(image, optOffset + OPT_INITIALIZEDSIZE) + initializedGrowth));
+
+	sectionCount = Get16(out, peOffset + COFF_SECTIONCOUNT);
+	uint32_t imageSize = 0;
+	for (int i = 0; i < sectionCount; i++) {
+		const uint32_t h = sectionOffset + i * SECTION_SIZE;
+		imageSize = std::max(imageSize, Get32(out, h + SECTION_RVA) + std::max(Get32(out, h + SECTION_VIRTUALSIZE), Get32(out, h + SECTION_RAWSIZE)));
+	}
+	Set32(out, optOffset + OPT_IMAGESIZE, Align(imageSize, sectionAlign));
+	Set32(out, optOffset + OPT_CHECKSUM, 0);
+	image.swap(out);
+
+	// The checksum covers the overlay, so it's written last. It all goes to
+	// a new file that then replaces the old one, since the overlay may still
+	// be in the old one.
+	PePath temp = path;
+	for (const char* c = ".new"; *c; c++) temp.push_back(*c);
+	FILE* f = OpenStream(temp, true);
+	if (!f) return Fail("couldn't write the file");
+
+	Checksum checksum;
+	bool ok = WriteSummed(f, image.data(), image.size(), checksum);
+	for (size_t i = 0; ok && i < overlay.size(); i++) {
+		const PeOverlayPart& part = overlay[i];
+		ok = part.file.empty() ? WriteSummed(f, part.bytes.data(), part.bytes.size(), checksum) : CopySummed(f, part, checksum);
+	}
+
+	Set32(image, optOffset + OPT_CHECKSUM, checksum.Value());
+	ok = ok && Seek(f, optOffset + OPT_CHECKSUM) && fwrite(&image[optOffset + OPT_CHECKSUM], 1, 4, f) == 4;
+	ok = fclose(f) == 0 && ok;
+#ifdef _WIN32
+	ok = ok && MoveFileExW(temp.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING);
+	if (!ok) _wremove(temp.c_str());
+#else
+	ok = ok && rename(temp.c_str(), path.c_str()) == 0;
+	if (!ok) remove(temp.c_str());
+#endif
+	if (!ok) return Fail("couldn't write the file");
+
+	// The old file's gone, so the overlay's parts are in the new one now
+	uint64_t at = image.size();
+	for (PeOverlayPart& part : overlay) {
+		if (!part.file.empty()) {
+			part.file = path;
+			part.offset = at;
+		}
+		at += part.size;
+	}
+	return true;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+// Reads and rewrites the resources of a PE image (an .exe or a .dll) by
+// itself, rather than with BeginUpdateResource and friends, so that
+// WriteZipToSetup can stamp Setup.exe on a build server that isn't running
+// Windows. Both PE32 and PE32+ images work.
+//
+// Load parses the whole .rsrc tree into resources; change that as you like,
+// and Save lays the tree out again and writes the image with it. When .rsrc
+// is the last section, or only .reloc follows it (which is what the linker
+// makes), the new tree goes where the old one was and .reloc moves up behind
+// it; otherwise it goes in a new section at the end. Either way the section
+// table, SizeOfImage, SizeOfInitializedData, the data directories and the
+// checksum are fixed up to match. An Authenticode signature can't survive
+// the change, so it's dropped; anything else past the last section (the
+// overlay) is kept, or replaced with whatever overlay is set to. The overlay
+// can be big: parts of it can be files (Load leaves a big one in the image's
+// own), which Save copies across in large blocks rather than reading in.
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+typedef std::wstring PePath;
+#else
+typedef std::string PePath;
+#endif
+
+// A resource type, name or language: a number, or a string if name isn't empty
+struct PeResourceId
+{
+	uint16_t id;
+	std::u16string name;
+
+	PeResourceId(uint16_t id = 0) : id(id) {}
+	PeResourceId(const std::u16string& name) : id(0), name(name) {}
+	PeResourceId(const char16_t* name) : id(0), name(name) {}
+
+	bool IsName() const { return !name.empty(); }
+	bool operator==(const PeResourceId& other) const { return id == other.id && name == other.name; }
+};
+
+struct PeResource
+{
+	PeResourceId type;
+	PeResourceId name;
+	uint16_t language;
+	uint32_t codePage;
+	std::vector<uint8_t> data;
+};
+
+// A piece of the overlay: bytes, or size bytes of file from offset
+struct PeOverlayPart
+{
+	std::vector<uint8_t> bytes;
+	PePath file;
+	uint64_t offset, size;
+
+	PeOverlayPart(std::vector<uint8_t>&& bytes) : bytes(std::move(bytes)), offset(0), size(this->bytes.size()) {}
+	PeOverlayPart(const PePath& file, uint64_t offset, uint64_t size) : file(file), offset(offset), size(size) {}
+};
+
+class PeImage
+{
+public:
+	bool Load(const PePath& path);
+	bool Save(const PePath& path);
+
+	// Replaces the resource with this type, name and language, or adds it
+	void SetResource(const PeResourceId& type, const PeResourceId& name, uint16_t language, const void* data, size_t size);
+	void SetResource(const PeResourceId& type, const PeResourceId& name, uint16_t language, std::vector<uint8_t>&& data);
+	const PeResource* Find(const PeResourceId& type, const PeResourceId& name, uint16_t language) const;
+
+	std::vector<PeResource> resources;
+
+	// What's past the last section, less any signature; Load makes it one part
+	std::vector<PeOverlayPart> overlay;
+
+	// What went wrong, when Load or Save returns false
+	const std::string& Error() const { return error; }
+
+private:
+	std::vector<uint8_t> image;
+	uint32_t peOffset, optOffset, dirOffset, sectionOffset;
+	uint16_t sectionCount;
+	bool pe32Plus;
+	std::string error;
+
+	bool Fail(const std::string& why) { error = why; return false; }
+	bool ParseDirectory(uint32_t base, uint32_t size, uint32_t offset, int depth, PeResource& path);
+	bool ReadName(uint32_t base, uint32_t size, uint32_t offset, std::u16string& name);
+	void BuildTree(uint32_t rva, std::vector<uint8_t>& tree) const;
+	int SectionOf(uint32_t rva) const;
+	int64_t RvaToOffset(uint32_t rva, uint32_t size) const;
+};
+
+bool PeFileSize(const PePath& path, uint64_t& size);
+bool PeReadFile(const PePath& path, std::vector<uint8_t>& data);
+bool PeReadFile(const PePath& path, uint64_t offset, size_t size, std::vector<uint8_t>& data);
+bool PeWriteFile(const PePath& path, const std::vector<uint8_t>& data);
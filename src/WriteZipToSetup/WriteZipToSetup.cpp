@@ -1,131 +1,503 @@
 // WriteZipToSetup.cpp : Defines the entry point for the console application.
 //
+// Stamps the payload zip (and the required framework) into Setup.exe as
+// resources. It does that with PeResources.cpp rather than with Windows'
+// UpdateResource, so it builds and runs on Linux too (see the Makefile).
+// With --overlay the zip is appended to Setup.exe instead, with a trailer
+// that Setup finds it by (see OpenZipOverlay in ../Setup/unzip.h); that has
+// no 4GB limit, and Setup reads it in place rather than all at once, and the
+// zip is copied across in large blocks rather than read into memory.
+//
+// With --jobs, it stamps a list of Setup.exes (say, one per product or
+// channel) in one go, several at once.
+//
+// Either way, it also adds a manifest with the BLAKE3 of every item in the
+// zip, which Setup checks the items against as it unzips them (see
+// SetUnzipManifest in ../Setup/unzip.h). It's made with Setup's own unzip
+// engine, which is built in.
+//
+// With --zstd it compresses a file to a single zstd frame instead, which is
+// what Update.exe --releasify --setup-compression=zstd stores the payload's
+// members as (method 93), and --unzstd turns one back. Both use the vendored
+// zstd in ../../vendor/zstd, so nothing else needs shipping for them.
 
+#ifdef _WIN32
 #include "stdafx.h"
+#define PATHFMT "%ls"
+#else
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#define PATHFMT "%s"
+#endif
+#include "PeResources.h"
+#include "../Setup/unzip.h"
+#include "../../vendor/zstd/lib/zstd.h"
+#include <stdarg.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+// not in unzip.h, but it's the engine's own, which the trailer's checked with
+unsigned long ucrc32(unsigned long crc, const unsigned char *buf, unsigned int len);
 
 using namespace std;
 
-BOOL CALLBACK EnumResLangProc(HMODULE hModule, LPCTSTR lpszType, LPCTSTR lpszName, WORD wIDLanguage, LONG_PTR lParam)
+#ifdef _WIN32
+typedef wchar_t ArgChar;
+#define ARG(s) L##s
+#define argcmp wcscmp
+#define argtoi _wtoi
+#else
+typedef char ArgChar;
+#define ARG(s) s
+#define argcmp strcmp
+#define argtoi atoi
+#endif
+typedef basic_string<ArgChar> ArgString;
+
+// What Setup reads, with FindResource(NULL, MAKEINTRESOURCE(131), L"DATA") and friends
+static const PeResourceId dataType(u"DATA"), flagsType(u"FLAGS");
+static const uint16_t zipId = 131, flagsId = 132, manifestId = 133, enUS = 0x0409;
+
+// The overlay's trailer, as OpenZipOverlay reads it
+static const size_t trailerSize = 32;
+static const char trailerMagic[] = "Squirrel payload";
+
+// An argument as UTF-16, which is what Windows' resources hold
+static u16string ToUtf16(const ArgChar* arg)
 {
-	HANDLE hUpdate = (HANDLE)lParam;
-	HRSRC hFindItAgain = FindResourceEx(hModule, lpszType, lpszName, wIDLanguage);
+	u16string result;
+#ifdef _WIN32
+	for (; *arg; arg++) result.push_back((char16_t)*arg);
+#else
+	for (const unsigned char* p = (const unsigned char*)arg; *p;) {
+		uint32_t c = *p++;
+		int more = c >= 0xF0 ? 3 : c >= 0xE0 ? 2 : c >= 0xC0 ? 1 : 0;
+		if (more) c &= 0x3F >> more;
+		for (; more > 0 && (*p & 0xC0) == 0x80; more--) c = (c << 6) | (*p++ & 0x3F);
 
-	HGLOBAL hGlobal = LoadResource(hModule, hFindItAgain);
-	if (!hGlobal) return true;
+		if (c >= 0x10000) {
+			result.push_back((char16_t)(0xD800 + ((c - 0x10000) >> 10)));
+			result.push_back((char16_t)(0xDC00 + ((c - 0x10000) & 0x3FF)));
+		} else {
+			result.push_back((char16_t)c);
+		}
+	}
+#endif
+	return result;
+}
 
-	UpdateResource(hUpdate, lpszType, lpszName, wIDLanguage, LockResource(hGlobal), SizeofResource(hModule, hFindItAgain));
-	return true;
+// The trailer for a zip of zipSize bytes
+static vector<uint8_t> OverlayTrailer(uint64_t zipSize)
+{
+	vector<uint8_t> trailer(trailerSize, 0);
+	for (int i = 0; i < 8; i++) trailer[i] = (uint8_t)(zipSize >> (8 * i));
+	trailer[8] = 1;
+	uint32_t crc = (uint32_t)ucrc32(0, trailer.data(), 12);
+	for (int i = 0; i < 4; i++) trailer[12 + i] = (uint8_t)(crc >> (8 * i));
+	memcpy(&trailer[16], trailerMagic, 16);
+	return trailer;
 }
 
-BOOL CALLBACK EnumResNameProc(HMODULE hModule, LPCTSTR lpszType, LPTSTR lpszName, LONG_PTR lParam)
+static bool HasOverlayPayload(const vector<PeOverlayPart>& overlay)
 {
-	HANDLE hUpdate = (HANDLE)lParam;
+	if (overlay.empty() || overlay.back().size < trailerSize) return false;
 
-	EnumResourceLanguages(hModule, lpszType, lpszName, EnumResLangProc, (LONG_PTR)hUpdate);
-	return true;
+	// A big overlay's left in the file
+	const PeOverlayPart& last = overlay.back();
+	vector<uint8_t> tail(last.bytes.end() - min(last.bytes.size(), (size_t)16), last.bytes.end());
+	if (!last.file.empty() && !PeReadFile(last.file, last.offset + last.size - 16, 16, tail)) return false;
+	return tail.size() == 16 && memcmp(tail.data(), trailerMagic, 16) == 0;
 }
 
-BOOL CALLBACK EnumResTypeProc(HMODULE hMod, LPTSTR lpszType, LONG_PTR lParam)
+// Unzips the whole zip to hash its items. False, with why, if one's bad; the
+// manifest's left empty if the engine can't open the zip at all (one over 4GB,
+// say, as it only reads the old zip records), as Setup can't check it anyway.
+static bool MakeManifest(const ArgString& zip, vector<uint8_t>& manifest, string& why)
 {
-	std::vector<wchar_t*>* typeList = (std::vector<wchar_t*>*)lParam;
-	if (IS_INTRESOURCE(lpszType)) {
-		typeList->push_back(lpszType);
-	} else {
-		typeList->push_back(_wcsdup(lpszType));
-	}
+	HZIP hz = OpenZip(zip.c_str(), NULL);
+	if (!hz) return true;
 
+	unsigned int size = 0;
+	ZRESULT result = MakeZipManifest(hz, 0, NULL, &size);
+	if (result == ZR_OK) {
+		manifest.resize(size);
+		result = MakeZipManifest(hz, 0, manifest.data(), &size);
+	}
+	CloseZip(hz);
+	if (result != ZR_OK) {
+		TCHAR message[256];
+		FormatZipMessage(result, message, 256);
+		for (TCHAR* c = message; *c; c++) why.push_back((char)*c);
+		return false;
+	}
 	return true;
 }
 
-int CopyResourcesToStubExecutable(wchar_t* src, wchar_t* dest)
+static FILE* OpenFile(const ArgChar* path, bool write)
+{
+	FILE* f = NULL;
+#ifdef _WIN32
+	if (_wfopen_s(&f, path, write ? L"wb" : L"rb") != 0) f = NULL;
+#else
+	f = fopen(path, write ? "wb" : "rb");
+#endif
+	return f;
+}
+
+// src to dest as one zstd frame at level, or back again, a buffer at a time.
+// The frame records its content size, as SetupZipBuilder's readers expect.
+int ZstdFile(bool compress, int level, const ArgChar* src, const ArgChar* dest)
 {
-	HMODULE hSrc = LoadLibraryEx(src, NULL, LOAD_LIBRARY_AS_DATAFILE);
-	if (!hSrc) return GetLastError();
+	FILE* in = OpenFile(src, false);
+	if (!in) {
+		printf("Can't read " PATHFMT "\n", src);
+		return -1;
+	}
+	FILE* out = OpenFile(dest, true);
+	if (!out) {
+		printf("Can't write " PATHFMT "\n", dest);
+		fclose(in);
+		return -1;
+	}
+
+	ZSTD_CCtx* cctx = compress ? ZSTD_createCCtx() : NULL;
+	ZSTD_DCtx* dctx = compress ? NULL : ZSTD_createDCtx();
+	vector<uint8_t> inBuf(compress ? ZSTD_CStreamInSize() : ZSTD_DStreamInSize());
+	vector<uint8_t> outBuf(compress ? ZSTD_CStreamOutSize() : ZSTD_DStreamOutSize());
+	size_t result = 0;
+	bool ok = compress ? cctx != NULL : dctx != NULL;
 
-	HANDLE hUpdate = BeginUpdateResource(dest, true);
-	if (!hUpdate) return GetLastError();
+	if (ok && compress) {
+		ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level);
+		ZSTD_CCtx_setParameter(cctx, ZSTD_c_checksumFlag, 1);
+		uint64_t size = 0;
+		if (PeFileSize(src, size)) ZSTD_CCtx_setPledgedSrcSize(cctx, size);
+	}
+
+	bool lastChunk = false;
+	while (ok && !lastChunk) {
+		size_t read = fread(inBuf.data(), 1, inBuf.size(), in);
+		lastChunk = read < inBuf.size();
+		if (lastChunk && ferror(in)) {
+			ok = false;
+			break;
+		}
 
-	std::vector<wchar_t*> typeList;
-	EnumResourceTypes(hSrc, EnumResTypeProc, (LONG_PTR)&typeList);
+		ZSTD_inBuffer input = { inBuf.data(), read, 0 };
+		for (;;) {
+			ZSTD_outBuffer output = { outBuf.data(), outBuf.size(), 0 };
+			if (compress) {
+				result = ZSTD_compressStream2(cctx, &output, &input, lastChunk ? ZSTD_e_end : ZSTD_e_continue);
+			} else {
+				result = ZSTD_decompressStream(dctx, &output, &input);
+			}
+			if (ZSTD_isError(result) || fwrite(outBuf.data(), 1, output.pos, out) != output.pos) {
+				ok = false;
+				break;
+			}
 
-	for (auto& type : typeList) {
-		EnumResourceNames(hSrc, type, EnumResNameProc, (LONG_PTR)hUpdate);
+			// Compressing, the last chunk's done when the frame's ended; otherwise
+			// when the input's used up and the output buffer wasn't filled
+			bool done = compress && lastChunk ? result == 0 : input.pos == input.size && output.pos < output.size;
+			if (done) break;
+		}
 	}
 
-	EndUpdateResource(hUpdate, false);
+	// A frame that stops short
+	if (ok && !compress && result != 0) ok = false;
+
+	if (ZSTD_isError(result)) printf("zstd: %s\n", ZSTD_getErrorName(result));
+	ZSTD_freeCCtx(cctx);
+	ZSTD_freeDCtx(dctx);
+	fclose(in);
+	if (fclose(out) != 0) ok = false;
+
+	if (!ok) {
+		printf("Can't %s " PATHFMT " to " PATHFMT "\n", compress ? "compress" : "decompress", src, dest);
+		return -1;
+	}
 	return 0;
 }
 
-int wmain(int argc, wchar_t* argv[])
+// As BeginUpdateResource(dest, TRUE) used to: all of dest's resources are
+// thrown away, and replaced with all of src's
+int CopyResourcesToStubExecutable(const ArgChar* src, const ArgChar* dest)
 {
-	if (argc > 1 && wcscmp(argv[1], L"--copy-stub-resources") == 0) {
-		if (argc != 4) goto fail;
-		return CopyResourcesToStubExecutable(argv[2], argv[3]);
+	PeImage source, stub;
+	if (!source.Load(src)) {
+		printf("Can't read " PATHFMT ": %s\n", src, source.Error().c_str());
+		return -1;
 	}
-	bool setFramework = false;
-	if (argc == 5 && wcscmp(argv[3], L"--set-required-framework") == 0) {
-		setFramework = true;
-	} else if (argc != 3) {
-		goto fail;
+	if (!stub.Load(dest)) {
+		printf("Can't read " PATHFMT ": %s\n", dest, stub.Error().c_str());
+		return -1;
 	}
 
-	wprintf(L"Setup: %s, Zip: %s\n", argv[1], argv[2]);
-
-	// Read the entire zip file into memory, yolo
-	HANDLE hFile = CreateFile(argv[2], GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
-	if (hFile == INVALID_HANDLE_VALUE) {
-		printf("Can't open Zip file\n");
+	stub.resources = source.resources;
+	if (!stub.Save(dest)) {
+		printf("Can't write " PATHFMT ": %s\n", dest, stub.Error().c_str());
 		return -1;
 	}
 
-	BY_HANDLE_FILE_INFORMATION fileInfo;
-	if (!GetFileInformationByHandle(hFile, &fileInfo)) {
-		goto fail;
+	return 0;
+}
+
+// One Setup.exe to stamp, from the command line or a line of a --jobs file
+struct Job
+{
+	ArgString setupExe, zip, framework;
+	bool setFramework = false, overlay = false;
+};
+
+// Setup.exe, the zip, and then any options
+static bool ParseJob(const vector<ArgString>& args, Job& job)
+{
+	if (args.size() < 2) return false;
+	job.setupExe = args[0];
+	job.zip = args[1];
+
+	for (size_t i = 2; i < args.size(); i++) {
+		if (args[i] == ARG("--set-required-framework") && i + 1 < args.size()) {
+			job.setFramework = true;
+			job.framework = args[++i];
+		} else if (args[i] == ARG("--overlay")) {
+			job.overlay = true;
+		} else {
+			return false;
+		}
+	}
+	return true;
+}
+
+// A job's messages are kept until it's done, so that jobs running side by
+// side don't print over each other
+static void Say(string& log, const char* format, ...)
+{
+	char line[1024];
+	va_list args;
+	va_start(args, format);
+	vsnprintf(line, sizeof(line), format, args);
+	va_end(args);
+	log += line;
+}
+
+static bool StampSetup(const Job& job, string& log)
+{
+	Say(log, "Setup: " PATHFMT ", Zip: " PATHFMT "\n", job.setupExe.c_str(), job.zip.c_str());
+
+	uint64_t zipSize;
+	if (!PeFileSize(job.zip, zipSize)) {
+		Say(log, "Can't open Zip file\n");
+		return false;
+	}
+	if (!job.overlay && zipSize > UINT32_MAX) {
+		Say(log, "The Zip file is too big for a resource, use --overlay\n");
+		return false;
+	}
+
+	PeImage setup;
+	if (!setup.Load(job.setupExe)) {
+		Say(log, "Couldn't open setup.exe: %s\n", setup.Error().c_str());
+		return false;
 	}
 
-	BYTE* pBuf = new BYTE[fileInfo.nFileSizeLow + 0x1000];
-	BYTE* pCurrent = pBuf;
-	DWORD dwBytesRead;
+	// Setup looks for the overlay first, so only one of them can be there
+	if (job.overlay) {
+		Say(log, "Appending Zip file!\n");
+		setup.resources.erase(remove_if(setup.resources.begin(), setup.resources.end(), [](const PeResource& r) {
+			return r.type == dataType && r.name == PeResourceId(zipId);
+		}), setup.resources.end());
 
-	printf("Starting to read in Zip file!\n");
-	do {
-		if (!ReadFile(hFile, pCurrent, 0x1000, &dwBytesRead, NULL)) {
-			printf("Failed to read file! 0x%u\n", GetLastError());
-			goto fail;
+		// Zeros to make it all end on 8 bytes (the overlay starts on a
+		// FileAlignment boundary), which is where signtool will put a
+		// signature; then the zip, copied across as Setup.exe is written
+		setup.overlay.clear();
+		setup.overlay.push_back(PeOverlayPart(vector<uint8_t>((8 - (zipSize + trailerSize) % 8) % 8, 0)));
+		setup.overlay.push_back(PeOverlayPart(job.zip, 0, zipSize));
+		setup.overlay.push_back(PeOverlayPart(OverlayTrailer(zipSize)));
+	} else {
+		// A resource has to be in memory, so the zip's read straight into one
+		Say(log, "Starting to read in Zip file!\n");
+		vector<uint8_t> zip;
+		if (!PeReadFile(job.zip, zip)) {
+			Say(log, "Can't open Zip file\n");
+			return false;
 		}
 
-		pCurrent += dwBytesRead;
-	} while (dwBytesRead > 0);
+		Say(log, "Updating Resource!\n");
+		if (HasOverlayPayload(setup.overlay)) setup.overlay.clear();
+		setup.SetResource(dataType, zipId, enUS, std::move(zip));
+	}
+
+	// An old manifest would fail every item of the new zip, so it goes whatever happens
+	Say(log, "Hashing Zip file!\n");
+	setup.resources.erase(remove_if(setup.resources.begin(), setup.resources.end(), [](const PeResource& r) {
+		return r.type == dataType && r.name == PeResourceId(manifestId);
+	}), setup.resources.end());
+
+	vector<uint8_t> manifest;
+	string why;
+	if (!MakeManifest(job.zip, manifest, why)) {
+		Say(log, "Can't hash the Zip file: %s\n", why.c_str());
+		return false;
+	}
+	if (manifest.empty()) Say(log, "Can't open the Zip file to hash it, so Setup won't check it\n");
+	else setup.SetResource(dataType, manifestId, enUS, std::move(manifest));
 
-	printf("Updating Resource!\n");
-	HANDLE hRes = BeginUpdateResource(argv[1], false);
-	if (!hRes) {
-		printf("Couldn't open setup.exe for writing\n");
-		goto fail;
+	if (job.setFramework) {
+		u16string framework = ToUtf16(job.framework.c_str());
+		setup.SetResource(flagsType, flagsId, enUS, framework.c_str(), (framework.size() + 1) * sizeof(char16_t));
 	}
 
-	if (!UpdateResource(hRes, L"DATA", (LPCWSTR)131, 0x0409, pBuf, fileInfo.nFileSizeLow)) {
-		printf("Failed to update resource\n");
-		goto fail;
+	Say(log, "Finished!\n");
+	if (!setup.Save(job.setupExe)) {
+		Say(log, "Failed to update resource: %s\n", setup.Error().c_str());
+		return false;
 	}
 
-	if (setFramework) {
-		if (!UpdateResource(hRes, L"FLAGS", (LPCWSTR)132, 0x0409, argv[4], (wcslen(argv[4])+1) * sizeof(wchar_t))) {
-			printf("Failed to update resource\n");
-			goto fail;
+	Say(log, "It worked!\n");
+	return true;
+}
+
+static ArgString ToArg(const string& utf8)
+{
+#ifdef _WIN32
+	int length = MultiByteToWideChar(CP_UTF8, 0, utf8.data(), (int)utf8.size(), NULL, 0);
+	ArgString result(length, L'\0');
+	if (length > 0) MultiByteToWideChar(CP_UTF8, 0, utf8.data(), (int)utf8.size(), &result[0], length);
+	return result;
+#else
+	return utf8;
+#endif
+}
+
+// A --jobs file has a job per line, in UTF-8: its arguments as they'd be on
+// the command line, with "quotes" around any that have spaces in. Blank lines
+// and lines starting with # are skipped.
+static bool ReadJobs(const ArgChar* path, vector<Job>& jobs)
+{
+	vector<uint8_t> text;
+	if (!PeReadFile(path, text)) {
+		printf("Can't read " PATHFMT "\n", path);
+		return false;
+	}
+
+	size_t at = text.size() >= 3 && text[0] == 0xEF && text[1] == 0xBB && text[2] == 0xBF ? 3 : 0;
+	for (int lineNumber = 1; at < text.size(); lineNumber++) {
+		size_t end = find(text.begin() + at, text.end(), '\n') - text.begin();
+		string line(text.begin() + at, text.begin() + end);
+		at = end + 1;
+
+		vector<ArgString> args;
+		for (size_t i = 0;;) {
+			while (i < line.size() && (line[i] == ' ' || line[i] == '\t' || line[i] == '\r')) i++;
+			if (i == line.size() || (args.empty() && line[i] == '#')) break;
+
+			string arg;
+			bool quoted = false;
+			for (; i < line.size() && (quoted || (line[i] != ' ' && line[i] != '\t' && line[i] != '\r')); i++) {
+				if (line[i] == '"') quoted = !quoted;
+				else arg += line[i];
+			}
+			args.push_back(ToArg(arg));
+		}
+		if (args.empty()) continue;
+
+		Job job;
+		if (!ParseJob(args, job)) {
+			printf(PATHFMT ":%d: should be [Setup.exe template] [Zip File] [options]\n", path, lineNumber);
+			return false;
 		}
+		jobs.push_back(job);
 	}
+	return true;
+}
 
-	printf("Finished!\n");
-	if (!EndUpdateResource(hRes, false)) {
-		printf("Failed to update resource\n");
-		goto fail;
+// Each job only reads and writes its own files, so they're taken off the list
+// by as many threads as there are cores (or threads)
+static int RunJobs(const vector<Job>& jobs, unsigned int threads)
+{
+	if (threads == 0) threads = max(1u, thread::hardware_concurrency());
+	threads = (unsigned int)min((size_t)threads, jobs.size());
+
+	atomic<size_t> next(0);
+	atomic<int> failed(0);
+	mutex printing;
+	vector<thread> workers;
+	for (unsigned int t = 0; t < threads; t++) {
+		workers.push_back(thread([&]() {
+			for (size_t i; (i = next++) < jobs.size();) {
+				string log;
+				if (!StampSetup(jobs[i], log)) failed++;
+
+				lock_guard<mutex> lock(printing);
+				fputs(log.c_str(), stdout);
+				fflush(stdout);
+			}
+		}));
 	}
+	for (thread& worker : workers) worker.join();
 
-	printf("It worked!\n");
+	if (failed > 0) {
+		printf("%d of %d jobs failed\n", (int)failed, (int)jobs.size());
+		return -1;
+	}
 	return 0;
+}
 
-fail:
-	printf("Usage: WriteZipToSetup [Setup.exe template] [Zip File]\n");
+static int Usage()
+{
+	printf("Usage: WriteZipToSetup [Setup.exe template] [Zip File] [--set-required-framework version] [--overlay]\n");
+	printf("       WriteZipToSetup --jobs [File with one of the above per line] [--threads count]\n");
+	printf("       WriteZipToSetup --zstd [level] [File] [Compressed file]\n");
+	printf("       WriteZipToSetup --unzstd [Compressed file] [File]\n");
 	return -1;
 }
+
+#ifdef _WIN32
+int wmain(int argc, wchar_t* argv[])
+#else
+int main(int argc, char* argv[])
+#endif
+{
+	if (argc > 1 && argcmp(argv[1], ARG("--copy-stub-resources")) == 0) {
+		if (argc != 4) return Usage();
+		return CopyResourcesToStubExecutable(argv[2], argv[3]);
+	}
+
+	if (argc > 1 && argcmp(argv[1], ARG("--zstd")) == 0) {
+		if (argc != 5) return Usage();
+		int level = argtoi(argv[2]);
+		if (level < 1 || level > ZSTD_maxCLevel()) return Usage();
+		return ZstdFile(true, level, argv[3], argv[4]);
+	}
+
+	if (argc > 1 && argcmp(argv[1], ARG("--unzstd")) == 0) {
+		if (argc != 4) return Usage();
+		return ZstdFile(false, 0, argv[2], argv[3]);
+	}
+
+	if (argc > 1 && argcmp(argv[1], ARG("--jobs")) == 0) {
+		int threads = 0;
+		if (argc == 5 && argcmp(argv[3], ARG("--threads")) == 0) threads = argtoi(argv[4]);
+		else if (argc != 3) return Usage();
+		if (threads < 0) return Usage();
+
+		vector<Job> jobs;
+		if (!ReadJobs(argv[2], jobs)) return Usage();
+		return RunJobs(jobs, (unsigned int)threads);
+	}
+
+	Job job;
+	if (!ParseJob(vector<ArgString>(argv + 1, argv + argc), job)) return Usage();
+
+	string log;
+	bool ok = StampSetup(job, log);
+	fputs(log.c_str(), stdout);
+	return ok ? 0 : -1;
+}
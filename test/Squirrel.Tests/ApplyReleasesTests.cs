@@ -131,6 +131,77 @@ public async Task RunningUpgradeAppTwiceDoesntCrash()
             }
         }
 
+        [Fact]
+        public async Task UpgradeRewritesTheCurrentAppPointer()
+        {
+            string tempDir;
+            string remotePkgDir;
+
+            using (Utility.WithTempDirectory(out tempDir))
+            using (Utility.WithTempDirectory(out remotePkgDir)) {
+                IntegrationTestHelper.CreateFakeInstalledApp("0.1.0", remotePkgDir);
+                var pkgs = ReleaseEntry.BuildReleasesFile(remotePkgDir);
+                ReleaseEntry.WriteReleaseFile(pkgs, Path.Combine(remotePkgDir, "RELEASES"));
+
+                using (var fixture = new UpdateManager(remotePkgDir, "theApp", tempDir)) {
+                    await fixture.FullInstall();
+                }
+
+                // NB: The pointer's written before FullInstall returns, but the
+                // first run it starts mustn't still be going when we update
+                var rootDir = Path.Combine(tempDir, "theApp");
+                IntegrationTestHelper.WaitForAppsToExit(rootDir);
+
+                var pointerFile = Path.Combine(rootDir, ".current-app");
+                var lines = File.ReadAllLines(pointerFile);
+                Assert.Equal("squirrel-current-app 1", lines[0]);
+                Assert.Equal("app-0.1.0", lines[3]);
+                Assert.Equal(lines[1], lines[4]);
+                var firstGeneration = long.Parse(lines[1]);
+
+                IntegrationTestHelper.CreateFakeInstalledApp("0.2.0", remotePkgDir);
+                pkgs = ReleaseEntry.BuildReleasesFile(remotePkgDir);
+                ReleaseEntry.WriteReleaseFile(pkgs, Path.Combine(remotePkgDir, "RELEASES"));
+
+                // NB: UpdateApp waits for the --squirrel-updated hooks it runs
+                using (var fixture = new UpdateManager(remotePkgDir, "theApp", tempDir)) {
+                    await fixture.UpdateApp();
+                }
+
+                lines = File.ReadAllLines(pointerFile);
+                Assert.Equal("app-0.2.0", lines[3]);
+                Assert.Equal(firstGeneration + 1, long.Parse(lines[1]));
+                Assert.Equal(Directory.GetLastWriteTimeUtc(rootDir).ToFileTimeUtc(), long.Parse(lines[2]));
+            }
+        }
+
+        // NB: StubExecutable's CompareAppVersions has to agree with these, or
+        // the stub's scan and the pointer would launch different versions
+        [Theory]
+        [InlineData("1.0.0-beta9 1.0.0-beta10", "1.0.0-beta10")]
+        [InlineData("1.0.0-RC10 1.0.0-rc2", "1.0.0-RC10")]
+        [InlineData("1.0.0-beta2 1.0.0-beta02", "1.0.0-beta2")]
+        [InlineData("1.0.0-alpha2 1.0.0-beta1", "1.0.0-beta1")]
+        [InlineData("1.0.0-alpha 1.0.0-Beta", "1.0.0-Beta")]
+        [InlineData("1.0.0-beta 1.0.0", "1.0.0")]
+        [InlineData("1.0.0 1.0.0.1-beta", "1.0.0.1-beta")]
+        [InlineData("1.9.0 1.10.0-rc", "1.10.0-rc")]
+        public void CurrentAppPointerOrdersPrereleasesAsTheStubDoes(string versions, string expected)
+        {
+            string rootDir;
+
+            using (Utility.WithTempDirectory(out rootDir)) {
+                foreach (var v in versions.Split(' ')) {
+                    Directory.CreateDirectory(Path.Combine(rootDir, "app-" + v));
+                }
+
+                new UpdateManager.ApplyReleasesImpl(rootDir).writeCurrentAppPointer();
+
+                var lines = File.ReadAllLines(Path.Combine(rootDir, ".current-app"));
+                Assert.Equal("app-" + expected, lines[3]);
+            }
+        }
+
         [Fact]
         public async Task FullUninstallRemovesAllVersions()
         {
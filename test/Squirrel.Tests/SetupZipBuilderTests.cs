@@ -0,0 +1,230 @@
+using System;
+using System.Collections.Generic;
+using System.IO;
+using System.Linq;
+using System.Threading;
+using Squirrel;
+using Squirrel.SimpleSplat;
+using SharpCompress.Archives.Zip;
+using SharpCompress.Common;
+using Xunit;
+
+namespace Squirrel.Tests.Core
+{
+    public class SetupZipBuilderTests : IEnableLogger
+    {
+        [Fact]
+        public void ChunkedZipRoundTripsThroughOtherReaders()
+        {
+            string tempDir;
+            using (Utility.WithTempDirectory(out tempDir)) {
+                var src = Path.Combine(tempDir, "src");
+                Directory.CreateDirectory(Path.Combine(src, "lib"));
+
+                var rng = new Random(42);
+                var big = new byte[(3 * 65536) + 1234];
+                for (int i = 0; i < big.Length; i++) big[i] = (byte)(i % 251 < 128 ? rng.Next(16) : i);
+
+                File.WriteAllBytes(Path.Combine(src, "lib", "big.bin"), big);
+                File.WriteAllText(Path.Combine(src, "RELEASES"), "hello world");
+                File.WriteAllBytes(Path.Combine(src, "empty"), new byte[0]);
+
+                var target = Path.Combine(tempDir, "setup.zip");
+                new SetupZipBuilder() { ChunkSize = 65536 }.CreateFromDirectory(src, target);
+
+                using (var za = ZipArchive.Open(target)) {
+                    var names = za.Entries.Select(x => x.Key).ToArray();
+                    Assert.Equal(new[] { "RELEASES", "empty", "lib/big.bin" }, names);
+
+                    foreach (var entry in za.Entries) {
+                        using (var s = entry.OpenEntryStream())
+                        using (var ms = new MemoryStream()) {
+                            s.CopyTo(ms);
+                            Assert.Equal(File.ReadAllBytes(Path.Combine(src, entry.Key)), ms.ToArray());
+                        }
+                    }
+                }
+
+                // Check the chunk index that Setup reads from the local header
+                var chunkOffsets = new List<long>();
+                var chunkDataStart = 0L;
+                var chunkDataSize = 0L;
+
+                using (var br = new BinaryReader(File.OpenRead(target))) {
+                    var offset = 0L;
+                    for (int i = 0; i < 3; i++) {
+                        br.BaseStream.Position = offset;
+                        Assert.Equal(0x04034b50, br.ReadInt32());
+
+                        br.BaseStream.Position = offset + 18;
+                        var compressedSize = br.ReadUInt32();
+                        br.ReadUInt32();
+                        var nameLength = br.ReadUInt16();
+                        var extraLength = br.ReadUInt16();
+                        var name = new string(br.ReadChars(nameLength));
+
+                        if (name != "lib/big.bin") {
+                            Assert.Equal(0, extraLength);
+                        } else {
+                            Assert.Equal(SetupZipBuilder.ChunkIndexExtraFieldId, br.ReadUInt16());
+                            Assert.Equal(extraLength - 4, br.ReadUInt16());
+                            Assert.Equal(1, br.ReadByte());
+                            br.ReadByte();
+                            Assert.Equal(65536u, br.ReadUInt32());
+
+                            var count = br.ReadUInt32();
+                            Assert.Equal(4u, count);
+                            Assert.Equal(extraLength, 4 + 10 + 4 * (int)count);
+
+                            var last = -1L;
+                            for (int j = 0; j < count; j++) {
+                                var chunkOffset = br.ReadUInt32();
+                                if (j == 0) Assert.Equal(0u, chunkOffset);
+                                Assert.True(chunkOffset > last && chunkOffset < compressedSize);
+                                last = chunkOffset;
+                                chunkOffsets.Add(chunkOffset);
+                            }
+
+                            chunkDataStart = offset + 30 + nameLength + extraLength;
+                            chunkDataSize = compressedSize;
+                        }
+
+                        offset += 30 + nameLength + extraLength + compressedSize;
+                    }
+                }
+
+                // Setup inflates each chunk on its own, from its offset, so
+                // every one has to come out as that ChunkSize slice of the file
+                var data = File.ReadAllBytes(target).Skip((int)chunkDataStart).Take((int)chunkDataSize).ToArray();
+                chunkOffsets.Add(chunkDataSize);
+
+                for (int i = 0; i < chunkOffsets.Count - 1; i++) {
+                    var slice = data.Skip((int)chunkOffsets[i]).Take((int)(chunkOffsets[i + 1] - chunkOffsets[i])).ToList();
+
+                    // NB: All but the last chunk end on a full flush rather than
+                    // a final block, so end them with an empty final block
+                    var isLastChunk = i == chunkOffsets.Count - 2;
+                    if (!isLastChunk) slice.AddRange(new byte[] { 0x03, 0x00 });
+
+                    using (var inflate = new System.IO.Compression.DeflateStream(new MemoryStream(slice.ToArray()), System.IO.Compression.CompressionMode.Decompress))
+                    using (var ms = new MemoryStream()) {
+                        inflate.CopyTo(ms);
+
+                        var expected = big.Skip(i * 65536).Take(65536).ToArray();
+                        Assert.Equal(expected, ms.ToArray());
+                    }
+                }
+            }
+        }
+
+        [Fact]
+        public void IncompressibleMembersAreStored()
+        {
+            string tempDir;
+            using (Utility.WithTempDirectory(out tempDir)) {
+                var src = Path.Combine(tempDir, "src");
+                Directory.CreateDirectory(src);
+
+                var rng = new Random(42);
+                var noise = new byte[(5 * 65536) + 99];
+                rng.NextBytes(noise);
+                File.WriteAllBytes(Path.Combine(src, "noise.bin"), noise);
+                File.WriteAllText(Path.Combine(src, "text.txt"), String.Concat(Enumerable.Repeat("the quick brown fox jumps over the lazy dog\n", 5000)));
+
+                var stored = Path.Combine(tempDir, "stored.zip");
+                new SetupZipBuilder() { ChunkSize = 65536 }.CreateFromDirectory(src, stored);
+
+                var deflated = Path.Combine(tempDir, "deflated.zip");
+                new SetupZipBuilder() { ChunkSize = 65536, StoreIncompressible = false }.CreateFromDirectory(src, deflated);
+
+                foreach (var target in new[] { stored, deflated }) {
+                    using (var za = ZipArchive.Open(target)) {
+                        foreach (var entry in za.Entries) {
+                            var expected = entry.Key == "noise.bin" && target == stored ? CompressionType.None : CompressionType.Deflate;
+                            Assert.Equal(expected, entry.CompressionType);
+
+                            using (var s = entry.OpenEntryStream())
+                            using (var ms = new MemoryStream()) {
+                                s.CopyTo(ms);
+                                Assert.Equal(File.ReadAllBytes(Path.Combine(src, entry.Key)), ms.ToArray());
+                            }
+                        }
+                    }
+                }
+
+                // Stored, it's just the bytes: no chunk index, and nothing gained or lost
+                using (var br = new BinaryReader(File.OpenRead(stored))) {
+                    br.BaseStream.Position = 18;
+                    Assert.Equal((uint)noise.Length, br.ReadUInt32());
+                    br.ReadUInt32();
+                    br.ReadUInt16();
+                    Assert.Equal(0, br.ReadUInt16());
+                }
+            }
+        }
+
+        [Fact]
+        public void ZstdMembersRoundTrip()
+        {
+            string tempDir;
+            using (Utility.WithTempDirectory(out tempDir)) {
+                var src = Path.Combine(tempDir, "src");
+                Directory.CreateDirectory(src);
+
+                var rng = new Random(42);
+                var noise = new byte[65536 + 99];
+                rng.NextBytes(noise);
+                File.WriteAllBytes(Path.Combine(src, "noise.bin"), noise);
+                File.WriteAllText(Path.Combine(src, "text.txt"), String.Concat(Enumerable.Repeat("the quick brown fox jumps over the lazy dog\n", 5000)));
+
+                var target = Path.Combine(tempDir, "setup.zip");
+                new SetupZipBuilder() { Compression = SetupZipCompression.Zstandard }.CreateFromDirectory(src, target);
+
+                using (var br = new BinaryReader(File.OpenRead(target))) {
+                    foreach (var name in new[] { "noise.bin", "text.txt" }) {
+                        var expected = File.ReadAllBytes(Path.Combine(src, name));
+
+                        Assert.Equal(0x04034b50, br.ReadInt32());
+                        var versionNeeded = br.ReadUInt16();
+                        br.ReadUInt16();
+                        var method = br.ReadUInt16();
+                        br.ReadUInt32();
+                        var crc = br.ReadUInt32();
+                        var compressedSize = br.ReadUInt32();
+                        var uncompressedSize = br.ReadUInt32();
+                        var nameLength = br.ReadUInt16();
+                        var extraLength = br.ReadUInt16();
+                        Assert.Equal(name, new string(br.ReadChars(nameLength)));
+                        br.ReadBytes(extraLength);
+                        var data = br.ReadBytes((int)compressedSize);
+
+                        var expectedCrc = new Crc32();
+                        expectedCrc.Update(expected, 0, expected.Length);
+                        Assert.Equal(expectedCrc.Value, crc);
+                        Assert.Equal((uint)expected.Length, uncompressedSize);
+
+                        // The noise doesn't compress, so it's stored either way
+                        if (name == "noise.bin") {
+                            Assert.Equal(0, method);
+                            Assert.Equal(expected, data);
+                            continue;
+                        }
+
+                        Assert.Equal(93, method);
+                        Assert.Equal(63, versionNeeded);
+                        Assert.True(compressedSize < uncompressedSize);
+
+                        // Read it back with the same zstd Setup decodes it with
+                        var frame = Path.Combine(tempDir, name + ".zst");
+                        var readBack = Path.Combine(tempDir, name + ".out");
+                        File.WriteAllBytes(frame, data);
+
+                        var result = Utility.InvokeProcessAsync(Utility.FindWriteZipToSetup(), String.Format("--unzstd \"{0}\" \"{1}\"", frame, readBack), CancellationToken.None).Result;
+                        Assert.Equal(0, result.Item1);
+                        Assert.Equal(expected, File.ReadAllBytes(readBack));
+                    }
+                }
+            }
+        }
+    }
+}
@@ -109,6 +109,35 @@ public static string CreateFakeInstalledApp(string version, string outputDir, st
             }
         }
 
+        // FullInstall starts the app with --squirrel-firstrun and doesn't wait
+        // for it, so a test that goes on to change the app's folders first
+        // waits here for every exe under appDir to exit
+        public static void WaitForAppsToExit(string appDir, int timeoutMs = 15 * 1000)
+        {
+            var deadline = DateTime.UtcNow.AddMilliseconds(timeoutMs);
+            var exes = new HashSet<string>(Directory.EnumerateFiles(appDir, "*.exe", SearchOption.AllDirectories), StringComparer.OrdinalIgnoreCase);
+
+            foreach (var name in exes.Select(Path.GetFileNameWithoutExtension).Distinct(StringComparer.OrdinalIgnoreCase)) {
+                foreach (var p in Process.GetProcessesByName(name)) {
+                    using (p) {
+                        string path;
+                        try {
+                            path = p.MainModule.FileName;
+                        } catch (Exception) {
+                            continue; // NB: It's gone already, or it isn't ours to look at
+                        }
+
+                        if (!exes.Contains(path)) continue;
+
+                        var left = (int)(deadline - DateTime.UtcNow).TotalMilliseconds;
+                        if (left <= 0 || !p.WaitForExit(left)) {
+                            throw new TimeoutException(path + " is still running");
+                        }
+                    }
+                }
+            }
+        }
+
         public static IDisposable WithFakeInstallDirectory(out string path)
         {
             return WithFakeInstallDirectory("SampleUpdatingApp.1.1.0.0.nupkg", out path);